@@ -0,0 +1,373 @@
+#pragma once
+
+#include <antlr4-runtime.h>
+#include <algorithm>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <ostream>
+#include <sstream>
+#include <stdexcept>
+#include <vector>
+
+/**
+ * 整数数组，所有元素放在一块连续的 int32_t 缓冲区里
+ *
+ * 多维数组按行展开成一维，strides_[k] 是第 k 维的下标加一时跨过的元素个数：
+ * int a[3][4] 的 strides_ 是 {4, 1}，a[i][j] 在缓冲区中的下标是 i * 4 + j
+ *
+ * 缓冲区也可以来自外面（比如映射的文件），buffer_ 释放时由它决定怎么归还。
+ * 用另一个数组初始化的数组和它共用缓冲区（写时复制），
+ * 写入之前要调用 unshare，由它在还有别的数组共用时复制一份
+ */
+class Array
+{
+  public:
+    /// 元素个数的上限，防止一条声明就把内存用光
+    static constexpr size_t maxSize = size_t(1) << 28;
+    /// 不分配缓冲区的数组的元素个数上限，下标是 int32_t
+    static constexpr size_t maxLength = INT32_MAX;
+
+    /**
+     * dims 是每一维的长度，都大于 0，元素初始化为 0
+     */
+    explicit Array(std::vector<size_t> dims)
+        : dims_(std::move(dims)), strides_(dims_.size())
+    {
+        buffer_ = newBuffer(computeStrides(maxSize), 0);
+    }
+
+    /**
+     * 元素是 elements 开始的 size() 个，不复制
+     */
+    Array(std::vector<size_t> dims, std::shared_ptr<int32_t> elements)
+        : dims_(std::move(dims)),
+          strides_(dims_.size()),
+          buffer_(std::move(elements))
+    {
+        computeStrides(maxLength);
+    }
+
+    /**
+     * 元素是 source 中从第 offset 个开始的 size() 个，不复制
+     */
+    Array(std::vector<size_t> dims, const Array &source, size_t offset)
+        : Array(std::move(dims),
+                std::shared_ptr<int32_t>(source.buffer_,
+                                         source.data() + offset))
+    {
+    }
+
+    /**
+     * 维数
+     */
+    size_t rank() const
+    {
+        return dims_.size();
+    }
+
+    size_t dim(size_t k) const
+    {
+        return dims_[k];
+    }
+
+    size_t stride(size_t k) const
+    {
+        return strides_[k];
+    }
+
+    /**
+     * 元素个数
+     */
+    size_t size() const
+    {
+        return dims_[0] * strides_[0];
+    }
+
+    int32_t *data() const
+    {
+        return buffer_.get();
+    }
+
+    /**
+     * 缓冲区是否还和别的数组共用
+     */
+    bool isShared() const
+    {
+        return buffer_.use_count() > 1;
+    }
+
+    /**
+     * 写入之前调用：缓冲区和别的数组共用时，把自己的元素复制到新的缓冲区
+     */
+    void unshare()
+    {
+        if (isShared())
+        {
+            buffer_ = newBuffer(data(), data() + size());
+        }
+    }
+
+  private:
+    using Buffer = std::vector<int32_t>;
+
+    /**
+     * 从最后一维往前算出 strides_，返回元素个数，超过 limit 时报错
+     */
+    size_t computeStrides(size_t limit)
+    {
+        size_t size = 1;
+        for (size_t k = dims_.size(); k-- > 0;)
+        {
+            if (dims_[k] > limit / size)
+            {
+                throw std::runtime_error("数组太大");
+            }
+            strides_[k] = size;
+            size *= dims_[k];
+        }
+        return size;
+    }
+
+    /**
+     * 新的缓冲区，返回的指针指向第一个元素，同时持有整个 vector
+     */
+    template <typename... Args>
+    static std::shared_ptr<int32_t> newBuffer(Args &&...args)
+    {
+        auto buffer = std::make_shared<Buffer>(std::forward<Args>(args)...);
+        return std::shared_ptr<int32_t>(buffer, buffer->data());
+    }
+
+  private:
+    std::vector<size_t> dims_;
+    std::vector<size_t> strides_;
+    /// 指向第一个元素，不一定是缓冲区的开头
+    std::shared_ptr<int32_t> buffer_;
+};
+
+/**
+ * 数组、子数组或者切片：a、a[i] 和 slice(a, 1, 3) 都是 ArrayRef，
+ * 下标取满之后才得到元素
+ *
+ * 第 depth 维只取 extent 个，第一个在缓冲区中的下标是 offset，
+ * 相邻两个隔 step 个元素，之后的各维和数组相同。
+ * ArrayRef 不复制元素，通过它写入的就是原来的数组。
+ * 元素就是缓冲区中的 int32_t*，和普通变量一样参与运算和赋值，不需要装箱
+ */
+struct ArrayRef
+{
+    Array *array;
+    /// 第一个元素在缓冲区中的下标
+    size_t offset;
+    /// 已经取过的下标个数
+    size_t depth;
+    /// 第 depth 维的长度
+    size_t extent;
+    /// 第 depth 维的下标加一时跨过的元素个数
+    size_t step;
+
+    /**
+     * 整个数组（或者子数组）的第 depth 维
+     */
+    ArrayRef(Array *array, size_t offset = 0, size_t depth = 0)
+        : ArrayRef(array,
+                   offset,
+                   depth,
+                   array->dim(depth),
+                   array->stride(depth))
+    {
+    }
+
+    ArrayRef(Array *array,
+             size_t offset,
+             size_t depth,
+             size_t extent,
+             size_t step)
+        : array(array), offset(offset), depth(depth), extent(extent), step(step)
+    {
+    }
+
+    /**
+     * 取一个下标，还有剩下的维时返回子数组 ArrayRef，否则返回元素的 int32_t*
+     */
+    antlrcpp::Any index(int32_t i) const
+    {
+        if (i < 0 || static_cast<size_t>(i) >= extent)
+        {
+            std::stringstream ss;
+            ss << "数组下标" << i << "越界，长度为" << extent;
+            throw std::runtime_error(ss.str());
+        }
+        auto position = offset + i * step;
+        if (depth + 1 == array->rank())
+        {
+            return array->data() + position;
+        }
+        return ArrayRef{array, position, depth + 1};
+    }
+
+    /**
+     * 第 depth 维的第 start 个开始，每 every 个取一个，一共取 count 个
+     *
+     * 调用方保证不越界
+     */
+    ArrayRef slice(size_t start, size_t count, size_t every) const
+    {
+        return ArrayRef{array, offset + start * step, depth, count,
+                        step * every};
+    }
+
+    /**
+     * 第 depth 维的长度
+     */
+    size_t length() const
+    {
+        return extent;
+    }
+
+    /**
+     * 第 depth 维的每一项（一个元素或者一个子数组）的元素个数
+     */
+    size_t rowSize() const
+    {
+        return array->stride(depth);
+    }
+
+    /**
+     * 元素个数
+     */
+    size_t size() const
+    {
+        return extent * rowSize();
+    }
+
+    /**
+     * 元素在缓冲区中是否连续，数组、子数组和不跳着取的切片都是连续的
+     */
+    bool contiguous() const
+    {
+        return extent <= 1 || step == rowSize();
+    }
+
+    /**
+     * 是否是整个数组
+     */
+    bool isWhole() const
+    {
+        return depth == 0 && offset == 0 && extent == array->dim(0) &&
+               step == array->stride(0);
+    }
+
+    /**
+     * 第一个元素
+     */
+    int32_t *data() const
+    {
+        return array->data() + offset;
+    }
+
+    /**
+     * 按顺序把元素分成若干段连续的 (int32_t*, 个数) 交给 f，连续时只有一段
+     */
+    template <typename F>
+    void forEachRun(F f) const
+    {
+        if (contiguous())
+        {
+            f(data(), size());
+            return;
+        }
+        for (size_t i = 0; i < extent; ++i)
+        {
+            f(data() + i * step, rowSize());
+        }
+    }
+
+    /**
+     * 按 [[1, 2], [3, 4]] 的格式输出
+     */
+    void print(std::ostream &out) const
+    {
+        out << '[';
+        for (size_t i = 0; i < length(); ++i)
+        {
+            if (i > 0)
+            {
+                out << ", ";
+            }
+            auto element = index(static_cast<int32_t>(i));
+            if (element.is<ArrayRef>())
+            {
+                element.as<ArrayRef>().print(out);
+            }
+            else
+            {
+                out << *element.as<int32_t *>();
+            }
+        }
+        out << ']';
+    }
+};
+
+/**
+ * int w[3] = slice(a, 1, 3); 用 source 的元素初始化新数组，元素个数必须相同
+ *
+ * source 的元素连续时和它共用缓冲区（写时复制），否则按顺序复制一份
+ */
+inline Array arrayFrom(std::vector<size_t> dims, const ArrayRef &source)
+{
+    auto array = source.contiguous()
+                     ? Array(std::move(dims), *source.array, source.offset)
+                     : Array(std::move(dims));
+    if (array.size() != source.size())
+    {
+        std::stringstream ss;
+        ss << "初始值的元素个数和数组不同：" << source.size() << "和"
+           << array.size();
+        throw std::runtime_error(ss.str());
+    }
+    if (!source.contiguous())
+    {
+        auto *element = array.data();
+        source.forEachRun([&element](int32_t *data, size_t n) {
+            element = std::copy(data, data + n, element);
+        });
+    }
+    return array;
+}
+
+/**
+ * 内置函数返回的新数组，比如 load 映射的文件
+ *
+ * 解释器在每条语句开始时调用 clear，
+ * 用它们初始化的数组共用缓冲区，不受影响
+ */
+class TemporaryArrays
+{
+  public:
+    /**
+     * 元素初始化为 0
+     */
+    ArrayRef add(std::vector<size_t> dims)
+    {
+        return ArrayRef{&arrays_.emplace_back(std::move(dims))};
+    }
+
+    /**
+     * 元素是 elements 开始的若干个，不复制
+     */
+    ArrayRef add(std::vector<size_t> dims, std::shared_ptr<int32_t> elements)
+    {
+        return ArrayRef{
+            &arrays_.emplace_back(std::move(dims), std::move(elements))};
+    }
+
+    void clear()
+    {
+        arrays_.clear();
+    }
+
+  private:
+    std::deque<Array> arrays_;
+};
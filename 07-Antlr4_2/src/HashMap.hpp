@@ -0,0 +1,305 @@
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <ostream>
+#include <stdexcept>
+#include <vector>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+/**
+ * map m; 整数到整数的 map，开放寻址的哈希表，
+ * 和 Abseil 的 SwissTable 是同样的结构
+ *
+ * 每个槽位有一个控制字节：空、删除过，或者键的哈希值的低 7 位。
+ * 槽位 16 个一组，查找时用 SSE2 一次比较一组的 16 个控制字节，
+ * 只有控制字节相同的槽位才去比较键，大部分查找只读一组控制字节和一个槽位。
+ * 组的个数是 2 的幂，按 1、2、3…… 的间隔跳着探查，最终会走遍所有的组。
+ *
+ * 槽位中放键和值的编号，值放在 values_ 中：deque 扩容时不移动已有的元素，
+ * 哈希表扩容时值也不动，m[k] 得到的 int32_t* 和普通变量一样一直有效
+ */
+class IntMap
+{
+  public:
+    /// 键的个数上限，和数组的元素个数上限相同
+    static constexpr size_t maxSize = size_t(1) << 28;
+
+    size_t size() const
+    {
+        return size_;
+    }
+
+    /**
+     * 键对应的值，没有时返回空
+     */
+    int32_t *find(int32_t key)
+    {
+        auto slot = findSlot(key, hashOf(key));
+        return slot == npos ? nullptr : &values_[slots_[slot].value];
+    }
+
+    /**
+     * 键对应的值，没有时插入，值为 0
+     */
+    int32_t *insert(int32_t key)
+    {
+        auto hash = hashOf(key);
+        auto slot = findSlot(key, hash);
+        if (slot != npos)
+        {
+            return &values_[slots_[slot].value];
+        }
+        if (growthLeft_ == 0)
+        {
+            rehash();
+        }
+        slot = findFree(hash);
+        if (control_[slot] == empty)
+        {
+            --growthLeft_;
+        }
+        control_[slot] = static_cast<int8_t>(hash & 0x7F);
+        uint32_t value;
+        if (freeValues_.empty())
+        {
+            value = static_cast<uint32_t>(values_.size());
+            values_.push_back(0);
+        }
+        else
+        {
+            value = freeValues_.back();
+            freeValues_.pop_back();
+            values_[value] = 0;
+        }
+        slots_[slot] = {key, value};
+        ++size_;
+        return &values_[value];
+    }
+
+    /**
+     * 删除键，返回是否有这个键
+     */
+    bool erase(int32_t key)
+    {
+        auto slot = findSlot(key, hashOf(key));
+        if (slot == npos)
+        {
+            return false;
+        }
+        freeValues_.push_back(slots_[slot].value);
+        // 组里有空槽说明这一组从来没有满过，没有查找会越过它，可以直接置空；
+        // 否则要留下删除标记，让经过这里的查找继续往后找
+        if (matchEmpty(&control_[slot / groupSize * groupSize]) != 0)
+        {
+            control_[slot] = empty;
+            ++growthLeft_;
+        }
+        else
+        {
+            control_[slot] = deleted;
+        }
+        --size_;
+        return true;
+    }
+
+    /**
+     * 删除所有的键，释放存储空间
+     */
+    void clear()
+    {
+        *this = IntMap();
+    }
+
+    /**
+     * 按槽位的顺序把 (键, 值) 交给 f，插入和删除之后顺序可能改变
+     */
+    template <typename F>
+    void forEach(F f) const
+    {
+        for (size_t slot = 0; slot < control_.size(); ++slot)
+        {
+            if (control_[slot] >= 0)
+            {
+                f(slots_[slot].key, values_[slots_[slot].value]);
+            }
+        }
+    }
+
+    /**
+     * 按 {1: 2, 3: 4} 的格式输出
+     */
+    void print(std::ostream &out) const
+    {
+        out << '{';
+        bool first = true;
+        forEach([&](int32_t key, int32_t value) {
+            out << (first ? "" : ", ") << key << ": " << value;
+            first = false;
+        });
+        out << '}';
+    }
+
+  private:
+    struct Slot
+    {
+        int32_t key;
+        /// 值在 values_ 中的下标
+        uint32_t value;
+    };
+
+    static constexpr size_t groupSize = 16;
+    static constexpr size_t npos = SIZE_MAX;
+    /// 控制字节的最高位为 1 表示没有键，为 0 时低 7 位是哈希值
+    static constexpr int8_t empty = -128;
+    static constexpr int8_t deleted = -2;
+
+    /**
+     * 乘法散列的低位只取决于键的低位，把高 32 位异或下来
+     */
+    static uint64_t hashOf(int32_t key)
+    {
+        uint64_t hash = static_cast<uint32_t>(key) * 0x9E3779B97F4A7C15ull;
+        return hash ^ (hash >> 32);
+    }
+
+    /**
+     * 一组控制字节中等于 value 的，第 k 位为 1 表示第 k 个槽位
+     */
+    static uint32_t match(const int8_t *group, int8_t value)
+    {
+#if defined(__SSE2__)
+        auto bytes = _mm_loadu_si128(reinterpret_cast<const __m128i *>(group));
+        return static_cast<uint32_t>(
+            _mm_movemask_epi8(_mm_cmpeq_epi8(bytes, _mm_set1_epi8(value))));
+#else
+        uint32_t bits = 0;
+        for (size_t k = 0; k < groupSize; ++k)
+        {
+            bits |= static_cast<uint32_t>(group[k] == value) << k;
+        }
+        return bits;
+#endif
+    }
+
+    static uint32_t matchEmpty(const int8_t *group)
+    {
+        return match(group, empty);
+    }
+
+    /**
+     * 空的或者删除过的槽位，也就是最高位为 1 的控制字节
+     */
+    static uint32_t matchFree(const int8_t *group)
+    {
+#if defined(__SSE2__)
+        auto bytes = _mm_loadu_si128(reinterpret_cast<const __m128i *>(group));
+        return static_cast<uint32_t>(_mm_movemask_epi8(bytes));
+#else
+        uint32_t bits = 0;
+        for (size_t k = 0; k < groupSize; ++k)
+        {
+            bits |= static_cast<uint32_t>(group[k] < 0) << k;
+        }
+        return bits;
+#endif
+    }
+
+    size_t groups() const
+    {
+        return control_.size() / groupSize;
+    }
+
+    size_t findSlot(int32_t key, uint64_t hash) const
+    {
+        if (control_.empty())
+        {
+            return npos;
+        }
+        auto h2 = static_cast<int8_t>(hash & 0x7F);
+        auto mask = groups() - 1;
+        for (size_t group = (hash >> 7) & mask, step = 1;;
+             group = (group + step++) & mask)
+        {
+            const auto *control = &control_[group * groupSize];
+            for (auto bits = match(control, h2); bits != 0; bits &= bits - 1)
+            {
+                auto slot = group * groupSize + __builtin_ctz(bits);
+                if (slots_[slot].key == key)
+                {
+                    return slot;
+                }
+            }
+            // 插入时在第一个有空位的组就停下了，键不会在更后面
+            if (matchEmpty(control) != 0)
+            {
+                return npos;
+            }
+        }
+    }
+
+    /**
+     * 探查序列上第一个空的或者删除过的槽位，调用方保证有空槽
+     */
+    size_t findFree(uint64_t hash) const
+    {
+        auto mask = groups() - 1;
+        for (size_t group = (hash >> 7) & mask, step = 1;;
+             group = (group + step++) & mask)
+        {
+            auto bits = matchFree(&control_[group * groupSize]);
+            if (bits != 0)
+            {
+                return group * groupSize + __builtin_ctz(bits);
+            }
+        }
+    }
+
+    /**
+     * 没有空位时重建哈希表：键多就扩大一倍，删除标记多就按原来的大小重建。
+     * 最多用掉 7/8 的槽位（包括删除标记），保证每次探查都能很快遇到空槽
+     */
+    void rehash()
+    {
+        if (size_ >= maxSize)
+        {
+            throw std::runtime_error("map太大");
+        }
+        auto capacity = control_.size();
+        if (capacity == 0)
+        {
+            capacity = groupSize;
+        }
+        else if (size_ >= capacity * 7 / 16)
+        {
+            capacity *= 2;
+        }
+        auto control = std::move(control_);
+        auto slots = std::move(slots_);
+        control_.assign(capacity, empty);
+        slots_.resize(capacity);
+        growthLeft_ = capacity * 7 / 8 - size_;
+        for (size_t slot = 0; slot < control.size(); ++slot)
+        {
+            if (control[slot] >= 0)
+            {
+                auto hash = hashOf(slots[slot].key);
+                auto free = findFree(hash);
+                control_[free] = control[slot];
+                slots_[free] = slots[slot];
+            }
+        }
+    }
+
+  private:
+    std::vector<int8_t> control_;
+    std::vector<Slot> slots_;
+    std::deque<int32_t> values_;
+    /// 删除的键空出来的值，插入时先用这些
+    std::vector<uint32_t> freeValues_;
+    size_t size_ = 0;
+    /// 还能填入多少个空槽，为 0 时 rehash
+    size_t growthLeft_ = 0;
+};
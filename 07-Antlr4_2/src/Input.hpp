@@ -0,0 +1,213 @@
+#pragma once
+
+#include <unistd.h>
+#include <cerrno>
+#include <cstdint>
+#include <memory>
+#include <stdexcept>
+#include <streambuf>
+#include <string>
+
+/**
+ * 脚本的输入：从文件描述符（默认是标准输入）或者嵌入方给的流中
+ * 读取空白分隔的十进制整数
+ *
+ * 一次 read 一大块到自己的缓冲区，再逐个字符手工解析，
+ * 不经过 iostream 和 locale，每个数只有几次比较和一次乘加。
+ * 用 read 而不用 fread，管道和终端有多少数据就先处理多少，不会等缓冲区填满
+ */
+namespace input
+{
+class IntReader
+{
+  public:
+    /// 缓冲区的大小，和 Linux 管道的容量相同
+    static constexpr size_t capacity = size_t(1) << 16;
+
+    explicit IntReader(int fd = STDIN_FILENO)
+        : fd_(fd), buffer_(new char[capacity])
+    {
+    }
+
+    /**
+     * 从 source 读取，每次用 sgetn 取一块，source 要比这个对象活得长
+     */
+    explicit IntReader(std::streambuf &source)
+        : fd_(-1), source_(&source), buffer_(new char[capacity])
+    {
+    }
+
+    /**
+     * 跳过空白之后是否已经没有输入了
+     */
+    bool atEnd()
+    {
+        skipSpaces();
+        return peek() < 0;
+    }
+
+    /**
+     * 读一个整数，可以带正负号，前后必须是空白或者输入的开头、结尾
+     */
+    int32_t next()
+    {
+        if (atEnd())
+        {
+            throw std::runtime_error("输入已经读完了");
+        }
+        int sign = peek();
+        int c = sign;
+        if (sign == '-' || sign == '+')
+        {
+            ++begin_;
+            c = peek();
+        }
+        if (!isDigit(c))
+        {
+            throw std::runtime_error("输入中的" + badToken(signText(sign)) +
+                                     "不是整数");
+        }
+        bool negative = sign == '-';
+        // 在 uint32_t 上累加，INT32_MIN 的绝对值也放得下
+        uint32_t limit = negative ? 0x80000000u : 0x7fffffffu;
+        uint32_t value = 0;
+        bool overflow = false;
+        // 数字可能被缓冲区的边界切开，每次处理缓冲区中连续的一段
+        do
+        {
+            const char *p = buffer_.get() + begin_;
+            const char *end = buffer_.get() + end_;
+            for (; p != end && isDigit(*p); ++p)
+            {
+                auto digit = static_cast<uint32_t>(*p - '0');
+                overflow = overflow || value > (limit - digit) / 10;
+                value = value * 10 + digit;
+            }
+            begin_ = p - buffer_.get();
+        } while (begin_ == end_ && refill());
+        c = begin_ == end_ ? -1 : static_cast<unsigned char>(buffer_[begin_]);
+        if (overflow)
+        {
+            badToken("");
+            throw std::runtime_error("输入中的整数超出了int的范围");
+        }
+        if (c >= 0 && !isSpace(c))
+        {
+            throw std::runtime_error(
+                "输入中的" + badToken(signText(sign) + std::to_string(value)) +
+                "不是整数");
+        }
+        return static_cast<int32_t>(negative ? 0u - value : value);
+    }
+
+    /**
+     * 连续读 n 个整数到 data
+     */
+    void next(int32_t *data, size_t n)
+    {
+        for (size_t i = 0; i < n; ++i)
+        {
+            data[i] = next();
+        }
+    }
+
+  private:
+    static bool isDigit(int c)
+    {
+        return static_cast<unsigned>(c - '0') < 10;
+    }
+
+    static bool isSpace(int c)
+    {
+        return c == ' ' || (c >= '\t' && c <= '\r');
+    }
+
+    static std::string signText(int sign)
+    {
+        return sign == '-' || sign == '+' ? std::string(1, char(sign)) : "";
+    }
+
+    /**
+     * 下一个字符，不取走，没有输入时返回 -1
+     */
+    int peek()
+    {
+        if (begin_ == end_ && !refill())
+        {
+            return -1;
+        }
+        return static_cast<unsigned char>(buffer_[begin_]);
+    }
+
+    void skipSpaces()
+    {
+        do
+        {
+            const char *p = buffer_.get() + begin_;
+            const char *end = buffer_.get() + end_;
+            for (; p != end && isSpace(*p); ++p)
+            {
+            }
+            begin_ = p - buffer_.get();
+        } while (begin_ == end_ && refill());
+    }
+
+    /**
+     * 缓冲区用完之后再读一块，读到结尾时返回 false
+     */
+    bool refill()
+    {
+        begin_ = end_ = 0;
+        // 终端上按 Ctrl-D 之后再 read 还会等待输入
+        while (!eof_)
+        {
+            auto n = source_ != nullptr
+                         ? static_cast<ssize_t>(
+                               source_->sgetn(buffer_.get(), capacity))
+                         : ::read(fd_, buffer_.get(), capacity);
+            if (n > 0)
+            {
+                end_ = static_cast<size_t>(n);
+                return true;
+            }
+            if (n == 0)
+            {
+                eof_ = true;
+            }
+            else if (errno != EINTR)
+            {
+                throw std::runtime_error("读取输入失败");
+            }
+        }
+        return false;
+    }
+
+    /**
+     * 取走出错的那一项的剩余部分，接在已经读过的 token 后面返回，
+     * 最多保留 20 个字符
+     */
+    std::string badToken(std::string token)
+    {
+        for (int c = peek(); c >= 0 && !isSpace(c); c = peek())
+        {
+            if (token.size() < 20)
+            {
+                token += static_cast<char>(c);
+            }
+            ++begin_;
+        }
+        return token;
+    }
+
+  private:
+    int fd_;
+    /// 不为空时从这里读，不用 fd_
+    std::streambuf *source_ = nullptr;
+    std::unique_ptr<char[]> buffer_;
+    /// 缓冲区中还没有解析的是 [begin_, end_)
+    size_t begin_ = 0;
+    size_t end_ = 0;
+    /// 已经读到了结尾
+    bool eof_ = false;
+};
+}  // namespace input
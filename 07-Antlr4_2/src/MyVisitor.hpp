@@ -2,87 +2,11 @@
 
 #include <cstdlib>
 #include "./generated/FalconScriptBaseVisitor.h"
+#include <deque>
 #include <sstream>
-
-/**
- * 普通二元运算符
- */
-#define BINARY_OPERATOR(op_name, op)                                          \
-    case FalconScriptParser::op_name:                                         \
-        if (left.is<int>() && right.is<int>())                                \
-        {                                                                     \
-            result = static_cast<int32_t>(left.as<int>() op right.as<int>()); \
-        }                                                                     \
-        else if (left.is<int>() && right.is<int *>())                         \
-        {                                                                     \
-            result =                                                          \
-                static_cast<int32_t>(left.as<int>() op * right.as<int *>());  \
-        }                                                                     \
-        else if (left.is<int *>() && right.is<int>())                         \
-        {                                                                     \
-            result =                                                          \
-                static_cast<int32_t>(*left.as<int *>() op right.as<int>());   \
-        }                                                                     \
-        else if (left.is<int *>() && right.is<int *>())                       \
-        {                                                                     \
-            result = static_cast<int32_t>(*left.as<int *>() op *              \
-                                          right.as<int *>());                 \
-        }                                                                     \
-        else                                                                  \
-        {                                                                     \
-            throw std::runtime_error("类型不匹配");                           \
-        }                                                                     \
-        break
-
-/**
- * 赋值运算符
- *
- * 如果是repl模式且不在循环中，则输出变量的新值
- */
-#define ASSIGN_OPERATOR(op_name, op)                                          \
-    case FalconScriptParser::op_name:                                         \
-        if (left.is<int32_t>())                                               \
-        {                                                                     \
-            throw std::runtime_error("赋值号左侧不能为字面量");               \
-        }                                                                     \
-        if (right.is<int32_t>())                                              \
-        {                                                                     \
-            result = static_cast<int32_t>(*left.as<int32_t *>()               \
-                                               op right.as<int32_t>());       \
-        }                                                                     \
-        else if (right.is<int32_t *>())                                       \
-        {                                                                     \
-            result = static_cast<int32_t>(*left.as<int32_t *>() op *          \
-                                          right.as<int32_t *>());             \
-        }                                                                     \
-        else                                                                  \
-        {                                                                     \
-            throw std::runtime_error("类型不匹配");                           \
-        }                                                                     \
-        if (isRepl_ && loopDepth_ == 0)                                       \
-        {                                                                     \
-            std ::cout << leftName << ": " << result.as<int>() << std ::endl; \
-        }                                                                     \
-        break
-
-/**
- * 前缀运算符
- */
-#define PREFIX_UNARY_OPERATOR(op_name, op)                             \
-    case FalconScriptParser::op_name:                                  \
-        if (child.is<int32_t>())                                       \
-        {                                                              \
-            result = static_cast<int32_t>(op child.as<int32_t>());     \
-        }                                                              \
-        else if (child.is<int32_t *>())                                \
-        {                                                              \
-            result = static_cast<int32_t>(op * child.as<int32_t *>()); \
-        }                                                              \
-        else                                                           \
-        {                                                              \
-            throw std::runtime_error("类型不匹配");                    \
-        }                                                              \
-        break
+#include "Array.hpp"
+#include "Builtins.hpp"
+#include "OperatorKernels.hpp"
 
 /**
  * 支持的变量类型
@@ -90,7 +14,10 @@
 enum class FalconType
 {
     Integer,  ///< int32_t*
-    Array,  ///< std::vector<antlrcpp::Any>* // 可能直接存储数字，可能有子数组
+    Long,  ///< int64_t*
+    BigInt,  ///< BigInt*，见 BigInt.hpp
+    Array,  ///< ArrayRef，元素在 Array 的连续缓冲区里
+    Map,  ///< IntMap*，见 HashMap.hpp
 };
 
 /**
@@ -105,7 +32,15 @@ enum class StatementFlowControl
 class MyVisitor : public FalconScriptBaseVisitor
 {
   public:
-    MyVisitor(bool isRepl) : isRepl_(isRepl), loopDepth_(0)
+    /**
+     * 所有状态（变量、输出）都属于这个实例，不同实例可以在不同线程中同时运行
+     *
+     * input 是内置函数 read_int 等读取的输入，为空时没有输入
+     */
+    MyVisitor(bool isRepl,
+              std::ostream &out = std::cout,
+              input::IntReader *input = nullptr)
+        : isRepl_(isRepl), loopDepth_(0), out_(out), input_(input)
     {
     }
 
@@ -124,6 +59,7 @@ class MyVisitor : public FalconScriptBaseVisitor
         // {
         //     std::cout << "Error: " << e.what() << std::endl;
         // }
+        temporaries_.clear();
         return nullptr;
     }
 
@@ -151,6 +87,8 @@ class MyVisitor : public FalconScriptBaseVisitor
     virtual antlrcpp::Any visitBlockStatement(
         FalconScriptParser::BlockStatementContext *ctx) override
     {
+        // 上一条语句中内置函数返回的数组已经用完了
+        temporaries_.clear();
         if (ctx->statement())
         {
             return visitStatement(ctx->statement());
@@ -168,6 +106,8 @@ class MyVisitor : public FalconScriptBaseVisitor
     virtual antlrcpp::Any visitStatement(
         FalconScriptParser::StatementContext *ctx) override
     {
+        // 循环体可以不是块，每次迭代也要释放
+        temporaries_.clear();
         // 花括号包裹的语句块
         if (ctx->blockLabel)
         {
@@ -175,17 +115,8 @@ class MyVisitor : public FalconScriptBaseVisitor
         }
         else if (ctx->IF())
         {
-            int32_t condition;
             auto value = visitParExpression(ctx->parExpression());
-            if (value.is<int32_t>())
-            {
-                condition = value.as<int32_t>();
-            }
-            else if (value.is<int32_t *>())
-            {
-                condition = *value.as<int32_t *>();
-            }
-            if (condition != 0)
+            if (isTrue(value))
             {
                 return visitStatement(ctx->statement(0));
             }
@@ -300,8 +231,8 @@ class MyVisitor : public FalconScriptBaseVisitor
                 }
                 parent = parent->parent;
             }
-            std::cout << "\033[33mWarning: \033[0mbreak不在循环中，已忽略"
-                      << std::endl;
+            out_ << "\033[33mWarning: \033[0mbreak不在循环中，已忽略"
+                 << std::endl;
         }
         else if (ctx->CONTINUE())
         {
@@ -317,18 +248,42 @@ class MyVisitor : public FalconScriptBaseVisitor
                 }
                 parent = parent->parent;
             }
-            std::cout << "\033[33mWarning: \033[0mcontinue不在循环中，已忽略"
-                      << std::endl;
+            out_ << "\033[33mWarning: \033[0mcontinue不在循环中，已忽略"
+                 << std::endl;
         }
         else if (ctx->statementExpression)
         {
             auto result = visitExpression(ctx->statementExpression);
             // 类似于 a; 的语句，输出变量的值
-            if (ctx->statementExpression->primary())
+            if (result.is<ArrayRef>())
+            {
+                out_ << ctx->statementExpression->getText() << ": ";
+                result.as<ArrayRef>().print(out_);
+                out_ << std::endl;
+            }
+            else if (result.is<IntMap *>())
+            {
+                out_ << ctx->statementExpression->getText() << ": ";
+                result.as<IntMap *>()->print(out_);
+                out_ << std::endl;
+            }
+            // 变量和数组元素是 int32_t*，long 和 bigint 变量是 int64_t* 和
+            // BigInt*，只读的 m[k] 是 int32_t
+            else if (ctx->statementExpression->primary() ||
+                     ctx->statementExpression->L_BRACKET())
+            {
+                out_ << ctx->statementExpression->getText() << ": ";
+                printValue(result);
+                out_ << std::endl;
+            }
+            // 有返回值的内置函数，和变量一样输出结果
+            else if (ctx->statementExpression->methodCall())
             {
-                assert(result.is<int32_t *>());
-                std::cout << ctx->statementExpression->getText() << ": "
-                          << *result.as<int *>() << std::endl;
+                if (result.is<int32_t>())
+                {
+                    out_ << ctx->statementExpression->getText() << ": "
+                         << result.as<int32_t>() << std::endl;
+                }
             }
             else if (ctx->statementExpression->bop != nullptr)
             {
@@ -351,8 +306,10 @@ class MyVisitor : public FalconScriptBaseVisitor
                         if (isRepl_ && loopDepth_ == 0)
                         {
                             // 非赋值的二元运算符的计算结果输出
-                            std::cout << ctx->statementExpression->getText()
-                                      << ": " << result.as<int>() << std::endl;
+                            out_ << ctx->statementExpression->getText()
+                                 << ": ";
+                            printValue(result);
+                            out_ << std::endl;
                         }
                 }
             }
@@ -361,7 +318,8 @@ class MyVisitor : public FalconScriptBaseVisitor
         return nullptr;
     }
 
-    virtual antlrcpp::Any /* int32_t, int32_t* */ visitExpression(
+    virtual antlrcpp::Any /* int32_t, int64_t, BigInt 和它们的指针 */
+    visitExpression(
         FalconScriptParser::ExpressionContext *ctx) override
     {
         // 缓存所有的表达式结果
@@ -370,62 +328,55 @@ class MyVisitor : public FalconScriptBaseVisitor
         {
             result /* int32_t, int32_t* */ = visitPrimary(ctx->primary());
         }
+        // 内置函数
+        else if (ctx->methodCall())
+        {
+            result = visitMethodCall(ctx->methodCall());
+        }
+        // 数组下标，下标取满时得到元素的 int32_t*，否则是子数组；
+        // map 的下标是键
+        else if (ctx->L_BRACKET())
+        {
+            antlrcpp::Any array(visitExpression(ctx->expression(0)));
+            if (array.is<IntMap *>())
+            {
+                result = indexMap(ctx, array.as<IntMap *>());
+            }
+            else if (!array.is<ArrayRef>())
+            {
+                throw std::runtime_error(ctx->expression(0)->getText() +
+                                         "不是数组");
+            }
+            else
+            {
+                auto index = valueOf(visitExpression(ctx->expression(1)));
+                auto ref = array.as<ArrayRef>();
+                result = ref.index(index);
+                // 写入和别的数组共用的缓冲区之前先复制一份
+                if (ref.array->isShared() && result.is<int32_t *>() &&
+                    isWritten(ctx))
+                {
+                    ref.array->unshare();
+                    result = ref.index(index);
+                }
+            }
+        }
         // 双目运算符
         else if (ctx->bop != nullptr && ctx->expression().size() == 2)
         {
             // 获取左右表达式的结果
             antlrcpp::Any left(visitExpression(ctx->expression(0)));
             antlrcpp::Any right(visitExpression(ctx->expression(1)));
-            assert(left.is<int32_t>() ||
-                   left.is<int32_t *>() && left.as<int32_t *>() != nullptr);
-            assert(right.is<int32_t>() ||
-                   right.is<int32_t *>() && right.as<int32_t *>() != nullptr);
-
-            std::string leftName;
-            // 根据运算符类型进行计算
-            switch (ctx->bop->getType())
-            {
-                BINARY_OPERATOR(PLUS, +);
-                BINARY_OPERATOR(MINUS, -);
-                BINARY_OPERATOR(MULTIPLY, *);
-                BINARY_OPERATOR(DIVIDE, /);
-                BINARY_OPERATOR(MODULUS, %);
-                BINARY_OPERATOR(L_SHIFT, <<);
-                BINARY_OPERATOR(R_SHIFT, >>);
-                BINARY_OPERATOR(EQUAL, ==);
-                BINARY_OPERATOR(NOT_EQUAL, !=);
-                BINARY_OPERATOR(GREATER, >);
-                BINARY_OPERATOR(LESS, <);
-                BINARY_OPERATOR(GREATER_EQUAL, >=);
-                BINARY_OPERATOR(LESS_EQUAL, <=);
-                BINARY_OPERATOR(BIT_AND, &);
-                BINARY_OPERATOR(BIT_OR, |);
-                BINARY_OPERATOR(BIT_XOR, ^);
-                BINARY_OPERATOR(AND, &&);
-                BINARY_OPERATOR(OR, ||);
-                default:
-                    // 赋值号需要获取左边的变量名
-                    leftName =
-                        ctx->expression(0)->primary()->IDENTIFIER()->getText();
-                    break;
-            }
-            // 赋值号
-            switch (ctx->bop->getType())
-            {
-                // 这里会用到 leftName 修改内存中的变量值
-                ASSIGN_OPERATOR(ASSIGN, =);
-                ASSIGN_OPERATOR(PLUS_ASSIGN, +=);
-                ASSIGN_OPERATOR(MINUS_ASSIGN, -=);
-                ASSIGN_OPERATOR(MULTIPLY_ASSIGN, *=);
-                ASSIGN_OPERATOR(DIVIDE_ASSIGN, /=);
-                ASSIGN_OPERATOR(MODULUS_ASSIGN, %=);
-                ASSIGN_OPERATOR(L_SHIFT_ASSIGN, <<=);
-                ASSIGN_OPERATOR(R_SHIFT_ASSIGN, >>=);
-                ASSIGN_OPERATOR(BIT_AND_ASSIGN, &=);
-                ASSIGN_OPERATOR(BIT_OR_ASSIGN, |=);
-                ASSIGN_OPERATOR(BIT_XOR_ASSIGN, ^=);
-                default:
-                    break;
+            // 运算核的编号缓存在节点上，操作数的种类变了才重新查表
+            auto kernel = binaryKernelIndex(ctx->kernel, ctx, left, right);
+            const auto &op = binaryOperators[kernel / binaryKinds];
+            result = op.kernels[kernel % binaryKinds](left, right);
+            // 如果是repl模式且不在循环中，则输出赋值后变量的新值
+            if (op.assign && isRepl_ && loopDepth_ == 0)
+            {
+                out_ << ctx->expression(0)->getText() << ": ";
+                printValue(result);
+                out_ << std::endl;
             }
         }
         // 前置单目运算符
@@ -433,22 +384,21 @@ class MyVisitor : public FalconScriptBaseVisitor
         {
             antlrcpp::Any child(visitExpression(ctx->expression(0)));
             switch (ctx->prefix->getType())
-            {
-                PREFIX_UNARY_OPERATOR(PLUS, +);
-                PREFIX_UNARY_OPERATOR(MINUS, -);
-                PREFIX_UNARY_OPERATOR(NOT, !);
-                PREFIX_UNARY_OPERATOR(NEGATE, ~);
-            }
-            switch (ctx->prefix->getType())
             {
                 case FalconScriptParser::INCREMENT:
-                    assert(child.is<int32_t *>());
-                    result = ++*child.as<int32_t *>();
+                    result = step(child, 1, true);
                     break;
                 case FalconScriptParser::DECREMENT:
-                    assert(child.is<int32_t *>());
-                    result = --*child.as<int32_t *>();
+                    result = step(child, -1, true);
                     break;
+                default:
+                {
+                    auto kernel =
+                        unaryKernelIndex(ctx->kernel, ctx, child);
+                    result = unaryOperators[kernel / operandKinds]
+                                 .kernels[kernel % operandKinds](child);
+                    break;
+                }
             }
         }
         // 后置单目运算符
@@ -458,12 +408,10 @@ class MyVisitor : public FalconScriptBaseVisitor
             switch (ctx->postfix->getType())
             {
                 case FalconScriptParser::INCREMENT:
-                    assert(child.is<int32_t *>());
-                    result = (*child.as<int32_t *>())++;
+                    result = step(child, 1, false);
                     break;
                 case FalconScriptParser::DECREMENT:
-                    assert(child.is<int32_t *>());
-                    result = (*child.as<int32_t *>())--;
+                    result = step(child, -1, false);
                     break;
             }
         }
@@ -472,8 +420,7 @@ class MyVisitor : public FalconScriptBaseVisitor
                  ctx->bop->getType() == FalconScriptParser::TERNARY)
         {
             antlrcpp::Any cond(visitExpression(ctx->expression(0)));
-            assert(cond.is<int32_t>());
-            if (cond.as<int32_t>() != 0)
+            if (isTrue(cond))
             {
                 result = visitExpression(ctx->expression(1));
             }
@@ -486,6 +433,42 @@ class MyVisitor : public FalconScriptBaseVisitor
         return result;
     }
 
+    /**
+     * 调用内置函数，参数从左到右求值，见 Builtins.hpp
+     */
+    virtual antlrcpp::Any /* int32_t，或者没有返回值 */ visitMethodCall(
+        FalconScriptParser::MethodCallContext *ctx) override
+    {
+        auto name = ctx->IDENTIFIER()->getText();
+        auto *builtin = findBuiltin(name);
+        if (builtin == nullptr)
+        {
+            throw std::runtime_error("函数" + name + "未定义");
+        }
+        BuiltinArgs args;
+        if (ctx->expressionList())
+        {
+            for (auto *argument : ctx->expressionList()->expression())
+            {
+                args.push_back(visitExpression(argument));
+            }
+        }
+        auto maxArity = builtin->arity + builtin->optional;
+        if (args.size() < builtin->arity || args.size() > maxArity)
+        {
+            std::stringstream ss;
+            ss << "函数" << name << "需要" << builtin->arity;
+            if (builtin->optional > 0)
+            {
+                ss << "到" << maxArity;
+            }
+            ss << "个参数";
+            throw std::runtime_error(ss.str());
+        }
+        BuiltinContext context{temporaries_, input_};
+        return builtin->call(builtin->name, args, context);
+    }
+
     virtual antlrcpp::Any /* @see visitExpression, int32_t, int32_t* */
     visitPrimary(FalconScriptParser::PrimaryContext *ctx) override
     {
@@ -514,15 +497,106 @@ class MyVisitor : public FalconScriptBaseVisitor
         }
     }
 
-    virtual antlrcpp::Any /* int32_t */ visitLiteral(
+    virtual antlrcpp::Any /* int32_t, int64_t, std::string */ visitLiteral(
         FalconScriptParser::LiteralContext *ctx) override
     {
+        // 字符串只能作为内置函数的参数，比如文件名
+        if (ctx->STRING_LITERAL())
+        {
+            return unescape(ctx->STRING_LITERAL()->getText());
+        }
         return visitIntegerLiteral(ctx->integerLiteral());
     }
 
-    virtual antlrcpp::Any /* int32_t */ visitIntegerLiteral(
+    /**
+     * 去掉字符串字面量两边的引号，处理 \n、\"、\\、八进制的 \101
+     * 和 \u0041 这样的转义字符，\u 转成 UTF-8
+     */
+    static std::string unescape(const std::string &literal)
+    {
+        std::string result;
+        auto end = literal.size() - 1;
+        for (size_t i = 1; i < end; ++i)
+        {
+            if (literal[i] != '\\')
+            {
+                result += literal[i];
+                continue;
+            }
+            auto c = literal[++i];
+            switch (c)
+            {
+                case 'b':
+                    result += '\b';
+                    break;
+                case 't':
+                    result += '\t';
+                    break;
+                case 'n':
+                    result += '\n';
+                    break;
+                case 'f':
+                    result += '\f';
+                    break;
+                case 'r':
+                    result += '\r';
+                    break;
+                case 'u':
+                {
+                    while (literal[i] == 'u')
+                    {
+                        ++i;
+                    }
+                    auto code = std::stoul(literal.substr(i, 4), nullptr, 16);
+                    i += 3;
+                    // 一个字节 0xxxxxxx，两个字节 110xxxxx 10xxxxxx，
+                    // 三个字节 1110xxxx 10xxxxxx 10xxxxxx
+                    auto bytes = code < 0x80 ? 1 : code < 0x800 ? 2 : 3;
+                    const unsigned lead[] = {0, 0, 0xC0, 0xE0};
+                    result += static_cast<char>(lead[bytes] |
+                                                (code >> (6 * (bytes - 1))));
+                    for (int k = bytes - 2; k >= 0; --k)
+                    {
+                        result += static_cast<char>(0x80 |
+                                                    ((code >> (6 * k)) & 0x3F));
+                    }
+                    break;
+                }
+                default:
+                    if (c >= '0' && c <= '7')
+                    {
+                        // 最多三位，不超过 \377
+                        int value = c - '0';
+                        for (int digits = 1; digits < 3 && i + 1 < end;
+                             ++digits)
+                        {
+                            int next = literal[i + 1] - '0';
+                            if (next < 0 || next > 7 || value * 8 + next > 0377)
+                            {
+                                break;
+                            }
+                            value = value * 8 + next;
+                            ++i;
+                        }
+                        result += static_cast<char>(value);
+                    }
+                    else
+                    {
+                        // \"、\' 和 \\ 就是引号和反斜杠本身
+                        result += c;
+                    }
+            }
+        }
+        return result;
+    }
+
+    virtual antlrcpp::Any /* int32_t, int64_t */ visitIntegerLiteral(
         FalconScriptParser::IntegerLiteralContext *ctx) override
     {
+        if (isLongLiteral(ctx))
+        {
+            return longLiteral(ctx);
+        }
         if (ctx->DECIMAL_LITERAL())
         {
             return std::atoi(ctx->DECIMAL_LITERAL()->getText().c_str());
@@ -551,6 +625,10 @@ class MyVisitor : public FalconScriptBaseVisitor
         {
             return visitPrimitiveType(ctx->primitiveType());
         }
+        if (ctx->MAP())
+        {
+            return FalconType::Map;
+        }
         throw std::runtime_error("未知类型");
     }
 
@@ -561,14 +639,28 @@ class MyVisitor : public FalconScriptBaseVisitor
         {
             return FalconType::Integer;
         }
+        if (ctx->LONG())
+        {
+            return FalconType::Long;
+        }
+        if (ctx->BIGINT())
+        {
+            return FalconType::BigInt;
+        }
         return nullptr;
     }
 
     virtual antlrcpp::Any /* std::nullptr_t */ visitVariableDeclarators(
         FalconScriptParser::VariableDeclaratorsContext *ctx) override
     {
+        bool isMap = ctx->typeType()->MAP() != nullptr;
         for (auto declarator : ctx->variableDeclarator())
         {
+            if (isMap)
+            {
+                declareMap(declarator);
+                continue;
+            }
             visitVariableDeclarator(declarator);
         }
         return nullptr;
@@ -585,17 +677,47 @@ class MyVisitor : public FalconScriptBaseVisitor
             ss << "变量" << varName.as<std::string>() << "已定义";
             throw std::runtime_error(ss.str());
         }
-        int value = 0;
+        auto *declarators =
+            static_cast<FalconScriptParser::VariableDeclaratorsContext *>(
+                ctx->parent);
+        auto type = visitTypeType(declarators->typeType()).as<FalconType>();
+        if (!ctx->variableDeclaratorId()->expression().empty())
+        {
+            if (type != FalconType::Integer)
+            {
+                throw std::runtime_error(declarators->typeType()->getText() +
+                                         "不能声明成数组");
+            }
+            declareArray(varName.as<std::string>(), ctx);
+            return nullptr;
+        }
+        if (type == FalconType::BigInt)
+        {
+            declareBigInt(varName.as<std::string>(), ctx);
+            return nullptr;
+        }
+        bool isLong = type == FalconType::Long;
+        int64_t value = 0;
         if (ctx->variableInitializer())
         {
-            value = visitVariableInitializer(ctx->variableInitializer());
+            auto initial =
+                visitVariableInitializer(ctx->variableInitializer());
+            value = isLong ? longValueOf(initial) : valueOf(initial);
+        }
+        if (isLong)
+        {
+            variables_[varName.as<std::string>()] =
+                &longValues_.emplace_back(value);
+        }
+        else
+        {
+            variables_[varName.as<std::string>()] =
+                &values_.emplace_back(static_cast<int32_t>(value));
         }
-        variables_[varName.as<std::string>()] = new int(value);
         // 新定义的变量输出一下
         if (isRepl_ && loopDepth_ == 0)
         {
-            std::cout << varName.as<std::string>() << ": " << value
-                      << std::endl;
+            out_ << varName.as<std::string>() << ": " << value << std::endl;
         }
 
         return nullptr;
@@ -610,6 +732,10 @@ class MyVisitor : public FalconScriptBaseVisitor
     virtual antlrcpp::Any /* @see visitExpression */ visitVariableInitializer(
         FalconScriptParser::VariableInitializerContext *ctx) override
     {
+        if (ctx->arrayInitializer())
+        {
+            throw std::runtime_error("只有数组可以用花括号初始化");
+        }
         return visitExpression(ctx->expression());
     }
 
@@ -645,18 +771,379 @@ class MyVisitor : public FalconScriptBaseVisitor
 
   private:
     /**
-     * 可能的类型：int32_t*, std::vector<antlrcpp::Any>
-     * 数组内部也是存储上述两种类型
+     * 表达式的值，变量和数组元素都要解引用
+     */
+    static int32_t valueOf(const antlrcpp::Any &value)
+    {
+        if (value.is<int32_t>())
+        {
+            return value.as<int32_t>();
+        }
+        if (value.is<int32_t *>())
+        {
+            return *value.as<int32_t *>();
+        }
+        if (value.is<ArrayRef>())
+        {
+            throw std::runtime_error("数组不能直接参与运算");
+        }
+        if (value.is<int64_t>() || value.is<int64_t *>())
+        {
+            throw std::runtime_error("long不能隐式转换成int");
+        }
+        if (value.is<BigInt>() || value.is<BigInt *>())
+        {
+            throw std::runtime_error("bigint不能隐式转换成int");
+        }
+        // 没有返回值的内置函数
+        throw std::runtime_error("类型不匹配");
+    }
+
+    /**
+     * int 或者 long 表达式的值，int 扩展成 int64_t
+     */
+    static int64_t longValueOf(const antlrcpp::Any &value)
+    {
+        if (value.is<int64_t>())
+        {
+            return value.as<int64_t>();
+        }
+        if (value.is<int64_t *>())
+        {
+            return *value.as<int64_t *>();
+        }
+        if (value.is<BigInt>() || value.is<BigInt *>())
+        {
+            throw std::runtime_error("bigint不能隐式转换成long");
+        }
+        return valueOf(value);
+    }
+
+    /**
+     * bigint 的初始值可以是 int、long、bigint，
+     * 或者十进制的字符串字面量，比如 "123456789012345678901234567890"
+     */
+    static BigInt bigValueOf(const antlrcpp::Any &value)
+    {
+        if (value.is<BigInt>())
+        {
+            return value.as<BigInt>();
+        }
+        if (value.is<BigInt *>())
+        {
+            return *value.as<BigInt *>();
+        }
+        if (value.is<std::string>())
+        {
+            return BigInt::parse(value.as<std::string>());
+        }
+        return longValueOf(value);
+    }
+
+    /**
+     * 条件表达式的值是否不为 0
+     */
+    static bool isTrue(const antlrcpp::Any &value)
+    {
+        if (value.is<BigInt>())
+        {
+            return !value.as<BigInt>().isZero();
+        }
+        if (value.is<BigInt *>())
+        {
+            return !value.as<BigInt *>()->isZero();
+        }
+        return longValueOf(value) != 0;
+    }
+
+    /**
+     * 输出 int、long 或者 bigint 表达式的值
+     */
+    void printValue(const antlrcpp::Any &value)
+    {
+        if (value.is<BigInt>())
+        {
+            out_ << value.as<BigInt>();
+        }
+        else if (value.is<BigInt *>())
+        {
+            out_ << *value.as<BigInt *>();
+        }
+        else
+        {
+            out_ << longValueOf(value);
+        }
+    }
+
+    /**
+     * ++ 和 --，操作数是 int、long 或者 bigint 变量，prefix 为 true 时得到新值
+     */
+    static antlrcpp::Any step(antlrcpp::Any &child, int delta, bool prefix)
+    {
+        if (child.is<int64_t *>())
+        {
+            return step(*child.as<int64_t *>(), delta, prefix);
+        }
+        if (child.is<BigInt *>())
+        {
+            return step(*child.as<BigInt *>(), delta, prefix);
+        }
+        assert(child.is<int32_t *>());
+        return step(*child.as<int32_t *>(), delta, prefix);
+    }
+
+    template <typename T>
+    static T step(T &variable, int delta, bool prefix)
+    {
+        T old = variable;
+        variable = static_cast<T>(variable + delta);
+        return prefix ? variable : old;
+    }
+
+    /**
+     * 带 L 后缀的整数字面量是 long
+     */
+    static bool isLongLiteral(FalconScriptParser::IntegerLiteralContext *ctx)
+    {
+        auto text = ctx->getText();
+        return text.back() == 'l' || text.back() == 'L';
+    }
+
+    /**
+     * 超出 long 的范围时和 int 一样按二进制截断，
+     * strtoull 不认识 0b 前缀，二进制要先去掉
+     */
+    static int64_t longLiteral(FalconScriptParser::IntegerLiteralContext *ctx)
+    {
+        auto text = ctx->getText();
+        int base = ctx->HEX_LITERAL()     ? 16
+                   : ctx->OCTAL_LITERAL() ? 8
+                   : ctx->BINARY_LITERAL() ? 2
+                                           : 10;
+        if (base == 2)
+        {
+            text = text.substr(2);
+        }
+        return static_cast<int64_t>(std::strtoull(text.c_str(), nullptr, base));
+    }
+
+    /**
+     * 表达式的结果是否会被写入：它是赋值的左边或者 ++、-- 的操作数，
+     * 中间可以隔着括号和三目运算符的分支
+     */
+    static bool isWritten(FalconScriptParser::ExpressionContext *ctx)
+    {
+        antlr4::tree::ParseTree *node = ctx;
+        for (auto *parent = node->parent; parent != nullptr;
+             node = parent, parent = node->parent)
+        {
+            if (dynamic_cast<FalconScriptParser::PrimaryContext *>(parent))
+            {
+                continue;
+            }
+            auto *expression =
+                dynamic_cast<FalconScriptParser::ExpressionContext *>(parent);
+            if (expression == nullptr)
+            {
+                return false;
+            }
+            if (expression->primary() != nullptr)
+            {
+                continue;
+            }
+            if (expression->postfix != nullptr)
+            {
+                return true;
+            }
+            if (expression->prefix != nullptr)
+            {
+                auto type = expression->prefix->getType();
+                return type == FalconScriptParser::INCREMENT ||
+                       type == FalconScriptParser::DECREMENT;
+            }
+            if (expression->bop == nullptr)
+            {
+                return false;
+            }
+            if (expression->bop->getType() == FalconScriptParser::TERNARY)
+            {
+                if (node == expression->expression(0))
+                {
+                    return false;
+                }
+                continue;
+            }
+            auto op = findOperator(binaryOperators,
+                                   expression->bop->getType());
+            return op >= 0 && binaryOperators[op].assign &&
+                   node == expression->expression(0);
+        }
+        return false;
+    }
+
+    /**
+     * m[k]：写入时没有这个键就插入，得到值的 int32_t*；
+     * 只读时不插入，得到值本身，没有这个键时为 0
+     */
+    antlrcpp::Any indexMap(FalconScriptParser::ExpressionContext *ctx,
+                           IntMap *map)
+    {
+        auto key = valueOf(visitExpression(ctx->expression(1)));
+        if (isWritten(ctx))
+        {
+            return map->insert(key);
+        }
+        auto *value = map->find(key);
+        return value == nullptr ? 0 : *value;
+    }
+
+    /**
+     * bigint x = "123456789012345678901234567890";
+     */
+    void declareBigInt(const std::string &name,
+                       FalconScriptParser::VariableDeclaratorContext *ctx)
+    {
+        BigInt value;
+        if (ctx->variableInitializer())
+        {
+            auto initial =
+                visitVariableInitializer(ctx->variableInitializer());
+            value = bigValueOf(initial);
+        }
+        auto *variable = &bigValues_.emplace_back(std::move(value));
+        variables_[name] = variable;
+        if (isRepl_ && loopDepth_ == 0)
+        {
+            out_ << name << ": " << *variable << std::endl;
+        }
+    }
+
+    /**
+     * map m; 不能是数组，也不能有初始值
+     */
+    void declareMap(FalconScriptParser::VariableDeclaratorContext *ctx)
+    {
+        auto name = ctx->variableDeclaratorId()->IDENTIFIER()->getText();
+        if (!ctx->variableDeclaratorId()->expression().empty())
+        {
+            throw std::runtime_error("map不能声明成数组");
+        }
+        if (ctx->variableInitializer())
+        {
+            throw std::runtime_error("map不能有初始值");
+        }
+        if (variables_.find(name) != variables_.end())
+        {
+            throw std::runtime_error("变量" + name + "已定义");
+        }
+        auto *map = &maps_.emplace_back();
+        variables_[name] = map;
+        if (isRepl_ && loopDepth_ == 0)
+        {
+            out_ << name << ": ";
+            map->print(out_);
+            out_ << std::endl;
+        }
+    }
+
+    /**
+     * int a[2][3] = {{1, 2, 3}, {4, 5, 6}};
+     * int w[3] = slice(a[0], 0, 3);
+     *
+     * 每一维的长度在声明时求值，没有给出初始值的元素为 0。
+     * 用另一个数组初始化时元素个数必须相同，见 arrayFrom
+     */
+    void declareArray(const std::string &name,
+                      FalconScriptParser::VariableDeclaratorContext *ctx)
+    {
+        std::vector<size_t> dims;
+        for (auto dimension : ctx->variableDeclaratorId()->expression())
+        {
+            auto length = valueOf(visitExpression(dimension));
+            if (length <= 0)
+            {
+                throw std::runtime_error("数组的长度必须大于0");
+            }
+            dims.push_back(static_cast<size_t>(length));
+        }
+        auto initializer = ctx->variableInitializer();
+        antlrcpp::Any source;
+        if (initializer && initializer->expression())
+        {
+            source = visitExpression(initializer->expression());
+            if (!source.is<ArrayRef>())
+            {
+                throw std::runtime_error("数组只能用花括号或者数组初始化");
+            }
+        }
+        ArrayRef array{source.isNull()
+                           ? &arrays_.emplace_back(std::move(dims))
+                           : &arrays_.emplace_back(arrayFrom(
+                                 std::move(dims), source.as<ArrayRef>()))};
+        if (initializer && initializer->arrayInitializer())
+        {
+            initializeArray(array, initializer->arrayInitializer());
+        }
+        variables_[name] = array;
+        if (isRepl_ && loopDepth_ == 0)
+        {
+            out_ << name << ": ";
+            array.print(out_);
+            out_ << std::endl;
+        }
+    }
+
+    /**
+     * 按花括号的嵌套层次逐维填充，层次必须和数组的维数一致
+     */
+    void initializeArray(const ArrayRef &array,
+                         FalconScriptParser::ArrayInitializerContext *ctx)
+    {
+        auto initializers = ctx->variableInitializer();
+        if (initializers.size() > array.length())
+        {
+            throw std::runtime_error("初始值的个数超过了数组的长度");
+        }
+        for (size_t i = 0; i < initializers.size(); ++i)
+        {
+            auto element = array.index(static_cast<int32_t>(i));
+            auto nested = initializers[i]->arrayInitializer();
+            if (element.is<ArrayRef>() != (nested != nullptr))
+            {
+                throw std::runtime_error("初始值的层次和数组的维数不一致");
+            }
+            if (nested)
+            {
+                initializeArray(element.as<ArrayRef>(), nested);
+            }
+            else
+            {
+                *element.as<int32_t *>() =
+                    valueOf(visitExpression(initializers[i]->expression()));
+            }
+        }
+    }
+
+  private:
+    /**
+     * 可能的类型：int32_t*, int64_t*, BigInt*, ArrayRef, IntMap*
      */
-    static std::unordered_map<std::string, antlrcpp::Any> variables_;
+    std::unordered_map<std::string, antlrcpp::Any> variables_;
+    /// 变量的存储空间，deque 扩容时不会移动已有元素，指针一直有效
+    std::deque<int32_t> values_;
+    std::deque<int64_t> longValues_;
+    std::deque<BigInt> bigValues_;
+    /// 数组的存储空间，同样不会移动
+    std::deque<Array> arrays_;
+    std::deque<IntMap> maps_;
+    /// 内置函数返回的数组，每条语句开始时释放
+    TemporaryArrays temporaries_;
     /// isRepl_ 是否处于REPL模式
     const bool isRepl_;
     /// loopDepth_ 记录当前所在的循环层级
     int loopDepth_;
+    /// 脚本的输出
+    std::ostream &out_;
+    input::IntReader *input_;
 };
 
-inline std::unordered_map<std::string, antlrcpp::Any> MyVisitor::variables_ =
-    {};
-
-#undef BINARY_OPERATOR
-#undef PREFIX_UNARY_OPERATOR
@@ -0,0 +1,479 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SIMD_X86 1
+#define SIMD_TARGET(isa) __attribute__((target(isa)))
+#endif
+
+/**
+ * 整数数组的批量运算：求和、最小值、最大值、填充、逐元素的加减乘
+ *
+ * 每个运算有标量、SSE4.1、AVX2 三个版本。编译时不要求任何指令集，
+ * SIMD 版本用 target 属性单独编译，第一次调用时按 CPU 实际支持的指令集
+ * 选出一组，之后都通过函数指针调用。
+ *
+ * 加减乘按补码回绕，和运算符的语义一致；这样求和的顺序也不影响结果，
+ * 可以放心地拆成多路并行累加。
+ */
+namespace simd
+{
+/**
+ * 标量版本，也用来处理 SIMD 版本末尾不满一个向量的元素
+ */
+namespace scalar
+{
+inline int32_t sumFrom(int32_t init, const int32_t *a, size_t n)
+{
+    auto total = static_cast<uint32_t>(init);
+    for (size_t i = 0; i < n; ++i)
+    {
+        total += static_cast<uint32_t>(a[i]);
+    }
+    return static_cast<int32_t>(total);
+}
+
+inline int32_t minFrom(int32_t init, const int32_t *a, size_t n)
+{
+    for (size_t i = 0; i < n; ++i)
+    {
+        init = a[i] < init ? a[i] : init;
+    }
+    return init;
+}
+
+inline int32_t maxFrom(int32_t init, const int32_t *a, size_t n)
+{
+    for (size_t i = 0; i < n; ++i)
+    {
+        init = a[i] > init ? a[i] : init;
+    }
+    return init;
+}
+
+inline int32_t sum(const int32_t *a, size_t n)
+{
+    return sumFrom(0, a, n);
+}
+
+/**
+ * n 必须大于 0，下同
+ */
+inline int32_t min(const int32_t *a, size_t n)
+{
+    return minFrom(a[0], a + 1, n - 1);
+}
+
+inline int32_t max(const int32_t *a, size_t n)
+{
+    return maxFrom(a[0], a + 1, n - 1);
+}
+
+inline void fill(int32_t *a, size_t n, int32_t value)
+{
+    for (size_t i = 0; i < n; ++i)
+    {
+        a[i] = value;
+    }
+}
+
+/**
+ * a[i] += value，减去一个数就是加上它的相反数
+ */
+inline void addScalar(int32_t *a, size_t n, int32_t value)
+{
+    for (size_t i = 0; i < n; ++i)
+    {
+        a[i] = static_cast<int32_t>(static_cast<uint32_t>(a[i]) +
+                                    static_cast<uint32_t>(value));
+    }
+}
+
+inline void mulScalar(int32_t *a, size_t n, int32_t value)
+{
+    for (size_t i = 0; i < n; ++i)
+    {
+        a[i] = static_cast<int32_t>(static_cast<uint32_t>(a[i]) *
+                                    static_cast<uint32_t>(value));
+    }
+}
+
+/**
+ * a[i] += b[i]
+ */
+inline void add(int32_t *a, const int32_t *b, size_t n)
+{
+    for (size_t i = 0; i < n; ++i)
+    {
+        a[i] = static_cast<int32_t>(static_cast<uint32_t>(a[i]) +
+                                    static_cast<uint32_t>(b[i]));
+    }
+}
+
+inline void sub(int32_t *a, const int32_t *b, size_t n)
+{
+    for (size_t i = 0; i < n; ++i)
+    {
+        a[i] = static_cast<int32_t>(static_cast<uint32_t>(a[i]) -
+                                    static_cast<uint32_t>(b[i]));
+    }
+}
+
+inline void mul(int32_t *a, const int32_t *b, size_t n)
+{
+    for (size_t i = 0; i < n; ++i)
+    {
+        a[i] = static_cast<int32_t>(static_cast<uint32_t>(a[i]) *
+                                    static_cast<uint32_t>(b[i]));
+    }
+}
+}  // namespace scalar
+
+#ifdef SIMD_X86
+/**
+ * 每次处理 4 个元素，min/max 和乘法需要 SSE4.1
+ */
+namespace sse41
+{
+SIMD_TARGET("sse4.1") inline __m128i load(const int32_t *p)
+{
+    return _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+}
+
+SIMD_TARGET("sse4.1") inline void store(int32_t *p, __m128i v)
+{
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(p), v);
+}
+
+/**
+ * 4 路归约成 1 个数：先和交换了高低两半的自己运算，再和交换了相邻两个的运算
+ */
+SIMD_TARGET("sse4.1") inline int32_t reduceAdd(__m128i v)
+{
+    v = _mm_add_epi32(v, _mm_shuffle_epi32(v, 0x4e));
+    v = _mm_add_epi32(v, _mm_shuffle_epi32(v, 0xb1));
+    return _mm_cvtsi128_si32(v);
+}
+
+SIMD_TARGET("sse4.1") inline int32_t reduceMin(__m128i v)
+{
+    v = _mm_min_epi32(v, _mm_shuffle_epi32(v, 0x4e));
+    v = _mm_min_epi32(v, _mm_shuffle_epi32(v, 0xb1));
+    return _mm_cvtsi128_si32(v);
+}
+
+SIMD_TARGET("sse4.1") inline int32_t reduceMax(__m128i v)
+{
+    v = _mm_max_epi32(v, _mm_shuffle_epi32(v, 0x4e));
+    v = _mm_max_epi32(v, _mm_shuffle_epi32(v, 0xb1));
+    return _mm_cvtsi128_si32(v);
+}
+
+SIMD_TARGET("sse4.1") inline int32_t sum(const int32_t *a, size_t n)
+{
+    auto acc = _mm_setzero_si128();
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4)
+    {
+        acc = _mm_add_epi32(acc, load(a + i));
+    }
+    auto total = reduceAdd(acc);
+    return scalar::sumFrom(total, a + i, n - i);
+}
+
+SIMD_TARGET("sse4.1") inline int32_t min(const int32_t *a, size_t n)
+{
+    if (n < 4)
+    {
+        return scalar::min(a, n);
+    }
+    auto acc = load(a);
+    size_t i = 4;
+    for (; i + 4 <= n; i += 4)
+    {
+        acc = _mm_min_epi32(acc, load(a + i));
+    }
+    auto best = reduceMin(acc);
+    return scalar::minFrom(best, a + i, n - i);
+}
+
+SIMD_TARGET("sse4.1") inline int32_t max(const int32_t *a, size_t n)
+{
+    if (n < 4)
+    {
+        return scalar::max(a, n);
+    }
+    auto acc = load(a);
+    size_t i = 4;
+    for (; i + 4 <= n; i += 4)
+    {
+        acc = _mm_max_epi32(acc, load(a + i));
+    }
+    auto best = reduceMax(acc);
+    return scalar::maxFrom(best, a + i, n - i);
+}
+
+SIMD_TARGET("sse4.1") inline void fill(int32_t *a, size_t n, int32_t value)
+{
+    auto v = _mm_set1_epi32(value);
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4)
+    {
+        store(a + i, v);
+    }
+    scalar::fill(a + i, n - i, value);
+}
+
+SIMD_TARGET("sse4.1")
+inline void addScalar(int32_t *a, size_t n, int32_t value)
+{
+    auto v = _mm_set1_epi32(value);
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4)
+    {
+        store(a + i, _mm_add_epi32(load(a + i), v));
+    }
+    scalar::addScalar(a + i, n - i, value);
+}
+
+SIMD_TARGET("sse4.1")
+inline void mulScalar(int32_t *a, size_t n, int32_t value)
+{
+    auto v = _mm_set1_epi32(value);
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4)
+    {
+        store(a + i, _mm_mullo_epi32(load(a + i), v));
+    }
+    scalar::mulScalar(a + i, n - i, value);
+}
+
+SIMD_TARGET("sse4.1")
+inline void add(int32_t *a, const int32_t *b, size_t n)
+{
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4)
+    {
+        store(a + i, _mm_add_epi32(load(a + i), load(b + i)));
+    }
+    scalar::add(a + i, b + i, n - i);
+}
+
+SIMD_TARGET("sse4.1")
+inline void sub(int32_t *a, const int32_t *b, size_t n)
+{
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4)
+    {
+        store(a + i, _mm_sub_epi32(load(a + i), load(b + i)));
+    }
+    scalar::sub(a + i, b + i, n - i);
+}
+
+SIMD_TARGET("sse4.1")
+inline void mul(int32_t *a, const int32_t *b, size_t n)
+{
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4)
+    {
+        store(a + i, _mm_mullo_epi32(load(a + i), load(b + i)));
+    }
+    scalar::mul(a + i, b + i, n - i);
+}
+}  // namespace sse41
+
+/**
+ * 每次处理 8 个元素，归约时先把两个 128 位的半边合起来，再交给 SSE 版本
+ */
+namespace avx2
+{
+SIMD_TARGET("avx2") inline __m256i load(const int32_t *p)
+{
+    return _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p));
+}
+
+SIMD_TARGET("avx2") inline void store(int32_t *p, __m256i v)
+{
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(p), v);
+}
+
+SIMD_TARGET("avx2") inline __m128i low(__m256i v)
+{
+    return _mm256_castsi256_si128(v);
+}
+
+SIMD_TARGET("avx2") inline __m128i high(__m256i v)
+{
+    return _mm256_extracti128_si256(v, 1);
+}
+
+SIMD_TARGET("avx2") inline int32_t sum(const int32_t *a, size_t n)
+{
+    auto acc = _mm256_setzero_si256();
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+        acc = _mm256_add_epi32(acc, load(a + i));
+    }
+    auto total = sse41::reduceAdd(
+        _mm_add_epi32(low(acc), high(acc)));
+    return scalar::sumFrom(total, a + i, n - i);
+}
+
+SIMD_TARGET("avx2") inline int32_t min(const int32_t *a, size_t n)
+{
+    if (n < 8)
+    {
+        return sse41::min(a, n);
+    }
+    auto acc = load(a);
+    size_t i = 8;
+    for (; i + 8 <= n; i += 8)
+    {
+        acc = _mm256_min_epi32(acc, load(a + i));
+    }
+    auto best = sse41::reduceMin(
+        _mm_min_epi32(low(acc), high(acc)));
+    return scalar::minFrom(best, a + i, n - i);
+}
+
+SIMD_TARGET("avx2") inline int32_t max(const int32_t *a, size_t n)
+{
+    if (n < 8)
+    {
+        return sse41::max(a, n);
+    }
+    auto acc = load(a);
+    size_t i = 8;
+    for (; i + 8 <= n; i += 8)
+    {
+        acc = _mm256_max_epi32(acc, load(a + i));
+    }
+    auto best = sse41::reduceMax(
+        _mm_max_epi32(low(acc), high(acc)));
+    return scalar::maxFrom(best, a + i, n - i);
+}
+
+SIMD_TARGET("avx2") inline void fill(int32_t *a, size_t n, int32_t value)
+{
+    auto v = _mm256_set1_epi32(value);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+        store(a + i, v);
+    }
+    scalar::fill(a + i, n - i, value);
+}
+
+SIMD_TARGET("avx2")
+inline void addScalar(int32_t *a, size_t n, int32_t value)
+{
+    auto v = _mm256_set1_epi32(value);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+        store(a + i, _mm256_add_epi32(load(a + i), v));
+    }
+    scalar::addScalar(a + i, n - i, value);
+}
+
+SIMD_TARGET("avx2")
+inline void mulScalar(int32_t *a, size_t n, int32_t value)
+{
+    auto v = _mm256_set1_epi32(value);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+        store(a + i, _mm256_mullo_epi32(load(a + i), v));
+    }
+    scalar::mulScalar(a + i, n - i, value);
+}
+
+SIMD_TARGET("avx2")
+inline void add(int32_t *a, const int32_t *b, size_t n)
+{
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+        store(a + i, _mm256_add_epi32(load(a + i), load(b + i)));
+    }
+    scalar::add(a + i, b + i, n - i);
+}
+
+SIMD_TARGET("avx2")
+inline void sub(int32_t *a, const int32_t *b, size_t n)
+{
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+        store(a + i, _mm256_sub_epi32(load(a + i), load(b + i)));
+    }
+    scalar::sub(a + i, b + i, n - i);
+}
+
+SIMD_TARGET("avx2")
+inline void mul(int32_t *a, const int32_t *b, size_t n)
+{
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+        store(a + i, _mm256_mullo_epi32(load(a + i), load(b + i)));
+    }
+    scalar::mul(a + i, b + i, n - i);
+}
+}  // namespace avx2
+#endif
+
+/**
+ * 一组实现，按 CPU 支持的指令集选择
+ */
+struct Kernels
+{
+    const char *isa;
+    int32_t (*sum)(const int32_t *a, size_t n);
+    int32_t (*min)(const int32_t *a, size_t n);
+    int32_t (*max)(const int32_t *a, size_t n);
+    void (*fill)(int32_t *a, size_t n, int32_t value);
+    void (*addScalar)(int32_t *a, size_t n, int32_t value);
+    void (*mulScalar)(int32_t *a, size_t n, int32_t value);
+    void (*add)(int32_t *a, const int32_t *b, size_t n);
+    void (*sub)(int32_t *a, const int32_t *b, size_t n);
+    void (*mul)(int32_t *a, const int32_t *b, size_t n);
+};
+
+#define SIMD_KERNELS(ns)                                                   \
+    Kernels                                                                \
+    {                                                                      \
+        #ns, ns::sum, ns::min, ns::max, ns::fill, ns::addScalar,           \
+            ns::mulScalar, ns::add, ns::sub, ns::mul                       \
+    }
+
+inline Kernels selectKernels()
+{
+#ifdef SIMD_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+    {
+        return SIMD_KERNELS(avx2);
+    }
+    if (__builtin_cpu_supports("sse4.1"))
+    {
+        return SIMD_KERNELS(sse41);
+    }
+#endif
+    return SIMD_KERNELS(scalar);
+}
+
+#undef SIMD_KERNELS
+
+/**
+ * 当前 CPU 上最快的一组实现，第一次调用时检测，之后直接返回
+ */
+inline const Kernels &kernels()
+{
+    static const Kernels selected = selectKernels();
+    return selected;
+}
+}  // namespace simd
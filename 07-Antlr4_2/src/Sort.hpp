@@ -0,0 +1,108 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <thread>
+#include <vector>
+
+/**
+ * 整数数组的并行排序（归并排序）
+ *
+ * 把数组平均分成若干段，每个线程用 std::sort 排一段，
+ * 再一轮一轮地把相邻的两段归并成一段，同一轮的各次归并也在不同的线程中进行，
+ * 在数组和同样大小的缓冲区之间来回倒。
+ *
+ * 每次排序临时创建线程，排完就结束，不用 ThreadPool：
+ * 常驻进程的工作线程执行脚本时如果在同一个线程池里等待子任务，
+ * 所有工作线程都在等的时候就没有线程执行子任务了
+ */
+namespace parallel
+{
+/// 元素少于这个数时只用当前线程，创建线程的开销比排序还大
+constexpr size_t minParallelSize = size_t(1) << 17;
+/// 每一段至少有这么多个元素
+constexpr size_t minChunkSize = size_t(1) << 16;
+
+/**
+ * 用 count 个线程分别执行 f(0)、f(1)……f(count - 1)，当前线程执行 f(0)
+ */
+template <typename F>
+void forEach(size_t count, F f)
+{
+    std::vector<std::thread> threads;
+    threads.reserve(count);
+    for (size_t i = 1; i < count; ++i)
+    {
+        threads.emplace_back(f, i);
+    }
+    f(0);
+    for (auto &thread : threads)
+    {
+        thread.join();
+    }
+}
+
+/**
+ * 从小到大排序，threads 为 0 时按 CPU 的核数
+ *
+ * 归并用的缓冲区和数组一样大，由 allocator 分配，调用方可以把它记在账上
+ */
+template <typename Allocator = std::allocator<int32_t>>
+void sort(int32_t *data,
+          size_t n,
+          size_t threads = 0,
+          const Allocator &allocator = Allocator())
+{
+    if (threads == 0)
+    {
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    size_t chunks = std::min(threads, n / minChunkSize);
+    if (n < minParallelSize || chunks < 2)
+    {
+        std::sort(data, data + n);
+        return;
+    }
+    // 第 i 段是 [bounds[i], bounds[i + 1])
+    std::vector<size_t> bounds(chunks + 1);
+    for (size_t i = 0; i <= chunks; ++i)
+    {
+        bounds[i] = n * i / chunks;
+    }
+    forEach(chunks, [&](size_t i) {
+        std::sort(data + bounds[i], data + bounds[i + 1]);
+    });
+
+    std::vector<int32_t, Allocator> buffer(n, allocator);
+    int32_t *from = data;
+    int32_t *to = buffer.data();
+    while (bounds.size() > 2)
+    {
+        // 第 i 次归并第 2i 段和第 2i + 1 段，段数是奇数时最后一段直接复制
+        size_t merges = bounds.size() / 2;
+        forEach(merges, [&](size_t i) {
+            auto begin = bounds[2 * i];
+            auto middle = bounds[2 * i + 1];
+            auto end = 2 * i + 2 < bounds.size() ? bounds[2 * i + 2] : middle;
+            std::merge(from + begin, from + middle, from + middle, from + end,
+                       to + begin);
+        });
+        std::vector<size_t> merged;
+        for (size_t i = 0; i < bounds.size(); i += 2)
+        {
+            merged.push_back(bounds[i]);
+        }
+        if (merged.back() != n)
+        {
+            merged.push_back(n);
+        }
+        bounds.swap(merged);
+        std::swap(from, to);
+    }
+    if (from != data)
+    {
+        std::copy(from, from + n, data);
+    }
+}
+}  // namespace parallel
@@ -0,0 +1,93 @@
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <string>
+
+#include "Input.hpp"
+
+/**
+ * README 中"读取输入"一节的对比：从标准输入读完所有的整数要多久
+ *
+ *     ./input_bench generate 10000000 > data.txt
+ *     ./input_bench cin < data.txt        // std::cin >> x
+ *     ./input_bench nosync < data.txt     // 先 sync_with_stdio(false)
+ *     ./input_bench reader < data.txt     // input::IntReader
+ *
+ * 每种方式单独一个进程，sync_with_stdio 只能在第一次输入之前调用。
+ * 输出个数和总和，几种方式的结果应该相同
+ */
+namespace
+{
+/**
+ * 一行一个随机的 int，和 README 中的数据相同，种子固定
+ */
+void generate(size_t n)
+{
+    std::mt19937 rng(2024);
+    std::uniform_int_distribution<int32_t> value(INT32_MIN, INT32_MAX);
+    for (size_t i = 0; i < n; ++i)
+    {
+        std::printf("%d\n", value(rng));
+    }
+}
+
+template <typename Next>
+void measure(const char* name, Next next)
+{
+    auto start = std::chrono::steady_clock::now();
+    size_t count = 0;
+    int64_t sum = 0;
+    int32_t x;
+    while (next(x))
+    {
+        ++count;
+        sum += x;
+    }
+    std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - start;
+    std::printf("%-8s %.2f s，%zu 个，总和 %lld\n", name, elapsed.count(),
+                count, static_cast<long long>(sum));
+}
+}  // namespace
+
+int main(int argc, char* argv[])
+{
+    std::string mode = argc > 1 ? argv[1] : "";
+    if (mode == "generate" && argc == 3)
+    {
+        generate(std::strtoull(argv[2], nullptr, 10));
+    }
+    else if (mode == "cin" || mode == "nosync")
+    {
+        if (mode == "nosync")
+        {
+            std::ios::sync_with_stdio(false);
+        }
+        measure(mode.c_str(), [](int32_t& x) {
+            return static_cast<bool>(std::cin >> x);
+        });
+    }
+    else if (mode == "reader")
+    {
+        input::IntReader reader;
+        measure("reader", [&reader](int32_t& x) {
+            if (reader.atEnd())
+            {
+                return false;
+            }
+            x = reader.next();
+            return true;
+        });
+    }
+    else
+    {
+        std::cerr << "请输入： input_bench generate 个数 | cin | nosync | "
+                     "reader"
+                  << std::endl;
+        return 1;
+    }
+    return 0;
+}
@@ -51,6 +51,8 @@ void repl()
     std::cout << "> ";
     std::string buffer;
     std::string input;
+    // 变量保存在 visitor 中，所有输入共用一个实例
+    MyVisitor visitor(true);
     while (std::getline(std::cin, input))
     {
         // 检查是否退出
@@ -88,8 +90,6 @@ void repl()
         FalconScriptParser parser(&tokens);
         // 解析输入并生成解析树（AST）
         auto* tree = parser.prog();
-        // 创建自定义 visitor 实例
-        MyVisitor visitor(true);
         // 遍历语法树
         visitor.visitProg(tree);
 
@@ -126,7 +126,9 @@ int main(int argc, char* argv[])
         antlr4::CommonTokenStream tokens(&lexer);
         FalconScriptParser parser(&tokens);
         auto* tree = parser.prog();
-        MyVisitor visitor(false);
+        // 脚本从文件读取，标准输入留给 read_int 等内置函数
+        input::IntReader input;
+        MyVisitor visitor(false, std::cout, &input);
         visitor.visitProg(tree);
     }
     else
@@ -15,7 +15,22 @@ class AnnotatedTree
     {
     }
 
+    /**
+     * 节点对应的作用域，没有时为空
+     *
+     * 分析完之后注解树不再修改，执行时只能用这样的只读接口
+     */
+    Scope* scopeOf(antlr4::ParserRuleContext* ctx) const
+    {
+        auto it = node2scope.find(ctx);
+        return it == node2scope.end() ? nullptr : it->second;
+    }
+
   public:
     antlr4::tree::ParseTree* ast;
     std::unordered_map<antlr4::ParserRuleContext*, Scope*> node2scope;
+    /// 持有所有作用域对象，node2scope 中只存裸指针
+    std::vector<std::shared_ptr<Scope>> scopes;
+    /// 已经编号的表达式节点个数，见 MyListener::enterExpression
+    size_t expressions = 0;
 };
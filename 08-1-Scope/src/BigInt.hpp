@@ -0,0 +1,704 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "Memory.hpp"
+
+/**
+ * bigint：任意精度的整数
+ *
+ * 值在 int64_t 的范围内时直接放在 small_ 里，不分配堆内存，
+ * 加减乘用 __builtin_*_overflow 检查溢出，溢出之后才换成 limb 数组。
+ * limb 是 64 位的，从低位到高位存放绝对值，符号单独存放，
+ * 乘法和除法的中间结果用 unsigned __int128。
+ *
+ * 两个乘数都有 karatsubaThreshold 个 limb 以上时用 Karatsuba 乘法；
+ * 转成十进制时用 10^(19·2^k) 分治，两半分别转换，见 appendDecimal
+ *
+ * 变量的 limb 数组记在 MemoryAccount 的账上，和数组一样受内存上限的约束：
+ * 赋值时 limbs_ 保留自己的分配器，运算结果复制进变量的存储里记账；
+ * 运算的中间结果用默认的分配器，不记账
+ */
+class BigInt
+{
+  public:
+    using Limb = uint64_t;
+    using Limbs = std::vector<Limb, AccountedAllocator<Limb>>;
+
+    /// limb 数少于这个数时用竖式乘法
+    static constexpr size_t karatsubaThreshold = 32;
+    /// limb 数不超过这个数时逐段除以 10^19 转换成十进制
+    static constexpr size_t decimalThreshold = 32;
+    /// limb 数的上限，大约一百二十万位十进制数，
+    /// 避免 x = x * x 耗尽内存，也让单次乘除法的时间有上限
+    static constexpr size_t maxLimbs = size_t(1) << 16;
+
+    BigInt(int64_t value = 0) : small_(value)
+    {
+    }
+
+    /**
+     * 复制 value，limb 数组记在 memory 的账上，之后赋给它的值也记在这里
+     */
+    BigInt(const BigInt &value, MemoryAccount *memory)
+        : small_(value.small_),
+          negative_(value.negative_),
+          limbs_(value.limbs_, AccountedAllocator<Limb>(memory))
+    {
+    }
+
+    /**
+     * 十进制字符串，可以带正负号
+     */
+    static BigInt parse(const std::string &text)
+    {
+        size_t begin = text.size() > 0 && (text[0] == '-' || text[0] == '+');
+        if (begin == text.size())
+        {
+            throw std::runtime_error(text + "不是整数");
+        }
+        Limbs magnitude;
+        // 第一段是多出来的几位，之后每 19 位一段
+        size_t end = begin + (text.size() - begin) % decimalDigits;
+        if (end == begin)
+        {
+            end += decimalDigits;
+        }
+        for (; begin < text.size(); begin = end, end += decimalDigits)
+        {
+            Limb chunk = 0;
+            for (size_t i = begin; i < end; ++i)
+            {
+                if (text[i] < '0' || text[i] > '9')
+                {
+                    throw std::runtime_error(text + "不是整数");
+                }
+                chunk = chunk * 10 + static_cast<Limb>(text[i] - '0');
+            }
+            multiplyAdd(magnitude, decimalBase, chunk);
+        }
+        return fromMagnitude(std::move(magnitude), text[0] == '-');
+    }
+
+    bool isZero() const
+    {
+        return isSmall() && small_ == 0;
+    }
+
+    bool isNegative() const
+    {
+        return isSmall() ? small_ < 0 : negative_;
+    }
+
+    /**
+     * limb 的个数，值放在 small_ 里时是 0；运算和转换的时间随它增长
+     */
+    size_t limbCount() const
+    {
+        return limbs_.size();
+    }
+
+    /**
+     * 低 64 位按补码解释，和 long 转成 int 一样截断
+     */
+    int64_t truncate() const
+    {
+        if (isSmall())
+        {
+            return small_;
+        }
+        return static_cast<int64_t>(negative_ ? 0 - limbs_[0] : limbs_[0]);
+    }
+
+    std::string toString() const
+    {
+        if (isSmall())
+        {
+            return std::to_string(small_);
+        }
+        std::vector<Limbs> powers{{decimalBase}};
+        while (powers.back().size() <= (limbs_.size() + 1) / 2)
+        {
+            powers.push_back(multiply(powers.back(), powers.back()));
+        }
+        std::string text = negative_ ? "-" : "";
+        appendDecimal(limbs_, 0, powers, text);
+        return text;
+    }
+
+    friend std::ostream &operator<<(std::ostream &out, const BigInt &value)
+    {
+        return out << value.toString();
+    }
+
+    friend BigInt operator+(const BigInt &a, const BigInt &b)
+    {
+        int64_t sum;
+        if (a.isSmall() && b.isSmall() &&
+            !__builtin_add_overflow(a.small_, b.small_, &sum))
+        {
+            return sum;
+        }
+        Limbs x, y;
+        return addSigned(a.magnitude(x), a.isNegative(), b.magnitude(y),
+                         b.isNegative());
+    }
+
+    friend BigInt operator-(const BigInt &a, const BigInt &b)
+    {
+        int64_t difference;
+        if (a.isSmall() && b.isSmall() &&
+            !__builtin_sub_overflow(a.small_, b.small_, &difference))
+        {
+            return difference;
+        }
+        Limbs x, y;
+        return addSigned(a.magnitude(x), a.isNegative(), b.magnitude(y),
+                         !b.isNegative());
+    }
+
+    friend BigInt operator*(const BigInt &a, const BigInt &b)
+    {
+        int64_t product;
+        if (a.isSmall() && b.isSmall() &&
+            !__builtin_mul_overflow(a.small_, b.small_, &product))
+        {
+            return product;
+        }
+        Limbs x, y;
+        const auto &u = a.magnitude(x);
+        const auto &v = b.magnitude(y);
+        // 乘积至少有 u.size() + v.size() - 1 个 limb，太大就不用乘了
+        checkSize(u.size() + v.size() - 1);
+        return fromMagnitude(multiply(u, v), a.isNegative() != b.isNegative());
+    }
+
+    /**
+     * 和 int 一样向 0 取整
+     */
+    friend BigInt operator/(const BigInt &a, const BigInt &b)
+    {
+        if (a.isSmall() && b.isSmall() && b.small_ != 0 &&
+            !(a.small_ == INT64_MIN && b.small_ == -1))
+        {
+            return a.small_ / b.small_;
+        }
+        Limbs quotient, remainder;
+        divide(a, b, quotient, remainder);
+        return fromMagnitude(std::move(quotient),
+                             a.isNegative() != b.isNegative());
+    }
+
+    /**
+     * 余数的符号和被除数相同
+     */
+    friend BigInt operator%(const BigInt &a, const BigInt &b)
+    {
+        if (a.isSmall() && b.isSmall() && b.small_ != 0)
+        {
+            return b.small_ == -1 ? 0 : a.small_ % b.small_;
+        }
+        Limbs quotient, remainder;
+        divide(a, b, quotient, remainder);
+        return fromMagnitude(std::move(remainder), a.isNegative());
+    }
+
+    friend BigInt operator-(const BigInt &a)
+    {
+        if (a.isSmall() && a.small_ != INT64_MIN)
+        {
+            return -a.small_;
+        }
+        Limbs x;
+        return fromMagnitude(a.magnitude(x), !a.isNegative());
+    }
+
+    friend bool operator==(const BigInt &a, const BigInt &b)
+    {
+        return compare(a, b) == 0;
+    }
+
+    friend bool operator!=(const BigInt &a, const BigInt &b)
+    {
+        return compare(a, b) != 0;
+    }
+
+    friend bool operator<(const BigInt &a, const BigInt &b)
+    {
+        return compare(a, b) < 0;
+    }
+
+    friend bool operator>(const BigInt &a, const BigInt &b)
+    {
+        return compare(a, b) > 0;
+    }
+
+    friend bool operator<=(const BigInt &a, const BigInt &b)
+    {
+        return compare(a, b) <= 0;
+    }
+
+    friend bool operator>=(const BigInt &a, const BigInt &b)
+    {
+        return compare(a, b) >= 0;
+    }
+
+  private:
+    using Wide = unsigned __int128;
+
+    /// 10^19 是 64 位能放下的最大的 10 的幂
+    static constexpr Limb decimalBase = 10000000000000000000ull;
+    static constexpr size_t decimalDigits = 19;
+
+    bool isSmall() const
+    {
+        return limbs_.empty();
+    }
+
+    /**
+     * 绝对值，small_ 的绝对值放在 scratch 中返回
+     */
+    const Limbs &magnitude(Limbs &scratch) const
+    {
+        if (!isSmall())
+        {
+            return limbs_;
+        }
+        scratch.clear();
+        if (small_ != 0)
+        {
+            // INT64_MIN 的绝对值也放得下
+            auto value = static_cast<Limb>(small_);
+            scratch.push_back(small_ < 0 ? 0 - value : value);
+        }
+        return scratch;
+    }
+
+    /**
+     * 放得进 int64_t 的值一定放在 small_ 里，相等的值只有一种表示
+     */
+    static BigInt fromMagnitude(Limbs magnitude, bool negative)
+    {
+        trim(magnitude);
+        BigInt result;
+        if (magnitude.empty())
+        {
+            return result;
+        }
+        checkSize(magnitude.size());
+        auto limit = static_cast<Limb>(INT64_MAX) + (negative ? 1 : 0);
+        if (magnitude.size() == 1 && magnitude[0] <= limit)
+        {
+            result.small_ = static_cast<int64_t>(
+                negative ? 0 - magnitude[0] : magnitude[0]);
+            return result;
+        }
+        result.limbs_ = std::move(magnitude);
+        result.negative_ = negative;
+        return result;
+    }
+
+    static void checkSize(size_t limbs)
+    {
+        if (limbs > maxLimbs)
+        {
+            throw std::runtime_error("bigint太大");
+        }
+    }
+
+    static int compare(const BigInt &a, const BigInt &b)
+    {
+        if (a.isSmall() && b.isSmall())
+        {
+            return (a.small_ > b.small_) - (a.small_ < b.small_);
+        }
+        if (a.isNegative() != b.isNegative())
+        {
+            return a.isNegative() ? -1 : 1;
+        }
+        Limbs x, y;
+        auto result = compare(a.magnitude(x), b.magnitude(y));
+        return a.isNegative() ? -result : result;
+    }
+
+    static void trim(Limbs &a)
+    {
+        while (!a.empty() && a.back() == 0)
+        {
+            a.pop_back();
+        }
+    }
+
+    static int compare(const Limbs &a, const Limbs &b)
+    {
+        if (a.size() != b.size())
+        {
+            return a.size() < b.size() ? -1 : 1;
+        }
+        for (size_t i = a.size(); i-- > 0;)
+        {
+            if (a[i] != b[i])
+            {
+                return a[i] < b[i] ? -1 : 1;
+            }
+        }
+        return 0;
+    }
+
+    static BigInt addSigned(const Limbs &a,
+                            bool aNegative,
+                            const Limbs &b,
+                            bool bNegative)
+    {
+        if (aNegative == bNegative)
+        {
+            return fromMagnitude(add(a, b), aNegative);
+        }
+        auto order = compare(a, b);
+        if (order == 0)
+        {
+            return 0;
+        }
+        return order > 0 ? fromMagnitude(subtract(a, b), aNegative)
+                         : fromMagnitude(subtract(b, a), bNegative);
+    }
+
+    static Limbs add(const Limbs &a, const Limbs &b)
+    {
+        Limbs result = a.size() >= b.size() ? a : b;
+        addAt(result, a.size() >= b.size() ? b : a, 0);
+        return result;
+    }
+
+    /**
+     * target += value << (64 * offset)，进位时加长 target
+     */
+    static void addAt(Limbs &target, const Limbs &value, size_t offset)
+    {
+        if (target.size() < offset + value.size())
+        {
+            target.resize(offset + value.size());
+        }
+        Limb carry = 0;
+        size_t i = 0;
+        for (; i < value.size(); ++i)
+        {
+            Wide sum = Wide(target[offset + i]) + value[i] + carry;
+            target[offset + i] = static_cast<Limb>(sum);
+            carry = static_cast<Limb>(sum >> 64);
+        }
+        for (i += offset; carry != 0; ++i)
+        {
+            if (i == target.size())
+            {
+                target.push_back(0);
+            }
+            carry = ++target[i] == 0;
+        }
+    }
+
+    /**
+     * a - b，调用方保证 a >= b
+     */
+    static Limbs subtract(const Limbs &a, const Limbs &b)
+    {
+        Limbs result = a;
+        subtractFrom(result, b);
+        return result;
+    }
+
+    static void subtractFrom(Limbs &a, const Limbs &b)
+    {
+        Limb borrow = 0;
+        for (size_t i = 0; i < a.size() && (i < b.size() || borrow); ++i)
+        {
+            Limb subtrahend = i < b.size() ? b[i] : 0;
+            Wide difference = Wide(a[i]) - subtrahend - borrow;
+            a[i] = static_cast<Limb>(difference);
+            borrow = static_cast<Limb>(difference >> 64) != 0;
+        }
+        trim(a);
+    }
+
+    /**
+     * a = a * factor + addend
+     */
+    static void multiplyAdd(Limbs &a, Limb factor, Limb addend)
+    {
+        Limb carry = addend;
+        for (auto &limb : a)
+        {
+            Wide product = Wide(limb) * factor + carry;
+            limb = static_cast<Limb>(product);
+            carry = static_cast<Limb>(product >> 64);
+        }
+        if (carry != 0)
+        {
+            a.push_back(carry);
+        }
+    }
+
+    static Limbs multiply(const Limbs &a, const Limbs &b)
+    {
+        if (a.size() < b.size())
+        {
+            return multiply(b, a);
+        }
+        if (b.empty())
+        {
+            return {};
+        }
+        if (b.size() < karatsubaThreshold)
+        {
+            return multiplySchoolbook(a, b);
+        }
+        // 长短悬殊时把长的按短的长度切开，每一段和短的做 Karatsuba
+        if (a.size() >= 2 * b.size())
+        {
+            Limbs result(a.size() + b.size());
+            for (size_t i = 0; i < a.size(); i += b.size())
+            {
+                Limbs chunk(a.begin() + i,
+                            a.begin() + std::min(i + b.size(), a.size()));
+                trim(chunk);
+                addAt(result, multiply(chunk, b), i);
+            }
+            trim(result);
+            return result;
+        }
+        return multiplyKaratsuba(a, b);
+    }
+
+    static Limbs multiplySchoolbook(const Limbs &a, const Limbs &b)
+    {
+        Limbs result(a.size() + b.size());
+        for (size_t i = 0; i < a.size(); ++i)
+        {
+            Limb carry = 0;
+            for (size_t j = 0; j < b.size(); ++j)
+            {
+                Wide product = Wide(a[i]) * b[j] + result[i + j] + carry;
+                result[i + j] = static_cast<Limb>(product);
+                carry = static_cast<Limb>(product >> 64);
+            }
+            result[i + b.size()] = carry;
+        }
+        trim(result);
+        return result;
+    }
+
+    /**
+     * a = a1·B^m + a0，b = b1·B^m + b0，
+     * a·b = z2·B^2m + z1·B^m + z0，其中 z0 = a0·b0，z2 = a1·b1，
+     * z1 = (a0 + a1)(b0 + b1) - z0 - z2，三次乘法代替四次。
+     * 调用方保证 b.size() <= a.size() < 2 * b.size()
+     */
+    static Limbs multiplyKaratsuba(const Limbs &a, const Limbs &b)
+    {
+        size_t m = a.size() / 2;
+        Limbs a0(a.begin(), a.begin() + m), a1(a.begin() + m, a.end());
+        Limbs b0(b.begin(), b.begin() + m), b1(b.begin() + m, b.end());
+        trim(a0);
+        trim(b0);
+        auto z0 = multiply(a0, b0);
+        auto z2 = multiply(a1, b1);
+        auto z1 = multiply(add(a0, a1), add(b0, b1));
+        subtractFrom(z1, z0);
+        subtractFrom(z1, z2);
+        Limbs result(a.size() + b.size());
+        addAt(result, z0, 0);
+        addAt(result, z1, m);
+        addAt(result, z2, 2 * m);
+        trim(result);
+        return result;
+    }
+
+    /**
+     * 除以一个 limb，返回余数
+     */
+    static Limb divideSmall(Limbs &a, Limb divisor)
+    {
+        Limb remainder = 0;
+        for (size_t i = a.size(); i-- > 0;)
+        {
+            Wide current = (Wide(remainder) << 64) | a[i];
+            a[i] = static_cast<Limb>(current / divisor);
+            remainder = static_cast<Limb>(current % divisor);
+        }
+        trim(a);
+        return remainder;
+    }
+
+    static void divide(const BigInt &a,
+                       const BigInt &b,
+                       Limbs &quotient,
+                       Limbs &remainder)
+    {
+        if (b.isZero())
+        {
+            throw std::runtime_error("除数不能为0");
+        }
+        Limbs x, y;
+        divide(a.magnitude(x), b.magnitude(y), quotient, remainder);
+    }
+
+    /**
+     * 绝对值的除法，Knuth 的算法 D（TAOCP 4.3.1），每次商一个 limb
+     */
+    static void divide(const Limbs &a,
+                       const Limbs &b,
+                       Limbs &quotient,
+                       Limbs &remainder)
+    {
+        if (compare(a, b) < 0)
+        {
+            quotient.clear();
+            remainder = a;
+            return;
+        }
+        if (b.size() == 1)
+        {
+            quotient = a;
+            auto rest = divideSmall(quotient, b[0]);
+            remainder.assign(rest != 0, rest);
+            return;
+        }
+        // 左移到除数的最高位为 1，试商最多大 2
+        int shift = __builtin_clzll(b.back());
+        auto u = shiftLeft(a, shift);
+        u.resize(a.size() + 1);
+        auto v = shiftLeft(b, shift);
+        size_t n = v.size();
+        size_t m = a.size() - n;
+        quotient.assign(m + 1, 0);
+        for (size_t j = m + 1; j-- > 0;)
+        {
+            Wide numerator = (Wide(u[j + n]) << 64) | u[j + n - 1];
+            Wide guess = numerator / v[n - 1];
+            Wide rest = numerator % v[n - 1];
+            while ((guess >> 64) != 0 ||
+                   guess * v[n - 2] > ((rest << 64) | u[j + n - 2]))
+            {
+                --guess;
+                rest += v[n - 1];
+                if ((rest >> 64) != 0)
+                {
+                    break;
+                }
+            }
+            // u[j..j+n] -= guess * v
+            __int128 borrow = 0;
+            __int128 difference = 0;
+            for (size_t i = 0; i < n; ++i)
+            {
+                Wide product = guess * v[i];
+                difference = static_cast<__int128>(u[i + j]) - borrow -
+                             static_cast<Limb>(product);
+                u[i + j] = static_cast<Limb>(difference);
+                borrow = static_cast<__int128>(product >> 64) -
+                         (difference >> 64);
+            }
+            difference = static_cast<__int128>(u[j + n]) - borrow;
+            u[j + n] = static_cast<Limb>(difference);
+            quotient[j] = static_cast<Limb>(guess);
+            // 试商大了 1，加回去
+            if (difference < 0)
+            {
+                --quotient[j];
+                Limb carry = 0;
+                for (size_t i = 0; i < n; ++i)
+                {
+                    Wide sum = Wide(u[i + j]) + v[i] + carry;
+                    u[i + j] = static_cast<Limb>(sum);
+                    carry = static_cast<Limb>(sum >> 64);
+                }
+                u[j + n] += carry;
+            }
+        }
+        trim(quotient);
+        u.resize(n);
+        remainder = shiftRight(u, shift);
+    }
+
+    static Limbs shiftLeft(const Limbs &a, int shift)
+    {
+        Limbs result(a.size() + 1);
+        for (size_t i = 0; i < a.size(); ++i)
+        {
+            result[i] |= a[i] << shift;
+            result[i + 1] = shift == 0 ? 0 : a[i] >> (64 - shift);
+        }
+        trim(result);
+        return result;
+    }
+
+    static Limbs shiftRight(const Limbs &a, int shift)
+    {
+        Limbs result(a.size());
+        for (size_t i = 0; i < a.size(); ++i)
+        {
+            result[i] = a[i] >> shift;
+            if (shift != 0 && i + 1 < a.size())
+            {
+                result[i] |= a[i + 1] << (64 - shift);
+            }
+        }
+        trim(result);
+        return result;
+    }
+
+    /**
+     * 绝对值转成十进制追加到 text，width 不为 0 时在前面补 0 到 width 位
+     *
+     * 除以不超过一半长度的 10^(19·2^k)，商和余数分别转换，余数补足 19·2^k 位。
+     * 短的数逐段除以 10^19，每段 19 位
+     */
+    static void appendDecimal(const Limbs &a,
+                              size_t width,
+                              const std::vector<Limbs> &powers,
+                              std::string &text)
+    {
+        if (a.size() <= decimalThreshold)
+        {
+            std::string digits;
+            Limbs rest = a;
+            while (!rest.empty())
+            {
+                auto chunk = std::to_string(divideSmall(rest, decimalBase));
+                if (!rest.empty())
+                {
+                    chunk.insert(0, decimalDigits - chunk.size(), '0');
+                }
+                digits.insert(0, chunk);
+            }
+            if (width > digits.size())
+            {
+                text.append(width - digits.size(), '0');
+            }
+            text += digits;
+            return;
+        }
+        size_t k = powers.size() - 1;
+        while (k > 0 && powers[k].size() > (a.size() + 1) / 2)
+        {
+            --k;
+        }
+        Limbs quotient, remainder;
+        divide(a, powers[k], quotient, remainder);
+        size_t lowDigits = decimalDigits << k;
+        appendDecimal(quotient, width > lowDigits ? width - lowDigits : 0,
+                      powers, text);
+        appendDecimal(remainder, lowDigits, powers, text);
+    }
+
+  private:
+    int64_t small_ = 0;
+    /// limbs_ 不为空时的符号
+    bool negative_ = false;
+    /// 绝对值，为空时值是 small_
+    Limbs limbs_;
+};
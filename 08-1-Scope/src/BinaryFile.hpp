@@ -0,0 +1,220 @@
+#pragma once
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include "Array.hpp"
+
+/**
+ * 整数数组和二进制文件
+ *
+ * 文件中依次存放小端序的 int32_t 或者 int64_t，没有文件头，
+ * 元素个数由文件大小决定。
+ * 读取时把整个文件 mmap 进来，int32_t 的文件直接用映射的页面做数组的缓冲区，
+ * 不复制也不解析，多大的文件都立即返回，用到哪一页内核才读入哪一页。
+ * 映射是 MAP_PRIVATE 的，写入时内核复制那一页（写时复制），文件本身不会被修改
+ */
+namespace binary_file
+{
+/// 主机也是小端序时，int32_t 的文件可以直接当作数组
+constexpr bool littleEndian = __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__;
+
+/**
+ * 按小端序读写一个整数，在小端序的主机上编译成一条 mov
+ */
+template <typename T>
+T decode(const unsigned char *bytes)
+{
+    uint64_t value = 0;
+    for (size_t k = 0; k < sizeof(T); ++k)
+    {
+        value |= static_cast<uint64_t>(bytes[k]) << (8 * k);
+    }
+    return static_cast<T>(value);
+}
+
+template <typename T>
+void encode(unsigned char *bytes, T value)
+{
+    auto bits = static_cast<uint64_t>(value);
+    for (size_t k = 0; k < sizeof(T); ++k)
+    {
+        bytes[k] = static_cast<unsigned char>(bits >> (8 * k));
+    }
+}
+
+/**
+ * 映射整个文件，bytes 释放时 munmap
+ */
+struct Mapping
+{
+    std::shared_ptr<unsigned char> bytes;
+    size_t size;
+};
+
+inline Mapping map(const std::string &path)
+{
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        throw std::runtime_error("无法打开文件：" + path);
+    }
+    struct stat status;
+    if (::fstat(fd, &status) != 0 || !S_ISREG(status.st_mode))
+    {
+        ::close(fd);
+        throw std::runtime_error("无法打开文件：" + path);
+    }
+    auto size = static_cast<size_t>(status.st_size);
+    if (size == 0)
+    {
+        ::close(fd);
+        throw std::runtime_error("文件" + path + "是空的");
+    }
+    // 映射建立之后就不再需要文件描述符
+    void *address =
+        ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (address == MAP_FAILED)
+    {
+        throw std::runtime_error("无法映射文件：" + path);
+    }
+    return {std::shared_ptr<unsigned char>(
+                static_cast<unsigned char *>(address),
+                [size](unsigned char *bytes) { ::munmap(bytes, size); }),
+            size};
+}
+
+/**
+ * 文件中的整数个数，文件大小必须是 width 的整数倍
+ */
+inline size_t elementCount(const std::string &path,
+                           const Mapping &file,
+                           size_t width)
+{
+    if (file.size % width != 0)
+    {
+        std::stringstream ss;
+        ss << "文件" << path << "的大小" << file.size << "不是" << width
+           << "的整数倍";
+        throw std::runtime_error(ss.str());
+    }
+    return file.size / width;
+}
+
+/**
+ * 读取 int32_t 的文件，得到一维数组
+ */
+inline ArrayRef load32(const std::string &path, TemporaryArrays &temporaries)
+{
+    auto file = map(path);
+    auto count = elementCount(path, file, sizeof(int32_t));
+    if (littleEndian)
+    {
+        // mmap 的地址按页对齐，可以直接当作 int32_t*
+        auto *data = reinterpret_cast<int32_t *>(file.bytes.get());
+        return temporaries.add({count},
+                               std::shared_ptr<int32_t>(file.bytes, data));
+    }
+    auto array = temporaries.add({count});
+    for (size_t i = 0; i < count; ++i)
+    {
+        array.data()[i] = decode<int32_t>(file.bytes.get() + i * 4);
+    }
+    return array;
+}
+
+/**
+ * 读取 int64_t 的文件，元素要复制到新的缓冲区，超出 int 的范围时报错
+ */
+inline ArrayRef load64(const std::string &path, TemporaryArrays &temporaries)
+{
+    auto file = map(path);
+    auto count = elementCount(path, file, sizeof(int64_t));
+    auto array = temporaries.add({count});
+    auto *data = array.data();
+    for (size_t i = 0; i < count; ++i)
+    {
+        auto value = decode<int64_t>(file.bytes.get() + i * 8);
+        if (value < INT32_MIN || value > INT32_MAX)
+        {
+            std::stringstream ss;
+            ss << "文件" << path << "的第" << i << "个整数" << value
+               << "超出了int的范围";
+            throw std::runtime_error(ss.str());
+        }
+        data[i] = static_cast<int32_t>(value);
+    }
+    return array;
+}
+
+/**
+ * 按顺序把数组的元素写成 width 字节的整数，文件已经存在时替换
+ *
+ * 先写到同一个目录下的临时文件，写完再 rename 过去：
+ * 原来的文件可能正映射着（比如 save(a, "f") 中的 a 来自 load("f")），
+ * 直接截断会让还没读入的页面失效。
+ * int32_t 在小端序的主机上按连续的段直接 fwrite，
+ * 其他情况先在缓冲区里转换一批再写
+ */
+inline void save(const ArrayRef &array, const std::string &path, size_t width)
+{
+    auto temporary = path + ".XXXXXX";
+    int fd = ::mkstemp(&temporary[0]);
+    if (fd < 0)
+    {
+        throw std::runtime_error("无法写入文件：" + path);
+    }
+    ::fchmod(fd, 0644);
+    std::unique_ptr<std::FILE, int (*)(std::FILE *)> file(::fdopen(fd, "wb"),
+                                                          &std::fclose);
+    if (!file)
+    {
+        ::close(fd);
+        ::unlink(temporary.c_str());
+        throw std::runtime_error("无法写入文件：" + path);
+    }
+    bool ok = true;
+    array.forEachRun([&](int32_t *data, size_t n) {
+        if (width == sizeof(int32_t) && littleEndian)
+        {
+            ok = ok && std::fwrite(data, width, n, file.get()) == n;
+            return;
+        }
+        unsigned char buffer[4096 * sizeof(int64_t)];
+        auto batch = sizeof(buffer) / width;
+        for (size_t i = 0; i < n && ok; i += batch)
+        {
+            auto m = std::min(batch, n - i);
+            for (size_t k = 0; k < m; ++k)
+            {
+                if (width == sizeof(int32_t))
+                {
+                    encode<int32_t>(buffer + k * width, data[i + k]);
+                }
+                else
+                {
+                    encode<int64_t>(buffer + k * width, data[i + k]);
+                }
+            }
+            ok = std::fwrite(buffer, width, m, file.get()) == m;
+        }
+    });
+    // fclose 时才把缓冲区写出去，也要检查
+    ok = std::fclose(file.release()) == 0 && ok;
+    if (!ok || ::rename(temporary.c_str(), path.c_str()) != 0)
+    {
+        ::unlink(temporary.c_str());
+        throw std::runtime_error("写入文件" + path + "失败");
+    }
+}
+}  // namespace binary_file
@@ -0,0 +1,214 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <unordered_map>
+
+/**
+ * 超出执行预算时抛出，解释器不会把它当作普通的运行时错误吞掉
+ */
+class BudgetExceeded : public std::runtime_error
+{
+  public:
+    using std::runtime_error::runtime_error;
+};
+
+/**
+ * 执行预算：限制一次执行的步数和墙钟时间
+ *
+ * MyVisitor 在回边和进入语句块时各消耗一步，字节码中每次跳转
+ * （进入一个基本块）消耗一步；两次计数之间的直线代码不会超过脚本的长度。
+ * 内置函数和 bigint 运算的时间和数据的大小成正比，按元素或者 limb 的个数
+ * 一次消耗多步，见 charge。
+ * 超时由 Watchdog 线程设置中断标志，在同样的位置检查。
+ */
+class Budget
+{
+  public:
+    static constexpr uint64_t unlimited = UINT64_MAX;
+
+    /**
+     * timeout 为 0 表示不限时间
+     */
+    explicit Budget(uint64_t steps = unlimited,
+                    std::chrono::milliseconds timeout = {});
+
+    ~Budget();
+
+    Budget(const Budget &) = delete;
+    Budget &operator=(const Budget &) = delete;
+
+    /**
+     * 走一步，步数用完或者超时时抛出 BudgetExceeded
+     */
+    void step()
+    {
+        if (remaining_ == 0 || interrupted_.load(std::memory_order_relaxed))
+            [[unlikely]]
+        {
+            exceeded();
+        }
+        --remaining_;
+    }
+
+    /**
+     * 一次走 steps 步，剩下的步数不够时抛出 BudgetExceeded，一步也不扣
+     */
+    void charge(uint64_t steps)
+    {
+        if (steps > remaining_ || interrupted_.load(std::memory_order_relaxed))
+            [[unlikely]]
+        {
+            exceeded();
+        }
+        remaining_ -= steps;
+    }
+
+    /**
+     * 让下一次 step 抛出异常，可以在其他线程中调用
+     */
+    void interrupt()
+    {
+        interrupted_.store(true, std::memory_order_relaxed);
+    }
+
+  private:
+    [[noreturn]] void exceeded() const
+    {
+        if (interrupted_.load(std::memory_order_relaxed))
+        {
+            throw BudgetExceeded("超出时间限制");
+        }
+        throw BudgetExceeded("超出步数限制");
+    }
+
+  private:
+    uint64_t remaining_;
+    std::atomic<bool> interrupted_;
+    /// 在 Watchdog 中登记的编号，0 表示不限时间
+    uint64_t watch_;
+};
+
+/**
+ * 进程中唯一的看门狗线程，到了截止时间就中断对应的 Budget
+ *
+ * 同时执行的脚本再多也只有一个线程，第一次需要限时的时候才启动
+ */
+class Watchdog
+{
+  public:
+    static Watchdog &instance()
+    {
+        static Watchdog watchdog;
+        return watchdog;
+    }
+
+    ~Watchdog()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stopping_ = true;
+        }
+        changed_.notify_all();
+        if (thread_.joinable())
+        {
+            thread_.join();
+        }
+    }
+
+    /**
+     * 登记一个截止时间，返回的编号用于 cancel
+     */
+    uint64_t arm(Budget *budget, std::chrono::milliseconds timeout)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!thread_.joinable())
+        {
+            thread_ = std::thread([this] { work(); });
+        }
+        auto id = ++lastId_;
+        auto deadline = std::chrono::steady_clock::now() + timeout;
+        deadlines_[{deadline, id}] = budget;
+        armed_[id] = deadline;
+        changed_.notify_all();
+        return id;
+    }
+
+    /**
+     * 执行结束，取消截止时间，返回之后不会再访问 budget
+     */
+    void cancel(uint64_t id)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = armed_.find(id);
+        if (it != armed_.end())
+        {
+            deadlines_.erase({it->second, id});
+            armed_.erase(it);
+        }
+    }
+
+  private:
+    Watchdog() : lastId_(0), stopping_(false)
+    {
+    }
+
+    void work()
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        while (!stopping_)
+        {
+            if (deadlines_.empty())
+            {
+                changed_.wait(lock);
+                continue;
+            }
+            auto first = deadlines_.begin();
+            if (std::chrono::steady_clock::now() < first->first.first)
+            {
+                changed_.wait_until(lock, first->first.first);
+                continue;
+            }
+            first->second->interrupt();
+            armed_.erase(first->first.second);
+            deadlines_.erase(first);
+        }
+    }
+
+  private:
+    std::mutex mutex_;
+    std::condition_variable changed_;
+    /// (截止时间, 编号) -> 预算，按截止时间排序
+    std::map<std::pair<std::chrono::steady_clock::time_point, uint64_t>,
+             Budget *>
+        deadlines_;
+    /// 还没有到期的编号 -> 截止时间
+    std::unordered_map<uint64_t, std::chrono::steady_clock::time_point>
+        armed_;
+    uint64_t lastId_;
+    bool stopping_;
+    std::thread thread_;
+};
+
+inline Budget::Budget(uint64_t steps, std::chrono::milliseconds timeout)
+    : remaining_(steps), interrupted_(false), watch_(0)
+{
+    if (timeout.count() > 0)
+    {
+        watch_ = Watchdog::instance().arm(this, timeout);
+    }
+}
+
+inline Budget::~Budget()
+{
+    if (watch_ != 0)
+    {
+        Watchdog::instance().cancel(watch_);
+    }
+}
@@ -0,0 +1,711 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "Array.hpp"
+#include "BigInt.hpp"
+#include "BinaryFile.hpp"
+#include "Budget.hpp"
+#include "HashMap.hpp"
+#include "Input.hpp"
+#include "Simd.hpp"
+#include "Sort.hpp"
+
+/**
+ * 内置函数：整数数组的批量运算、map 的操作和读写文件
+ *
+ * 数组参数可以是整个数组，也可以是子数组（a[i] 是 a 的第 i 行）或者切片，
+ * 元素按连续的段交给 Simd.hpp 中的向量化实现处理，
+ * 不用在解释器中逐个元素地执行。
+ *
+ * - len(a)：第一维的长度；len(m)：map 中键的个数
+ * - sum(a)、min(a)、max(a)：所有元素的和、最小值、最大值
+ * - fill(a, x)：所有元素赋值为 x
+ * - copy(a, b)：把 b 的元素复制到 a，元素个数必须相同
+ * - add(a, x)、sub(a, x)、mul(a, x)：a 的每个元素加上（减去、乘以）x，
+ *   x 是数组时逐元素运算，元素个数必须相同
+ * - slice(a, start, n)、slice(a, start, n, step)：a 的第一维从 start 开始
+ *   每 step 个取一个，一共取 n 个，得到的切片和原来的数组共用元素
+ * - load("f")、load64("f")：把 int32_t（int64_t）的二进制文件读成一维数组，
+ *   见 BinaryFile.hpp
+ * - save(a, "f")、save64(a, "f")：把 a 的元素写成 int32_t（int64_t）的文件
+ * - read_int()：从输入中读一个整数，见 Input.hpp
+ * - read_ints(n)：读 n 个整数，得到一维数组；read_ints(a)：按顺序读满 a
+ * - eof()：输入中已经没有整数时为 1
+ * - sort(a)：从小到大排序，元素多时并行，见 Sort.hpp
+ * - binary_search(a, x)：在排好序的 a 中找 x，返回第一个 x 的下标，
+ *   没有时返回 -1
+ * - unique(a)：去掉相邻的重复元素，剩下的移到前面，返回剩下的个数
+ * - partition(a, x)：小于 x 的元素移到前面，返回它们的个数
+ * - has(m, k)：map 中有没有键 k；erase(m, k)：删除键 k，返回删除前有没有
+ * - keys(m)、values(m)：所有的键（值），得到一维数组，两者的顺序相同
+ * - clear(m)：删除所有的键
+ *
+ * 求值的函数返回 int32_t，
+ * slice、load、read_ints(n)、keys 和 values 返回 ArrayRef，
+ * 修改数组和写文件的函数没有返回值
+ *
+ * 要处理所有元素的函数按元素个数消耗执行预算，一个元素一步，见 charge
+ */
+using BuiltinArgs = std::vector<antlrcpp::Any>;
+
+/**
+ * 内置函数用到的解释器状态
+ */
+struct BuiltinContext
+{
+    /// load 读进来的数组放在这里，见 TemporaryArrays
+    TemporaryArrays &temporaries;
+    /// read_int 等读取的输入，为空时没有输入
+    input::IntReader *input = nullptr;
+    /// 为 false 时不能读写文件
+    bool allowFiles = true;
+    /// 临时的缓冲区记在这个账上，和数组一样受 --max-memory 的限制
+    MemoryAccount *memory = nullptr;
+    /// sort 最多使用的线程数，0 表示按 CPU 的核数
+    size_t sortThreads = 0;
+    /// 执行预算，为空时不限制
+    Budget *budget = nullptr;
+};
+
+struct Builtin
+{
+    const char *name;
+    size_t arity;
+    antlrcpp::Any (*call)(const char *name,
+                          BuiltinArgs &args,
+                          BuiltinContext &context);
+    /// 可以省略的参数个数，最多 arity + optional 个参数
+    size_t optional = 0;
+};
+
+namespace builtin
+{
+/**
+ * 处理 elements 个元素，消耗同样多步的预算
+ */
+inline void charge(const BuiltinContext &context, size_t elements)
+{
+    if (context.budget != nullptr)
+    {
+        context.budget->charge(elements);
+    }
+}
+
+inline std::string argumentError(const char *name, size_t i, const char *kind)
+{
+    std::stringstream ss;
+    ss << "函数" << name << "的第" << i + 1 << "个参数必须是" << kind;
+    return ss.str();
+}
+
+inline ArrayRef arrayArgument(const char *name, BuiltinArgs &args, size_t i)
+{
+    if (!args[i].is<ArrayRef>())
+    {
+        throw std::runtime_error(argumentError(name, i, "数组"));
+    }
+    return args[i].as<ArrayRef>();
+}
+
+inline IntMap *mapArgument(const char *name, BuiltinArgs &args, size_t i)
+{
+    if (!args[i].is<IntMap *>())
+    {
+        throw std::runtime_error(argumentError(name, i, "map"));
+    }
+    return args[i].as<IntMap *>();
+}
+
+/**
+ * 整数参数可以是字面量、运算结果、变量或者数组元素
+ */
+inline int32_t intArgument(const char *name, BuiltinArgs &args, size_t i)
+{
+    if (args[i].is<int32_t>())
+    {
+        return args[i].as<int32_t>();
+    }
+    if (args[i].is<int32_t *>())
+    {
+        return *args[i].as<int32_t *>();
+    }
+    if (args[i].is<int64_t>() || args[i].is<int64_t *>() ||
+        args[i].is<BigInt>() || args[i].is<BigInt *>())
+    {
+        throw std::runtime_error(argumentError(name, i, "int"));
+    }
+    throw std::runtime_error(argumentError(name, i, "整数"));
+}
+
+/**
+ * 字符串参数只能是字面量，比如文件名
+ */
+inline std::string stringArgument(const char *name, BuiltinArgs &args, size_t i)
+{
+    if (!args[i].is<std::string>())
+    {
+        throw std::runtime_error(argumentError(name, i, "字符串"));
+    }
+    return args[i].as<std::string>();
+}
+
+inline void requireSameSize(const char *name,
+                            const ArrayRef &a,
+                            const ArrayRef &b)
+{
+    if (a.size() != b.size())
+    {
+        std::stringstream ss;
+        ss << "函数" << name << "的两个数组的元素个数不同：" << a.size()
+           << "和" << b.size();
+        throw std::runtime_error(ss.str());
+    }
+}
+
+/**
+ * 要修改的数组参数，和别的数组共用缓冲区时先复制一份（写时复制）
+ */
+inline ArrayRef targetArgument(const char *name, BuiltinArgs &args, size_t i)
+{
+    auto array = arrayArgument(name, args, i);
+    array.array->unshare();
+    return array;
+}
+
+/**
+ * 把 target 和 source 的元素按顺序一一对应，
+ * 分成两边都连续的若干段 (target 中的位置, source 中的位置, 个数) 交给 f
+ */
+template <typename F>
+void forEachRunPair(const ArrayRef &target, const ArrayRef &source, F f)
+{
+    if (target.contiguous() && source.contiguous())
+    {
+        f(target.data(), source.data(), target.size());
+        return;
+    }
+    // 连续的一侧看成只有一行
+    struct Cursor
+    {
+        int32_t *data;
+        size_t rowSize;
+        size_t step;
+        size_t row = 0;
+        size_t column = 0;
+
+        explicit Cursor(const ArrayRef &array)
+            : data(array.data()),
+              rowSize(array.contiguous() ? array.size() : array.rowSize()),
+              step(array.step)
+        {
+        }
+
+        int32_t *position() const
+        {
+            return data + row * step + column;
+        }
+
+        void advance(size_t n)
+        {
+            column += n;
+            if (column == rowSize)
+            {
+                ++row;
+                column = 0;
+            }
+        }
+    };
+    Cursor to(target);
+    Cursor from(source);
+    for (size_t remaining = target.size(); remaining > 0;)
+    {
+        auto n = std::min({to.rowSize - to.column, from.rowSize - from.column,
+                           remaining});
+        f(to.position(), from.position(), n);
+        to.advance(n);
+        from.advance(n);
+        remaining -= n;
+    }
+}
+
+/**
+ * 每一段连续的元素分别求值，再用 combine 合并
+ */
+template <typename Combine>
+int32_t reduce(const ArrayRef &array,
+               int32_t (*kernel)(const int32_t *, size_t),
+               Combine combine)
+{
+    bool first = true;
+    int32_t result = 0;
+    array.forEachRun([&](int32_t *data, size_t n) {
+        auto value = kernel(data, n);
+        result = first ? value : combine(result, value);
+        first = false;
+    });
+    return result;
+}
+
+inline antlrcpp::Any len(const char *name, BuiltinArgs &args, BuiltinContext &)
+{
+    if (args[0].is<IntMap *>())
+    {
+        return static_cast<int32_t>(args[0].as<IntMap *>()->size());
+    }
+    return static_cast<int32_t>(arrayArgument(name, args, 0).length());
+}
+
+inline antlrcpp::Any sum(const char *name,
+                         BuiltinArgs &args,
+                         BuiltinContext &context)
+{
+    auto array = arrayArgument(name, args, 0);
+    charge(context, array.size());
+    return reduce(array, simd::kernels().sum,
+                  [](int32_t a, int32_t b) {
+                      return static_cast<int32_t>(static_cast<uint32_t>(a) +
+                                                  static_cast<uint32_t>(b));
+                  });
+}
+
+inline antlrcpp::Any min(const char *name,
+                         BuiltinArgs &args,
+                         BuiltinContext &context)
+{
+    auto array = arrayArgument(name, args, 0);
+    charge(context, array.size());
+    return reduce(array, simd::kernels().min,
+                  [](int32_t a, int32_t b) { return std::min(a, b); });
+}
+
+inline antlrcpp::Any max(const char *name,
+                         BuiltinArgs &args,
+                         BuiltinContext &context)
+{
+    auto array = arrayArgument(name, args, 0);
+    charge(context, array.size());
+    return reduce(array, simd::kernels().max,
+                  [](int32_t a, int32_t b) { return std::max(a, b); });
+}
+
+inline antlrcpp::Any fill(const char *name,
+                          BuiltinArgs &args,
+                          BuiltinContext &context)
+{
+    auto array = targetArgument(name, args, 0);
+    auto value = intArgument(name, args, 1);
+    charge(context, array.size());
+    array.forEachRun([value](int32_t *data, size_t n) {
+        simd::kernels().fill(data, n, value);
+    });
+    return antlrcpp::Any();
+}
+
+/**
+ * 两个参数可以是同一个数组中重叠的部分（比如 a 和 a[0]），所以用 memmove；
+ * 重叠的两个切片不连续时，按元素的顺序一段一段地复制
+ */
+inline antlrcpp::Any copy(const char *name,
+                          BuiltinArgs &args,
+                          BuiltinContext &context)
+{
+    auto target = targetArgument(name, args, 0);
+    auto source = arrayArgument(name, args, 1);
+    requireSameSize(name, target, source);
+    charge(context, target.size());
+    forEachRunPair(target, source, [](int32_t *to, int32_t *from, size_t n) {
+        std::memmove(to, from, n * sizeof(int32_t));
+    });
+    return antlrcpp::Any();
+}
+
+/**
+ * 切片的第一维要在原来的范围之内，长度和间隔都大于 0
+ */
+inline antlrcpp::Any slice(const char *name,
+                           BuiltinArgs &args,
+                           BuiltinContext &)
+{
+    auto array = arrayArgument(name, args, 0);
+    auto start = intArgument(name, args, 1);
+    auto count = intArgument(name, args, 2);
+    auto every = args.size() > 3 ? intArgument(name, args, 3) : 1;
+    if (count <= 0 || every <= 0)
+    {
+        throw std::runtime_error("切片的长度和间隔必须大于0");
+    }
+    // 最后一个下标 start + (count - 1) * every 用 64 位计算，不会溢出
+    auto last = static_cast<int64_t>(start) +
+                static_cast<int64_t>(count - 1) * every;
+    if (start < 0 || last >= static_cast<int64_t>(array.length()))
+    {
+        std::stringstream ss;
+        ss << "切片的下标" << start << "到" << last << "越界，长度为"
+           << array.length();
+        throw std::runtime_error(ss.str());
+    }
+    return array.slice(static_cast<size_t>(start), static_cast<size_t>(count),
+                       static_cast<size_t>(every));
+}
+
+inline void requireFiles(const char *name, const BuiltinContext &context)
+{
+    if (!context.allowFiles)
+    {
+        throw std::runtime_error(std::string("不允许读写文件，不能调用") +
+                                 name);
+    }
+}
+
+/**
+ * 读进来的数组是临时的，用它初始化数组（int a[n] = load("f");）时共用缓冲区
+ */
+template <ArrayRef (*read)(const std::string &, TemporaryArrays &)>
+antlrcpp::Any load(const char *name, BuiltinArgs &args, BuiltinContext &context)
+{
+    requireFiles(name, context);
+    auto array = read(stringArgument(name, args, 0), context.temporaries);
+    charge(context, array.size());
+    return array;
+}
+
+template <size_t width>
+antlrcpp::Any save(const char *name, BuiltinArgs &args, BuiltinContext &context)
+{
+    requireFiles(name, context);
+    auto array = arrayArgument(name, args, 0);
+    charge(context, array.size());
+    binary_file::save(array, stringArgument(name, args, 1), width);
+    return antlrcpp::Any();
+}
+
+inline input::IntReader &requireInput(const char *name,
+                                     const BuiltinContext &context)
+{
+    if (context.input == nullptr)
+    {
+        throw std::runtime_error(std::string("没有可以读取的输入，不能调用") +
+                                 name);
+    }
+    return *context.input;
+}
+
+inline antlrcpp::Any readInt(const char *name,
+                             BuiltinArgs &,
+                             BuiltinContext &context)
+{
+    return requireInput(name, context).next();
+}
+
+/**
+ * 参数是整数 n 时读 n 个，放在新的临时数组中返回；
+ * 是数组时按顺序读满它的元素，可以只读到子数组或者切片里
+ */
+inline antlrcpp::Any readInts(const char *name,
+                              BuiltinArgs &args,
+                              BuiltinContext &context)
+{
+    auto &reader = requireInput(name, context);
+    if (args[0].is<ArrayRef>())
+    {
+        auto array = targetArgument(name, args, 0);
+        charge(context, array.size());
+        array.forEachRun(
+            [&reader](int32_t *data, size_t n) { reader.next(data, n); });
+        return antlrcpp::Any();
+    }
+    auto count = intArgument(name, args, 0);
+    if (count <= 0)
+    {
+        throw std::runtime_error(std::string("函数") + name +
+                                 "读取的个数必须大于0");
+    }
+    charge(context, static_cast<size_t>(count));
+    auto array = context.temporaries.add({static_cast<size_t>(count)});
+    reader.next(array.data(), array.size());
+    return array;
+}
+
+/**
+ * 没有输入时也是 1
+ */
+inline antlrcpp::Any eof(const char *, BuiltinArgs &, BuiltinContext &context)
+{
+    return static_cast<int32_t>(context.input == nullptr ||
+                                context.input->atEnd());
+}
+
+/**
+ * 调整元素顺序的函数需要连续的元素：跳着取的切片先按顺序复制出来，
+ * f(data, n) 处理完再复制回去
+ */
+template <typename F>
+int32_t withContiguous(const ArrayRef &array,
+                       const BuiltinContext &context,
+                       F f)
+{
+    if (array.contiguous())
+    {
+        return f(array.data(), array.size());
+    }
+    std::vector<int32_t, AccountedAllocator<int32_t>> elements(
+        array.size(), AccountedAllocator<int32_t>(context.memory));
+    auto *element = elements.data();
+    array.forEachRun([&element](int32_t *data, size_t n) {
+        element = std::copy(data, data + n, element);
+    });
+    auto result = f(elements.data(), elements.size());
+    element = elements.data();
+    array.forEachRun([&element](int32_t *data, size_t n) {
+        std::copy(element, element + n, data);
+        element += n;
+    });
+    return result;
+}
+
+inline antlrcpp::Any sort(const char *name,
+                          BuiltinArgs &args,
+                          BuiltinContext &context)
+{
+    auto array = targetArgument(name, args, 0);
+    charge(context, array.size());
+    withContiguous(array, context, [&context](int32_t *data, size_t n) {
+        parallel::sort(data, n, context.sortThreads,
+                       AccountedAllocator<int32_t>(context.memory));
+        return 0;
+    });
+    return antlrcpp::Any();
+}
+
+/**
+ * 元素按顺序编号（多维数组按行展开），切片不用复制，按编号算出位置
+ */
+inline antlrcpp::Any binarySearch(const char *name,
+                                  BuiltinArgs &args,
+                                  BuiltinContext &)
+{
+    auto array = arrayArgument(name, args, 0);
+    auto value = intArgument(name, args, 1);
+    auto *data = array.data();
+    auto rowSize = array.contiguous() ? array.size() : array.rowSize();
+    auto at = [&](size_t k) {
+        return data[k / rowSize * array.step + k % rowSize];
+    };
+    // 第一个不小于 value 的元素
+    size_t low = 0;
+    size_t high = array.size();
+    while (low < high)
+    {
+        auto middle = low + (high - low) / 2;
+        if (at(middle) < value)
+        {
+            low = middle + 1;
+        }
+        else
+        {
+            high = middle;
+        }
+    }
+    if (low < array.size() && at(low) == value)
+    {
+        return static_cast<int32_t>(low);
+    }
+    return -1;
+}
+
+/**
+ * 剩下的元素之后的元素不保证是原来的值
+ */
+inline antlrcpp::Any unique(const char *name,
+                            BuiltinArgs &args,
+                            BuiltinContext &context)
+{
+    auto array = targetArgument(name, args, 0);
+    charge(context, array.size());
+    return withContiguous(array, context, [](int32_t *data, size_t n) {
+        auto end = std::unique(data, data + n);
+        return static_cast<int32_t>(end - data);
+    });
+}
+
+/**
+ * 两部分内部的顺序不保证
+ */
+inline antlrcpp::Any partition(const char *name,
+                               BuiltinArgs &args,
+                               BuiltinContext &context)
+{
+    auto array = targetArgument(name, args, 0);
+    auto value = intArgument(name, args, 1);
+    charge(context, array.size());
+    return withContiguous(array, context, [value](int32_t *data, size_t n) {
+        auto end = std::partition(data, data + n,
+                                  [value](int32_t x) { return x < value; });
+        return static_cast<int32_t>(end - data);
+    });
+}
+
+inline antlrcpp::Any has(const char *name, BuiltinArgs &args, BuiltinContext &)
+{
+    auto *map = mapArgument(name, args, 0);
+    return static_cast<int32_t>(map->find(intArgument(name, args, 1)) !=
+                                nullptr);
+}
+
+inline antlrcpp::Any erase(const char *name,
+                           BuiltinArgs &args,
+                           BuiltinContext &)
+{
+    auto *map = mapArgument(name, args, 0);
+    return static_cast<int32_t>(map->erase(intArgument(name, args, 1)));
+}
+
+inline antlrcpp::Any clear(const char *name,
+                           BuiltinArgs &args,
+                           BuiltinContext &context)
+{
+    auto *map = mapArgument(name, args, 0);
+    charge(context, map->size());
+    map->clear();
+    return antlrcpp::Any();
+}
+
+/**
+ * 键（keys 为 true）或者值，按 IntMap::forEach 的顺序放进临时数组，
+ * 用它初始化数组之后就可以用下标遍历
+ */
+template <bool keys>
+antlrcpp::Any entries(const char *name,
+                      BuiltinArgs &args,
+                      BuiltinContext &context)
+{
+    auto *map = mapArgument(name, args, 0);
+    if (map->size() == 0)
+    {
+        throw std::runtime_error(std::string("函数") + name + "的map是空的");
+    }
+    charge(context, map->size());
+    auto array = context.temporaries.add({map->size()});
+    auto *element = array.data();
+    map->forEach([&element](int32_t key, int32_t value) {
+        *element++ = keys ? key : value;
+    });
+    return array;
+}
+
+/**
+ * 逐元素运算，第二个参数是数组时用 arrays，是整数时用 scalars
+ */
+template <void (*arrays)(int32_t *, const int32_t *, size_t),
+          void (*scalars)(int32_t *, size_t, int32_t)>
+antlrcpp::Any elementwise(const char *name,
+                          BuiltinArgs &args,
+                          BuiltinContext &context)
+{
+    auto target = targetArgument(name, args, 0);
+    charge(context, target.size());
+    if (args[1].is<ArrayRef>())
+    {
+        auto source = args[1].as<ArrayRef>();
+        requireSameSize(name, target, source);
+        forEachRunPair(target, source,
+                       [](int32_t *to, int32_t *from, size_t n) {
+                           arrays(to, from, n);
+                       });
+    }
+    else
+    {
+        auto value = intArgument(name, args, 1);
+        target.forEachRun(
+            [value](int32_t *data, size_t n) { scalars(data, n, value); });
+    }
+    return antlrcpp::Any();
+}
+
+inline void addArrays(int32_t *a, const int32_t *b, size_t n)
+{
+    simd::kernels().add(a, b, n);
+}
+
+inline void subArrays(int32_t *a, const int32_t *b, size_t n)
+{
+    simd::kernels().sub(a, b, n);
+}
+
+inline void mulArrays(int32_t *a, const int32_t *b, size_t n)
+{
+    simd::kernels().mul(a, b, n);
+}
+
+inline void addScalar(int32_t *a, size_t n, int32_t value)
+{
+    simd::kernels().addScalar(a, n, value);
+}
+
+/**
+ * 减去 value 就是加上 -value，在 uint32_t 上取反，INT32_MIN 也不会溢出
+ */
+inline void subScalar(int32_t *a, size_t n, int32_t value)
+{
+    simd::kernels().addScalar(
+        a, n, static_cast<int32_t>(0u - static_cast<uint32_t>(value)));
+}
+
+inline void mulScalar(int32_t *a, size_t n, int32_t value)
+{
+    simd::kernels().mulScalar(a, n, value);
+}
+}  // namespace builtin
+
+/**
+ * 所有的内置函数
+ */
+inline const Builtin builtinFunctions[] = {
+    {"len", 1, builtin::len},
+    {"sum", 1, builtin::sum},
+    {"min", 1, builtin::min},
+    {"max", 1, builtin::max},
+    {"fill", 2, builtin::fill},
+    {"copy", 2, builtin::copy},
+    {"add", 2, builtin::elementwise<builtin::addArrays, builtin::addScalar>},
+    {"sub", 2, builtin::elementwise<builtin::subArrays, builtin::subScalar>},
+    {"mul", 2, builtin::elementwise<builtin::mulArrays, builtin::mulScalar>},
+    {"slice", 3, builtin::slice, 1},
+    {"load", 1, builtin::load<binary_file::load32>},
+    {"load64", 1, builtin::load<binary_file::load64>},
+    {"save", 2, builtin::save<sizeof(int32_t)>},
+    {"save64", 2, builtin::save<sizeof(int64_t)>},
+    {"read_int", 0, builtin::readInt},
+    {"read_ints", 1, builtin::readInts},
+    {"eof", 0, builtin::eof},
+    {"sort", 1, builtin::sort},
+    {"binary_search", 2, builtin::binarySearch},
+    {"unique", 1, builtin::unique},
+    {"partition", 2, builtin::partition},
+    {"has", 2, builtin::has},
+    {"erase", 2, builtin::erase},
+    {"clear", 1, builtin::clear},
+    {"keys", 1, builtin::entries<true>},
+    {"values", 1, builtin::entries<false>},
+};
+
+/**
+ * 按名字查找内置函数，没有时返回空
+ */
+inline const Builtin *findBuiltin(const std::string &name)
+{
+    for (const auto &function : builtinFunctions)
+    {
+        if (name == function.name)
+        {
+            return &function;
+        }
+    }
+    return nullptr;
+}
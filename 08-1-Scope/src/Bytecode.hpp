@@ -0,0 +1,334 @@
+#pragma once
+
+#include "IRPasses.hpp"
+#include "SwitchTable.hpp"
+
+/**
+ * 寄存器式字节码的操作码
+ *
+ * 运算类指令的格式统一为 a = b op c，a、b、c 都是寄存器编号
+ */
+enum class OpCode : uint8_t
+{
+    Move,          ///< a = b
+    Add,
+    Sub,
+    Mul,
+    Div,
+    Mod,
+    Shl,
+    Shr,
+    Eq,
+    Ne,
+    Lt,
+    Le,
+    Gt,
+    Ge,
+    BitAnd,
+    BitOr,
+    BitXor,
+    And,
+    Or,
+    InBounds,      ///< a = 0 <= b && b < c
+    Neg,           ///< a = -b
+    Not,           ///< a = !b
+    BitNot,        ///< a = ~b
+    LoadSlot,      ///< a = *slots[b]
+    StoreSlot,     ///< *slots[a] = b
+    Print,         ///< 输出 strings[b]: a
+    ArrayDim,      ///< a = arrays[b] 第 c 维的长度
+    LoadElement,   ///< a = arrays[b] 按行展开后的第 c 个元素
+    StoreElement,  ///< arrays[a] 按行展开后的第 b 个元素 = c
+    NewArray,      ///< 按 BytecodeProgram::arrays[a] 创建数组
+    PrintArray,    ///< 输出 strings[b]: arrays[a]
+    Vector,        ///< 执行批量运算 vectors[b]，a 不小于 0 时把结果写入 a
+    IndexError,    ///< 下标 a 越界，长度为 b；c 不为 0 时抛出异常，否则输出
+    Error,         ///< 错误信息是 strings[a]；b 不为 0 时抛出异常，否则输出
+    Jump,          ///< 跳转到 a
+    JumpIfTrue,    ///< b != 0 时跳转到 a
+    JumpIfFalse,   ///< b == 0 时跳转到 a
+    Switch,        ///< 跳转到 switchTables[a] 中 b 对应的地址
+    Halt,
+};
+
+struct Instruction
+{
+    OpCode op;
+    int32_t a;
+    int32_t b;
+    int32_t c;
+};
+
+/**
+ * 批量运算，对应 IR 中的 Vector* 指令，操作数的格式也相同
+ */
+struct VectorOperation
+{
+    IROpcode op;
+    int32_t array;
+    int32_t source;  ///< 源数组，-1 表示 value 是标量
+    int32_t start;   ///< 寄存器，array 中的第一个元素
+    int32_t count;   ///< 寄存器，元素个数
+    int32_t value;   ///< 寄存器，标量、归约的初值或者 source 中的第一个元素
+};
+
+/**
+ * 可以直接交给 VM 执行的程序
+ */
+struct BytecodeProgram
+{
+    std::vector<Instruction> code;
+    /// 寄存器的初始值，常量在这里预先放好，不需要单独的加载指令
+    std::vector<int32_t> registers;
+    std::vector<std::string> strings;
+    /// 外部变量的名字，运行时由调用方按顺序提供变量的地址
+    std::vector<std::string> slots;
+    std::vector<SwitchTable> switchTables;
+    /// 用到的数组，声明的数组由 NewArray 创建，其余的由调用方按名字提供
+    std::vector<IRArray> arrays;
+    std::vector<VectorOperation> vectors;
+    /// 可能声明失败的循环内变量，循环外不能有同名的变量
+    std::vector<std::string> shadows;
+};
+
+/**
+ * 把 SSA 形式的 IR 翻译成字节码
+ *
+ * 每个 SSA 值占一个寄存器。Phi 的消除：每个 Phi 额外分配一个临时寄存器，
+ * 前驱在跳转前把操作数写入临时寄存器，块开头再从临时寄存器搬到 Phi 自己的寄存器，
+ * 这样不需要拆分关键边，也不会遇到 lost-copy 和 swap 问题。
+ */
+class BytecodeLowering
+{
+  public:
+    explicit BytecodeLowering(const IRFunction &fn) : fn_(fn)
+    {
+    }
+
+    BytecodeProgram lower()
+    {
+        BytecodeProgram program;
+        program.slots = fn_.slots;
+        program.arrays = fn_.arrays;
+        program.shadows = fn_.shadows;
+        registerOf_.assign(fn_.valueCount(), -1);
+        phiTemp_.assign(fn_.valueCount(), -1);
+        auto order = fn_.reversePostOrder();
+
+        // 分配寄存器
+        for (auto *block : order)
+        {
+            for (auto *instr : block->instrs)
+            {
+                if (!instr->hasValue())
+                {
+                    continue;
+                }
+                registerOf_[instr->id] =
+                    static_cast<int32_t>(program.registers.size());
+                program.registers.push_back(
+                    instr->op == IROpcode::Const ? instr->imm : 0);
+                if (instr->op == IROpcode::Phi)
+                {
+                    phiTemp_[instr->id] =
+                        static_cast<int32_t>(program.registers.size());
+                    program.registers.push_back(0);
+                }
+            }
+        }
+
+        std::vector<int32_t> blockStart(fn_.blockIdBound(), -1);
+        std::vector<std::pair<size_t, IRBlock *>> fixups;
+        auto jumpTo = [&](OpCode op, IRBlock *target, int32_t cond) {
+            fixups.push_back({program.code.size(), target});
+            program.code.push_back({op, -1, cond, 0});
+        };
+        std::vector<IRInstr *> switches;
+
+        for (size_t i = 0; i < order.size(); ++i)
+        {
+            auto *block = order[i];
+            auto *next = i + 1 < order.size() ? order[i + 1] : nullptr;
+            blockStart[block->id] = static_cast<int32_t>(program.code.size());
+            for (auto *instr : block->instrs)
+            {
+                auto reg = registerOf_[instr->id];
+                switch (instr->op)
+                {
+                    case IROpcode::Const:
+                        break;
+                    case IROpcode::Phi:
+                        program.code.push_back(
+                            {OpCode::Move, reg, phiTemp_[instr->id], 0});
+                        break;
+                    case IROpcode::Copy:
+                        program.code.push_back(
+                            {OpCode::Move, reg, operand(instr, 0), 0});
+                        break;
+                    case IROpcode::LoadSlot:
+                        program.code.push_back(
+                            {OpCode::LoadSlot, reg, instr->imm, 0});
+                        break;
+                    case IROpcode::StoreSlot:
+                        program.code.push_back(
+                            {OpCode::StoreSlot, instr->imm, operand(instr, 0),
+                             0});
+                        break;
+                    case IROpcode::Print:
+                        program.code.push_back(
+                            {OpCode::Print, operand(instr, 0),
+                             static_cast<int32_t>(program.strings.size()), 0});
+                        program.strings.push_back(instr->text);
+                        break;
+                    case IROpcode::ArrayDim:
+                        program.code.push_back(
+                            {OpCode::ArrayDim, reg, instr->imm, instr->dim});
+                        break;
+                    case IROpcode::LoadElement:
+                        program.code.push_back({OpCode::LoadElement, reg,
+                                                instr->imm, operand(instr, 0)});
+                        break;
+                    case IROpcode::StoreElement:
+                        program.code.push_back(
+                            {OpCode::StoreElement, instr->imm,
+                             operand(instr, 0), operand(instr, 1)});
+                        break;
+                    case IROpcode::NewArray:
+                        program.code.push_back(
+                            {OpCode::NewArray, instr->imm, 0, 0});
+                        break;
+                    case IROpcode::PrintArray:
+                        program.code.push_back(
+                            {OpCode::PrintArray, instr->imm,
+                             static_cast<int32_t>(program.strings.size()), 0});
+                        program.strings.push_back(instr->text);
+                        break;
+                    case IROpcode::VectorSum:
+                    case IROpcode::VectorMin:
+                    case IROpcode::VectorMax:
+                    case IROpcode::VectorFill:
+                    case IROpcode::VectorCopy:
+                    case IROpcode::VectorAdd:
+                    case IROpcode::VectorSub:
+                    case IROpcode::VectorMul:
+                        program.code.push_back(
+                            {OpCode::Vector, instr->hasValue() ? reg : -1,
+                             static_cast<int32_t>(program.vectors.size()), 0});
+                        program.vectors.push_back(
+                            {instr->op, instr->imm, instr->source,
+                             operand(instr, 0), operand(instr, 1),
+                             operand(instr, 2)});
+                        break;
+                    case IROpcode::IndexError:
+                        program.code.push_back(
+                            {OpCode::IndexError, operand(instr, 0),
+                             operand(instr, 1), instr->imm});
+                        break;
+                    case IROpcode::Error:
+                        program.code.push_back(
+                            {OpCode::Error,
+                             static_cast<int32_t>(program.strings.size()),
+                             instr->imm, 0});
+                        program.strings.push_back(instr->text);
+                        break;
+                    case IROpcode::Jump:
+                        emitPhiCopies(program, block, instr->targets[0]);
+                        if (instr->targets[0] != next)
+                        {
+                            jumpTo(OpCode::Jump, instr->targets[0], 0);
+                        }
+                        break;
+                    case IROpcode::Branch:
+                    {
+                        auto *onTrue = instr->targets[0];
+                        auto *onFalse = instr->targets[1];
+                        emitPhiCopies(program, block, onTrue);
+                        emitPhiCopies(program, block, onFalse);
+                        auto cond = operand(instr, 0);
+                        if (onTrue == next)
+                        {
+                            jumpTo(OpCode::JumpIfFalse, onFalse, cond);
+                        }
+                        else
+                        {
+                            jumpTo(OpCode::JumpIfTrue, onTrue, cond);
+                            if (onFalse != next)
+                            {
+                                jumpTo(OpCode::Jump, onFalse, 0);
+                            }
+                        }
+                        break;
+                    }
+                    case IROpcode::Switch:
+                        for (auto *target : instr->targets)
+                        {
+                            emitPhiCopies(program, block, target);
+                        }
+                        // 分派表在所有块的地址确定之后生成
+                        program.code.push_back(
+                            {OpCode::Switch,
+                             static_cast<int32_t>(switches.size()),
+                             operand(instr, 0), 0});
+                        switches.push_back(instr);
+                        break;
+                    case IROpcode::Return:
+                        program.code.push_back({OpCode::Halt, 0, 0, 0});
+                        break;
+                    default:
+                        program.code.push_back(
+                            {static_cast<OpCode>(
+                                 static_cast<int>(OpCode::Add) +
+                                 static_cast<int>(instr->op) -
+                                 static_cast<int>(IROpcode::Add)),
+                             reg, operand(instr, 0),
+                             instr->operands.size() > 1 ? operand(instr, 1)
+                                                        : 0});
+                        break;
+                }
+            }
+        }
+        for (auto &[index, target] : fixups)
+        {
+            program.code[index].a = blockStart[target->id];
+        }
+        for (auto *instr : switches)
+        {
+            std::vector<std::pair<int32_t, int>> cases;
+            for (auto &[value, index] : instr->cases)
+            {
+                cases.push_back({value, blockStart[instr->targets[index]->id]});
+            }
+            program.switchTables.emplace_back(
+                std::move(cases), blockStart[instr->targets[0]->id]);
+        }
+        return program;
+    }
+
+  private:
+    int32_t operand(const IRInstr *instr, size_t i) const
+    {
+        return registerOf_[instr->operands[i]->id];
+    }
+
+    /**
+     * 从 from 跳到 to 之前，把 to 中 Phi 的对应操作数写入临时寄存器
+     */
+    void emitPhiCopies(BytecodeProgram &program, IRBlock *from, IRBlock *to)
+    {
+        int index = to->predIndex(from);
+        for (auto *instr : to->instrs)
+        {
+            if (instr->op != IROpcode::Phi)
+            {
+                break;
+            }
+            program.code.push_back(
+                {OpCode::Move, phiTemp_[instr->id], operand(instr, index), 0});
+        }
+    }
+
+  private:
+    const IRFunction &fn_;
+    std::vector<int32_t> registerOf_;
+    std::vector<int32_t> phiTemp_;
+};
@@ -0,0 +1,446 @@
+#pragma once
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include "Bytecode.hpp"
+#include "Sha256.hpp"
+
+/**
+ * 编译好的字节码的磁盘缓存
+ *
+ * 文件名由源码的哈希值决定，内容是字节码、寄存器初值（常量）、字符串和分派表。
+ * 命中时直接用 mmap 读入，跳过词法、语法分析、作用域分析和 IR 优化。
+ * 文件头中记录了格式版本、源码的 SHA-256 和其余内容的校验和，
+ * 任何一项对不上都当作没有命中。
+ *
+ * 64 位的 FNV-1a 只用来起文件名和发现损坏：它很容易构造出碰撞，
+ * 两段不同的源码可能对应同一个文件，是不是同一段源码由 SHA-256 判断
+ */
+class BytecodeCache
+{
+  public:
+    /// 字节码格式、IR 优化或者语言语义有变化时加一，旧的缓存自动失效
+    static constexpr uint32_t version = 5;
+
+    explicit BytecodeCache(std::string dir) : dir_(std::move(dir))
+    {
+    }
+
+    /**
+     * 读取 source 对应的字节码，没有缓存或者缓存无效时返回空
+     */
+    std::unique_ptr<BytecodeProgram> load(const std::string &source) const
+    {
+        auto hash = sourceHash(source);
+        int fd = ::open(path(hash).c_str(), O_RDONLY);
+        if (fd < 0)
+        {
+            return nullptr;
+        }
+        struct stat st;
+        if (::fstat(fd, &st) != 0 || st.st_size == 0)
+        {
+            ::close(fd);
+            return nullptr;
+        }
+        auto size = static_cast<size_t>(st.st_size);
+        void *data = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if (data == MAP_FAILED)
+        {
+            return nullptr;
+        }
+        auto program = parse(static_cast<const char *>(data), size,
+                             Sha256::digest(source));
+        ::munmap(data, size);
+        return program;
+    }
+
+    /**
+     * 写入缓存，失败时静默忽略，下次运行重新编译即可
+     *
+     * 先写临时文件再改名，同时运行的多个进程或线程不会读到写了一半的文件
+     *
+     * 用到数组的程序不缓存：去掉下标检查之后，读入时无法再验证元素访问不越界
+     */
+    void store(const std::string &source, const BytecodeProgram &program) const
+    {
+        if (!program.arrays.empty())
+        {
+            return;
+        }
+        ::mkdir(dir_.c_str(), 0755);
+        auto hash = sourceHash(source);
+        auto target = path(hash);
+        auto temp = target + ".XXXXXX";
+        int fd = ::mkstemp(temp.data());
+        if (fd < 0)
+        {
+            return;
+        }
+        // mkstemp 创建的文件只有自己能读
+        ::fchmod(fd, 0644);
+        auto image = serialize(program, Sha256::digest(source));
+        bool ok = writeAll(fd, image.data(), image.size());
+        ok = ::close(fd) == 0 && ok;
+        if (!ok || std::rename(temp.c_str(), target.c_str()) != 0)
+        {
+            ::unlink(temp.c_str());
+        }
+    }
+
+  private:
+    static constexpr char magic[4] = {'F', 'A', 'L', 'C'};
+    /// 魔数、版本号、源码的 SHA-256 和校验和，之后的内容都由校验和覆盖
+    static constexpr size_t headerSize = sizeof(magic) + sizeof(uint32_t) +
+                                         sizeof(Sha256::Digest) +
+                                         sizeof(uint64_t);
+
+    /**
+     * 64 位 FNV-1a，从 hash 接着往下算
+     */
+    static uint64_t fnv1a(const char *data,
+                          size_t size,
+                          uint64_t hash = 14695981039346656037ull)
+    {
+        for (size_t i = 0; i < size; ++i)
+        {
+            hash ^= static_cast<unsigned char>(data[i]);
+            hash *= 1099511628211ull;
+        }
+        return hash;
+    }
+
+    /**
+     * 源码的哈希值，只用作文件名，版本号也参与计算
+     */
+    static uint64_t sourceHash(const std::string &source)
+    {
+        char bytes[4];
+        for (int i = 0; i < 4; ++i)
+        {
+            bytes[i] = static_cast<char>(version >> (i * 8));
+        }
+        return fnv1a(source.data(), source.size(), fnv1a(bytes, 4));
+    }
+
+    static bool writeAll(int fd, const char *data, size_t size)
+    {
+        while (size > 0)
+        {
+            auto n = ::write(fd, data, size);
+            if (n < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            if (n <= 0)
+            {
+                return false;
+            }
+            data += n;
+            size -= static_cast<size_t>(n);
+        }
+        return true;
+    }
+
+    std::string path(uint64_t hash) const
+    {
+        char name[32];
+        std::snprintf(name, sizeof(name), "%016llx.fbc",
+                      static_cast<unsigned long long>(hash));
+        return dir_ + "/" + name;
+    }
+
+    /**
+     * 按本机字节序依次写入各个字段
+     */
+    class Writer
+    {
+      public:
+        template <typename T>
+        void put(T value)
+        {
+            buffer.append(reinterpret_cast<const char *>(&value), sizeof(T));
+        }
+
+        void putString(const std::string &s)
+        {
+            put(static_cast<uint32_t>(s.size()));
+            buffer.append(s);
+        }
+
+        std::string buffer;
+    };
+
+    /**
+     * 和 Writer 对应，越界时 ok 变为 false，之后读到的都是 0
+     */
+    class Reader
+    {
+      public:
+        Reader(const char *data, size_t size)
+            : p_(data), end_(data + size), ok(true)
+        {
+        }
+
+        template <typename T>
+        T get()
+        {
+            T value{};
+            if (static_cast<size_t>(end_ - p_) < sizeof(T))
+            {
+                ok = false;
+                return value;
+            }
+            std::memcpy(&value, p_, sizeof(T));
+            p_ += sizeof(T);
+            return value;
+        }
+
+        /**
+         * 读取元素个数，个数超过剩余的字节数时一定是坏文件
+         */
+        uint32_t getCount()
+        {
+            auto count = get<uint32_t>();
+            if (count > static_cast<size_t>(end_ - p_))
+            {
+                ok = false;
+                return 0;
+            }
+            return count;
+        }
+
+        std::string getString()
+        {
+            auto size = getCount();
+            std::string s(p_, size);
+            p_ += size;
+            return s;
+        }
+
+        bool atEnd() const
+        {
+            return p_ == end_;
+        }
+
+      private:
+        const char *p_;
+        const char *end_;
+
+      public:
+        bool ok;
+    };
+
+    static std::string serialize(const BytecodeProgram &program,
+                                 const Sha256::Digest &digest)
+    {
+        Writer w;
+        w.buffer.append(magic, sizeof(magic));
+        w.put(version);
+        w.put(digest);
+        // 校验和最后填上
+        w.put(uint64_t(0));
+        w.put(static_cast<uint32_t>(program.code.size()));
+        for (auto &ins : program.code)
+        {
+            w.put(static_cast<uint8_t>(ins.op));
+            w.put(ins.a);
+            w.put(ins.b);
+            w.put(ins.c);
+        }
+        w.put(static_cast<uint32_t>(program.registers.size()));
+        for (auto value : program.registers)
+        {
+            w.put(value);
+        }
+        w.put(static_cast<uint32_t>(program.strings.size()));
+        for (auto &s : program.strings)
+        {
+            w.putString(s);
+        }
+        w.put(static_cast<uint32_t>(program.switchTables.size()));
+        for (auto &table : program.switchTables)
+        {
+            w.put(table.min_);
+            w.put(table.defaultTarget_);
+            w.put(static_cast<uint32_t>(table.dense_.size()));
+            for (auto target : table.dense_)
+            {
+                w.put(target);
+            }
+            w.put(static_cast<uint32_t>(table.sorted_.size()));
+            for (auto &[value, target] : table.sorted_)
+            {
+                w.put(value);
+                w.put(target);
+            }
+        }
+        auto checksum = fnv1a(w.buffer.data() + headerSize,
+                              w.buffer.size() - headerSize);
+        std::memcpy(&w.buffer[headerSize - sizeof(checksum)], &checksum,
+                    sizeof(checksum));
+        return std::move(w.buffer);
+    }
+
+    static std::unique_ptr<BytecodeProgram> parse(const char *data,
+                                                  size_t size,
+                                                  const Sha256::Digest &digest)
+    {
+        if (size < headerSize ||
+            std::memcmp(data, magic, sizeof(magic)) != 0)
+        {
+            return nullptr;
+        }
+        Reader r(data + sizeof(magic), size - sizeof(magic));
+        // 文件名相同的不一定是同一段源码
+        if (r.get<uint32_t>() != version || r.get<Sha256::Digest>() != digest)
+        {
+            return nullptr;
+        }
+        // 结构检查拦不住的损坏（比如常量或者操作码被改了）由校验和发现
+        if (r.get<uint64_t>() !=
+            fnv1a(data + headerSize, size - headerSize))
+        {
+            return nullptr;
+        }
+        auto program = std::make_unique<BytecodeProgram>();
+        program->code.resize(r.getCount());
+        for (auto &ins : program->code)
+        {
+            ins.op = static_cast<OpCode>(r.get<uint8_t>());
+            ins.a = r.get<int32_t>();
+            ins.b = r.get<int32_t>();
+            ins.c = r.get<int32_t>();
+        }
+        program->registers.resize(r.getCount());
+        for (auto &value : program->registers)
+        {
+            value = r.get<int32_t>();
+        }
+        program->strings.resize(r.getCount());
+        for (auto &s : program->strings)
+        {
+            s = r.getString();
+        }
+        program->switchTables.resize(r.getCount());
+        for (auto &table : program->switchTables)
+        {
+            table.min_ = r.get<int32_t>();
+            table.defaultTarget_ = r.get<int>();
+            table.dense_.resize(r.getCount());
+            for (auto &target : table.dense_)
+            {
+                target = r.get<int>();
+            }
+            table.sorted_.resize(r.getCount());
+            for (auto &[value, target] : table.sorted_)
+            {
+                value = r.get<int32_t>();
+                target = r.get<int>();
+            }
+        }
+        if (!r.ok || !r.atEnd() || !isValid(*program))
+        {
+            return nullptr;
+        }
+        return program;
+    }
+
+    /**
+     * 检查寄存器、跳转地址等下标，损坏的文件不能让虚拟机越界访问
+     *
+     * 缓存的都是整个脚本，不会有槽位，也不会有数组
+     */
+    static bool isValid(const BytecodeProgram &program)
+    {
+        auto code = program.code.size();
+        auto regs = program.registers.size();
+        auto inRange = [](int32_t index, size_t size) {
+            return index >= 0 && static_cast<size_t>(index) < size;
+        };
+        for (auto &ins : program.code)
+        {
+            bool ok;
+            switch (ins.op)
+            {
+                case OpCode::Print:
+                    ok = inRange(ins.a, regs) &&
+                         inRange(ins.b, program.strings.size());
+                    break;
+                // 整个脚本中的运行时错误只输出，不抛出
+                case OpCode::Error:
+                    ok = inRange(ins.a, program.strings.size()) && ins.b == 0;
+                    break;
+                case OpCode::Jump:
+                    ok = inRange(ins.a, code);
+                    break;
+                case OpCode::JumpIfTrue:
+                case OpCode::JumpIfFalse:
+                    ok = inRange(ins.a, code) && inRange(ins.b, regs);
+                    break;
+                case OpCode::Switch:
+                    ok = inRange(ins.a, program.switchTables.size()) &&
+                         inRange(ins.b, regs);
+                    break;
+                case OpCode::Halt:
+                    ok = true;
+                    break;
+                case OpCode::LoadSlot:
+                case OpCode::StoreSlot:
+                case OpCode::ArrayDim:
+                case OpCode::LoadElement:
+                case OpCode::StoreElement:
+                case OpCode::NewArray:
+                case OpCode::PrintArray:
+                case OpCode::Vector:
+                case OpCode::IndexError:
+                    ok = false;
+                    break;
+                default:
+                    ok = ins.op < OpCode::LoadSlot && inRange(ins.a, regs) &&
+                         inRange(ins.b, regs) &&
+                         (ins.op < OpCode::Add || ins.op >= OpCode::Neg ||
+                          inRange(ins.c, regs));
+                    break;
+            }
+            if (!ok)
+            {
+                return false;
+            }
+        }
+        for (auto &table : program.switchTables)
+        {
+            if (!inRange(table.defaultTarget_, code))
+            {
+                return false;
+            }
+            for (auto target : table.dense_)
+            {
+                if (!inRange(target, code))
+                {
+                    return false;
+                }
+            }
+            for (auto &[value, target] : table.sorted_)
+            {
+                if (!inRange(target, code))
+                {
+                    return false;
+                }
+            }
+        }
+        // 最后一条指令之后没有代码，只能是停机或者跳转
+        return code > 0 && (program.code.back().op == OpCode::Halt ||
+                            program.code.back().op == OpCode::Jump);
+    }
+
+  private:
+    std::string dir_;
+};
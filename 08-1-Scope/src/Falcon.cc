@@ -0,0 +1,295 @@
+#include "Falcon.hpp"
+
+#include <algorithm>
+#include <sstream>
+#include <stdexcept>
+#include "Interpreter.hpp"
+#include "Scheduler.hpp"
+
+namespace falcon
+{
+struct Program::Impl
+{
+    CompileOptions options;
+    /// 解析和分析过的脚本，解释执行时各个 Context 的解释器都共用它的语法树
+    std::unique_ptr<Interpreter> loaded;
+    /// 为空表示脚本中有 IR 不支持的写法，需要解释执行
+    std::unique_ptr<BytecodeProgram> bytecode;
+};
+
+struct Context::State
+{
+    State(std::ostream &out, std::ostream &err) : out(out), err(err)
+    {
+    }
+
+    std::ostream &out;
+    std::ostream &err;
+    uint64_t maxSteps = Budget::unlimited;
+    std::chrono::milliseconds timeout{0};
+    size_t maxMemory = MemoryAccount::unlimited;
+    /// 为空表示没有输入
+    std::unique_ptr<input::IntReader> input;
+    std::unordered_map<std::string, int32_t> globals;
+    /// interpreter 中加载的是哪个程序，持有它以免地址被新的程序复用
+    std::shared_ptr<const Program> program;
+    std::unique_ptr<Interpreter> interpreter;
+};
+
+namespace
+{
+/**
+ * 按编译时 names 的顺序取出 Context 给的初值，和 names 对不上时抛出异常
+ */
+std::vector<int32_t> globalValues(
+    const std::vector<std::string> &names,
+    const std::unordered_map<std::string, int32_t> &globals)
+{
+    for (auto &global : globals)
+    {
+        if (std::find(names.begin(), names.end(), global.first) ==
+            names.end())
+        {
+            throw std::runtime_error("编译时没有指定可以注入的顶层变量：" +
+                                     global.first);
+        }
+    }
+    std::vector<int32_t> values;
+    for (auto &name : names)
+    {
+        auto it = globals.find(name);
+        if (it == globals.end())
+        {
+            throw std::runtime_error("没有给出顶层变量的初值：" + name);
+        }
+        values.push_back(it->second);
+    }
+    return values;
+}
+}  // namespace
+
+Context::Context(std::ostream &out, std::ostream &err)
+    : state_(std::make_unique<State>(out, err))
+{
+}
+
+Context::~Context() = default;
+
+void Context::setInput(std::istream &in)
+{
+    state_->input = std::make_unique<input::IntReader>(*in.rdbuf());
+}
+
+void Context::setGlobals(std::unordered_map<std::string, int32_t> globals)
+{
+    state_->globals = std::move(globals);
+}
+
+void Context::setLimits(uint64_t maxSteps,
+                        std::chrono::milliseconds timeout,
+                        size_t maxMemory)
+{
+    state_->maxSteps = maxSteps;
+    state_->timeout = timeout;
+    state_->maxMemory = maxMemory;
+}
+
+Program::Program(std::unique_ptr<Impl> impl) : impl_(std::move(impl))
+{
+}
+
+Program::~Program() = default;
+
+bool Program::run(Context &context) const
+{
+    auto &state = *context.state_;
+    try
+    {
+        auto globals = globalValues(impl_->options.globals, state.globals);
+        if (impl_->bytecode != nullptr)
+        {
+            Interpreter::Options options;
+            options.maxSteps = state.maxSteps;
+            options.timeout = state.timeout;
+            options.maxMemory = state.maxMemory;
+            Interpreter::runBytecode(*impl_->bytecode, globals, options,
+                                     state.out, state.err);
+            return true;
+        }
+        // 第一次执行这个程序时创建自己的解释器，语法树用编译时分析好的
+        if (state.program.get() != this)
+        {
+            Interpreter::Options options;
+            options.osrThreshold = impl_->options.osrThreshold;
+            options.allowFiles = impl_->options.allowFiles;
+            options.globals = impl_->options.globals;
+            state.interpreter = std::make_unique<Interpreter>(
+                *impl_->loaded, options, state.out, state.err);
+            state.program = shared_from_this();
+        }
+        state.interpreter->setInput(state.input.get());
+        state.interpreter->setLimits(state.maxSteps, state.timeout,
+                                     state.maxMemory);
+        state.interpreter->execute(globals);
+    }
+    catch (BudgetExceeded &)
+    {
+        return false;
+    }
+    catch (std::exception &e)
+    {
+        state.err << "Error: " << e.what() << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool Program::isCompiled() const
+{
+    return impl_->bytecode != nullptr;
+}
+
+std::shared_ptr<const Program> compile(const std::string &source,
+                                       const CompileOptions &options)
+{
+    auto impl = std::make_unique<Program::Impl>();
+    impl->options = options;
+
+    Interpreter::Options loadOptions;
+    loadOptions.globals = options.globals;
+    impl->loaded = std::make_unique<Interpreter>(loadOptions);
+    std::istringstream in(source);
+    if (impl->loaded->load(in) > 0)
+    {
+        throw std::runtime_error("脚本中有语法错误");
+    }
+    auto declared = impl->loaded->declaredGlobals();
+    for (auto &name : options.globals)
+    {
+        if (std::find(declared.begin(), declared.end(), name) ==
+            declared.end())
+        {
+            throw std::runtime_error("脚本中没有顶层变量：" + name);
+        }
+    }
+    if (options.optimize)
+    {
+        impl->bytecode = impl->loaded->compile();
+    }
+    return std::shared_ptr<const Program>(new Program(std::move(impl)));
+}
+
+struct Scheduler::Impl
+{
+    Impl(size_t threads, size_t quantum) : scheduler(threads, quantum)
+    {
+    }
+
+    ::Scheduler scheduler;
+};
+
+Scheduler::Scheduler(size_t threads, size_t quantum)
+    : impl_(std::make_unique<Impl>(threads, quantum))
+{
+}
+
+Scheduler::~Scheduler() = default;
+
+void Scheduler::spawn(std::shared_ptr<const Program> program,
+                      Context &context,
+                      std::function<void(bool)> done)
+{
+    if (!program->isCompiled())
+    {
+        throw std::invalid_argument("解释执行的程序不能按时间片调度");
+    }
+    // 虚拟机的状态在堆上，时间片用完时暂停，下次从停下的地方继续。
+    // 执行限制和 Program::run 相同：寄存器和数组都记在 memory 的账上，
+    // 成员按声明的逆序析构，虚拟机释放数组时账户还在
+    struct Task
+    {
+        Task(const Program::Impl &program, const Context::State &state)
+            : values(globalValues(program.options.globals, state.globals)),
+              budget(state.maxSteps, state.timeout),
+              memory(limited(state.maxMemory)),
+              registers(memory,
+                        program.bytecode->registers.size() * sizeof(int32_t)),
+              vm(*program.bytecode, state.out, &budget, &memory)
+        {
+            for (auto &value : values)
+            {
+                slots.push_back(&value);
+            }
+        }
+
+        static MemoryAccount limited(size_t maxMemory)
+        {
+            MemoryAccount memory;
+            memory.setLimit(maxMemory);
+            return memory;
+        }
+
+        /// 注入的初值，虚拟机只读这些槽位
+        std::vector<int32_t> values;
+        std::vector<int32_t *> slots;
+        Budget budget;
+        MemoryAccount memory;
+        MemoryCharge registers;
+        VM vm;
+    };
+    auto &state = *context.state_;
+    std::shared_ptr<Task> task;
+    try
+    {
+        task = std::make_shared<Task>(*program->impl_, state);
+    }
+    catch (BudgetExceeded &)
+    {
+    }
+    catch (std::exception &e)
+    {
+        state.err << "Error: " << e.what() << std::endl;
+    }
+    if (task == nullptr)
+    {
+        // 寄存器就已经超出内存限制了，或者初值对不上，done 同样在工作线程中调用
+        impl_->scheduler.spawn([done](size_t) {
+            if (done)
+            {
+                done(false);
+            }
+            return true;
+        });
+        return;
+    }
+    impl_->scheduler.spawn([program, task, &state, done](size_t quantum) {
+        bool finished = true;
+        try
+        {
+            if (!task->vm.resume(quantum, task->slots.data()))
+            {
+                return false;
+            }
+        }
+        catch (BudgetExceeded &)
+        {
+            finished = false;
+        }
+        catch (std::exception &e)
+        {
+            state.err << "Error: " << e.what() << std::endl;
+            finished = false;
+        }
+        if (done)
+        {
+            done(finished);
+        }
+        return true;
+    });
+}
+
+void Scheduler::wait()
+{
+    impl_->scheduler.wait();
+}
+}  // namespace falcon
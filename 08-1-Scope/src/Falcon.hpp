@@ -0,0 +1,169 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * 嵌入用的接口（libfalcon.a）：脚本只编译一次，之后可以执行任意多次
+ *
+ * 只依赖标准库，使用者不需要 antlr4 的头文件，
+ * 链接 libfalcon.a 和 antlr4-runtime 即可：
+ *
+ *     auto program = falcon::compile(source);
+ *     falcon::Context context(out);
+ *     context.setInput(in);
+ *     program->run(context);
+ *
+ * 或者交给 Scheduler，和其他程序一起按时间片轮流执行：
+ *
+ *     falcon::Scheduler scheduler(4);
+ *     scheduler.spawn(program, context, [](bool finished) { ... });
+ */
+namespace falcon
+{
+struct CompileOptions
+{
+    bool optimize = true;     ///< 尽量编译成字节码，不支持的写法退回解释执行
+    int osrThreshold = 1000;  ///< 解释执行时的栈上替换阈值，0 表示关闭
+    bool allowFiles = true;   ///< 内置函数 load、save 可以读写文件
+    /// 可以用 Context::setGlobals 注入初值的顶层变量
+    std::vector<std::string> globals;
+};
+
+class Program;
+
+/**
+ * 执行程序的环境：输入、输出、顶层变量的初值，以及解释执行时的栈帧和各种缓存
+ *
+ * 同一个 Context 反复执行同一个程序时会复用这些缓存。
+ * Context 不能同时在多个线程中使用，每个线程各用一个
+ */
+class Context
+{
+  public:
+    /**
+     * 脚本的输出写到 out；执行中断的原因（运行时错误）写到 err，
+     * 和语句中的错误一样以 "Error: " 开头
+     */
+    explicit Context(std::ostream &out = std::cout,
+                     std::ostream &err = std::cerr);
+    ~Context();
+
+    /**
+     * 内置函数 read_int 等从 in 读取输入，之后每次执行接着上一次读。
+     * in 要比 Context 活得长；没有设置时没有输入
+     */
+    void setInput(std::istream &in);
+
+    /**
+     * 之后每次执行时顶层变量的初值，和命令行的 -D 一样：
+     * 声明时照常计算初始值，然后换成这里的值。
+     * 编译时 CompileOptions::globals 中的变量都要给出初值，也只能给这些变量
+     */
+    void setGlobals(std::unordered_map<std::string, int32_t> globals);
+
+    /**
+     * 之后每次执行最多 maxSteps 步（见 Budget.hpp）、最长 timeout、
+     * 栈帧和变量最多使用 maxMemory 字节，超出时停止执行。
+     * timeout 为 0 表示不限时间
+     */
+    void setLimits(uint64_t maxSteps,
+                   std::chrono::milliseconds timeout = {},
+                   size_t maxMemory = SIZE_MAX);
+
+    Context(const Context &) = delete;
+    Context &operator=(const Context &) = delete;
+
+  private:
+    struct State;
+    std::unique_ptr<State> state_;
+    friend class Program;
+    friend class Scheduler;
+};
+
+/**
+ * 编译好的程序，创建之后不再修改，可以在多个线程之间共享
+ */
+class Program : public std::enable_shared_from_this<Program>
+{
+  public:
+    ~Program();
+
+    Program(const Program &) = delete;
+    Program &operator=(const Program &) = delete;
+
+    /**
+     * 执行一次，超出 Context 的执行限制或者出错时停止并返回 false，
+     * 出错的原因写到 Context 的 err
+     */
+    bool run(Context &context) const;
+
+    /**
+     * 是否编译成了字节码
+     *
+     * 否则在编译时分析好的语法树上解释执行，语法树只读，所有 Context 共用，
+     * 每个 Context 只有自己的栈帧和缓存
+     */
+    bool isCompiled() const;
+
+  private:
+    struct Impl;
+    explicit Program(std::unique_ptr<Impl> impl);
+
+    std::unique_ptr<Impl> impl_;
+    friend std::shared_ptr<const Program> compile(
+        const std::string &source, const CompileOptions &options);
+    friend class Scheduler;
+};
+
+/**
+ * 用少量线程同时执行大量程序，按时间片轮流执行
+ *
+ * 程序每执行 quantum 条指令让出一次线程，排到队尾，
+ * 一个长时间运行的程序不会让其他程序一直等着。
+ * 只接受编译成字节码的程序：解释执行时递归地遍历语法树，不能中途暂停，
+ * 一个租户的慢脚本就会一直占着线程，这样的程序只能用 Program::run
+ */
+class Scheduler
+{
+  public:
+    explicit Scheduler(size_t threads, size_t quantum = 10000);
+    /// 等所有程序执行完再返回
+    ~Scheduler();
+
+    Scheduler(const Scheduler &) = delete;
+    Scheduler &operator=(const Scheduler &) = delete;
+
+    /**
+     * 提交一个程序，立即返回，执行完之后在工作线程中调用 done，
+     * 参数和 Program::run 的返回值相同。时间限制从提交时开始计算
+     *
+     * 程序执行完之前 context 不能再用于其他程序。
+     * program 没有编译成字节码时抛出 std::invalid_argument
+     */
+    void spawn(std::shared_ptr<const Program> program,
+               Context &context,
+               std::function<void(bool)> done = nullptr);
+
+    /**
+     * 等到已经提交的程序全部执行完
+     */
+    void wait();
+
+  private:
+    struct Impl;
+    std::unique_ptr<Impl> impl_;
+};
+
+/**
+ * 编译脚本，有语法错误时抛出 std::runtime_error
+ */
+std::shared_ptr<const Program> compile(const std::string &source,
+                                       const CompileOptions &options = {});
+}  // namespace falcon
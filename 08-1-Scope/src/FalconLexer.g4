@@ -2,6 +2,9 @@ lexer grammar FalconLexer;
 
 // 类型
 INT: 'int';
+LONG: 'long';
+BIGINT: 'bigint';
+MAP: 'map';
 
 // 关键字
 IF: 'if';
@@ -23,6 +26,7 @@ DECIMAL_LITERAL: ('0' | [1-9] (Digits? | '_'+ Digits)) [lL]?;
 HEX_LITERAL: '0' [xX] [0-9a-fA-F] ([0-9a-fA-F_]* [0-9a-fA-F])? [lL]?; 
 OCTAL_LITERAL: '0' '_'* [0-7] ([0-7_]* [0-7])? [lL]?; 
 BINARY_LITERAL: '0' [bB] [01] ([01_]* [01])? [lL]?; 
+STRING_LITERAL: '"' (~["\\\r\n] | EscapeSequence)* '"';
 
 // 运算符
 // 双目运算符
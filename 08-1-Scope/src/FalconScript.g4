@@ -21,14 +21,18 @@ statement
     | FOR '(' forControl ')' statement
     | WHILE parExpression statement
     | DO statement WHILE parExpression ';'
+    | SWITCH parExpression '{' switchBlockStatementGroup* switchLabel* '}'
     | BREAK ';'
     | CONTINUE ';'
     | SEMI
     | statementExpression=expression ';'
     ;
 
-expression
+// id 是表达式节点的编号，由 MyListener 分配，各个 MyVisitor 按编号缓存运算核
+expression locals [int id = -1]
     : primary
+    | methodCall
+    | expression '[' expression ']'
     | expression postfix=('++' | '--')
     | prefix=('+'|'-'|'++'|'--') expression
     | prefix=('~'|'!') expression
@@ -48,14 +52,21 @@ expression
       expression
     ;
 
+// 内置函数，见 Builtins.hpp
+methodCall
+    : IDENTIFIER '(' expressionList? ')'
+    ;
+
 primary
     : '(' expression ')'
     | literal
     | IDENTIFIER
     ;
 
+// 字符串只用作内置函数的参数，见 Builtins.hpp
 literal
     : integerLiteral
+    | STRING_LITERAL
     ;
 
 integerLiteral
@@ -65,12 +76,18 @@ integerLiteral
     | BINARY_LITERAL
     ;
 
+// map 是整数到整数的哈希表，见 HashMap.hpp
 typeType
     : primitiveType
+    | MAP
     ;
 
+// long 是 64 位整数，bigint 是任意精度的整数（见 BigInt.hpp），
+// 不同类型一起运算时按较宽的类型计算
 primitiveType
     : INT
+    | LONG
+    | BIGINT
     ;
 
 variableDeclarators
@@ -81,12 +98,18 @@ variableDeclarator
     : variableDeclaratorId ('=' variableInitializer)?
     ;
 
+// int a[3][4]; 方括号中是每一维的长度
 variableDeclaratorId
-    : IDENTIFIER
+    : IDENTIFIER ('[' expression ']')*
     ;
 
 variableInitializer
-    : expression
+    : arrayInitializer
+    | expression
+    ;
+
+arrayInitializer
+    : '{' (variableInitializer (',' variableInitializer)* ','?)? '}'
     ;
 
 
@@ -94,6 +117,15 @@ parExpression
     : '(' expression ')'
     ;
 
+switchBlockStatementGroup
+    : switchLabel+ blockStatement+
+    ;
+
+switchLabel
+    : CASE constantExpression=expression ':'
+    | DEFAULT ':'
+    ;
+
 forControl
     : forInit? ';' expression? ';' forUpdate=expressionList?
     ;
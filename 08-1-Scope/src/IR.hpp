@@ -0,0 +1,738 @@
+#pragma once
+
+#include <algorithm>
+#include <climits>
+#include <cstdint>
+#include <memory>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * IR 指令的操作码
+ *
+ * 所有的值都是 int32_t，运算语义和 MyVisitor 中的运算符保持一致
+ */
+enum class IROpcode : uint8_t
+{
+    // 常量
+    Const,
+    // 双目运算符
+    Add,
+    Sub,
+    Mul,
+    Div,
+    Mod,
+    Shl,
+    Shr,
+    Eq,
+    Ne,
+    Lt,
+    Le,
+    Gt,
+    Ge,
+    BitAnd,
+    BitOr,
+    BitXor,
+    And,
+    Or,
+    InBounds,  ///< 0 <= a < b，数组的下标检查，b 总是正数
+    // 单目运算符
+    Neg,
+    Not,
+    BitNot,
+    // SSA 相关
+    Phi,
+    Copy,
+    // 读取外部变量，imm 是槽位编号
+    LoadSlot,
+    // 数组，imm 是数组编号
+    ArrayDim,     ///< 循环外的数组第 dim 维的长度
+    LoadElement,  ///< 按行展开后第 operands[0] 个元素
+    // 向量化之后的批量运算，数组中从第 operands[0] 个元素开始的 operands[1] 个
+    VectorSum,  ///< operands[2] 加上这些元素的和
+    VectorMin,  ///< operands[2] 和这些元素中的最小值
+    VectorMax,  ///< operands[2] 和这些元素中的最大值
+    // 有副作用的指令
+    Print,
+    StoreSlot,     ///< 写回外部变量，imm 是槽位编号
+    NewArray,      ///< 创建数组，各维的长度在 IRFunction::arrays 中
+    StoreElement,  ///< 第 operands[0] 个元素写入 operands[1]
+    PrintArray,    ///< 输出整个数组
+    // source 小于 0 时另一个操作数是标量 operands[2]，
+    // 否则是 source 数组中从第 operands[2] 个元素开始的部分
+    VectorFill,  ///< 全部赋值为 operands[2]
+    VectorCopy,  ///< 从 source 数组中复制
+    VectorAdd,   ///< 逐个加上另一个操作数
+    VectorSub,   ///< 逐个减去另一个操作数
+    VectorMul,   ///< 逐个乘以另一个操作数
+    // 运行时错误，MyVisitor 在这里抛出异常，输出之后跳过当前的 blockStatement；
+    // imm 不为 0 时改为抛出异常，交给循环外的解释器处理
+    IndexError,  ///< 下标 operands[0] 越界，长度为 operands[1]
+    Error,       ///< 错误信息是 text
+    // 终结指令
+    Jump,
+    Branch,
+    Switch,  ///< 多路分支，targets[0] 是 default
+    Return,
+};
+
+/**
+ * 除数为 0 时和 MyVisitor 一样抛出异常，而不是触发 SIGFPE
+ */
+inline void irCheckDivisor(int32_t b)
+{
+    if (b == 0)
+    {
+        throw std::runtime_error("除数不能为0");
+    }
+}
+
+/**
+ * 双目运算的语义，常量折叠和虚拟机共用
+ *
+ * 加减乘按补码回绕，INT_MIN / -1 也回绕成 INT_MIN，
+ * 移位量只取低 5 位（和 x86 上 MyVisitor 的实际行为一致）
+ */
+inline int32_t irEvalBinary(IROpcode op, int32_t a, int32_t b)
+{
+    auto ua = static_cast<uint32_t>(a);
+    auto ub = static_cast<uint32_t>(b);
+    switch (op)
+    {
+        case IROpcode::Add:
+            return static_cast<int32_t>(ua + ub);
+        case IROpcode::Sub:
+            return static_cast<int32_t>(ua - ub);
+        case IROpcode::Mul:
+            return static_cast<int32_t>(ua * ub);
+        case IROpcode::Div:
+            irCheckDivisor(b);
+            return b == -1 ? static_cast<int32_t>(0u - ua) : a / b;
+        case IROpcode::Mod:
+            irCheckDivisor(b);
+            return b == -1 ? 0 : a % b;
+        case IROpcode::Shl:
+            return static_cast<int32_t>(ua << (ub & 31));
+        case IROpcode::Shr:
+            return a >> (ub & 31);
+        case IROpcode::Eq:
+            return a == b;
+        case IROpcode::Ne:
+            return a != b;
+        case IROpcode::Lt:
+            return a < b;
+        case IROpcode::Le:
+            return a <= b;
+        case IROpcode::Gt:
+            return a > b;
+        case IROpcode::Ge:
+            return a >= b;
+        case IROpcode::BitAnd:
+            return a & b;
+        case IROpcode::BitOr:
+            return a | b;
+        case IROpcode::BitXor:
+            return a ^ b;
+        case IROpcode::And:
+            return a && b;
+        case IROpcode::Or:
+            return a || b;
+        case IROpcode::InBounds:
+            return static_cast<uint32_t>(a) < ub;
+        default:
+            return 0;
+    }
+}
+
+/**
+ * 单目运算的语义
+ */
+inline int32_t irEvalUnary(IROpcode op, int32_t a)
+{
+    switch (op)
+    {
+        case IROpcode::Neg:
+            return static_cast<int32_t>(0u - static_cast<uint32_t>(a));
+        case IROpcode::Not:
+            return !a;
+        case IROpcode::BitNot:
+            return ~a;
+        default:
+            return 0;
+    }
+}
+
+/**
+ * 除零在运行时抛出异常，编译期不能折叠掉，
+ * 否则死代码里的 a / 0 也会让整个脚本编译失败
+ */
+inline bool irCanFold(IROpcode op, int32_t, int32_t b)
+{
+    if (op == IROpcode::Div || op == IROpcode::Mod)
+    {
+        return b != 0;
+    }
+    return true;
+}
+
+inline bool irIsCommutative(IROpcode op)
+{
+    return op == IROpcode::Add || op == IROpcode::Mul || op == IROpcode::Eq ||
+           op == IROpcode::Ne || op == IROpcode::BitAnd ||
+           op == IROpcode::BitOr || op == IROpcode::BitXor ||
+           op == IROpcode::And || op == IROpcode::Or;
+}
+
+class IRBlock;
+
+/**
+ * IR 中的数组，编号就是它在 IRFunction::arrays 中的下标
+ *
+ * 脚本中声明的数组各维的长度都是编译期常量；
+ * 栈上替换时循环外的数组由调用方提供，dims 为空，rank 是循环中要求的维数
+ */
+struct IRArray
+{
+    std::string name;
+    std::vector<size_t> dims;
+    size_t rank = 0;  ///< 0 表示不限
+};
+
+/**
+ * IR 指令，同时也是它所定义的 SSA 值
+ */
+class IRInstr
+{
+  public:
+    IRInstr(IROpcode op, uint32_t id)
+        : op(op), id(id), imm(0), dim(0), source(-1), block(nullptr)
+    {
+    }
+
+    bool isTerminator() const
+    {
+        return op == IROpcode::Jump || op == IROpcode::Branch ||
+               op == IROpcode::Switch || op == IROpcode::Return;
+    }
+
+    /**
+     * Switch 在操作数等于 value 时跳转的目标块
+     */
+    IRBlock *switchTarget(int32_t value) const
+    {
+        for (auto &[caseValue, index] : cases)
+        {
+            if (caseValue == value)
+            {
+                return targets[index];
+            }
+        }
+        return targets[0];
+    }
+
+    bool isBinary() const
+    {
+        return op >= IROpcode::Add && op <= IROpcode::InBounds;
+    }
+
+    bool isUnary() const
+    {
+        return op >= IROpcode::Neg && op <= IROpcode::BitNot;
+    }
+
+    /**
+     * imm 是否是数组编号
+     */
+    bool isArrayAccess() const
+    {
+        return op == IROpcode::ArrayDim || op == IROpcode::LoadElement ||
+               op == IROpcode::NewArray || op == IROpcode::StoreElement ||
+               op == IROpcode::PrintArray || isVector();
+    }
+
+    /**
+     * 是否是向量化之后的批量运算
+     */
+    bool isVector() const
+    {
+        return (op >= IROpcode::VectorSum && op <= IROpcode::VectorMax) ||
+               (op >= IROpcode::VectorFill && op <= IROpcode::VectorMul);
+    }
+
+    /**
+     * 是否有副作用，有副作用的指令不能被删除、合并或移动
+     */
+    bool hasSideEffect() const
+    {
+        return op == IROpcode::Print || op == IROpcode::StoreSlot ||
+               op == IROpcode::NewArray || op == IROpcode::StoreElement ||
+               op == IROpcode::PrintArray ||
+               (op >= IROpcode::VectorFill && op <= IROpcode::VectorMul) ||
+               op == IROpcode::IndexError || op == IROpcode::Error ||
+               isTerminator();
+    }
+
+    /**
+     * 是否定义了一个值
+     */
+    bool hasValue() const
+    {
+        return !hasSideEffect();
+    }
+
+  public:
+    IROpcode op;
+    uint32_t id;                     ///< 值编号，函数内唯一
+    /// Const 的值，LoadSlot/StoreSlot 的槽位，数组指令的数组编号
+    int32_t imm;
+    int32_t dim;                     ///< ArrayDim 取的是第几维
+    int32_t source;                  ///< 向量指令的源数组编号，-1 表示没有
+    std::vector<IRInstr *> operands;  ///< Phi 的操作数和所在块的前驱一一对应
+    std::vector<IRBlock *> targets;   ///< 目标块，互不相同
+    /// Switch 的 case 值和目标块在 targets 中的下标
+    std::vector<std::pair<int32_t, int>> cases;
+    std::string text;                ///< Print 的标签，Error 的错误信息
+    IRBlock *block;                  ///< 所属的基本块
+};
+
+/**
+ * 基本块，Phi 指令总是位于块的开头，终结指令位于块的末尾
+ */
+class IRBlock
+{
+  public:
+    explicit IRBlock(uint32_t id) : id(id)
+    {
+    }
+
+    IRInstr *terminator() const
+    {
+        if (instrs.empty() || !instrs.back()->isTerminator())
+        {
+            return nullptr;
+        }
+        return instrs.back();
+    }
+
+    const std::vector<IRBlock *> &succs() const
+    {
+        static const std::vector<IRBlock *> empty;
+        auto *term = terminator();
+        return term ? term->targets : empty;
+    }
+
+    int predIndex(const IRBlock *pred) const
+    {
+        for (size_t i = 0; i < preds.size(); ++i)
+        {
+            if (preds[i] == pred)
+            {
+                return static_cast<int>(i);
+            }
+        }
+        return -1;
+    }
+
+  public:
+    uint32_t id;
+    std::vector<IRInstr *> instrs;
+    std::vector<IRBlock *> preds;
+};
+
+/**
+ * 一段可执行的 IR，整个脚本或者栈上替换时的一个循环对应一个 IRFunction
+ *
+ * 所有的指令和基本块都由 IRFunction 持有
+ */
+class IRFunction
+{
+  public:
+    IRFunction() : entry(nullptr), nextValueId_(0), nextBlockId_(0)
+    {
+    }
+
+    IRBlock *newBlock()
+    {
+        blockPool_.push_back(std::make_unique<IRBlock>(nextBlockId_++));
+        blocks.push_back(blockPool_.back().get());
+        return blocks.back();
+    }
+
+    /**
+     * 创建一条不属于任何块的指令
+     */
+    IRInstr *newInstr(IROpcode op)
+    {
+        instrPool_.push_back(std::make_unique<IRInstr>(op, nextValueId_++));
+        return instrPool_.back().get();
+    }
+
+    /**
+     * 常量统一放在入口块的开头，入口块支配所有块
+     */
+    IRInstr *constant(int32_t value)
+    {
+        auto it = constants_.find(value);
+        if (it != constants_.end())
+        {
+            return it->second;
+        }
+        auto *instr = newInstr(IROpcode::Const);
+        instr->imm = value;
+        instr->block = entry;
+        entry->instrs.insert(entry->instrs.begin(), instr);
+        constants_[value] = instr;
+        return instr;
+    }
+
+    /**
+     * 把指令从所在的块中摘除
+     */
+    void eraseInstr(IRInstr *instr)
+    {
+        auto &instrs = instr->block->instrs;
+        instrs.erase(std::find(instrs.begin(), instrs.end(), instr));
+        if (instr->op == IROpcode::Const)
+        {
+            constants_.erase(instr->imm);
+        }
+        instr->block = nullptr;
+    }
+
+    uint32_t valueCount() const
+    {
+        return nextValueId_;
+    }
+
+    /**
+     * 添加 from -> to 的边
+     */
+    static void addEdge(IRBlock *from, IRBlock *to)
+    {
+        to->preds.push_back(from);
+    }
+
+    /**
+     * 删除 from -> to 的边，同步删除 to 中 Phi 的对应操作数
+     */
+    static void removeEdge(IRBlock *from, IRBlock *to)
+    {
+        int index = to->predIndex(from);
+        if (index < 0)
+        {
+            return;
+        }
+        to->preds.erase(to->preds.begin() + index);
+        for (auto *instr : to->instrs)
+        {
+            if (instr->op != IROpcode::Phi)
+            {
+                break;
+            }
+            instr->operands.erase(instr->operands.begin() + index);
+        }
+    }
+
+    /**
+     * 按照 replacement 替换所有操作数，replacement 中允许出现链式替换
+     */
+    void replaceUses(std::unordered_map<IRInstr *, IRInstr *> &replacement)
+    {
+        if (replacement.empty())
+        {
+            return;
+        }
+        auto resolve = [&replacement](IRInstr *value) {
+            auto it = replacement.find(value);
+            while (it != replacement.end())
+            {
+                value = it->second;
+                it = replacement.find(value);
+            }
+            return value;
+        };
+        for (auto *block : blocks)
+        {
+            for (auto *instr : block->instrs)
+            {
+                for (auto &operand : instr->operands)
+                {
+                    operand = resolve(operand);
+                }
+            }
+        }
+    }
+
+    /**
+     * 删除从入口不可达的基本块
+     */
+    void removeUnreachableBlocks()
+    {
+        std::vector<bool> reachable(nextBlockId_, false);
+        std::vector<IRBlock *> worklist{entry};
+        reachable[entry->id] = true;
+        while (!worklist.empty())
+        {
+            auto *block = worklist.back();
+            worklist.pop_back();
+            for (auto *succ : block->succs())
+            {
+                if (!reachable[succ->id])
+                {
+                    reachable[succ->id] = true;
+                    worklist.push_back(succ);
+                }
+            }
+        }
+        for (auto *block : blocks)
+        {
+            if (reachable[block->id])
+            {
+                continue;
+            }
+            for (auto *succ : block->succs())
+            {
+                removeEdge(block, succ);
+            }
+        }
+        std::vector<IRBlock *> kept;
+        for (auto *block : blocks)
+        {
+            if (reachable[block->id])
+            {
+                kept.push_back(block);
+            }
+        }
+        blocks.swap(kept);
+    }
+
+    /**
+     * 逆后序，数据流分析按照这个顺序迭代收敛得最快
+     */
+    std::vector<IRBlock *> reversePostOrder() const
+    {
+        std::vector<IRBlock *> order;
+        std::vector<bool> visited(nextBlockId_, false);
+        // 显式栈，避免深层嵌套的脚本把调用栈撑爆
+        std::vector<std::pair<IRBlock *, size_t>> stack{{entry, 0}};
+        visited[entry->id] = true;
+        while (!stack.empty())
+        {
+            auto &[block, next] = stack.back();
+            const auto &succs = block->succs();
+            if (next < succs.size())
+            {
+                auto *succ = succs[next++];
+                if (!visited[succ->id])
+                {
+                    visited[succ->id] = true;
+                    stack.push_back({succ, 0});
+                }
+            }
+            else
+            {
+                order.push_back(block);
+                stack.pop_back();
+            }
+        }
+        return {order.rbegin(), order.rend()};
+    }
+
+    uint32_t blockIdBound() const
+    {
+        return nextBlockId_;
+    }
+
+    void dump(std::ostream &os) const;
+
+  public:
+    IRBlock *entry;
+    std::vector<IRBlock *> blocks;
+    /// 外部变量的名字，下标就是槽位编号
+    std::vector<std::string> slots;
+    std::vector<IRArray> arrays;
+    /// 栈上替换时循环中可能声明失败的变量，循环外不能有同名的变量
+    std::vector<std::string> shadows;
+
+  private:
+    std::vector<std::unique_ptr<IRBlock>> blockPool_;
+    std::vector<std::unique_ptr<IRInstr>> instrPool_;
+    std::unordered_map<int32_t, IRInstr *> constants_;
+    uint32_t nextValueId_;
+    uint32_t nextBlockId_;
+};
+
+inline const char *irOpcodeName(IROpcode op)
+{
+    switch (op)
+    {
+        case IROpcode::Const:
+            return "const";
+        case IROpcode::Add:
+            return "add";
+        case IROpcode::Sub:
+            return "sub";
+        case IROpcode::Mul:
+            return "mul";
+        case IROpcode::Div:
+            return "div";
+        case IROpcode::Mod:
+            return "mod";
+        case IROpcode::Shl:
+            return "shl";
+        case IROpcode::Shr:
+            return "shr";
+        case IROpcode::Eq:
+            return "eq";
+        case IROpcode::Ne:
+            return "ne";
+        case IROpcode::Lt:
+            return "lt";
+        case IROpcode::Le:
+            return "le";
+        case IROpcode::Gt:
+            return "gt";
+        case IROpcode::Ge:
+            return "ge";
+        case IROpcode::BitAnd:
+            return "bitand";
+        case IROpcode::BitOr:
+            return "bitor";
+        case IROpcode::BitXor:
+            return "bitxor";
+        case IROpcode::And:
+            return "and";
+        case IROpcode::Or:
+            return "or";
+        case IROpcode::InBounds:
+            return "inbounds";
+        case IROpcode::Neg:
+            return "neg";
+        case IROpcode::Not:
+            return "not";
+        case IROpcode::BitNot:
+            return "bitnot";
+        case IROpcode::Phi:
+            return "phi";
+        case IROpcode::Copy:
+            return "copy";
+        case IROpcode::LoadSlot:
+            return "loadslot";
+        case IROpcode::ArrayDim:
+            return "arraydim";
+        case IROpcode::LoadElement:
+            return "loadelement";
+        case IROpcode::Print:
+            return "print";
+        case IROpcode::StoreSlot:
+            return "storeslot";
+        case IROpcode::NewArray:
+            return "newarray";
+        case IROpcode::StoreElement:
+            return "storeelement";
+        case IROpcode::PrintArray:
+            return "printarray";
+        case IROpcode::VectorSum:
+            return "vectorsum";
+        case IROpcode::VectorMin:
+            return "vectormin";
+        case IROpcode::VectorMax:
+            return "vectormax";
+        case IROpcode::VectorFill:
+            return "vectorfill";
+        case IROpcode::VectorCopy:
+            return "vectorcopy";
+        case IROpcode::VectorAdd:
+            return "vectoradd";
+        case IROpcode::VectorSub:
+            return "vectorsub";
+        case IROpcode::VectorMul:
+            return "vectormul";
+        case IROpcode::IndexError:
+            return "indexerror";
+        case IROpcode::Error:
+            return "error";
+        case IROpcode::Jump:
+            return "jump";
+        case IROpcode::Branch:
+            return "branch";
+        case IROpcode::Switch:
+            return "switch";
+        case IROpcode::Return:
+            return "ret";
+    }
+    return "?";
+}
+
+/**
+ * 以文本形式输出 IR，用于调试
+ */
+inline void IRFunction::dump(std::ostream &os) const
+{
+    for (auto *block : blocks)
+    {
+        os << "bb" << block->id << ":";
+        if (!block->preds.empty())
+        {
+            os << "  ; preds:";
+            for (auto *pred : block->preds)
+            {
+                os << " bb" << pred->id;
+            }
+        }
+        os << "\n";
+        for (auto *instr : block->instrs)
+        {
+            os << "    ";
+            if (instr->hasValue())
+            {
+                os << "%" << instr->id << " = ";
+            }
+            os << irOpcodeName(instr->op);
+            if (instr->op == IROpcode::Const)
+            {
+                os << " " << instr->imm;
+            }
+            if (instr->op == IROpcode::LoadSlot ||
+                instr->op == IROpcode::StoreSlot)
+            {
+                os << " " << slots[instr->imm];
+            }
+            if (instr->isArrayAccess())
+            {
+                os << " " << arrays[instr->imm].name;
+            }
+            if (instr->source >= 0)
+            {
+                os << " " << arrays[instr->source].name;
+            }
+            if (instr->op == IROpcode::ArrayDim)
+            {
+                os << " " << instr->dim;
+            }
+            if (instr->op == IROpcode::Print ||
+                instr->op == IROpcode::PrintArray ||
+                instr->op == IROpcode::Error)
+            {
+                os << " \"" << instr->text << "\"";
+            }
+            for (auto *operand : instr->operands)
+            {
+                os << " %" << operand->id;
+            }
+            for (auto *target : instr->targets)
+            {
+                os << " bb" << target->id;
+            }
+            for (auto &[value, index] : instr->cases)
+            {
+                os << " [" << value << " -> bb" << instr->targets[index]->id
+                   << "]";
+            }
+            os << "\n";
+        }
+    }
+}
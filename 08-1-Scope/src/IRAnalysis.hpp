@@ -0,0 +1,317 @@
+#pragma once
+
+#include "IR.hpp"
+
+/**
+ * 支配树，采用 Cooper、Harvey、Kennedy 的迭代算法
+ */
+class IRDominatorTree
+{
+  public:
+    explicit IRDominatorTree(const IRFunction &fn)
+        : order_(fn.reversePostOrder()),
+          rpoIndex_(fn.blockIdBound(), -1),
+          idom_(fn.blockIdBound(), nullptr),
+          children_(fn.blockIdBound())
+    {
+        for (size_t i = 0; i < order_.size(); ++i)
+        {
+            rpoIndex_[order_[i]->id] = static_cast<int>(i);
+        }
+        idom_[fn.entry->id] = fn.entry;
+        bool changed = true;
+        while (changed)
+        {
+            changed = false;
+            for (size_t i = 1; i < order_.size(); ++i)
+            {
+                auto *block = order_[i];
+                IRBlock *newIdom = nullptr;
+                for (auto *pred : block->preds)
+                {
+                    if (idom_[pred->id] == nullptr)
+                    {
+                        continue;
+                    }
+                    newIdom = newIdom ? intersect(pred, newIdom) : pred;
+                }
+                if (idom_[block->id] != newIdom)
+                {
+                    idom_[block->id] = newIdom;
+                    changed = true;
+                }
+            }
+        }
+        for (size_t i = 1; i < order_.size(); ++i)
+        {
+            children_[idom_[order_[i]->id]->id].push_back(order_[i]);
+        }
+    }
+
+    IRBlock *idom(const IRBlock *block) const
+    {
+        return idom_[block->id];
+    }
+
+    const std::vector<IRBlock *> &children(const IRBlock *block) const
+    {
+        return children_[block->id];
+    }
+
+    /**
+     * a 是否支配 b
+     */
+    bool dominates(const IRBlock *a, const IRBlock *b) const
+    {
+        while (b != a)
+        {
+            auto *parent = idom_[b->id];
+            if (parent == b)
+            {
+                return false;
+            }
+            b = parent;
+        }
+        return true;
+    }
+
+    /**
+     * 可达块的逆后序
+     */
+    const std::vector<IRBlock *> &order() const
+    {
+        return order_;
+    }
+
+  private:
+    IRBlock *intersect(IRBlock *a, IRBlock *b) const
+    {
+        while (a != b)
+        {
+            while (rpoIndex_[a->id] > rpoIndex_[b->id])
+            {
+                a = idom_[a->id];
+            }
+            while (rpoIndex_[b->id] > rpoIndex_[a->id])
+            {
+                b = idom_[b->id];
+            }
+        }
+        return a;
+    }
+
+  private:
+    std::vector<IRBlock *> order_;
+    std::vector<int> rpoIndex_;
+    std::vector<IRBlock *> idom_;
+    std::vector<std::vector<IRBlock *>> children_;
+};
+
+/**
+ * 自然循环
+ */
+struct IRLoop
+{
+    IRBlock *header = nullptr;
+    IRBlock *preheader = nullptr;  ///< 循环外唯一的前驱，只有一个后继（循环头）
+    std::vector<IRBlock *> latches;  ///< 回边的起点
+    std::vector<IRBlock *> blocks;   ///< 按逆后序排列
+    std::vector<bool> contains;      ///< 按块编号索引
+
+    bool has(const IRBlock *block) const
+    {
+        return block->id < contains.size() && contains[block->id];
+    }
+
+    bool isInvariant(const IRInstr *value) const
+    {
+        return !has(value->block);
+    }
+};
+
+/**
+ * 找出函数中所有的自然循环
+ *
+ * 回边 latch -> header 要求 header 支配 latch，
+ * 循环体是从 latch 逆着边能走到、并且不经过 header 的所有块。
+ * 同一个循环头的多条回边合并成一个循环。
+ */
+class IRLoopInfo
+{
+  public:
+    explicit IRLoopInfo(IRFunction &fn) : fn_(fn)
+    {
+        analyze();
+    }
+
+    /**
+     * 从内到外排列，内层循环外提的指令还有机会继续外提
+     */
+    std::vector<IRLoop> &loops()
+    {
+        return loops_;
+    }
+
+    /**
+     * 保证每个循环都有 preheader，插入新块之后重新分析
+     *
+     * 循环头是入口块时没有地方放 preheader，这样的循环保持原样
+     */
+    void insertPreheaders()
+    {
+        bool inserted = false;
+        for (auto &loop : loops_)
+        {
+            if (loop.preheader == nullptr && loop.header != fn_.entry)
+            {
+                createPreheader(loop);
+                inserted = true;
+            }
+        }
+        if (inserted)
+        {
+            analyze();
+        }
+    }
+
+  private:
+    void analyze()
+    {
+        loops_.clear();
+        IRDominatorTree domTree(fn_);
+        std::vector<int> rpoIndex(fn_.blockIdBound(), -1);
+        for (size_t i = 0; i < domTree.order().size(); ++i)
+        {
+            rpoIndex[domTree.order()[i]->id] = static_cast<int>(i);
+        }
+        for (auto *header : domTree.order())
+        {
+            IRLoop loop;
+            loop.header = header;
+            for (auto *pred : header->preds)
+            {
+                if (rpoIndex[pred->id] >= 0 && domTree.dominates(header, pred))
+                {
+                    loop.latches.push_back(pred);
+                }
+            }
+            if (loop.latches.empty())
+            {
+                continue;
+            }
+            loop.contains.assign(fn_.blockIdBound(), false);
+            loop.contains[header->id] = true;
+            std::vector<IRBlock *> worklist(loop.latches);
+            while (!worklist.empty())
+            {
+                auto *block = worklist.back();
+                worklist.pop_back();
+                if (loop.contains[block->id])
+                {
+                    continue;
+                }
+                loop.contains[block->id] = true;
+                for (auto *pred : block->preds)
+                {
+                    worklist.push_back(pred);
+                }
+            }
+            for (auto *block : domTree.order())
+            {
+                if (loop.contains[block->id])
+                {
+                    loop.blocks.push_back(block);
+                }
+            }
+            std::vector<IRBlock *> outside;
+            for (auto *pred : header->preds)
+            {
+                if (!loop.has(pred))
+                {
+                    outside.push_back(pred);
+                }
+            }
+            if (outside.size() == 1 && outside[0]->succs().size() == 1)
+            {
+                loop.preheader = outside[0];
+            }
+            loops_.push_back(std::move(loop));
+        }
+        std::stable_sort(loops_.begin(), loops_.end(),
+                         [](const IRLoop &a, const IRLoop &b) {
+                             return a.blocks.size() < b.blocks.size();
+                         });
+    }
+
+    /**
+     * 把循环外进入循环头的边都改到新建的 preheader 上
+     */
+    void createPreheader(IRLoop &loop)
+    {
+        auto *header = loop.header;
+        auto *preheader = fn_.newBlock();
+        std::vector<IRBlock *> outside;
+        for (auto *pred : header->preds)
+        {
+            if (!loop.has(pred))
+            {
+                outside.push_back(pred);
+            }
+        }
+        // 循环头的每个 Phi，来自循环外的操作数在 preheader 中先汇合
+        for (auto *phi : header->instrs)
+        {
+            if (phi->op != IROpcode::Phi)
+            {
+                break;
+            }
+            auto *merged = fn_.newInstr(IROpcode::Phi);
+            merged->block = preheader;
+            preheader->instrs.push_back(merged);
+            std::vector<IRInstr *> inside;
+            for (size_t i = 0; i < header->preds.size(); ++i)
+            {
+                if (loop.has(header->preds[i]))
+                {
+                    inside.push_back(phi->operands[i]);
+                }
+                else
+                {
+                    merged->operands.push_back(phi->operands[i]);
+                }
+            }
+            inside.push_back(merged);
+            phi->operands = std::move(inside);
+        }
+        std::vector<IRBlock *> preds;
+        for (auto *pred : header->preds)
+        {
+            if (loop.has(pred))
+            {
+                preds.push_back(pred);
+            }
+        }
+        preds.push_back(preheader);
+        header->preds = std::move(preds);
+        for (auto *pred : outside)
+        {
+            for (auto &target : pred->terminator()->targets)
+            {
+                if (target == header)
+                {
+                    target = preheader;
+                }
+            }
+            preheader->preds.push_back(pred);
+        }
+        auto *jump = fn_.newInstr(IROpcode::Jump);
+        jump->block = preheader;
+        jump->targets.push_back(header);
+        preheader->instrs.push_back(jump);
+        loop.preheader = preheader;
+    }
+
+  private:
+    IRFunction &fn_;
+    std::vector<IRLoop> loops_;
+};
@@ -0,0 +1,1361 @@
+#pragma once
+
+#include <optional>
+#include <stdexcept>
+#include "./generated/FalconScriptParser.h"
+#include "AnnotatedTree.hpp"
+#include "Array.hpp"
+#include "IR.hpp"
+#include "SwitchTable.hpp"
+
+/**
+ * 脚本中有 IR 无法（或者不值得）表达的写法时抛出，调用方退回到 MyVisitor 解释执行
+ *
+ * 凡是 MyVisitor 会在运行时报错、断言失败的写法，这里都直接拒绝，保证两边的输出一致
+ * （数组下标越界除外，它要到运行时才知道，IR 中生成同样的报错分支）
+ */
+class IRUnsupported : public std::runtime_error
+{
+  public:
+    using std::runtime_error::runtime_error;
+};
+
+/**
+ * 从注解树构造 SSA 形式的 IR
+ *
+ * 变量在构造过程中直接转换为 SSA 值，不经过 alloca/load/store，
+ * 采用 Braun 等人的 "Simple and Efficient Construction of SSA Form"：
+ * 每个基本块记录变量的当前定义，读不到时沿着前驱查找，必要时插入 Phi；
+ * 前驱还没有全部确定的块（循环头）先插入不完整的 Phi，封闭（seal）时再补齐操作数。
+ */
+class IRBuilder
+{
+  public:
+    explicit IRBuilder(const AnnotatedTree *at)
+        : at_(at), cur_(nullptr), osr_(false)
+    {
+    }
+
+    /**
+     * 构造整个脚本
+     *
+     * globals 中的顶层变量从外部注入初值：声明时照常计算初始值，
+     * 然后换成第 i 个槽位中的值，槽位的顺序和 globals 相同
+     */
+    std::unique_ptr<IRFunction> build(
+        FalconScriptParser::ProgContext *ctx,
+        const std::vector<std::string> &globals = {})
+    {
+        fn_ = std::make_unique<IRFunction>();
+        fn_->slots = globals;
+        fn_->entry = fn_->newBlock();
+        sealBlock(fn_->entry);
+        cur_ = fn_->entry;
+
+        // 全局作用域
+        scopes_.emplace_back();
+        for (auto *statement : ctx->blockStatement())
+        {
+            buildBlockStatement(statement);
+        }
+        scopes_.pop_back();
+        emitTerminator(IROpcode::Return, {}, {});
+        return std::move(fn_);
+    }
+
+    /**
+     * 只构造一个循环语句剩下的迭代，用于栈上替换（OSR）
+     *
+     * 从循环条件开始执行，for 的 forInit 已经由解释器执行过了，
+     * do-while 在循环体之后进入，剩下的部分和 while 完全一样。
+     * 循环外定义的变量变成槽位：进入时读取，离开循环时写回。
+     */
+    std::unique_ptr<IRFunction> buildLoop(
+        FalconScriptParser::StatementContext *ctx)
+    {
+        fn_ = std::make_unique<IRFunction>();
+        fn_->entry = fn_->newBlock();
+        sealBlock(fn_->entry);
+        // 入口块只放常量和读取槽位的指令
+        auto *start = fn_->newBlock();
+        cur_ = fn_->entry;
+        emitTerminator(IROpcode::Jump, {}, {start});
+        sealBlock(start);
+        cur_ = start;
+        osr_ = true;
+
+        // 最外层是循环外的变量，用到的时候才加入
+        scopes_.emplace_back();
+        if (ctx->FOR())
+        {
+            bool hasScope = enterScope(ctx);
+            auto *forControl = ctx->forControl();
+            buildConditionLoop(forControl->expression(), ctx->statement(0),
+                               forControl->forUpdate);
+            exitScope(hasScope);
+        }
+        else if (ctx->WHILE())
+        {
+            buildConditionLoop(ctx->parExpression()->expression(),
+                               ctx->statement(0), nullptr);
+        }
+        else
+        {
+            throw IRUnsupported("不是循环语句");
+        }
+        for (size_t slot = 0; slot < slotVars_.size(); ++slot)
+        {
+            auto *store = emit(IROpcode::StoreSlot,
+                               {readVariable(slotVars_[slot], current())});
+            store->imm = static_cast<int32_t>(slot);
+        }
+        // 抛出异常之前也要写回，解释器接着用的是变量在出错时的值
+        for (auto *error : thrownErrors_)
+        {
+            auto *block = error->block;
+            for (size_t slot = 0; slot < slotVars_.size(); ++slot)
+            {
+                auto *store = fn_->newInstr(IROpcode::StoreSlot);
+                store->operands = {readVariable(slotVars_[slot], block)};
+                store->imm = static_cast<int32_t>(slot);
+                store->block = block;
+                auto &instrs = block->instrs;
+                instrs.insert(std::find(instrs.begin(), instrs.end(), error),
+                              store);
+            }
+        }
+        // 循环外的数组读取了第几维的长度，进入时就要保证它有这么多维
+        for (size_t array = 0; array < fn_->arrays.size(); ++array)
+        {
+            auto rank = fn_->arrays[array].rank;
+            auto used = arrayDims_[array].size();
+            if (rank == 0 ? used > 0 : used > rank)
+            {
+                throw IRUnsupported("数组的维数不确定");
+            }
+        }
+        scopes_.pop_back();
+        emitTerminator(IROpcode::Return, {}, {});
+        return std::move(fn_);
+    }
+
+  private:
+    /**
+     * 表达式的结果，和 MyVisitor 中 int32_t / int32_t* 两种结果对应
+     *
+     * var >= 0 时表示变量本身（左值），真正用到它的时候才读取变量的当前值
+     */
+    struct ExprValue
+    {
+        IRInstr *value;
+        int var;
+        /// 数组编号，>= 0 时表示数组、子数组或者数组元素（左值）
+        int array = -1;
+        /// 已经取过的下标个数
+        size_t depth = 0;
+        /// 按行展开后的下标，depth 为 0 时为空
+        IRInstr *offset = nullptr;
+    };
+
+    /**
+     * 循环的跳转目标
+     */
+    struct LoopTargets
+    {
+        IRBlock *breakTarget;
+        IRBlock *continueTarget;
+    };
+
+  private:
+    /**
+     * MyVisitor 在 blockStatement 上捕获运行时错误，输出之后执行下一条语句，
+     * 所以每条 blockStatement 之后都可能是错误的汇合点
+     */
+    void buildBlockStatement(FalconScriptParser::BlockStatementContext *ctx)
+    {
+        errorTargets_.push_back(nullptr);
+        if (ctx->statement())
+        {
+            buildStatement(ctx->statement());
+        }
+        else if (ctx->variableDeclarators())
+        {
+            buildVariableDeclarators(ctx->variableDeclarators());
+        }
+        auto *after = errorTargets_.back();
+        errorTargets_.pop_back();
+        if (after != nullptr)
+        {
+            emitTerminator(IROpcode::Jump, {}, {after});
+            sealBlock(after);
+            cur_ = after;
+        }
+    }
+
+    void buildBlock(FalconScriptParser::BlockContext *ctx)
+    {
+        bool hasScope = enterScope(ctx);
+        for (auto *statement : ctx->blockStatement())
+        {
+            buildBlockStatement(statement);
+        }
+        exitScope(hasScope);
+    }
+
+    void buildStatement(FalconScriptParser::StatementContext *ctx)
+    {
+        if (ctx->blockLabel)
+        {
+            buildBlock(ctx->blockLabel);
+        }
+        else if (ctx->IF())
+        {
+            auto *cond =
+                deref(buildExpression(ctx->parExpression()->expression()));
+            auto *thenBlock = fn_->newBlock();
+            auto *mergeBlock = fn_->newBlock();
+            auto *elseBlock = ctx->ELSE() ? fn_->newBlock() : mergeBlock;
+            emitTerminator(IROpcode::Branch, {cond}, {thenBlock, elseBlock});
+
+            sealBlock(thenBlock);
+            cur_ = thenBlock;
+            buildStatement(ctx->statement(0));
+            emitTerminator(IROpcode::Jump, {}, {mergeBlock});
+
+            if (ctx->ELSE())
+            {
+                sealBlock(elseBlock);
+                cur_ = elseBlock;
+                buildStatement(ctx->statement(1));
+                emitTerminator(IROpcode::Jump, {}, {mergeBlock});
+            }
+            sealBlock(mergeBlock);
+            cur_ = mergeBlock;
+        }
+        else if (ctx->FOR())
+        {
+            bool hasScope = enterScope(ctx);
+            auto *forControl = ctx->forControl();
+            if (forControl->forInit())
+            {
+                auto *forInit = forControl->forInit();
+                if (forInit->variableDeclarators())
+                {
+                    buildVariableDeclarators(forInit->variableDeclarators());
+                }
+                else if (forInit->expressionList())
+                {
+                    buildExpressionList(forInit->expressionList());
+                }
+            }
+            buildConditionLoop(forControl->expression(), ctx->statement(0),
+                               forControl->forUpdate);
+            exitScope(hasScope);
+        }
+        else if (ctx->WHILE() && ctx->DO() == nullptr)
+        {
+            buildConditionLoop(ctx->parExpression()->expression(),
+                               ctx->statement(0), nullptr);
+        }
+        else if (ctx->DO())
+        {
+            auto *body = fn_->newBlock();
+            auto *condBlock = fn_->newBlock();
+            auto *exit = fn_->newBlock();
+            emitTerminator(IROpcode::Jump, {}, {body});
+
+            cur_ = body;
+            loops_.push_back({exit, condBlock});
+            buildStatement(ctx->statement(0));
+            loops_.pop_back();
+            emitTerminator(IROpcode::Jump, {}, {condBlock});
+
+            sealBlock(condBlock);
+            cur_ = condBlock;
+            auto *cond = loopCondition(ctx->parExpression()->expression());
+            emitTerminator(IROpcode::Branch, {cond}, {body, exit});
+            sealBlock(body);
+
+            sealBlock(exit);
+            cur_ = exit;
+        }
+        else if (ctx->SWITCH())
+        {
+            buildSwitch(ctx);
+        }
+        else if (ctx->BREAK() || ctx->CONTINUE())
+        {
+            auto *target =
+                loops_.empty() ? nullptr
+                : ctx->BREAK() ? loops_.back().breakTarget
+                               : loops_.back().continueTarget;
+            if (target == nullptr)
+            {
+                // MyVisitor 会输出警告并忽略
+                throw IRUnsupported("break/continue不在循环中");
+            }
+            emitTerminator(IROpcode::Jump, {}, {target});
+        }
+        else if (ctx->statementExpression)
+        {
+            auto *expression = ctx->statementExpression;
+            auto result = buildExpression(expression);
+            // 类似于 a; 的语句，输出变量的值
+            if (result.array >= 0 && result.depth == 0)
+            {
+                auto *print = emit(IROpcode::PrintArray, {});
+                print->imm = result.array;
+                print->text = expression->getText();
+            }
+            else if (expression->primary() || expression->L_BRACKET())
+            {
+                if (result.var < 0 && result.array < 0)
+                {
+                    throw IRUnsupported("只能输出变量的值");
+                }
+                auto *print = emit(IROpcode::Print, {deref(result)});
+                print->text = expression->getText();
+            }
+        }
+    }
+
+    /**
+     * 先判断条件的循环：for 去掉 forInit 之后的部分，以及 while
+     *
+     * cond 为空表示没有条件，update 为空时 continue 直接回到循环头
+     */
+    void buildConditionLoop(FalconScriptParser::ExpressionContext *cond,
+                            FalconScriptParser::StatementContext *body,
+                            FalconScriptParser::ExpressionListContext *update)
+    {
+        auto *header = fn_->newBlock();
+        auto *bodyBlock = fn_->newBlock();
+        auto *updateBlock = update ? fn_->newBlock() : header;
+        auto *exit = fn_->newBlock();
+        emitTerminator(IROpcode::Jump, {}, {header});
+
+        // 循环头要等回边出现之后才能封闭
+        cur_ = header;
+        if (cond)
+        {
+            emitTerminator(IROpcode::Branch, {loopCondition(cond)},
+                           {bodyBlock, exit});
+        }
+        else
+        {
+            emitTerminator(IROpcode::Jump, {}, {bodyBlock});
+        }
+
+        sealBlock(bodyBlock);
+        cur_ = bodyBlock;
+        loops_.push_back({exit, updateBlock});
+        buildStatement(body);
+        loops_.pop_back();
+        emitTerminator(IROpcode::Jump, {}, {updateBlock});
+
+        if (update)
+        {
+            sealBlock(updateBlock);
+            cur_ = updateBlock;
+            buildExpressionList(update);
+            emitTerminator(IROpcode::Jump, {}, {header});
+        }
+        sealBlock(header);
+
+        sealBlock(exit);
+        cur_ = exit;
+    }
+
+    /**
+     * switch 语句：每个语句组一个基本块，没有 break 时落到下一个语句组的块
+     *
+     * 分派用一条 Switch 指令完成，下降到字节码时变成跳转表或者二分查找
+     */
+    void buildSwitch(FalconScriptParser::StatementContext *ctx)
+    {
+        std::vector<std::pair<int32_t, int>> labels;
+        int defaultTarget;
+        try
+        {
+            switchLabels(ctx, labels, defaultTarget);
+        }
+        catch (std::runtime_error &e)
+        {
+            throw IRUnsupported(e.what());
+        }
+        auto groups = ctx->switchBlockStatementGroup();
+        for (size_t i = 0; i + 1 < groups.size(); ++i)
+        {
+            for (auto *statement : groups[i]->blockStatement())
+            {
+                // 跳到后面的分支时，这里定义的变量在解释器中不存在
+                if (statement->variableDeclarators())
+                {
+                    throw IRUnsupported("switch 的分支之间共享变量");
+                }
+            }
+        }
+
+        auto *value =
+            deref(buildExpression(ctx->parExpression()->expression()));
+        bool hasScope = enterScope(ctx);
+        // 最后一个是出口，对应没有语句的结尾标签
+        std::vector<IRBlock *> blocks;
+        for (size_t i = 0; i <= groups.size(); ++i)
+        {
+            blocks.push_back(fn_->newBlock());
+        }
+        auto *exit = blocks.back();
+        // 多个标签跳到同一个块时只保留一条边
+        std::vector<IRBlock *> targets = {blocks[defaultTarget]};
+        std::vector<std::pair<int32_t, int>> cases;
+        for (auto &[label, group] : labels)
+        {
+            auto it = std::find(targets.begin(), targets.end(), blocks[group]);
+            if (it == targets.end())
+            {
+                it = targets.insert(it, blocks[group]);
+            }
+            cases.push_back(
+                {label, static_cast<int>(std::distance(targets.begin(), it))});
+        }
+        auto *dispatch = emitTerminator(IROpcode::Switch, {value}, targets);
+        dispatch->cases = std::move(cases);
+
+        // break 跳出 switch，continue 属于外层的循环
+        loops_.push_back(
+            {exit, loops_.empty() ? nullptr : loops_.back().continueTarget});
+        for (size_t i = 0; i < groups.size(); ++i)
+        {
+            // 前驱只有分派和上一个语句组，此时都已经确定
+            sealBlock(blocks[i]);
+            cur_ = blocks[i];
+            for (auto *statement : groups[i]->blockStatement())
+            {
+                buildBlockStatement(statement);
+            }
+            emitTerminator(IROpcode::Jump, {}, {blocks[i + 1]});
+        }
+        loops_.pop_back();
+        exitScope(hasScope);
+
+        sealBlock(exit);
+        cur_ = exit;
+    }
+
+    void buildVariableDeclarators(
+        FalconScriptParser::VariableDeclaratorsContext *ctx)
+    {
+        // map、long 和 bigint 只在 MyVisitor 中实现
+        if (ctx->typeType()->MAP() || !ctx->typeType()->primitiveType()->INT())
+        {
+            throw IRUnsupported(ctx->typeType()->getText());
+        }
+        auto errors = errorPaths_;
+        auto *start = current();
+        for (auto *declarator : ctx->variableDeclarator())
+        {
+            if (!declarator->variableDeclaratorId()->expression().empty())
+            {
+                buildArrayDeclarator(declarator);
+                continue;
+            }
+            // 先计算初始值，此时同名的外层变量仍然可见
+            IRInstr *value;
+            if (declarator->variableInitializer())
+            {
+                value = deref(buildExpression(
+                    declarator->variableInitializer()->expression()));
+            }
+            else
+            {
+                value = constant(0);
+            }
+            auto name =
+                declarator->variableDeclaratorId()->IDENTIFIER()->getText();
+            if (!osr_ && scopes_.size() == 1)
+            {
+                auto &slots = fn_->slots;
+                auto slot = std::find(slots.begin(), slots.end(), name);
+                if (slot != slots.end())
+                {
+                    value = emit(IROpcode::LoadSlot, {});
+                    value->imm = static_cast<int32_t>(slot - slots.begin());
+                }
+            }
+            auto &scope = scopes_.back();
+            if (scope.find(name) != scope.end())
+            {
+                throw IRUnsupported("变量" + name + "已定义");
+            }
+            // 初始值出错时 MyVisitor 不会定义这个变量（以及后面的变量），
+            // 之后用到它时报错，或者用到外层的同名变量
+            bool fallible = errorPaths_ != errors;
+            if (fallible && findVariable(name) >= 0)
+            {
+                throw IRUnsupported("可能声明失败的变量" + name +
+                                    "和外层变量同名");
+            }
+            int var = newVariable();
+            scope[name] = var;
+            writeVariable(var, current(), value);
+            if (fallible)
+            {
+                int flag = newVariable();
+                writeVariable(flag, start, constant(0));
+                writeVariable(flag, current(), constant(1));
+                definedFlags_[var] = flag;
+                if (osr_)
+                {
+                    fn_->shadows.push_back(name);
+                }
+            }
+        }
+    }
+
+    /**
+     * int a[2][3] = {{1, 2, 3}, {4, 5, 6}};
+     *
+     * MyVisitor 在离开作用域时释放数组，虚拟机中的数组一直存在到执行结束，
+     * 所以只支持顶层的数组，每条声明只执行一次。
+     * 长度必须是编译期常量，这样声明本身不会失败，元素个数也能在编译时检查
+     */
+    void buildArrayDeclarator(
+        FalconScriptParser::VariableDeclaratorContext *ctx)
+    {
+        auto *id = ctx->variableDeclaratorId();
+        auto name = id->IDENTIFIER()->getText();
+        if (osr_ || scopes_.size() != 1 || !loops_.empty())
+        {
+            throw IRUnsupported("只支持顶层的数组");
+        }
+        if (scopes_.back().count(name))
+        {
+            throw IRUnsupported("变量" + name + "已定义");
+        }
+        IRArray array;
+        array.name = name;
+        std::vector<IRInstr *> lengths;
+        size_t size = 1;
+        auto errors = errorPaths_;
+        for (auto *dimension : id->expression())
+        {
+            auto length = constantValue(deref(buildExpression(dimension)));
+            if (!length || *length <= 0 || errorPaths_ != errors)
+            {
+                throw IRUnsupported("数组的长度必须是正的常量");
+            }
+            auto dim = static_cast<size_t>(*length);
+            if (dim > Array::maxSize / size)
+            {
+                throw IRUnsupported("数组太大");
+            }
+            size *= dim;
+            array.dims.push_back(dim);
+            lengths.push_back(constant(*length));
+        }
+        auto *initializer = ctx->variableInitializer();
+        if (initializer && initializer->arrayInitializer() == nullptr)
+        {
+            throw IRUnsupported("数组只能用花括号初始化");
+        }
+        array.rank = array.dims.size();
+        int index = static_cast<int>(fn_->arrays.size());
+        fn_->arrays.push_back(std::move(array));
+        arrayDims_.push_back(std::move(lengths));
+        auto *create = emit(IROpcode::NewArray, {});
+        create->imm = index;
+        // 先定义再初始化，初始值中可以用到数组自己
+        int var = newVariable();
+        scopes_.back()[name] = var;
+        arrayVars_[var] = index;
+        if (initializer)
+        {
+            initializeArray(index, initializer->arrayInitializer(), 0, 0);
+        }
+    }
+
+    /**
+     * 按花括号的嵌套层次逐维填充，从 offset 开始写入第 depth 维
+     */
+    void initializeArray(int array,
+                         FalconScriptParser::ArrayInitializerContext *ctx,
+                         size_t depth,
+                         size_t offset)
+    {
+        auto dims = fn_->arrays[array].dims;
+        size_t stride = 1;
+        for (size_t k = depth + 1; k < dims.size(); ++k)
+        {
+            stride *= dims[k];
+        }
+        auto initializers = ctx->variableInitializer();
+        if (initializers.size() > dims[depth])
+        {
+            throw IRUnsupported("初始值的个数超过了数组的长度");
+        }
+        for (size_t i = 0; i < initializers.size(); ++i)
+        {
+            auto *nested = initializers[i]->arrayInitializer();
+            if ((depth + 1 < dims.size()) != (nested != nullptr))
+            {
+                throw IRUnsupported("初始值的层次和数组的维数不一致");
+            }
+            if (nested)
+            {
+                initializeArray(array, nested, depth + 1, offset + i * stride);
+                continue;
+            }
+            auto *value =
+                deref(buildExpression(initializers[i]->expression()));
+            auto *store = emit(
+                IROpcode::StoreElement,
+                {constant(static_cast<int32_t>(offset + i * stride)), value});
+            store->imm = array;
+        }
+    }
+
+    void buildExpressionList(FalconScriptParser::ExpressionListContext *ctx)
+    {
+        for (auto *expression : ctx->expression())
+        {
+            buildExpression(expression);
+        }
+    }
+
+    /**
+     * 循环条件，MyVisitor 直接 as<int>()，所以不接受单独的变量
+     */
+    IRInstr *loopCondition(FalconScriptParser::ExpressionContext *ctx)
+    {
+        auto cond = buildExpression(ctx);
+        if (cond.var >= 0 || cond.array >= 0)
+        {
+            throw IRUnsupported("循环条件不能是单独的变量");
+        }
+        return cond.value;
+    }
+
+    ExprValue buildExpression(FalconScriptParser::ExpressionContext *ctx)
+    {
+        if (ctx->primary())
+        {
+            return buildPrimary(ctx->primary());
+        }
+        // 内置函数直接在 MyVisitor 中批量处理数组，不值得翻译成 IR
+        else if (ctx->methodCall())
+        {
+            throw IRUnsupported("内置函数");
+        }
+        // 数组下标，和 MyVisitor 一样先求数组再求下标，然后检查下标
+        else if (ctx->L_BRACKET())
+        {
+            auto array = buildArray(ctx->expression(0));
+            auto *index = deref(buildExpression(ctx->expression(1)));
+            return indexArray(array, index);
+        }
+        // 双目运算符
+        else if (ctx->bop != nullptr && ctx->expression().size() == 2)
+        {
+            auto type = ctx->bop->getType();
+            auto binaryOp = binaryOpcode(type);
+            if (binaryOp != IROpcode::Return)
+            {
+                // 左右两边都求值之后才读取变量的值，和 MyVisitor 一致
+                auto left = buildExpression(ctx->expression(0));
+                auto right = buildExpression(ctx->expression(1));
+                auto *lhs = deref(left);
+                auto *rhs = deref(right);
+                return {emitBinary(binaryOp, lhs, rhs), -1};
+            }
+            // 赋值号左边只能是变量名或者数组元素
+            auto *leftPrimary = ctx->expression(0)->primary();
+            bool isVariable =
+                leftPrimary != nullptr && leftPrimary->IDENTIFIER() != nullptr;
+            if (!isVariable && ctx->expression(0)->L_BRACKET() == nullptr)
+            {
+                throw IRUnsupported("赋值号左侧必须是变量");
+            }
+            auto left = buildExpression(ctx->expression(0));
+            auto *rhs = deref(buildExpression(ctx->expression(1)));
+            IRInstr *value = rhs;
+            if (type != FalconScriptParser::ASSIGN)
+            {
+                value = emitBinary(assignOpcode(type), deref(left), rhs);
+            }
+            assign(left, value);
+            return {value, -1};
+        }
+        // 前置单目运算符
+        else if (ctx->prefix != nullptr && ctx->expression().size() == 1)
+        {
+            auto child = buildExpression(ctx->expression(0));
+            switch (ctx->prefix->getType())
+            {
+                case FalconScriptParser::PLUS:
+                    return {deref(child), -1};
+                case FalconScriptParser::MINUS:
+                    return {emit(IROpcode::Neg, {deref(child)}), -1};
+                case FalconScriptParser::NOT:
+                    return {emit(IROpcode::Not, {deref(child)}), -1};
+                case FalconScriptParser::NEGATE:
+                    return {emit(IROpcode::BitNot, {deref(child)}), -1};
+                case FalconScriptParser::INCREMENT:
+                case FalconScriptParser::DECREMENT:
+                {
+                    auto *value = increment(child, ctx->prefix->getType(),
+                                            deref(child));
+                    return {value, -1};
+                }
+            }
+        }
+        // 后置单目运算符
+        else if (ctx->postfix != nullptr)
+        {
+            auto child = buildExpression(ctx->expression(0));
+            auto *old = deref(child);
+            increment(child, ctx->postfix->getType(), old);
+            return {old, -1};
+        }
+        // 三目运算符，只会执行其中一个分支
+        else if (ctx->bop != nullptr && ctx->expression().size() == 3 &&
+                 ctx->bop->getType() == FalconScriptParser::TERNARY)
+        {
+            auto cond = buildExpression(ctx->expression(0));
+            if (cond.var >= 0 || cond.array >= 0)
+            {
+                throw IRUnsupported("三目运算符的条件不能是单独的变量");
+            }
+            auto *trueBlock = fn_->newBlock();
+            auto *falseBlock = fn_->newBlock();
+            auto *mergeBlock = fn_->newBlock();
+            emitTerminator(IROpcode::Branch, {cond.value},
+                           {trueBlock, falseBlock});
+
+            // 借用一个临时变量在两个分支之间传递结果
+            int var = static_cast<int>(currentDef_.size());
+            currentDef_.emplace_back();
+
+            sealBlock(trueBlock);
+            cur_ = trueBlock;
+            writeVariable(var, current(),
+                          deref(buildExpression(ctx->expression(1))));
+            emitTerminator(IROpcode::Jump, {}, {mergeBlock});
+
+            sealBlock(falseBlock);
+            cur_ = falseBlock;
+            writeVariable(var, current(),
+                          deref(buildExpression(ctx->expression(2))));
+            emitTerminator(IROpcode::Jump, {}, {mergeBlock});
+
+            sealBlock(mergeBlock);
+            cur_ = mergeBlock;
+            return {readVariable(var, current()), -1};
+        }
+        throw IRUnsupported("未知的表达式");
+    }
+
+    ExprValue buildPrimary(FalconScriptParser::PrimaryContext *ctx)
+    {
+        if (ctx->L_PAREN() && ctx->R_PAREN())
+        {
+            return buildExpression(ctx->expression());
+        }
+        else if (ctx->literal())
+        {
+            if (ctx->literal()->STRING_LITERAL())
+            {
+                throw IRUnsupported("字符串");
+            }
+            return {constant(integerLiteral(ctx->literal()->integerLiteral())),
+                    -1};
+        }
+        auto name = ctx->IDENTIFIER()->getText();
+        int var = findVariable(name);
+        if (var < 0)
+        {
+            if (osr_)
+            {
+                return {nullptr, externalVariable(name)};
+            }
+            throw IRUnsupported("变量" + name + "未定义");
+        }
+        auto flag = definedFlags_.find(var);
+        if (flag != definedFlags_.end())
+        {
+            check(readVariable(flag->second, current()), [&] {
+                auto *error = emit(IROpcode::Error, {});
+                error->text = "变量" + name + "未定义";
+                return error;
+            });
+        }
+        auto array = arrayVars_.find(var);
+        if (array != arrayVars_.end())
+        {
+            return {nullptr, -1, array->second};
+        }
+        return {nullptr, var};
+    }
+
+    /**
+     * 下标运算的左侧，栈上替换时没见过的名字是循环外的数组
+     */
+    ExprValue buildArray(FalconScriptParser::ExpressionContext *ctx)
+    {
+        auto *primary = ctx->primary();
+        if (osr_ && primary && primary->IDENTIFIER() &&
+            findVariable(primary->IDENTIFIER()->getText()) < 0)
+        {
+            return {nullptr, -1,
+                    externalArray(primary->IDENTIFIER()->getText())};
+        }
+        auto array = buildExpression(ctx);
+        if (array.array < 0)
+        {
+            throw IRUnsupported(ctx->getText() + "不是数组");
+        }
+        return array;
+    }
+
+    /**
+     * 取一个下标：越界时报错，否则把下标累加到按行展开的下标上
+     */
+    ExprValue indexArray(const ExprValue &array, IRInstr *index)
+    {
+        auto rank = fn_->arrays[array.array].rank;
+        if (rank != 0 && array.depth >= rank)
+        {
+            throw IRUnsupported("不是数组");
+        }
+        auto *length = arrayLength(array.array, array.depth);
+        check(emit(IROpcode::InBounds, {index, length}), [&] {
+            return emit(IROpcode::IndexError, {index, length});
+        });
+        auto *offset = index;
+        if (array.depth > 0)
+        {
+            offset = emit(IROpcode::Add,
+                          {emit(IROpcode::Mul, {array.offset, length}), index});
+        }
+        return {nullptr, -1, array.array, array.depth + 1, offset};
+    }
+
+    /**
+     * 第 k 维的长度，循环外的数组在入口块中读取
+     */
+    IRInstr *arrayLength(int array, size_t k)
+    {
+        auto &dims = arrayDims_[array];
+        if (dims.size() <= k)
+        {
+            dims.resize(k + 1, nullptr);
+        }
+        if (dims[k] == nullptr)
+        {
+            auto *dim = fn_->newInstr(IROpcode::ArrayDim);
+            dim->imm = array;
+            dim->dim = static_cast<int32_t>(k);
+            dim->block = fn_->entry;
+            auto &instrs = fn_->entry->instrs;
+            instrs.insert(instrs.end() - 1, dim);
+            dims[k] = dim;
+        }
+        return dims[k];
+    }
+
+    /**
+     * 在所有作用域中由内向外查找，找不到时返回 -1
+     */
+    int findVariable(const std::string &name) const
+    {
+        for (auto it = scopes_.rbegin(); it != scopes_.rend(); ++it)
+        {
+            auto found = it->find(name);
+            if (found != it->end())
+            {
+                return found->second;
+            }
+        }
+        return -1;
+    }
+
+    int newVariable()
+    {
+        int var = static_cast<int>(currentDef_.size());
+        currentDef_.emplace_back();
+        return var;
+    }
+
+    /**
+     * 循环外的变量，在入口块中读取槽位作为它的初始定义
+     */
+    int externalVariable(const std::string &name)
+    {
+        int var = newVariable();
+        scopes_.front()[name] = var;
+
+        auto *load = fn_->newInstr(IROpcode::LoadSlot);
+        load->imm = static_cast<int32_t>(fn_->slots.size());
+        load->block = fn_->entry;
+        auto &instrs = fn_->entry->instrs;
+        instrs.insert(instrs.end() - 1, load);
+        fn_->slots.push_back(name);
+        slotVars_.push_back(var);
+        writeVariable(var, fn_->entry, load);
+        return var;
+    }
+
+    /**
+     * 循环外的数组，维数和各维的长度由第一次进入时的数组决定
+     */
+    int externalArray(const std::string &name)
+    {
+        int var = newVariable();
+        scopes_.front()[name] = var;
+        int array = static_cast<int>(fn_->arrays.size());
+        fn_->arrays.push_back({name, {}, 0});
+        arrayDims_.emplace_back();
+        arrayVars_[var] = array;
+        return array;
+    }
+
+    /**
+     * ++/--，old 是变量原来的值，返回新值
+     */
+    IRInstr *increment(const ExprValue &child, size_t tokenType, IRInstr *old)
+    {
+        if (child.var < 0 && child.array < 0)
+        {
+            throw IRUnsupported("自增自减的对象必须是变量");
+        }
+        auto op = tokenType == FalconScriptParser::INCREMENT ? IROpcode::Add
+                                                             : IROpcode::Sub;
+        auto *value = emit(op, {old, constant(1)});
+        assign(child, value);
+        return value;
+    }
+
+    /**
+     * 在编译时就能算出来的值，算不出来时返回空
+     */
+    static std::optional<int32_t> constantValue(const IRInstr *value)
+    {
+        if (value->op == IROpcode::Const)
+        {
+            return value->imm;
+        }
+        if (value->isUnary())
+        {
+            auto a = constantValue(value->operands[0]);
+            if (a)
+            {
+                return irEvalUnary(value->op, *a);
+            }
+        }
+        else if (value->isBinary())
+        {
+            auto a = constantValue(value->operands[0]);
+            auto b = constantValue(value->operands[1]);
+            if (a && b && irCanFold(value->op, *a, *b))
+            {
+                return irEvalBinary(value->op, *a, *b);
+            }
+        }
+        return std::nullopt;
+    }
+
+    /**
+     * 超出 int 范围的字面量在 MyVisitor 中报错，这里同样拒绝
+     */
+    static int32_t integerLiteral(
+        FalconScriptParser::IntegerLiteralContext *ctx)
+    {
+        if (isLongLiteral(ctx))
+        {
+            throw IRUnsupported("long");
+        }
+        try
+        {
+            return intLiteral(ctx);
+        }
+        catch (std::runtime_error &e)
+        {
+            throw IRUnsupported(e.what());
+        }
+    }
+
+    /**
+     * 普通双目运算符对应的操作码，不是普通双目运算符时返回 Return
+     */
+    static IROpcode binaryOpcode(size_t tokenType)
+    {
+        switch (tokenType)
+        {
+            case FalconScriptParser::PLUS:
+                return IROpcode::Add;
+            case FalconScriptParser::MINUS:
+                return IROpcode::Sub;
+            case FalconScriptParser::MULTIPLY:
+                return IROpcode::Mul;
+            case FalconScriptParser::DIVIDE:
+                return IROpcode::Div;
+            case FalconScriptParser::MODULUS:
+                return IROpcode::Mod;
+            case FalconScriptParser::L_SHIFT:
+                return IROpcode::Shl;
+            case FalconScriptParser::R_SHIFT:
+                return IROpcode::Shr;
+            case FalconScriptParser::EQUAL:
+                return IROpcode::Eq;
+            case FalconScriptParser::NOT_EQUAL:
+                return IROpcode::Ne;
+            case FalconScriptParser::LESS:
+                return IROpcode::Lt;
+            case FalconScriptParser::LESS_EQUAL:
+                return IROpcode::Le;
+            case FalconScriptParser::GREATER:
+                return IROpcode::Gt;
+            case FalconScriptParser::GREATER_EQUAL:
+                return IROpcode::Ge;
+            case FalconScriptParser::BIT_AND:
+                return IROpcode::BitAnd;
+            case FalconScriptParser::BIT_OR:
+                return IROpcode::BitOr;
+            case FalconScriptParser::BIT_XOR:
+                return IROpcode::BitXor;
+            case FalconScriptParser::AND:
+                return IROpcode::And;
+            case FalconScriptParser::OR:
+                return IROpcode::Or;
+            default:
+                return IROpcode::Return;
+        }
+    }
+
+    /**
+     * 复合赋值运算符对应的操作码
+     */
+    static IROpcode assignOpcode(size_t tokenType)
+    {
+        switch (tokenType)
+        {
+            case FalconScriptParser::PLUS_ASSIGN:
+                return IROpcode::Add;
+            case FalconScriptParser::MINUS_ASSIGN:
+                return IROpcode::Sub;
+            case FalconScriptParser::MULTIPLY_ASSIGN:
+                return IROpcode::Mul;
+            case FalconScriptParser::DIVIDE_ASSIGN:
+                return IROpcode::Div;
+            case FalconScriptParser::MODULUS_ASSIGN:
+                return IROpcode::Mod;
+            case FalconScriptParser::L_SHIFT_ASSIGN:
+                return IROpcode::Shl;
+            case FalconScriptParser::R_SHIFT_ASSIGN:
+                return IROpcode::Shr;
+            case FalconScriptParser::BIT_AND_ASSIGN:
+                return IROpcode::BitAnd;
+            case FalconScriptParser::BIT_OR_ASSIGN:
+                return IROpcode::BitOr;
+            case FalconScriptParser::BIT_XOR_ASSIGN:
+                return IROpcode::BitXor;
+            default:
+                throw IRUnsupported("未知的赋值运算符");
+        }
+    }
+
+  private:
+    /**
+     * 和 MyListener 的划分保持一致：有作用域的节点才新建一层名字表
+     */
+    bool enterScope(antlr4::ParserRuleContext *ctx)
+    {
+        if (at_->node2scope.find(ctx) == at_->node2scope.end())
+        {
+            return false;
+        }
+        scopes_.emplace_back();
+        return true;
+    }
+
+    void exitScope(bool hasScope)
+    {
+        if (hasScope)
+        {
+            scopes_.pop_back();
+        }
+    }
+
+    IRInstr *deref(const ExprValue &value)
+    {
+        if (value.array >= 0)
+        {
+            requireElement(value);
+            auto *load = emit(IROpcode::LoadElement, {value.offset});
+            load->imm = value.array;
+            return load;
+        }
+        if (value.var >= 0)
+        {
+            return readVariable(value.var, current());
+        }
+        return value.value;
+    }
+
+    /**
+     * 写入变量或者数组元素
+     */
+    void assign(const ExprValue &target, IRInstr *value)
+    {
+        if (target.array >= 0)
+        {
+            requireElement(target);
+            auto *store = emit(IROpcode::StoreElement, {target.offset, value});
+            store->imm = target.array;
+        }
+        else
+        {
+            writeVariable(target.var, current(), value);
+        }
+    }
+
+    /**
+     * 只有数组元素能参与运算，整个数组和子数组在 MyVisitor 中会报错
+     */
+    void requireElement(const ExprValue &value)
+    {
+        auto &array = fn_->arrays[value.array];
+        if (value.depth == 0)
+        {
+            throw IRUnsupported("数组不能直接参与运算");
+        }
+        // 循环外的数组，第一次取到元素时确定维数
+        if (array.rank == 0)
+        {
+            array.rank = value.depth;
+        }
+        if (array.rank != value.depth)
+        {
+            throw IRUnsupported("数组不能直接参与运算");
+        }
+    }
+
+    /**
+     * 双目运算，除数可能为 0 时先检查，和 MyVisitor 一样报错
+     */
+    IRInstr *emitBinary(IROpcode op, IRInstr *lhs, IRInstr *rhs)
+    {
+        bool divides = op == IROpcode::Div || op == IROpcode::Mod;
+        if (divides && !(rhs->op == IROpcode::Const && rhs->imm != 0))
+        {
+            check(emit(IROpcode::Ne, {rhs, constant(0)}), [&] {
+                auto *error = emit(IROpcode::Error, {});
+                error->text = "除数不能为0";
+                return error;
+            });
+        }
+        return emit(op, {lhs, rhs});
+    }
+
+    /**
+     * cond 为 0 时报告运行时错误，error 在出错的分支中生成错误指令
+     */
+    template <typename MakeError>
+    void check(IRInstr *cond, MakeError error)
+    {
+        auto *ok = fn_->newBlock();
+        auto *fail = fn_->newBlock();
+        emitTerminator(IROpcode::Branch, {cond}, {ok, fail});
+        sealBlock(fail);
+        cur_ = fail;
+        raise(error());
+        sealBlock(ok);
+        cur_ = ok;
+    }
+
+    /**
+     * 报告错误之后跳到当前 blockStatement 的下一条语句，和 MyVisitor 一致
+     *
+     * 栈上替换时循环本身不在任何 blockStatement 中，这时改为抛出异常，
+     * 由循环外的解释器捕获
+     */
+    void raise(IRInstr *error)
+    {
+        ++errorPaths_;
+        if (errorTargets_.empty())
+        {
+            error->imm = 1;
+            thrownErrors_.push_back(error);
+            emitTerminator(IROpcode::Return, {}, {});
+            return;
+        }
+        auto *&target = errorTargets_.back();
+        if (target == nullptr)
+        {
+            target = fn_->newBlock();
+        }
+        emitTerminator(IROpcode::Jump, {}, {target});
+    }
+
+    IRInstr *constant(int32_t value)
+    {
+        return fn_->constant(value);
+    }
+
+    /**
+     * break/continue 之后的代码不可达，放到一个没有前驱的块里，最后统一删除
+     */
+    IRBlock *current()
+    {
+        if (cur_ == nullptr)
+        {
+            cur_ = fn_->newBlock();
+            sealBlock(cur_);
+        }
+        return cur_;
+    }
+
+    IRInstr *emit(IROpcode op, std::vector<IRInstr *> operands)
+    {
+        current();
+        auto *instr = fn_->newInstr(op);
+        instr->operands = std::move(operands);
+        instr->block = cur_;
+        cur_->instrs.push_back(instr);
+        return instr;
+    }
+
+    IRInstr *emitTerminator(IROpcode op,
+                            std::vector<IRInstr *> operands,
+                            std::vector<IRBlock *> targets)
+    {
+        // 紧跟在 break/continue 后面的跳转本身也不可达
+        if (cur_ == nullptr && operands.empty())
+        {
+            return nullptr;
+        }
+        auto *instr = emit(op, std::move(operands));
+        instr->targets = std::move(targets);
+        for (auto *target : instr->targets)
+        {
+            IRFunction::addEdge(cur_, target);
+        }
+        cur_ = nullptr;
+        return instr;
+    }
+
+  private:
+    void writeVariable(int var, IRBlock *block, IRInstr *value)
+    {
+        currentDef_[var][block->id] = value;
+    }
+
+    IRInstr *readVariable(int var, IRBlock *block)
+    {
+        auto &defs = currentDef_[var];
+        auto it = defs.find(block->id);
+        if (it != defs.end())
+        {
+            return it->second;
+        }
+        return readVariableRecursive(var, block);
+    }
+
+    IRInstr *readVariableRecursive(int var, IRBlock *block)
+    {
+        IRInstr *value;
+        if (!isSealed(block))
+        {
+            value = newPhi(block);
+            incompletePhis_[block->id].push_back({var, value});
+        }
+        else if (block->preds.empty())
+        {
+            // 只有不可达的代码会走到这里
+            value = constant(0);
+        }
+        else if (block->preds.size() == 1)
+        {
+            value = readVariable(var, block->preds[0]);
+        }
+        else
+        {
+            // 先写入 Phi 打破循环
+            value = newPhi(block);
+            writeVariable(var, block, value);
+            addPhiOperands(var, value);
+        }
+        writeVariable(var, block, value);
+        return value;
+    }
+
+    void addPhiOperands(int var, IRInstr *phi)
+    {
+        for (auto *pred : phi->block->preds)
+        {
+            phi->operands.push_back(readVariable(var, pred));
+        }
+    }
+
+    IRInstr *newPhi(IRBlock *block)
+    {
+        auto *phi = fn_->newInstr(IROpcode::Phi);
+        phi->block = block;
+        block->instrs.insert(block->instrs.begin(), phi);
+        return phi;
+    }
+
+    bool isSealed(IRBlock *block) const
+    {
+        return block->id < sealed_.size() && sealed_[block->id];
+    }
+
+    void sealBlock(IRBlock *block)
+    {
+        if (sealed_.size() <= block->id)
+        {
+            sealed_.resize(block->id + 1, false);
+        }
+        auto it = incompletePhis_.find(block->id);
+        if (it != incompletePhis_.end())
+        {
+            for (auto &[var, phi] : it->second)
+            {
+                addPhiOperands(var, phi);
+            }
+            incompletePhis_.erase(it);
+        }
+        sealed_[block->id] = true;
+    }
+
+  private:
+    /// 注解树，里面有作用域信息
+    const AnnotatedTree *at_;
+    std::unique_ptr<IRFunction> fn_;
+    /// 当前正在填充的基本块，为空表示当前位置不可达
+    IRBlock *cur_;
+    /// 名字到变量编号的映射，每层对应一个作用域
+    std::vector<std::unordered_map<std::string, int>> scopes_;
+    /// 每个变量在每个基本块中的当前定义
+    std::vector<std::unordered_map<uint32_t, IRInstr *>> currentDef_;
+    std::vector<bool> sealed_;
+    std::unordered_map<uint32_t, std::vector<std::pair<int, IRInstr *>>>
+        incompletePhis_;
+    std::vector<LoopTargets> loops_;
+    /// 是否在为栈上替换构造循环，此时找不到的变量都是循环外的变量
+    bool osr_;
+    /// 每个槽位对应的变量编号
+    std::vector<int> slotVars_;
+    /// 变量编号 -> 数组编号，数组和变量共用作用域
+    std::unordered_map<int, int> arrayVars_;
+    /// 每个数组各维的长度，循环外的数组用到的时候才读取
+    std::vector<std::vector<IRInstr *>> arrayDims_;
+    /// 每层 blockStatement 出错之后的汇合点，用到的时候才创建
+    std::vector<IRBlock *> errorTargets_;
+    /// 已经生成的出错分支的个数
+    size_t errorPaths_ = 0;
+    /// 抛出异常的错误指令，构造完成之后在前面补上写回槽位的指令
+    std::vector<IRInstr *> thrownErrors_;
+    /// 可能声明失败的变量 -> 记录它是否已经定义的隐藏变量
+    std::unordered_map<int, int> definedFlags_;
+};
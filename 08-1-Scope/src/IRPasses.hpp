@@ -0,0 +1,1957 @@
+#pragma once
+
+#include <functional>
+#include <map>
+#include <set>
+#include "IRAnalysis.hpp"
+
+/**
+ * IR 上的优化
+ *
+ * 每个 pass 都保持 SSA 形式不变，可以按任意顺序组合
+ */
+class IROptimizer
+{
+  public:
+    explicit IROptimizer(IRFunction &fn) : fn_(fn)
+    {
+    }
+
+    /**
+     * 默认的优化流水线
+     */
+    void run()
+    {
+        propagateCopies();
+        sparseConditionalConstantPropagation();
+        simplifyCFG();
+        globalValueNumbering();
+        propagateCopies();
+        hoistLoopInvariants();
+        reduceInductionVariables();
+        eliminateBoundsChecks();
+        // preheader 中新生成的乘法大多是常量之间的运算，
+        // 去掉下标检查之后的分支条件是常量
+        sparseConditionalConstantPropagation();
+        propagateCopies();
+        eliminateDeadCode();
+        simplifyCFG();
+        // 要在去掉下标检查之后做，还有检查的循环不是直线代码
+        vectorizeLoops();
+        // 迭代次数是常量时，向量化的循环的条件在进入时就不成立，整个删掉
+        sparseConditionalConstantPropagation();
+        propagateCopies();
+        eliminateDeadCode();
+        simplifyCFG();
+    }
+
+    /**
+     * 复制传播：去掉 Copy 和平凡的 Phi（所有操作数相同，或者只引用自身）
+     *
+     * Braun 算法在构造时并不删除平凡 Phi，统一在这里清理
+     */
+    void propagateCopies()
+    {
+        bool changed = true;
+        while (changed)
+        {
+            changed = false;
+            std::unordered_map<IRInstr *, IRInstr *> replacement;
+            auto resolve = [&replacement](IRInstr *value) {
+                auto it = replacement.find(value);
+                while (it != replacement.end())
+                {
+                    value = it->second;
+                    it = replacement.find(value);
+                }
+                return value;
+            };
+            for (auto *block : fn_.blocks)
+            {
+                for (auto *instr : block->instrs)
+                {
+                    if (instr->op == IROpcode::Copy)
+                    {
+                        replacement[instr] = resolve(instr->operands[0]);
+                    }
+                    else if (instr->op == IROpcode::Phi)
+                    {
+                        IRInstr *same = nullptr;
+                        bool trivial = true;
+                        for (auto *operand : instr->operands)
+                        {
+                            operand = resolve(operand);
+                            if (operand == same || operand == instr)
+                            {
+                                continue;
+                            }
+                            if (same != nullptr)
+                            {
+                                trivial = false;
+                                break;
+                            }
+                            same = operand;
+                        }
+                        if (trivial && same != nullptr)
+                        {
+                            replacement[instr] = same;
+                        }
+                    }
+                }
+            }
+            if (!replacement.empty())
+            {
+                changed = true;
+                fn_.replaceUses(replacement);
+                for (auto &[instr, _] : replacement)
+                {
+                    fn_.eraseInstr(instr);
+                }
+            }
+        }
+    }
+
+    /**
+     * 稀疏条件常量传播（Wegman & Zadeck）
+     *
+     * 同时跟踪常量和可执行的边，所以能发现"因为条件恒定而永远走不到的分支里的赋值"
+     */
+    void sparseConditionalConstantPropagation()
+    {
+        enum class State : uint8_t
+        {
+            Top,       ///< 还不知道
+            Constant,  ///< 常量
+            Bottom,    ///< 不是常量
+        };
+        struct Cell
+        {
+            State state = State::Top;
+            int32_t value = 0;
+        };
+        std::vector<Cell> cells(fn_.valueCount());
+        std::vector<bool> executable(fn_.blockIdBound(), false);
+        std::set<std::pair<uint32_t, uint32_t>> executableEdges;
+        std::vector<std::pair<IRBlock *, IRBlock *>> flowWorklist{
+            {nullptr, fn_.entry}};
+        std::vector<IRInstr *> ssaWorklist;
+        auto users = computeUsers();
+
+        auto lower = [&](IRInstr *instr, State state, int32_t value = 0) {
+            auto &cell = cells[instr->id];
+            // 格只能往下走：Top -> Constant -> Bottom
+            if (cell.state == State::Bottom || state == State::Top ||
+                (cell.state == state && cell.value == value))
+            {
+                return;
+            }
+            if (cell.state == State::Constant)
+            {
+                state = State::Bottom;
+            }
+            cell.state = state;
+            cell.value = value;
+            for (auto *user : users[instr->id])
+            {
+                ssaWorklist.push_back(user);
+            }
+        };
+        auto isEdgeExecutable = [&](IRBlock *from, IRBlock *to) {
+            return executableEdges.count({from->id, to->id}) != 0;
+        };
+
+        auto visit = [&](IRInstr *instr) {
+            switch (instr->op)
+            {
+                case IROpcode::Const:
+                    lower(instr, State::Constant, instr->imm);
+                    break;
+                case IROpcode::Phi:
+                {
+                    Cell result;
+                    auto *block = instr->block;
+                    for (size_t i = 0; i < instr->operands.size(); ++i)
+                    {
+                        if (!isEdgeExecutable(block->preds[i], block))
+                        {
+                            continue;
+                        }
+                        auto &cell = cells[instr->operands[i]->id];
+                        if (cell.state == State::Top)
+                        {
+                            continue;
+                        }
+                        if (cell.state == State::Bottom ||
+                            (result.state == State::Constant &&
+                             result.value != cell.value))
+                        {
+                            result.state = State::Bottom;
+                            break;
+                        }
+                        result = cell;
+                    }
+                    if (result.state != State::Top)
+                    {
+                        lower(instr, result.state, result.value);
+                    }
+                    break;
+                }
+                case IROpcode::Copy:
+                {
+                    auto &cell = cells[instr->operands[0]->id];
+                    if (cell.state != State::Top)
+                    {
+                        lower(instr, cell.state, cell.value);
+                    }
+                    break;
+                }
+                case IROpcode::Jump:
+                    flowWorklist.push_back({instr->block, instr->targets[0]});
+                    break;
+                case IROpcode::Branch:
+                {
+                    auto &cell = cells[instr->operands[0]->id];
+                    if (cell.state == State::Constant)
+                    {
+                        flowWorklist.push_back(
+                            {instr->block,
+                             instr->targets[cell.value != 0 ? 0 : 1]});
+                    }
+                    else if (cell.state == State::Bottom)
+                    {
+                        for (auto *target : instr->targets)
+                        {
+                            flowWorklist.push_back({instr->block, target});
+                        }
+                    }
+                    break;
+                }
+                case IROpcode::Switch:
+                {
+                    auto &cell = cells[instr->operands[0]->id];
+                    if (cell.state == State::Constant)
+                    {
+                        flowWorklist.push_back(
+                            {instr->block, instr->switchTarget(cell.value)});
+                    }
+                    else if (cell.state == State::Bottom)
+                    {
+                        for (auto *target : instr->targets)
+                        {
+                            flowWorklist.push_back({instr->block, target});
+                        }
+                    }
+                    break;
+                }
+                case IROpcode::LoadSlot:
+                case IROpcode::ArrayDim:
+                case IROpcode::LoadElement:
+                case IROpcode::VectorSum:
+                case IROpcode::VectorMin:
+                case IROpcode::VectorMax:
+                    // 外部变量的值和数组元素在编译时未知
+                    lower(instr, State::Bottom);
+                    break;
+                case IROpcode::Print:
+                case IROpcode::StoreSlot:
+                case IROpcode::NewArray:
+                case IROpcode::StoreElement:
+                case IROpcode::PrintArray:
+                case IROpcode::VectorFill:
+                case IROpcode::VectorCopy:
+                case IROpcode::VectorAdd:
+                case IROpcode::VectorSub:
+                case IROpcode::VectorMul:
+                case IROpcode::IndexError:
+                case IROpcode::Error:
+                case IROpcode::Return:
+                    break;
+                default:
+                {
+                    bool top = false;
+                    bool bottom = false;
+                    for (auto *operand : instr->operands)
+                    {
+                        auto state = cells[operand->id].state;
+                        top |= state == State::Top;
+                        bottom |= state == State::Bottom;
+                    }
+                    if (bottom)
+                    {
+                        lower(instr, State::Bottom);
+                    }
+                    else if (!top)
+                    {
+                        auto a = cells[instr->operands[0]->id].value;
+                        if (instr->isUnary())
+                        {
+                            lower(instr, State::Constant,
+                                  irEvalUnary(instr->op, a));
+                        }
+                        else
+                        {
+                            auto b = cells[instr->operands[1]->id].value;
+                            if (irCanFold(instr->op, a, b))
+                            {
+                                lower(instr, State::Constant,
+                                      irEvalBinary(instr->op, a, b));
+                            }
+                            else
+                            {
+                                lower(instr, State::Bottom);
+                            }
+                        }
+                    }
+                    break;
+                }
+            }
+        };
+
+        while (!flowWorklist.empty() || !ssaWorklist.empty())
+        {
+            while (!flowWorklist.empty())
+            {
+                auto [from, to] = flowWorklist.back();
+                flowWorklist.pop_back();
+                if (from != nullptr)
+                {
+                    if (!executableEdges.insert({from->id, to->id}).second)
+                    {
+                        continue;
+                    }
+                }
+                if (executable[to->id])
+                {
+                    // 新的入边只影响 Phi
+                    for (auto *instr : to->instrs)
+                    {
+                        if (instr->op != IROpcode::Phi)
+                        {
+                            break;
+                        }
+                        visit(instr);
+                    }
+                    continue;
+                }
+                executable[to->id] = true;
+                for (auto *instr : to->instrs)
+                {
+                    visit(instr);
+                }
+            }
+            while (!ssaWorklist.empty())
+            {
+                auto *instr = ssaWorklist.back();
+                ssaWorklist.pop_back();
+                if (instr->block && executable[instr->block->id])
+                {
+                    visit(instr);
+                }
+            }
+        }
+
+        // 用常量替换，先收集再替换，新建常量会修改入口块
+        std::vector<IRInstr *> folded;
+        for (auto *block : fn_.blocks)
+        {
+            if (!executable[block->id])
+            {
+                continue;
+            }
+            for (auto *instr : block->instrs)
+            {
+                if (instr->hasValue() && instr->op != IROpcode::Const &&
+                    cells[instr->id].state == State::Constant)
+                {
+                    folded.push_back(instr);
+                }
+            }
+        }
+        std::unordered_map<IRInstr *, IRInstr *> replacement;
+        for (auto *instr : folded)
+        {
+            replacement[instr] = fn_.constant(cells[instr->id].value);
+        }
+        fn_.replaceUses(replacement);
+        for (auto &[instr, _] : replacement)
+        {
+            fn_.eraseInstr(instr);
+        }
+        // 只有一个后继可达的分支改成无条件跳转
+        for (auto *block : fn_.blocks)
+        {
+            auto *term = block->terminator();
+            if (!executable[block->id] || term == nullptr ||
+                term->targets.size() < 2)
+            {
+                continue;
+            }
+            std::vector<IRBlock *> taken;
+            for (auto *target : term->targets)
+            {
+                if (isEdgeExecutable(block, target))
+                {
+                    taken.push_back(target);
+                }
+            }
+            if (taken.size() != 1)
+            {
+                continue;
+            }
+            for (auto *target : term->targets)
+            {
+                if (target != taken[0])
+                {
+                    IRFunction::removeEdge(block, target);
+                }
+            }
+            term->op = IROpcode::Jump;
+            term->operands.clear();
+            term->targets = {taken[0]};
+            term->cases.clear();
+        }
+        fn_.removeUnreachableBlocks();
+    }
+
+    /**
+     * 全局值编号：沿支配树先序遍历，带作用域的哈希表记录已经算过的表达式，
+     * 被支配的位置上再次出现相同的计算时直接复用
+     */
+    void globalValueNumbering()
+    {
+        IRDominatorTree domTree(fn_);
+        std::map<std::vector<int64_t>, IRInstr *> available;
+        std::unordered_map<IRInstr *, IRInstr *> replacement;
+
+        std::function<void(IRBlock *)> walk = [&](IRBlock *block) {
+            std::vector<std::vector<int64_t>> inserted;
+            for (auto *instr : block->instrs)
+            {
+                if (!instr->isBinary() && !instr->isUnary() &&
+                    instr->op != IROpcode::Phi)
+                {
+                    continue;
+                }
+                std::vector<int64_t> key{static_cast<int64_t>(instr->op)};
+                // Phi 只有在同一个块里才可能相等
+                if (instr->op == IROpcode::Phi)
+                {
+                    key.push_back(block->id);
+                }
+                for (auto *operand : instr->operands)
+                {
+                    auto it = replacement.find(operand);
+                    key.push_back(
+                        (it == replacement.end() ? operand : it->second)->id);
+                }
+                if (irIsCommutative(instr->op) && key[1] > key[2])
+                {
+                    std::swap(key[1], key[2]);
+                }
+                auto found = available.find(key);
+                if (found != available.end())
+                {
+                    replacement[instr] = found->second;
+                }
+                else
+                {
+                    available[key] = instr;
+                    inserted.push_back(std::move(key));
+                }
+            }
+            for (auto *child : domTree.children(block))
+            {
+                walk(child);
+            }
+            for (auto &key : inserted)
+            {
+                available.erase(key);
+            }
+        };
+        walk(fn_.entry);
+
+        fn_.replaceUses(replacement);
+        for (auto &[instr, _] : replacement)
+        {
+            fn_.eraseInstr(instr);
+        }
+    }
+
+    /**
+     * 循环不变量外提：操作数都在循环外定义的纯计算移到 preheader
+     *
+     * 从内层循环往外处理，外提到内层 preheader 的指令还可以继续往外提。
+     * 外提的指令在循环一次都不执行时也会被执行，
+     * 所以不能外提除数可能为 0 的除法
+     */
+    void hoistLoopInvariants()
+    {
+        IRLoopInfo loopInfo(fn_);
+        loopInfo.insertPreheaders();
+        for (auto &loop : loopInfo.loops())
+        {
+            auto *preheader = loop.preheader;
+            if (preheader == nullptr)
+            {
+                continue;
+            }
+            // 块按逆后序访问，定义总是先于使用被处理
+            for (auto *block : loop.blocks)
+            {
+                size_t i = 0;
+                while (i < block->instrs.size())
+                {
+                    auto *instr = block->instrs[i];
+                    if (!isSpeculatable(instr) ||
+                        !std::all_of(instr->operands.begin(),
+                                     instr->operands.end(),
+                                     [&loop](IRInstr *operand) {
+                                         return loop.isInvariant(operand);
+                                     }))
+                    {
+                        ++i;
+                        continue;
+                    }
+                    block->instrs.erase(block->instrs.begin() + i);
+                    instr->block = preheader;
+                    preheader->instrs.insert(preheader->instrs.end() - 1,
+                                             instr);
+                }
+            }
+        }
+    }
+
+    /**
+     * 归纳变量的强度削弱
+     *
+     * 基本归纳变量 i 每次迭代增加常量 c，循环中的 i * k（k 是循环不变量）
+     * 换成新的归纳变量 j，每次迭代增加 c * k。
+     * i * i 用二阶差分：s = i * i，t = 2c * i + c * c，
+     * 每次迭代 s += t，t += 2c * c，同样只剩加法。
+     * 所有运算都是 32 位回绕的，和直接相乘的结果完全一致。
+     */
+    void reduceInductionVariables()
+    {
+        IRLoopInfo loopInfo(fn_);
+        loopInfo.insertPreheaders();
+        for (auto &loop : loopInfo.loops())
+        {
+            if (loop.preheader == nullptr)
+            {
+                continue;
+            }
+            std::unordered_map<IRInstr *, InductionVariable> ivs;
+            for (auto *instr : loop.header->instrs)
+            {
+                if (instr->op != IROpcode::Phi)
+                {
+                    break;
+                }
+                InductionVariable iv;
+                if (matchInductionVariable(loop, instr, iv))
+                {
+                    ivs[instr] = iv;
+                }
+            }
+            if (ivs.empty())
+            {
+                continue;
+            }
+            std::vector<IRInstr *> candidates;
+            for (auto *block : loop.blocks)
+            {
+                for (auto *instr : block->instrs)
+                {
+                    if (instr->op == IROpcode::Mul &&
+                        (ivs.count(instr->operands[0]) ||
+                         ivs.count(instr->operands[1])))
+                    {
+                        candidates.push_back(instr);
+                    }
+                }
+            }
+            std::unordered_map<IRInstr *, IRInstr *> replacement;
+            for (auto *mul : candidates)
+            {
+                auto *a = mul->operands[0];
+                auto *b = mul->operands[1];
+                if (!ivs.count(a))
+                {
+                    std::swap(a, b);
+                }
+                const auto &iv = ivs[a];
+                if (a == b)
+                {
+                    replacement[mul] = reduceSquare(loop, iv);
+                }
+                else if (loop.isInvariant(b))
+                {
+                    replacement[mul] = reduceLinear(loop, iv, b);
+                }
+            }
+            fn_.replaceUses(replacement);
+            for (auto &[instr, _] : replacement)
+            {
+                fn_.eraseInstr(instr);
+            }
+        }
+    }
+
+    /**
+     * 数组下标检查消除
+     *
+     * 计数循环 for (i = init; i < n; i += step) 中，循环体里的 a[i + c]
+     * 每次都要检查 0 <= i + c < len。i 从 init 单调增加，进入循环体时 i < n，
+     * 只要 init + c >= 0 并且 n + c <= len，这些检查就一定能通过。
+     * 把循环复制一份，副本中的检查直接当作通过，在 preheader 中只判断一次
+     * 上面的条件：成立时进入副本，否则执行原来的循环，越界时的报错和原来一样。
+     *
+     * 步长是循环不变量时还要在 preheader 中判断它的符号，i 递减的循环同理。
+     * 步长和偏移的绝对值不超过 maxStep，数组的长度不超过 Array::maxSize，
+     * 保证 i 在循环中不会溢出。从内层循环往外处理，外层循环的下标
+     * 在内层循环中也是不变量，由外层循环的副本消除。
+     */
+    void eliminateBoundsChecks()
+    {
+        // 已经处理过的循环头，复制出来的循环也算
+        std::set<uint32_t> visited;
+        for (int round = 0; round < maxVersionedLoops; ++round)
+        {
+            IRLoopInfo loopInfo(fn_);
+            loopInfo.insertPreheaders();
+            IRDominatorTree domTree(fn_);
+            bool versioned = false;
+            for (auto &loop : loopInfo.loops())
+            {
+                if (visited.insert(loop.header->id).second &&
+                    versionLoop(loop, domTree, visited))
+                {
+                    // 控制流图变了，重新分析
+                    versioned = true;
+                    break;
+                }
+            }
+            if (!versioned)
+            {
+                break;
+            }
+        }
+    }
+
+    /**
+     * 循环向量化：把简单的计数循环整个换成 Simd.hpp 中的批量运算
+     *
+     * i 从 init 开始每次加 1，i < bound（或 i <= bound）时执行循环体，
+     * 循环只从循环头退出，并且只做下面两类事情中的一类：
+     * - 逐元素赋值 a[i + c] = e，e 是 x、b[i + d] 或者它们之间的加减乘，
+     *   x 是循环不变量，循环体是一个基本块
+     * - 归约 s = s + b[i + d]、s = s - b[i + d]，
+     *   以及 if (b[i + d] > m) m = b[i + d] 这样的最大值、最小值，
+     *   循环头除了 i 之外的 Phi 都必须是归约变量
+     * 其他的指令都没有副作用，结果也不会流出循环，可以不管。
+     *
+     * 在 preheader 中算出迭代次数，执行批量运算，再把 i 和归约变量
+     * 进入循环时的值改成循环结束时的值，原来的循环就一次也不执行了。
+     * 读写同一个数组时下标必须完全相同，否则后面的迭代会读到前面写入的值，
+     * 只能按原来的循环逐个执行。
+     *
+     * 还有下标检查的循环中有 IndexError，不会被识别，只有下标检查消除的副本
+     * 能够向量化，进入副本的条件保证了访问的元素都在数组范围内，
+     * 迭代次数的计算也不会溢出。
+     */
+    void vectorizeLoops()
+    {
+        IRLoopInfo loopInfo(fn_);
+        loopInfo.insertPreheaders();
+        // 只在 preheader 中插入指令，控制流图不变，不用重新分析
+        for (auto &loop : loopInfo.loops())
+        {
+            vectorizeLoop(loop);
+        }
+    }
+
+    /**
+     * 死代码删除：从有副作用的指令出发标记用到的值，没被标记的全部删除
+     */
+    void eliminateDeadCode()
+    {
+        std::vector<bool> live(fn_.valueCount(), false);
+        std::vector<IRInstr *> worklist;
+        for (auto *block : fn_.blocks)
+        {
+            for (auto *instr : block->instrs)
+            {
+                if (instr->hasSideEffect())
+                {
+                    live[instr->id] = true;
+                    worklist.push_back(instr);
+                }
+            }
+        }
+        while (!worklist.empty())
+        {
+            auto *instr = worklist.back();
+            worklist.pop_back();
+            for (auto *operand : instr->operands)
+            {
+                if (!live[operand->id])
+                {
+                    live[operand->id] = true;
+                    worklist.push_back(operand);
+                }
+            }
+        }
+        for (auto *block : fn_.blocks)
+        {
+            std::vector<IRInstr *> dead;
+            for (auto *instr : block->instrs)
+            {
+                if (!live[instr->id])
+                {
+                    dead.push_back(instr);
+                }
+            }
+            for (auto *instr : dead)
+            {
+                fn_.eraseInstr(instr);
+            }
+        }
+    }
+
+    /**
+     * 化简控制流图：删除不可达块，合并只有一条边相连的块，跳过只有一条 Jump 的空块
+     */
+    void simplifyCFG()
+    {
+        fn_.removeUnreachableBlocks();
+        bool changed = true;
+        while (changed)
+        {
+            changed = false;
+            for (auto *block : fn_.blocks)
+            {
+                if (mergeIntoPredecessor(block) || forwardEmptyBlock(block))
+                {
+                    changed = true;
+                    break;
+                }
+            }
+        }
+    }
+
+  private:
+    /**
+     * 基本归纳变量 phi = Phi(init, phi + step)
+     */
+    struct InductionVariable
+    {
+        IRInstr *phi = nullptr;
+        IRInstr *init = nullptr;  ///< 从 preheader 进入循环时的值
+        IRInstr *next = nullptr;  ///< 所有回边上的值
+        int32_t step = 0;
+    };
+
+    /**
+     * 可以提前执行而不改变程序行为的指令
+     */
+    static bool isSpeculatable(const IRInstr *instr)
+    {
+        if (!instr->isBinary() && !instr->isUnary())
+        {
+            return false;
+        }
+        if (instr->op == IROpcode::Div || instr->op == IROpcode::Mod)
+        {
+            auto *divisor = instr->operands[1];
+            return divisor->op == IROpcode::Const && divisor->imm != 0;
+        }
+        return true;
+    }
+
+    static bool matchInductionVariable(const IRLoop &loop, IRInstr *phi,
+                                       InductionVariable &iv)
+    {
+        auto *header = loop.header;
+        int entryIndex = header->predIndex(loop.preheader);
+        IRInstr *next = nullptr;
+        for (size_t i = 0; i < phi->operands.size(); ++i)
+        {
+            if (static_cast<int>(i) == entryIndex)
+            {
+                continue;
+            }
+            if (next != nullptr && phi->operands[i] != next)
+            {
+                return false;
+            }
+            next = phi->operands[i];
+        }
+        if (next == nullptr || next->block == nullptr || !loop.has(next->block))
+        {
+            return false;
+        }
+        auto *lhs = next->operands.empty() ? nullptr : next->operands[0];
+        auto *rhs = next->operands.size() < 2 ? nullptr : next->operands[1];
+        if (next->op == IROpcode::Add && rhs == phi)
+        {
+            std::swap(lhs, rhs);
+        }
+        if ((next->op != IROpcode::Add && next->op != IROpcode::Sub) ||
+            lhs != phi || rhs->op != IROpcode::Const)
+        {
+            return false;
+        }
+        iv.phi = phi;
+        iv.init = phi->operands[entryIndex];
+        iv.next = next;
+        iv.step = next->op == IROpcode::Add
+                      ? rhs->imm
+                      : irEvalUnary(IROpcode::Neg, rhs->imm);
+        return true;
+    }
+
+    /**
+     * i * k 换成 j = Phi(init * k, j + step * k)
+     */
+    IRInstr *reduceLinear(const IRLoop &loop, const InductionVariable &iv,
+                          IRInstr *factor)
+    {
+        auto *preheader = loop.preheader;
+        auto *start = insertBefore(preheader->terminator(), IROpcode::Mul,
+                                   {iv.init, factor});
+        IRInstr *increment;
+        if (factor->op == IROpcode::Const)
+        {
+            increment = fn_.constant(
+                irEvalBinary(IROpcode::Mul, iv.step, factor->imm));
+        }
+        else
+        {
+            increment = insertBefore(preheader->terminator(), IROpcode::Mul,
+                                     {fn_.constant(iv.step), factor});
+        }
+        auto *phi = newHeaderPhi(loop);
+        auto *next = insertAfter(iv.next, IROpcode::Add, {phi, increment});
+        setHeaderPhiOperands(loop, phi, start, next);
+        return phi;
+    }
+
+    /**
+     * i * i 换成 s = Phi(init * init, s + t)，
+     * 其中 t = Phi(2c * init + c * c, t + 2c * c)
+     */
+    IRInstr *reduceSquare(const IRLoop &loop, const InductionVariable &iv)
+    {
+        auto *preheader = loop.preheader;
+        auto c = iv.step;
+        auto twoC = irEvalBinary(IROpcode::Mul, 2, c);
+        auto cc = irEvalBinary(IROpcode::Mul, c, c);
+        auto *square = insertBefore(preheader->terminator(), IROpcode::Mul,
+                                    {iv.init, iv.init});
+        auto *linear = insertBefore(preheader->terminator(), IROpcode::Mul,
+                                    {iv.init, fn_.constant(twoC)});
+        auto *delta = insertBefore(preheader->terminator(), IROpcode::Add,
+                                   {linear, fn_.constant(cc)});
+        auto *s = newHeaderPhi(loop);
+        auto *t = newHeaderPhi(loop);
+        auto *sNext = insertAfter(iv.next, IROpcode::Add, {s, t});
+        auto *tNext = insertAfter(
+            sNext, IROpcode::Add,
+            {t, fn_.constant(irEvalBinary(IROpcode::Mul, twoC, c))});
+        setHeaderPhiOperands(loop, s, square, sNext);
+        setHeaderPhiOperands(loop, t, delta, tNext);
+        return s;
+    }
+
+    /// 下标检查消除最多复制的循环个数
+    static constexpr int maxVersionedLoops = 16;
+    /// 超过这么多条指令的循环不复制
+    static constexpr size_t maxVersionedSize = 1000;
+    /// 下标检查消除允许的步长和偏移的绝对值
+    static constexpr int32_t maxStep = 1 << 20;
+
+    /**
+     * 计数循环：循环头的 Phi i 每次迭代加 step，
+     * 满足 i < bound 等条件时进入循环体
+     */
+    struct CountedLoop
+    {
+        IRInstr *phi = nullptr;
+        IRInstr *init = nullptr;   ///< 从 preheader 进入循环时的值
+        IRInstr *step = nullptr;   ///< 常量或者循环不变量
+        IRInstr *bound = nullptr;  ///< 循环不变量
+        bool increasing = false;   ///< i < bound、i <= bound 为真
+        bool inclusive = false;    ///< i <= bound、i >= bound 为真
+    };
+
+    /**
+     * 循环头的条件分支是 i < bound、i <= bound（递增）或者 i > bound、
+     * i >= bound（递减），并且回边上 i 的值是 i + step
+     */
+    bool matchCountedLoop(const IRLoop &loop, IRInstr *cond,
+                          CountedLoop &counted)
+    {
+        auto op = cond->op;
+        if (op != IROpcode::Lt && op != IROpcode::Le && op != IROpcode::Gt &&
+            op != IROpcode::Ge)
+        {
+            return false;
+        }
+        auto *phi = cond->operands[0];
+        auto *bound = cond->operands[1];
+        if (bound->op == IROpcode::Phi && bound->block == loop.header)
+        {
+            // n > i 就是 i < n
+            std::swap(phi, bound);
+            op = op == IROpcode::Lt   ? IROpcode::Gt
+                 : op == IROpcode::Le ? IROpcode::Ge
+                 : op == IROpcode::Gt ? IROpcode::Lt
+                                      : IROpcode::Le;
+        }
+        if (phi->op != IROpcode::Phi || phi->block != loop.header ||
+            !loop.isInvariant(bound))
+        {
+            return false;
+        }
+        auto *header = loop.header;
+        int entryIndex = header->predIndex(loop.preheader);
+        IRInstr *next = nullptr;
+        for (size_t i = 0; i < phi->operands.size(); ++i)
+        {
+            if (static_cast<int>(i) == entryIndex)
+            {
+                continue;
+            }
+            if (next != nullptr && phi->operands[i] != next)
+            {
+                return false;
+            }
+            next = phi->operands[i];
+        }
+        if (next == nullptr || next->block == nullptr ||
+            !loop.has(next->block) ||
+            (next->op != IROpcode::Add && next->op != IROpcode::Sub))
+        {
+            return false;
+        }
+        auto *lhs = next->operands[0];
+        auto *rhs = next->operands[1];
+        if (next->op == IROpcode::Add && rhs == phi)
+        {
+            std::swap(lhs, rhs);
+        }
+        if (lhs != phi || !loop.isInvariant(rhs))
+        {
+            return false;
+        }
+        counted.phi = phi;
+        counted.init = phi->operands[entryIndex];
+        counted.step = rhs;
+        counted.bound = bound;
+        counted.increasing = op == IROpcode::Lt || op == IROpcode::Le;
+        counted.inclusive = op == IROpcode::Le || op == IROpcode::Ge;
+        if (next->op == IROpcode::Sub)
+        {
+            // i - c 只接受常量，取反之后仍然是常量
+            if (rhs->op != IROpcode::Const || rhs->imm == INT32_MIN)
+            {
+                return false;
+            }
+            counted.step = fn_.constant(-rhs->imm);
+        }
+        if (counted.step->op == IROpcode::Const)
+        {
+            auto step = counted.step->imm;
+            return counted.increasing ? step >= 1 && step <= maxStep
+                                      : step <= -1 && step >= -maxStep;
+        }
+        return true;
+    }
+
+    /**
+     * 下标是 i、i + c 或者 i - c，c 是绝对值不超过 maxStep 的常量
+     */
+    static bool matchIndex(IRInstr *index, IRInstr *phi, int32_t &offset)
+    {
+        if (index == phi)
+        {
+            offset = 0;
+            return true;
+        }
+        if (index->op != IROpcode::Add && index->op != IROpcode::Sub)
+        {
+            return false;
+        }
+        auto *lhs = index->operands[0];
+        auto *rhs = index->operands[1];
+        if (index->op == IROpcode::Add && rhs == phi)
+        {
+            std::swap(lhs, rhs);
+        }
+        if (lhs != phi || rhs->op != IROpcode::Const || rhs->imm > maxStep ||
+            rhs->imm < -maxStep)
+        {
+            return false;
+        }
+        offset = index->op == IROpcode::Add ? rhs->imm : -rhs->imm;
+        return true;
+    }
+
+    /**
+     * 对一个计数循环做下标检查消除，复制了循环时返回 true
+     */
+    bool versionLoop(const IRLoop &loop, const IRDominatorTree &domTree,
+                     std::set<uint32_t> &visited)
+    {
+        auto *term = loop.header->terminator();
+        if (loop.preheader == nullptr || term->op != IROpcode::Branch ||
+            !loop.has(term->targets[0]) || loop.has(term->targets[1]))
+        {
+            return false;
+        }
+        CountedLoop counted;
+        if (!matchCountedLoop(loop, term->operands[0], counted))
+        {
+            return false;
+        }
+        // 只有循环体中的检查才能保证 i 满足循环条件
+        auto *body = term->targets[0];
+        size_t size = 0;
+        std::vector<IRInstr *> checks;
+        std::set<std::pair<int32_t, uint32_t>> ranges;
+        std::vector<std::pair<int32_t, IRInstr *>> conditions;
+        for (auto *block : loop.blocks)
+        {
+            size += block->instrs.size();
+            if (!domTree.dominates(body, block))
+            {
+                continue;
+            }
+            for (auto *instr : block->instrs)
+            {
+                int32_t offset;
+                if (instr->op != IROpcode::InBounds ||
+                    !loop.isInvariant(instr->operands[1]) ||
+                    !matchIndex(instr->operands[0], counted.phi, offset))
+                {
+                    continue;
+                }
+                checks.push_back(instr);
+                auto *length = instr->operands[1];
+                if (ranges.insert({offset, length->id}).second)
+                {
+                    conditions.push_back({offset, length});
+                }
+            }
+        }
+        if (checks.empty() || size > maxVersionedSize)
+        {
+            return false;
+        }
+
+        auto *guard = buildGuard(loop, counted, conditions);
+        auto cloneBase = fn_.blockIdBound();
+        std::unordered_map<IRInstr *, IRInstr *> values;
+        auto blocks = cloneLoop(loop, values);
+        auto *preheader = loop.preheader;
+        auto *jump = preheader->terminator();
+        jump->op = IROpcode::Branch;
+        jump->operands = {guard};
+        jump->targets = {blocks[loop.header], loop.header};
+        repairOutsideUses(loop, values, cloneBase);
+
+        std::unordered_map<IRInstr *, IRInstr *> replacement;
+        for (auto *check : checks)
+        {
+            replacement[values[check]] = fn_.constant(1);
+        }
+        fn_.replaceUses(replacement);
+        for (auto &[instr, _] : replacement)
+        {
+            fn_.eraseInstr(instr);
+        }
+        for (auto &[block, copy] : blocks)
+        {
+            if (visited.count(block->id))
+            {
+                visited.insert(copy->id);
+            }
+        }
+        return true;
+    }
+
+    /**
+     * 在 preheader 中计算进入没有检查的副本的条件
+     *
+     * 递增时 i 的范围是 [init, bound - 1]（i <= bound 时到 bound），
+     * 递减时是 [bound + 1, init]（i >= bound 时从 bound 开始），
+     * 每个 (c, len) 都要求 i + c 的范围落在 [0, len) 中。
+     * len - c 不会溢出，bound + c 可能溢出，所以比较 bound 和 len - c
+     */
+    IRInstr *buildGuard(
+        const IRLoop &loop, const CountedLoop &counted,
+        const std::vector<std::pair<int32_t, IRInstr *>> &conditions)
+    {
+        auto *pos = loop.preheader->terminator();
+        std::vector<IRInstr *> terms;
+        auto compare = [&](IROpcode op, IRInstr *a, IRInstr *b) {
+            terms.push_back(insertBefore(pos, op, {a, b}));
+        };
+        if (counted.step->op != IROpcode::Const)
+        {
+            if (counted.increasing)
+            {
+                compare(IROpcode::Ge, counted.step, fn_.constant(1));
+                compare(IROpcode::Le, counted.step, fn_.constant(maxStep));
+            }
+            else
+            {
+                compare(IROpcode::Ge, counted.step, fn_.constant(-maxStep));
+                compare(IROpcode::Le, counted.step, fn_.constant(-1));
+            }
+        }
+        for (auto &[offset, length] : conditions)
+        {
+            auto *limit = offset == 0 ? length
+                                      : insertBefore(pos, IROpcode::Sub,
+                                                     {length,
+                                                      fn_.constant(offset)});
+            if (counted.increasing)
+            {
+                // init + c >= 0，最大的 i 加 c 小于 len
+                compare(IROpcode::Ge, counted.init, fn_.constant(-offset));
+                compare(counted.inclusive ? IROpcode::Lt : IROpcode::Le,
+                        counted.bound, limit);
+            }
+            else
+            {
+                // 最小的 i 加 c 大于等于 0，init + c < len
+                compare(IROpcode::Ge, counted.bound,
+                        fn_.constant(counted.inclusive ? -offset
+                                                       : -offset - 1));
+                compare(IROpcode::Lt, counted.init, limit);
+            }
+        }
+        auto *guard = terms[0];
+        for (size_t i = 1; i < terms.size(); ++i)
+        {
+            guard = insertBefore(pos, IROpcode::And, {guard, terms[i]});
+        }
+        return guard;
+    }
+
+    /**
+     * 复制循环中的所有块，返回原来的块到副本的映射，values 记录指令的映射
+     *
+     * 副本中的回边指向副本的循环头，出口和原来的循环相同，
+     * 循环头的副本暂时只有来自 preheader 的入边记在 preds 中
+     */
+    std::unordered_map<IRBlock *, IRBlock *> cloneLoop(
+        const IRLoop &loop, std::unordered_map<IRInstr *, IRInstr *> &values)
+    {
+        std::unordered_map<IRBlock *, IRBlock *> blocks;
+        for (auto *block : loop.blocks)
+        {
+            auto *copy = fn_.newBlock();
+            blocks[block] = copy;
+            for (auto *instr : block->instrs)
+            {
+                auto *clone = fn_.newInstr(instr->op);
+                clone->imm = instr->imm;
+                clone->dim = instr->dim;
+                clone->source = instr->source;
+                clone->operands = instr->operands;
+                clone->targets = instr->targets;
+                clone->cases = instr->cases;
+                clone->text = instr->text;
+                clone->block = copy;
+                copy->instrs.push_back(clone);
+                values[instr] = clone;
+            }
+        }
+        auto mapBlock = [&blocks](IRBlock *block) {
+            auto it = blocks.find(block);
+            return it == blocks.end() ? block : it->second;
+        };
+        auto mapValue = [&values](IRInstr *value) {
+            auto it = values.find(value);
+            return it == values.end() ? value : it->second;
+        };
+        for (auto *block : loop.blocks)
+        {
+            auto *copy = blocks[block];
+            for (auto *pred : block->preds)
+            {
+                copy->preds.push_back(mapBlock(pred));
+            }
+            for (auto *instr : copy->instrs)
+            {
+                for (auto &operand : instr->operands)
+                {
+                    operand = mapValue(operand);
+                }
+                for (auto &target : instr->targets)
+                {
+                    target = mapBlock(target);
+                }
+            }
+        }
+        // 循环的出口多了来自副本的入边
+        for (auto *block : loop.blocks)
+        {
+            for (auto *succ : block->succs())
+            {
+                if (loop.has(succ))
+                {
+                    continue;
+                }
+                int index = succ->predIndex(block);
+                succ->preds.push_back(blocks[block]);
+                for (auto *phi : succ->instrs)
+                {
+                    if (phi->op != IROpcode::Phi)
+                    {
+                        break;
+                    }
+                    phi->operands.push_back(mapValue(phi->operands[index]));
+                }
+            }
+        }
+        return blocks;
+    }
+
+    /**
+     * 复制之后，循环中定义的值在循环外有了两个来源（原来的和副本），
+     * 循环外的使用改为读取到达那里的定义，在汇合处插入 Phi
+     *
+     * 编号不小于 cloneBase 的块是副本
+     */
+    void repairOutsideUses(const IRLoop &loop,
+                           std::unordered_map<IRInstr *, IRInstr *> &values,
+                           uint32_t cloneBase)
+    {
+        auto isInside = [&loop, cloneBase](const IRBlock *block) {
+            return loop.has(block) || block->id >= cloneBase;
+        };
+        auto users = computeUsers();
+        // 插入的 Phi 可能在循环中，先把要处理的值记下来
+        std::vector<IRInstr *> defined;
+        for (auto *block : loop.blocks)
+        {
+            defined.insert(defined.end(), block->instrs.begin(),
+                           block->instrs.end());
+        }
+        for (auto *value : defined)
+        {
+            std::vector<IRInstr *> outside;
+            for (auto *user : users[value->id])
+            {
+                if (!isInside(user->block))
+                {
+                    outside.push_back(user);
+                }
+            }
+            if (outside.empty())
+            {
+                continue;
+            }
+            auto *copy = values[value];
+            // 每个块末尾的定义，和 IRBuilder 中构造 SSA 的方法相同
+            std::unordered_map<IRBlock *, IRInstr *> defs{
+                {value->block, value}, {copy->block, copy}};
+            std::function<IRInstr *(IRBlock *)> read =
+                [&](IRBlock *at) -> IRInstr * {
+                auto it = defs.find(at);
+                if (it != defs.end())
+                {
+                    return it->second;
+                }
+                if (at->preds.size() == 1)
+                {
+                    return defs[at] = read(at->preds[0]);
+                }
+                auto *phi = fn_.newInstr(IROpcode::Phi);
+                phi->block = at;
+                at->instrs.insert(at->instrs.begin(), phi);
+                defs[at] = phi;
+                for (auto *pred : at->preds)
+                {
+                    phi->operands.push_back(read(pred));
+                }
+                return phi;
+            };
+            for (auto *user : outside)
+            {
+                for (size_t i = 0; i < user->operands.size(); ++i)
+                {
+                    if (user->operands[i] != value)
+                    {
+                        continue;
+                    }
+                    if (user->op != IROpcode::Phi)
+                    {
+                        user->operands[i] = read(user->block);
+                    }
+                    // 来自循环和副本的入边在复制时已经处理过了
+                    else if (!isInside(user->block->preds[i]))
+                    {
+                        user->operands[i] = read(user->block->preds[i]);
+                    }
+                }
+            }
+        }
+    }
+
+    /// 按行展开后的下标 i 加减的循环不变量，second 为真时是减去，按编号排序
+    using VectorOffset = std::vector<std::pair<IRInstr *, bool>>;
+
+    /**
+     * 向量化的循环中的操作数：循环不变量 value，或者数组 array 中
+     * 下标为 i + offset 的元素
+     */
+    struct VectorOperand
+    {
+        int32_t array = -1;  ///< -1 表示循环不变量
+        IRInstr *value = nullptr;
+        VectorOffset offset;
+    };
+
+    /**
+     * 归约 phi = phi + x（negate 时 phi = phi - x）、min(phi, x)、max(phi, x)
+     */
+    struct Reduction
+    {
+        IRInstr *phi = nullptr;
+        IROpcode op = IROpcode::VectorSum;
+        bool negate = false;
+        VectorOperand element;
+    };
+
+    /**
+     * 下标是 i 加减若干个循环不变量，
+     * 多维数组 a[r][i] 按行展开后的下标是 r * n + i，其中 r * n 是循环不变量
+     */
+    static bool matchOffset(const IRLoop &loop, IRInstr *index, IRInstr *phi,
+                            VectorOffset &offset)
+    {
+        offset.clear();
+        while (index != phi)
+        {
+            if (index->op != IROpcode::Add && index->op != IROpcode::Sub)
+            {
+                return false;
+            }
+            auto *lhs = index->operands[0];
+            auto *rhs = index->operands[1];
+            if (index->op == IROpcode::Add && loop.isInvariant(lhs))
+            {
+                std::swap(lhs, rhs);
+            }
+            if (!loop.isInvariant(rhs))
+            {
+                return false;
+            }
+            offset.push_back({rhs, index->op == IROpcode::Sub});
+            index = lhs;
+        }
+        std::sort(offset.begin(), offset.end(),
+                  [](const auto &a, const auto &b) {
+                      return a.first->id != b.first->id
+                                 ? a.first->id < b.first->id
+                                 : a.second < b.second;
+                  });
+        return true;
+    }
+
+    static bool matchOperand(const IRLoop &loop, IRInstr *value, IRInstr *phi,
+                             VectorOperand &operand)
+    {
+        operand.array = -1;
+        operand.value = value;
+        operand.offset.clear();
+        if (loop.isInvariant(value))
+        {
+            return true;
+        }
+        if (value->op != IROpcode::LoadElement)
+        {
+            return false;
+        }
+        operand.array = value->imm;
+        return matchOffset(loop, value->operands[0], phi, operand.offset);
+    }
+
+    /**
+     * 来自所有回边的操作数都相同时返回它，否则返回空
+     */
+    static IRInstr *backEdgeValue(const IRLoop &loop, IRInstr *phi)
+    {
+        int entryIndex = loop.header->predIndex(loop.preheader);
+        IRInstr *next = nullptr;
+        for (size_t i = 0; i < phi->operands.size(); ++i)
+        {
+            if (static_cast<int>(i) == entryIndex)
+            {
+                continue;
+            }
+            if (next != nullptr && phi->operands[i] != next)
+            {
+                return nullptr;
+            }
+            next = phi->operands[i];
+        }
+        return next;
+    }
+
+    /**
+     * 归约变量在回边上的值是 r + x、x + r、r - x，
+     * 或者按 x 和 r 的比较结果在两者中选一个的 Phi
+     */
+    static bool matchReduction(const IRLoop &loop, IRInstr *phi,
+                               IRInstr *counter, Reduction &reduction)
+    {
+        auto *next = backEdgeValue(loop, phi);
+        if (next == nullptr || next->block == nullptr ||
+            !loop.has(next->block))
+        {
+            return false;
+        }
+        reduction.phi = phi;
+        if (next->op == IROpcode::Add || next->op == IROpcode::Sub)
+        {
+            auto *lhs = next->operands[0];
+            auto *rhs = next->operands[1];
+            if (next->op == IROpcode::Add && rhs == phi)
+            {
+                std::swap(lhs, rhs);
+            }
+            reduction.op = IROpcode::VectorSum;
+            reduction.negate = next->op == IROpcode::Sub;
+            return lhs == phi &&
+                   matchOperand(loop, rhs, counter, reduction.element) &&
+                   reduction.element.array >= 0;
+        }
+        return matchSelect(loop, phi, next, counter, reduction);
+    }
+
+    /**
+     * if (x > r) r = x 这样的选择：next 是汇合块中的 Phi，
+     * 两个前驱是条件分支所在的块，或者只有这一个前驱、直接跳到汇合块的块
+     */
+    static bool matchSelect(const IRLoop &loop, IRInstr *phi, IRInstr *next,
+                            IRInstr *counter, Reduction &reduction)
+    {
+        auto *join = next->block;
+        if (next->op != IROpcode::Phi || join->preds.size() != 2)
+        {
+            return false;
+        }
+        IRBlock *branch = nullptr;
+        IRBlock *sides[2];
+        for (int k = 0; k < 2; ++k)
+        {
+            auto *pred = join->preds[k];
+            auto *from = pred;
+            if (pred->terminator()->op == IROpcode::Jump)
+            {
+                if (pred->preds.size() != 1)
+                {
+                    return false;
+                }
+                from = pred->preds[0];
+            }
+            if (branch != nullptr && from != branch)
+            {
+                return false;
+            }
+            branch = from;
+            // 分支直接跳到汇合块时，这一侧的目标就是汇合块
+            sides[k] = pred == from ? join : pred;
+        }
+        auto *term = branch->terminator();
+        if (term->op != IROpcode::Branch || !loop.has(branch))
+        {
+            return false;
+        }
+        int onTrue = term->targets[0] == sides[0] ? 0 : 1;
+        if (term->targets[0] != sides[onTrue] ||
+            term->targets[1] != sides[1 - onTrue])
+        {
+            return false;
+        }
+        // 比较 x 和 r，x 在左边
+        auto *cond = term->operands[0];
+        auto op = cond->op;
+        if (op != IROpcode::Lt && op != IROpcode::Le && op != IROpcode::Gt &&
+            op != IROpcode::Ge)
+        {
+            return false;
+        }
+        auto *x = cond->operands[0];
+        if (x == phi)
+        {
+            x = cond->operands[1];
+            op = op == IROpcode::Lt   ? IROpcode::Gt
+                 : op == IROpcode::Le ? IROpcode::Ge
+                 : op == IROpcode::Gt ? IROpcode::Lt
+                                      : IROpcode::Le;
+        }
+        else if (cond->operands[1] != phi)
+        {
+            return false;
+        }
+        auto &element = reduction.element;
+        if (!matchOperand(loop, x, counter, element) || element.array < 0)
+        {
+            return false;
+        }
+        // 条件为真时选 x 还是 r，x 可以是另一条读取同一个元素的指令
+        auto isElement = [&](IRInstr *value) {
+            VectorOperand other;
+            return matchOperand(loop, value, counter, other) &&
+                   other.array == element.array &&
+                   other.offset == element.offset;
+        };
+        auto *picked = next->operands[onTrue];
+        auto *other = next->operands[1 - onTrue];
+        bool pickX;
+        if (isElement(picked) && other == phi)
+        {
+            pickX = true;
+        }
+        else if (picked == phi && isElement(other))
+        {
+            pickX = false;
+        }
+        else
+        {
+            return false;
+        }
+        bool greater = op == IROpcode::Gt || op == IROpcode::Ge;
+        reduction.op =
+            greater == pickX ? IROpcode::VectorMax : IROpcode::VectorMin;
+        return true;
+    }
+
+    /**
+     * 向量化一个循环，成功时返回 true
+     */
+    bool vectorizeLoop(const IRLoop &loop)
+    {
+        auto *term = loop.header->terminator();
+        if (loop.preheader == nullptr || term->op != IROpcode::Branch ||
+            !loop.has(term->targets[0]) || loop.has(term->targets[1]))
+        {
+            return false;
+        }
+        CountedLoop counted;
+        if (!matchCountedLoop(loop, term->operands[0], counted) ||
+            !counted.increasing || counted.step->op != IROpcode::Const ||
+            counted.step->imm != 1)
+        {
+            return false;
+        }
+        // 最多只有一条 StoreElement，没有其他副作用，只从循环头退出
+        IRInstr *store = nullptr;
+        size_t size = 0;
+        for (auto *block : loop.blocks)
+        {
+            size += block->instrs.size();
+            for (auto *succ : block->succs())
+            {
+                if (!loop.has(succ) && block != loop.header)
+                {
+                    return false;
+                }
+            }
+            for (auto *instr : block->instrs)
+            {
+                if (!instr->hasSideEffect() || instr->isTerminator())
+                {
+                    continue;
+                }
+                if (instr->op != IROpcode::StoreElement || store != nullptr)
+                {
+                    return false;
+                }
+                store = instr;
+            }
+        }
+        if (size > maxVersionedSize)
+        {
+            return false;
+        }
+        std::vector<Reduction> reductions;
+        for (auto *instr : loop.header->instrs)
+        {
+            if (instr->op != IROpcode::Phi)
+            {
+                break;
+            }
+            if (instr == counted.phi)
+            {
+                continue;
+            }
+            if (store != nullptr)
+            {
+                return false;
+            }
+            reductions.emplace_back();
+            if (!matchReduction(loop, instr, counted.phi, reductions.back()))
+            {
+                return false;
+            }
+        }
+        if (store == nullptr)
+        {
+            if (reductions.empty())
+            {
+                return false;
+            }
+            emitCountedLoop(loop, counted, [&](IRInstr *count) {
+                emitReductions(loop, counted, reductions, count);
+            });
+            return true;
+        }
+
+        // 逐元素赋值 a[...] = lhs op rhs，op 为 Copy 时只有 lhs
+        auto *body = term->targets[0];
+        if (loop.blocks.size() != 2 || store->block != body)
+        {
+            return false;
+        }
+        VectorOperand target;
+        target.array = store->imm;
+        if (!matchOffset(loop, store->operands[0], counted.phi, target.offset))
+        {
+            return false;
+        }
+        auto *value = store->operands[1];
+        auto op = IROpcode::Copy;
+        VectorOperand lhs;
+        VectorOperand rhs;
+        if (!matchOperand(loop, value, counted.phi, lhs))
+        {
+            op = value->op;
+            if ((op != IROpcode::Add && op != IROpcode::Sub &&
+                 op != IROpcode::Mul) ||
+                !matchOperand(loop, value->operands[0], counted.phi, lhs) ||
+                !matchOperand(loop, value->operands[1], counted.phi, rhs))
+            {
+                return false;
+            }
+        }
+        // 读取目标数组时下标必须和写入的相同
+        for (auto *instr : body->instrs)
+        {
+            VectorOffset offset;
+            if (instr->op == IROpcode::LoadElement &&
+                instr->imm == target.array &&
+                (!matchOffset(loop, instr->operands[0], counted.phi,
+                              offset) ||
+                 offset != target.offset))
+            {
+                return false;
+            }
+        }
+        emitCountedLoop(loop, counted, [&](IRInstr *count) {
+            emitElementwise(loop, counted, count, target, op, lhs, rhs);
+        });
+        return true;
+    }
+
+    /**
+     * 在 preheader 中算出迭代次数 n = max(end - init, 0)，
+     * 交给 emit 生成批量运算，再让 i 从 init + n 开始，循环条件一开始就不成立
+     */
+    template <typename Emit>
+    void emitCountedLoop(const IRLoop &loop, const CountedLoop &counted,
+                         Emit emit)
+    {
+        auto *pos = loop.preheader->terminator();
+        auto *end = counted.inclusive
+                        ? insertBefore(pos, IROpcode::Add,
+                                       {counted.bound, fn_.constant(1)})
+                        : counted.bound;
+        auto *diff = insertBefore(pos, IROpcode::Sub, {end, counted.init});
+        auto *positive =
+            insertBefore(pos, IROpcode::Gt, {diff, fn_.constant(0)});
+        auto *count = insertBefore(pos, IROpcode::Mul, {diff, positive});
+        emit(count);
+        auto *last = insertBefore(pos, IROpcode::Add, {counted.init, count});
+        counted.phi->operands[loop.header->predIndex(loop.preheader)] = last;
+    }
+
+    /**
+     * 按行展开后的下标 init + offset
+     */
+    IRInstr *vectorStart(const IRLoop &loop, const CountedLoop &counted,
+                         const VectorOffset &offset)
+    {
+        auto *pos = loop.preheader->terminator();
+        auto *start = counted.init;
+        for (auto &[term, negative] : offset)
+        {
+            start = insertBefore(pos, negative ? IROpcode::Sub : IROpcode::Add,
+                                 {start, term});
+        }
+        return start;
+    }
+
+    IRInstr *insertVector(const IRLoop &loop, IROpcode op, int32_t array,
+                          std::vector<IRInstr *> operands, int32_t source = -1)
+    {
+        auto *instr =
+            insertBefore(loop.preheader->terminator(), op, std::move(operands));
+        instr->imm = array;
+        instr->source = source;
+        return instr;
+    }
+
+    void emitReductions(const IRLoop &loop, const CountedLoop &counted,
+                        const std::vector<Reduction> &reductions,
+                        IRInstr *count)
+    {
+        int entryIndex = loop.header->predIndex(loop.preheader);
+        for (auto &reduction : reductions)
+        {
+            auto &init = reduction.phi->operands[entryIndex];
+            auto *start = vectorStart(loop, counted, reduction.element.offset);
+            if (reduction.negate)
+            {
+                auto *sum =
+                    insertVector(loop, IROpcode::VectorSum,
+                                 reduction.element.array,
+                                 {start, count, fn_.constant(0)});
+                init = insertBefore(loop.preheader->terminator(),
+                                    IROpcode::Sub, {init, sum});
+            }
+            else
+            {
+                init = insertVector(loop, reduction.op, reduction.element.array,
+                                    {start, count, init});
+            }
+        }
+    }
+
+    /**
+     * 目标数组先赋值为 lhs（lhs 就是目标数组时不用），再和 rhs 运算；
+     * x - a[i] 改写成 a[i] * -1 + x
+     */
+    void emitElementwise(const IRLoop &loop, const CountedLoop &counted,
+                         IRInstr *count, const VectorOperand &target,
+                         IROpcode op, const VectorOperand &lhs,
+                         const VectorOperand &rhs)
+    {
+        auto *first = vectorStart(loop, counted, target.offset);
+        auto apply = [&](IROpcode vectorOp, const VectorOperand &operand) {
+            if (operand.array < 0)
+            {
+                insertVector(loop, vectorOp, target.array,
+                             {first, count, operand.value});
+            }
+            else
+            {
+                insertVector(loop, vectorOp, target.array,
+                             {first, count,
+                              vectorStart(loop, counted, operand.offset)},
+                             operand.array);
+            }
+        };
+        auto assign = [&](const VectorOperand &operand) {
+            if (operand.array < 0)
+            {
+                apply(IROpcode::VectorFill, operand);
+            }
+            else if (operand.array != target.array)
+            {
+                apply(IROpcode::VectorCopy, operand);
+            }
+        };
+        if (op == IROpcode::Copy)
+        {
+            assign(lhs);
+            return;
+        }
+        auto vectorOp = op == IROpcode::Add   ? IROpcode::VectorAdd
+                        : op == IROpcode::Sub ? IROpcode::VectorSub
+                                              : IROpcode::VectorMul;
+        if (lhs.array == target.array)
+        {
+            apply(vectorOp, rhs);
+        }
+        else if (rhs.array == target.array && op != IROpcode::Sub)
+        {
+            apply(vectorOp, lhs);
+        }
+        else if (rhs.array == target.array)
+        {
+            VectorOperand minusOne;
+            minusOne.value = fn_.constant(-1);
+            apply(IROpcode::VectorMul, minusOne);
+            apply(IROpcode::VectorAdd, lhs);
+        }
+        else
+        {
+            assign(lhs);
+            apply(vectorOp, rhs);
+        }
+    }
+
+    IRInstr *newHeaderPhi(const IRLoop &loop)
+    {
+        auto *phi = fn_.newInstr(IROpcode::Phi);
+        phi->block = loop.header;
+        loop.header->instrs.insert(loop.header->instrs.begin(), phi);
+        return phi;
+    }
+
+    /**
+     * 来自 preheader 的操作数是 start，来自回边的都是 next
+     */
+    static void setHeaderPhiOperands(const IRLoop &loop, IRInstr *phi,
+                                     IRInstr *start, IRInstr *next)
+    {
+        for (auto *pred : loop.header->preds)
+        {
+            phi->operands.push_back(pred == loop.preheader ? start : next);
+        }
+    }
+
+    IRInstr *insertBefore(IRInstr *pos, IROpcode op,
+                          std::vector<IRInstr *> operands)
+    {
+        auto *instr = fn_.newInstr(op);
+        instr->operands = std::move(operands);
+        instr->block = pos->block;
+        auto &instrs = pos->block->instrs;
+        instrs.insert(std::find(instrs.begin(), instrs.end(), pos), instr);
+        return instr;
+    }
+
+    IRInstr *insertAfter(IRInstr *pos, IROpcode op,
+                         std::vector<IRInstr *> operands)
+    {
+        auto *instr = fn_.newInstr(op);
+        instr->operands = std::move(operands);
+        instr->block = pos->block;
+        auto &instrs = pos->block->instrs;
+        instrs.insert(std::find(instrs.begin(), instrs.end(), pos) + 1, instr);
+        return instr;
+    }
+
+    std::vector<std::vector<IRInstr *>> computeUsers() const
+    {
+        std::vector<std::vector<IRInstr *>> users(fn_.valueCount());
+        for (auto *block : fn_.blocks)
+        {
+            for (auto *instr : block->instrs)
+            {
+                for (auto *operand : instr->operands)
+                {
+                    users[operand->id].push_back(instr);
+                }
+            }
+        }
+        return users;
+    }
+
+    /**
+     * pred 以 Jump 结尾并且是 block 唯一的前驱时，把 block 并入 pred
+     */
+    bool mergeIntoPredecessor(IRBlock *block)
+    {
+        if (block == fn_.entry || block->preds.size() != 1)
+        {
+            return false;
+        }
+        auto *pred = block->preds[0];
+        auto *term = pred->terminator();
+        if (pred == block || term->op != IROpcode::Jump)
+        {
+            return false;
+        }
+        // 只有一个前驱时 Phi 都是平凡的
+        std::unordered_map<IRInstr *, IRInstr *> replacement;
+        while (!block->instrs.empty() && block->instrs[0]->op == IROpcode::Phi)
+        {
+            replacement[block->instrs[0]] = block->instrs[0]->operands[0];
+            fn_.eraseInstr(block->instrs[0]);
+        }
+        fn_.replaceUses(replacement);
+
+        fn_.eraseInstr(term);
+        for (auto *instr : block->instrs)
+        {
+            instr->block = pred;
+            pred->instrs.push_back(instr);
+        }
+        block->instrs.clear();
+        for (auto *succ : pred->succs())
+        {
+            std::replace(succ->preds.begin(), succ->preds.end(), block, pred);
+        }
+        block->preds.clear();
+        fn_.blocks.erase(
+            std::find(fn_.blocks.begin(), fn_.blocks.end(), block));
+        return true;
+    }
+
+    /**
+     * block 里只有一条 Jump 时，让前驱直接跳到目标
+     */
+    bool forwardEmptyBlock(IRBlock *block)
+    {
+        if (block == fn_.entry || block->instrs.size() != 1 ||
+            block->instrs[0]->op != IROpcode::Jump)
+        {
+            return false;
+        }
+        auto *target = block->instrs[0]->targets[0];
+        if (target == block)
+        {
+            return false;
+        }
+        // 前驱已经能到达目标的话，Phi 的操作数会有歧义
+        for (auto *pred : block->preds)
+        {
+            if (target->predIndex(pred) >= 0 || pred == block)
+            {
+                return false;
+            }
+        }
+        int index = target->predIndex(block);
+        std::vector<IRInstr *> incoming;
+        for (auto *instr : target->instrs)
+        {
+            if (instr->op != IROpcode::Phi)
+            {
+                break;
+            }
+            incoming.push_back(instr->operands[index]);
+        }
+        IRFunction::removeEdge(block, target);
+        for (auto *pred : block->preds)
+        {
+            for (auto &t : pred->terminator()->targets)
+            {
+                if (t == block)
+                {
+                    t = target;
+                }
+            }
+            target->preds.push_back(pred);
+            for (size_t i = 0; i < incoming.size(); ++i)
+            {
+                target->instrs[i]->operands.push_back(incoming[i]);
+            }
+        }
+        block->preds.clear();
+        fn_.blocks.erase(
+            std::find(fn_.blocks.begin(), fn_.blocks.end(), block));
+        return true;
+    }
+
+  private:
+    IRFunction &fn_;
+};
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <charconv>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include "./generated/FalconScriptParser.h"
+
+/**
+ * 整数字面量的值，MyVisitor、IRBuilder 和 case 标签共用
+ *
+ * 去掉下划线、进制前缀和 L 后缀之后用 std::from_chars 解析，
+ * 还剩别的字符或者超出范围时报错，不像 atoi 那样悄悄截断。
+ * 十六进制、八进制和二进制按位解释：int 最多 32 位，long 最多 64 位，
+ * 0xffffffff 是 -1。十进制的 int 最大是 2147483648，long 最大是
+ * 9223372036854775808L，和 Java 一样是为了能写出 -2147483648，
+ * 按补码回绕成最小值
+ */
+inline bool isLongLiteral(FalconScriptParser::IntegerLiteralContext *ctx)
+{
+    auto text = ctx->getText();
+    return text.back() == 'l' || text.back() == 'L';
+}
+
+inline uint64_t literalBits(FalconScriptParser::IntegerLiteralContext *ctx,
+                            bool isLong)
+{
+    auto text = ctx->getText();
+    int base = ctx->HEX_LITERAL()       ? 16
+               : ctx->OCTAL_LITERAL()  ? 8
+               : ctx->BINARY_LITERAL() ? 2
+                                       : 10;
+    std::string digits;
+    for (auto c : text)
+    {
+        if (c != '_')
+        {
+            digits += c;
+        }
+    }
+    // from_chars 不认识 0x 和 0b 前缀；八进制的前导 0 不影响值
+    if (base == 16 || base == 2)
+    {
+        digits.erase(0, 2);
+    }
+    if (isLong)
+    {
+        digits.pop_back();
+    }
+    uint64_t value = 0;
+    const char *end = digits.data() + digits.size();
+    auto [last, error] = std::from_chars(digits.data(), end, value, base);
+    const char *type = isLong ? "long" : "int";
+    if (error == std::errc::invalid_argument || last != end)
+    {
+        throw std::runtime_error(text + "不是" + type + "字面量");
+    }
+    uint64_t max = base != 10 ? (isLong ? UINT64_MAX : UINT32_MAX)
+                              : (isLong ? uint64_t(1) << 63 : 1u << 31);
+    if (error == std::errc::result_out_of_range || value > max)
+    {
+        throw std::runtime_error("字面量" + text + "超出" + type + "的范围");
+    }
+    return value;
+}
+
+/**
+ * 不带 L 后缀的字面量
+ */
+inline int32_t intLiteral(FalconScriptParser::IntegerLiteralContext *ctx)
+{
+    return static_cast<int32_t>(static_cast<uint32_t>(literalBits(ctx, false)));
+}
+
+/**
+ * 带 L 后缀的字面量
+ */
+inline int64_t longLiteral(FalconScriptParser::IntegerLiteralContext *ctx)
+{
+    return static_cast<int64_t>(literalBits(ctx, true));
+}
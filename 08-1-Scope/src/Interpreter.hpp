@@ -0,0 +1,397 @@
+#pragma once
+
+#include <antlr4-runtime.h>
+
+#include "./generated/FalconScriptLexer.h"
+#include "./generated/FalconScriptParser.h"
+#include "MyListener.hpp"
+#include "MyVisitor.hpp"
+
+/**
+ * 解释器实例，持有执行脚本需要的全部状态：
+ * 语法树、注解树（作用域）、栈帧、各种按节点的缓存、输出
+ *
+ * 实例之间没有共享的可变数据，多个线程可以各自创建实例同时执行脚本，不需要加锁。
+ * 语法树和注解树分析完之后只读，可以由多个实例共用
+ */
+class Interpreter
+{
+  public:
+    struct Options
+    {
+        bool repl = false;      ///< repl 模式，输出新定义的变量和表达式的值
+        bool optimize = false;  ///< 编译成字节码执行
+        bool dumpIR = false;    ///< 把优化后的 IR 输出到 err
+        int osrThreshold = 0;   ///< 解释执行时的栈上替换阈值，0 表示关闭
+        /// 可以从外部注入初值的顶层变量，编译后按这个顺序对应字节码的槽位
+        std::vector<std::string> globals;
+        /// 每次 execute 最多执行的步数（循环的迭代次数）
+        uint64_t maxSteps = Budget::unlimited;
+        /// 每次 execute 最长的执行时间，0 表示不限制
+        std::chrono::milliseconds timeout{0};
+        /// 栈帧、变量和寄存器最多使用的字节数
+        size_t maxMemory = MemoryAccount::unlimited;
+        /// 每次 execute 结束时把内存峰值输出到 err
+        bool reportMemory = false;
+        /// 内置函数 load、save 可以读写文件
+        bool allowFiles = true;
+        /// 内置函数 sort 最多使用的线程数，0 表示按 CPU 的核数
+        size_t sortThreads = 0;
+        /// 内置函数 read_int 等从这个文件描述符读取输入，-1 表示没有输入
+        int inputFd = -1;
+    };
+
+  public:
+    explicit Interpreter(const Options &options,
+                         std::ostream &out = std::cout,
+                         std::ostream &err = std::cerr)
+        : Interpreter(std::make_shared<Parsed>(), options, out, err)
+    {
+    }
+
+    /**
+     * 和 loaded 共用它 load 好的脚本，不再解析和分析，直接 execute
+     *
+     * 语法树和注解树分析完就不再修改，按节点的缓存都在各自的实例里，
+     * 多个线程可以各自创建这样的实例同时执行。之后 loaded 不能再 load 或 eval
+     */
+    Interpreter(const Interpreter &loaded,
+                const Options &options,
+                std::ostream &out = std::cout,
+                std::ostream &err = std::cerr)
+        : Interpreter(loaded.parsed_, options, out, err)
+    {
+    }
+
+    /**
+     * 执行一段完整的脚本
+     */
+    void run(std::istream &in)
+    {
+        load(in);
+        execute();
+    }
+
+    /**
+     * 解析并分析脚本，返回语法错误的个数
+     */
+    size_t load(std::istream &in)
+    {
+        auto &source = parse(in);
+        parsed_->prog = source.parser.prog();
+        antlr4::tree::ParseTreeWalker::DEFAULT.walk(&listener_, parsed_->prog);
+        return source.parser.getNumberOfSyntaxErrors();
+    }
+
+    /**
+     * 之后内置函数 read_int 等从 input 读取，代替 Options::inputFd，
+     * 为空表示没有输入。input 由调用方持有
+     */
+    void setInput(input::IntReader *input)
+    {
+        visitor_.setInput(input);
+    }
+
+    /**
+     * 执行 load 进来的脚本
+     *
+     * 可以执行多次，每次都从空的全局作用域开始，字节码和按节点的缓存都会复用。
+     * globals 和 Options::globals 一一对应，是这一次注入的初值。
+     * 超出 maxSteps、timeout 或者 maxMemory 时抛出 BudgetExceeded，
+     * 之后仍然可以再次执行
+     */
+    void execute(const std::vector<int32_t> &globals = {})
+    {
+        if (options_.optimize && !compiled_)
+        {
+            bytecode_ = compile();
+            compiled_ = true;
+        }
+        if (bytecode_ != nullptr)
+        {
+            runBytecode(*bytecode_, globals, options_, out_, err_);
+            return;
+        }
+        std::unordered_map<std::string, int32_t> overrides;
+        for (size_t i = 0; i < globals.size(); ++i)
+        {
+            overrides[options_.globals[i]] = globals[i];
+        }
+        visitor_.setGlobals(std::move(overrides));
+        auto &memory = visitor_.memory();
+        memory.setLimit(options_.maxMemory);
+        memory.resetPeak();
+        Budget budget(options_.maxSteps, options_.timeout);
+        visitor_.setBudget(&budget);
+        try
+        {
+            visitor_.visitProg(parsed_->prog);
+        }
+        catch (BudgetExceeded &)
+        {
+            visitor_.setBudget(nullptr);
+            reportMemory(options_, err_, memory.peak());
+            throw;
+        }
+        visitor_.setBudget(nullptr);
+        reportMemory(options_, err_, memory.peak());
+    }
+
+    /**
+     * 修改之后每次 execute 的执行限制
+     */
+    void setLimits(uint64_t maxSteps,
+                   std::chrono::milliseconds timeout,
+                   size_t maxMemory)
+    {
+        options_.maxSteps = maxSteps;
+        options_.timeout = timeout;
+        options_.maxMemory = maxMemory;
+    }
+
+    /**
+     * 执行 compile 的结果，globals 是注入的初值，执行限制取自 options
+     *
+     * 多个线程可以同时用同一个 program 执行
+     */
+    static void runBytecode(const BytecodeProgram &program,
+                            const std::vector<int32_t> &globals,
+                            const Options &options,
+                            std::ostream &out,
+                            std::ostream &err)
+    {
+        // 整个脚本编译出来的字节码只读槽位，不会写回
+        std::vector<int32_t> values(globals);
+        std::vector<int32_t *> slots;
+        for (auto &value : values)
+        {
+            slots.push_back(&value);
+        }
+        // 寄存器的个数在编译时就确定了，数组由虚拟机创建时记账
+        MemoryAccount memory;
+        memory.setLimit(options.maxMemory);
+        try
+        {
+            MemoryCharge registers(
+                memory, program.registers.size() * sizeof(int32_t));
+            Budget budget(options.maxSteps, options.timeout);
+            VM(program, out, &budget, &memory).run(slots.data());
+        }
+        catch (BudgetExceeded &)
+        {
+            reportMemory(options, err, memory.peak());
+            throw;
+        }
+        reportMemory(options, err, memory.peak());
+    }
+
+    /**
+     * load 进来的脚本在顶层定义的变量，按出现的顺序
+     */
+    std::vector<std::string> declaredGlobals() const
+    {
+        std::vector<std::string> names;
+        for (auto *statement : parsed_->prog->blockStatement())
+        {
+            auto *declarators = statement->variableDeclarators();
+            // map 不能用 -D 注入初值
+            if (declarators != nullptr && !declarators->typeType()->MAP())
+            {
+                for (auto *declarator : declarators->variableDeclarator())
+                {
+                    // 数组不能用 -D 注入初值
+                    if (!declarator->variableDeclaratorId()
+                             ->expression()
+                             .empty())
+                    {
+                        continue;
+                    }
+                    names.push_back(declarator->variableDeclaratorId()
+                                        ->IDENTIFIER()
+                                        ->getText());
+                }
+            }
+        }
+        return names;
+    }
+
+    /**
+     * 把 load 进来的脚本编译成字节码，有 IR 不支持的写法时返回空
+     */
+    std::unique_ptr<BytecodeProgram> compile()
+    {
+        std::unique_ptr<IRFunction> fn;
+        try
+        {
+            fn = IRBuilder(&parsed_->at).build(parsed_->prog, options_.globals);
+        }
+        catch (IRUnsupported &e)
+        {
+            if (options_.dumpIR)
+            {
+                err_ << "IR: " << e.what() << "，退回解释执行" << std::endl;
+            }
+            return nullptr;
+        }
+        IROptimizer(*fn).run();
+        if (options_.dumpIR)
+        {
+            fn->dump(err_);
+        }
+        return std::make_unique<BytecodeProgram>(BytecodeLowering(*fn).lower());
+    }
+
+    /**
+     * execute 用到的字节码，没有开启优化或者编译失败时为空
+     */
+    const BytecodeProgram *bytecode() const
+    {
+        return bytecode_.get();
+    }
+
+    /**
+     * repl 的一次输入
+     *
+     * 第一次按整个程序解析，准备好全局作用域；之后每次只解析一条语句，
+     * 在同一个全局作用域中继续执行
+     */
+    void eval(const std::string &input)
+    {
+        std::istringstream in(input);
+        auto &source = parse(in);
+        if (isFirstInput_)
+        {
+            auto *prog = source.parser.prog();
+            antlr4::tree::ParseTreeWalker::DEFAULT.walk(&listener_, prog);
+            visitor_.visitProg(prog);
+            isFirstInput_ = false;
+        }
+        else [[likely]]
+        {
+            auto *blockStatement = source.parser.blockStatement();
+            antlr4::tree::ParseTreeWalker::DEFAULT.walk(&listener_,
+                                                        blockStatement);
+            visitor_.visitBlockStatement(blockStatement);
+        }
+    }
+
+  private:
+    /**
+     * 把语法错误输出到 err，格式和 antlr 默认的 ConsoleErrorListener 相同
+     */
+    class ErrorListener : public antlr4::BaseErrorListener
+    {
+      public:
+        explicit ErrorListener(std::ostream &err) : err_(err)
+        {
+        }
+
+        virtual void syntaxError(antlr4::Recognizer * /*recognizer*/,
+                                 antlr4::Token * /*offendingSymbol*/,
+                                 size_t line,
+                                 size_t charPositionInLine,
+                                 const std::string &msg,
+                                 std::exception_ptr /*e*/) override
+        {
+            err_ << "line " << line << ":" << charPositionInLine << " " << msg
+                 << std::endl;
+        }
+
+      private:
+        std::ostream &err_;
+    };
+
+    /**
+     * 一次输入的词法、语法分析器，语法树的节点属于 parser
+     */
+    struct Source
+    {
+        Source(std::istream &in, ErrorListener *errorListener)
+            : input(in), lexer(&input), tokens(&lexer), parser(&tokens)
+        {
+            lexer.removeErrorListeners();
+            lexer.addErrorListener(errorListener);
+            parser.removeErrorListeners();
+            parser.addErrorListener(errorListener);
+        }
+
+        antlr4::ANTLRInputStream input;
+        FalconScriptLexer lexer;
+        antlr4::CommonTokenStream tokens;
+        FalconScriptParser parser;
+    };
+
+  private:
+    static void reportMemory(const Options &options,
+                             std::ostream &err,
+                             size_t peak)
+    {
+        if (options.reportMemory)
+        {
+            err << "内存峰值：" << peak << " 字节" << std::endl;
+        }
+    }
+
+    /**
+     * load 和 eval 的结果：语法树、注解树（作用域）和 load 进来的脚本
+     *
+     * 分析完之后只读，可以由多个实例共用，见 Interpreter(const Interpreter &)
+     */
+    struct Parsed
+    {
+        /// 语法树的节点属于各自的 parser，各种缓存都以节点的地址或编号为键
+        std::vector<std::unique_ptr<Source>> sources;
+        AnnotatedTree at;
+        FalconScriptParser::ProgContext *prog = nullptr;
+    };
+
+    Interpreter(std::shared_ptr<Parsed> parsed,
+                const Options &options,
+                std::ostream &out,
+                std::ostream &err)
+        : options_(options),
+          out_(out),
+          err_(err),
+          errorListener_(err),
+          parsed_(std::move(parsed)),
+          listener_(&parsed_->at),
+          visitor_(options.repl, &parsed_->at, out),
+          compiled_(false),
+          isFirstInput_(true)
+    {
+        if (options_.osrThreshold > 0)
+        {
+            visitor_.enableOsr(options_.osrThreshold);
+        }
+        visitor_.setAllowFiles(options_.allowFiles);
+        visitor_.setSortThreads(options_.sortThreads);
+        if (options_.inputFd >= 0)
+        {
+            input_ = std::make_unique<input::IntReader>(options_.inputFd);
+            visitor_.setInput(input_.get());
+        }
+    }
+
+    Source &parse(std::istream &in)
+    {
+        parsed_->sources.push_back(
+            std::make_unique<Source>(in, &errorListener_));
+        return *parsed_->sources.back();
+    }
+
+  private:
+    Options options_;
+    std::ostream &out_;
+    std::ostream &err_;
+    ErrorListener errorListener_;
+    /// 语法树至少和实例的生命周期相同
+    std::shared_ptr<Parsed> parsed_;
+    MyListener listener_;
+    MyVisitor visitor_;
+    /// 多次 execute 共用，上一次没有读完的输入留给下一次
+    std::unique_ptr<input::IntReader> input_;
+    bool compiled_;
+    /// 为空表示没有开启优化，或者脚本中有 IR 不支持的写法
+    std::unique_ptr<BytecodeProgram> bytecode_;
+    bool isFirstInput_;
+};
@@ -0,0 +1,167 @@
+#pragma once
+
+#include <cstddef>
+#include <new>
+#include "Budget.hpp"
+
+/**
+ * 一个解释器实例的内存账本：正在使用的字节数、峰值和上限
+ *
+ * 只在一个线程中使用，不需要原子操作
+ */
+class MemoryAccount
+{
+  public:
+    static constexpr size_t unlimited = SIZE_MAX;
+
+    /**
+     * 记一笔分配，超过上限时抛出 BudgetExceeded，这一笔不计入
+     */
+    void charge(size_t bytes)
+    {
+        if (bytes > limit_ - inUse_) [[unlikely]]
+        {
+            throw BudgetExceeded("超出内存限制");
+        }
+        inUse_ += bytes;
+        if (inUse_ > peak_)
+        {
+            peak_ = inUse_;
+        }
+    }
+
+    void release(size_t bytes)
+    {
+        inUse_ -= bytes;
+    }
+
+    void setLimit(size_t limit)
+    {
+        limit_ = limit;
+    }
+
+    /**
+     * 从当前用量开始重新统计峰值
+     */
+    void resetPeak()
+    {
+        peak_ = inUse_;
+    }
+
+    size_t inUse() const
+    {
+        return inUse_;
+    }
+
+    size_t peak() const
+    {
+        return peak_;
+    }
+
+  private:
+    size_t inUse_ = 0;
+    size_t peak_ = 0;
+    size_t limit_ = unlimited;
+};
+
+/**
+ * 在作用域内占用一笔内存，析构时归还
+ */
+class MemoryCharge
+{
+  public:
+    MemoryCharge(MemoryAccount &account, size_t bytes)
+        : account_(account), bytes_(bytes)
+    {
+        account_.charge(bytes_);
+    }
+
+    ~MemoryCharge()
+    {
+        account_.release(bytes_);
+    }
+
+    MemoryCharge(const MemoryCharge &) = delete;
+    MemoryCharge &operator=(const MemoryCharge &) = delete;
+
+  private:
+    MemoryAccount &account_;
+    size_t bytes_;
+};
+
+/**
+ * 向 MemoryAccount 记账的分配器，内存本身仍然来自全局的 operator new
+ *
+ * 给 std::allocate_shared 和标准容器使用，栈帧、变量表和变量的存储空间
+ * 都通过它分配，一个脚本用了多少内存就能精确地统计和限制
+ *
+ * 默认构造的分配器没有账本，不记账，给 bigint 运算的中间结果使用
+ */
+template <typename T>
+class AccountedAllocator
+{
+  public:
+    using value_type = T;
+
+    AccountedAllocator() : account_(nullptr)
+    {
+    }
+
+    explicit AccountedAllocator(MemoryAccount *account) : account_(account)
+    {
+    }
+
+    template <typename U>
+    AccountedAllocator(const AccountedAllocator<U> &other)
+        : account_(other.account())
+    {
+    }
+
+    T *allocate(size_t n)
+    {
+        if (account_ == nullptr)
+        {
+            return static_cast<T *>(::operator new(n * sizeof(T)));
+        }
+        account_->charge(n * sizeof(T));
+        try
+        {
+            return static_cast<T *>(::operator new(n * sizeof(T)));
+        }
+        catch (...)
+        {
+            account_->release(n * sizeof(T));
+            throw;
+        }
+    }
+
+    void deallocate(T *p, size_t n)
+    {
+        // 先记账再释放，否则 GCC 在 -O2 下会报 -Wuse-after-free
+        if (account_ != nullptr)
+        {
+            account_->release(n * sizeof(T));
+        }
+        ::operator delete(p);
+    }
+
+    MemoryAccount *account() const
+    {
+        return account_;
+    }
+
+    template <typename U>
+    bool operator==(const AccountedAllocator<U> &other) const
+    {
+        return account_ == other.account();
+    }
+
+    template <typename U>
+    bool operator!=(const AccountedAllocator<U> &other) const
+    {
+        return account_ != other.account();
+    }
+
+  private:
+    MemoryAccount *account_;
+};
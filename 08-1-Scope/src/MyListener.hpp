@@ -7,7 +7,7 @@
 class MyListener : public FalconScriptBaseListener
 {
   public:
-    MyListener(AnnotatedTree* at) : at_(at)
+    MyListener(AnnotatedTree* at) : at_(at), blockId_(0)
     {
     }
 
@@ -18,6 +18,7 @@ class MyListener : public FalconScriptBaseListener
 
         at_->ast = ctx;
         at_->node2scope[ctx] = blockScope.get();
+        at_->scopes.push_back(blockScope);
         scopeStack_.push(blockScope);
     }
 
@@ -29,8 +30,10 @@ class MyListener : public FalconScriptBaseListener
     virtual void enterBlock(FalconScriptParser::BlockContext* ctx) override
     {
         // TODO: 检查父节点是否是函数
-        auto blockScope = std::make_shared<BlockScope>(scopeStack_.top().get(), ctx);
+        auto blockScope = std::make_shared<BlockScope>(
+            scopeStack_.top().get(), ctx, std::to_string(blockId_++));
         at_->node2scope[ctx] = blockScope.get();
+        at_->scopes.push_back(blockScope);
         scopeStack_.push(blockScope);
     }
 
@@ -43,12 +46,13 @@ class MyListener : public FalconScriptBaseListener
     virtual void enterStatement(
         FalconScriptParser::StatementContext* ctx) override
     {
-        // for 循环的 init 部分可能会定义变量
-        if (ctx->FOR())
+        // for 循环的 init 部分可能会定义变量，switch 的各个分支共用一个作用域
+        if (ctx->FOR() || ctx->SWITCH())
         {
-            auto blockScope =
-                std::make_shared<BlockScope>(scopeStack_.top().get(), ctx);
+            auto blockScope = std::make_shared<BlockScope>(
+                scopeStack_.top().get(), ctx, std::to_string(blockId_++));
             at_->node2scope[ctx] = blockScope.get();
+            at_->scopes.push_back(blockScope);
             scopeStack_.push(blockScope);
         }
     }
@@ -56,13 +60,25 @@ class MyListener : public FalconScriptBaseListener
     virtual void exitStatement(
         FalconScriptParser::StatementContext* ctx) override
     {
-        if (ctx->FOR())
+        if (ctx->FOR() || ctx->SWITCH())
         {
             scopeStack_.pop();
         }
     }
 
+    /**
+     * 给表达式节点编号，执行时按节点的缓存放在各自的数组里，
+     * 语法树本身分析完之后就不再修改，可以在多个线程之间共用
+     */
+    virtual void enterExpression(
+        FalconScriptParser::ExpressionContext* ctx) override
+    {
+        ctx->id = static_cast<int>(at_->expressions++);
+    }
+
   private:
     AnnotatedTree* at_;
     std::stack<std::shared_ptr<Scope>> scopeStack_;
+    /// 匿名块作用域的编号
+    uint32_t blockId_;
 };
@@ -1,90 +1,14 @@
 #pragma once
 
-#include <cstdlib>
 #include <sstream>
 #include "./generated/FalconScriptBaseVisitor.h"
 #include "AnnotatedTree.hpp"
+#include "Array.hpp"
+#include "Builtins.hpp"
+#include "OperatorKernels.hpp"
+#include "Osr.hpp"
 #include "StackFrame.hpp"
-
-/**
- * 普通二元运算符
- */
-#define BINARY_OPERATOR(op_name, op)                                          \
-    case FalconScriptParser::op_name:                                         \
-        if (left.is<int>() && right.is<int>())                                \
-        {                                                                     \
-            result = static_cast<int32_t>(left.as<int>() op right.as<int>()); \
-        }                                                                     \
-        else if (left.is<int>() && right.is<int *>())                         \
-        {                                                                     \
-            result =                                                          \
-                static_cast<int32_t>(left.as<int>() op * right.as<int *>());  \
-        }                                                                     \
-        else if (left.is<int *>() && right.is<int>())                         \
-        {                                                                     \
-            result =                                                          \
-                static_cast<int32_t>(*left.as<int *>() op right.as<int>());   \
-        }                                                                     \
-        else if (left.is<int *>() && right.is<int *>())                       \
-        {                                                                     \
-            result = static_cast<int32_t>(*left.as<int *>() op *              \
-                                          right.as<int *>());                 \
-        }                                                                     \
-        else                                                                  \
-        {                                                                     \
-            throw std::runtime_error("类型不匹配");                           \
-        }                                                                     \
-        break
-
-/**
- * 赋值运算符
- *
- * 如果是repl模式且不在循环中，则输出变量的新值
- */
-#define ASSIGN_OPERATOR(op_name, op)                                          \
-    case FalconScriptParser::op_name:                                         \
-        if (left.is<int32_t>())                                               \
-        {                                                                     \
-            throw std::runtime_error("赋值号左侧不能为字面量");               \
-        }                                                                     \
-        if (right.is<int32_t>())                                              \
-        {                                                                     \
-            result = static_cast<int32_t>(*left.as<int32_t *>()               \
-                                               op right.as<int32_t>());       \
-        }                                                                     \
-        else if (right.is<int32_t *>())                                       \
-        {                                                                     \
-            result = static_cast<int32_t>(*left.as<int32_t *>() op *          \
-                                          right.as<int32_t *>());             \
-        }                                                                     \
-        else                                                                  \
-        {                                                                     \
-            throw std::runtime_error("类型不匹配");                           \
-        }                                                                     \
-        if (isRepl_ && loopDepth_ == 0)                                       \
-        {                                                                     \
-            std ::cout << leftName << ": " << result.as<int>() << std ::endl; \
-        }                                                                     \
-        break
-
-/**
- * 前缀运算符
- */
-#define PREFIX_UNARY_OPERATOR(op_name, op)                             \
-    case FalconScriptParser::op_name:                                  \
-        if (child.is<int32_t>())                                       \
-        {                                                              \
-            result = static_cast<int32_t>(op child.as<int32_t>());     \
-        }                                                              \
-        else if (child.is<int32_t *>())                                \
-        {                                                              \
-            result = static_cast<int32_t>(op * child.as<int32_t *>()); \
-        }                                                              \
-        else                                                           \
-        {                                                              \
-            throw std::runtime_error("类型不匹配");                    \
-        }                                                              \
-        break
+#include "SwitchTable.hpp"
 
 /**
  * 支持的变量类型
@@ -92,6 +16,10 @@
 enum class FalconType
 {
     Integer,  ///< int32_t*
+    Long,  ///< int64_t*
+    BigInt,  ///< BigInt*，见 BigInt.hpp
+    Array,  ///< ArrayRef，元素在 Array 的连续缓冲区里
+    Map,  ///< IntMap*，见 HashMap.hpp
 };
 
 /**
@@ -109,9 +37,87 @@ enum class StatementFlowControl
 class MyVisitor : public FalconScriptBaseVisitor
 {
   public:
-    MyVisitor(bool isRepl, AnnotatedTree *at)
-        : at_{at}, stack_{}, isRepl_{isRepl}, loopDepth_{0}
+    /**
+     * 所有状态（栈帧、编译缓存、输出）都属于这个实例，
+     * 不同实例可以在不同线程中同时运行
+     */
+    MyVisitor(bool isRepl,
+              const AnnotatedTree *at,
+              std::ostream &out = std::cout)
+        : at_{at}, stack_{}, isRepl_{isRepl}, loopDepth_{0}, out_{out}
+    {
+    }
+
+  public:
+    /**
+     * 开启栈上替换，循环的回边执行 threshold 次之后切换到字节码执行
+     *
+     * repl 模式下每次输入都会重新生成语法树，不能按节点缓存编译结果，所以不开启
+     */
+    void enableOsr(int threshold)
+    {
+        if (!isRepl_)
+        {
+            osr_ = std::make_unique<OsrCompiler>(at_, threshold);
+        }
+    }
+
+    /**
+     * 限制执行的步数和时间，为空表示不限制
+     *
+     * 每条回边和每次进入语句块消耗一步，内置函数按元素的个数、
+     * bigint 的运算和输出按 limb 的个数消耗
+     *
+     * 超出预算时 visitProg 抛出 BudgetExceeded
+     */
+    void setBudget(Budget *budget)
+    {
+        budget_ = budget;
+    }
+
+    /**
+     * 栈帧和变量的内存用量，可以设置上限，超出时 visitProg 抛出 BudgetExceeded
+     */
+    MemoryAccount &memory()
+    {
+        return memory_;
+    }
+
+    const MemoryAccount &memory() const
+    {
+        return memory_;
+    }
+
+    /**
+     * 从外部注入初值的顶层变量，声明时照常计算初始值，然后换成这里的值
+     */
+    void setGlobals(std::unordered_map<std::string, int32_t> globals)
+    {
+        globals_ = std::move(globals);
+    }
+
+    /**
+     * 是否允许内置函数 load、save 读写文件，默认允许
+     */
+    void setAllowFiles(bool allowFiles)
     {
+        allowFiles_ = allowFiles;
+    }
+
+    /**
+     * 内置函数 sort 最多使用的线程数，默认为 0，按 CPU 的核数
+     */
+    void setSortThreads(size_t threads)
+    {
+        sortThreads_ = threads;
+    }
+
+    /**
+     * 内置函数 read_int 等读取的输入，为空时没有输入
+     */
+    void setInput(input::IntReader *input)
+    {
+        input_ = input;
     }
 
   public:
@@ -122,14 +128,26 @@ class MyVisitor : public FalconScriptBaseVisitor
         FalconScriptParser::ProgContext *ctx) override
     {
         // 准备全局作用域
-        auto *blockScope = reinterpret_cast<BlockScope *>(at_->node2scope[ctx]);
+        auto *blockScope = reinterpret_cast<BlockScope *>(at_->scopeOf(ctx));
         if (blockScope)
         {
             // 栈帧
-            auto frame = std::make_shared<StackFrame>(blockScope);
+            auto frame = newFrame(blockScope);
             pushStack(frame);
         }
-        visitChildren(ctx);
+        try
+        {
+            visitChildren(ctx);
+        }
+        catch (BudgetExceeded &)
+        {
+            // 执行到一半停下，下次执行要从干净的状态开始
+            stack_.clear();
+            temporaries_.clear();
+            loopDepth_ = 0;
+            throw;
+        }
+        temporaries_.clear();
 
         // repl模式下要保留栈帧，否则清空栈帧
         if (!isRepl_ && blockScope)
@@ -145,10 +163,11 @@ class MyVisitor : public FalconScriptBaseVisitor
     virtual antlrcpp::Any visitBlock(
         FalconScriptParser::BlockContext *ctx) override
     {
-        auto *blockScope = reinterpret_cast<BlockScope *>(at_->node2scope[ctx]);
+        charge(1);
+        auto *blockScope = reinterpret_cast<BlockScope *>(at_->scopeOf(ctx));
         if (blockScope)
         {
-            auto frame = std::make_shared<StackFrame>(blockScope);
+            auto frame = newFrame(blockScope);
             pushStack(frame);
         }
         antlrcpp::Any result = nullptr;
@@ -175,6 +194,8 @@ class MyVisitor : public FalconScriptBaseVisitor
     virtual antlrcpp::Any visitBlockStatement(
         FalconScriptParser::BlockStatementContext *ctx) override
     {
+        // 上一条语句中内置函数返回的数组已经用完了
+        temporaries_.clear();
         try
         {
             if (ctx->statement())
@@ -186,9 +207,13 @@ class MyVisitor : public FalconScriptBaseVisitor
                 visitVariableDeclarators(ctx->variableDeclarators());
             }
         }
+        catch (BudgetExceeded &)
+        {
+            throw;
+        }
         catch (std::exception &e)
         {
-            std::cout << "Error: " << e.what() << std::endl;
+            out_ << "Error: " << e.what() << std::endl;
         }
         return nullptr;
     }
@@ -199,6 +224,8 @@ class MyVisitor : public FalconScriptBaseVisitor
     virtual antlrcpp::Any visitStatement(
         FalconScriptParser::StatementContext *ctx) override
     {
+        // 循环体可以不是块，每次迭代也要释放
+        temporaries_.clear();
         // 花括号包裹的语句块
         if (ctx->blockLabel)
         {
@@ -206,18 +233,9 @@ class MyVisitor : public FalconScriptBaseVisitor
         }
         else if (ctx->IF())
         {
-            int32_t condition;
             auto value = visitParExpression(ctx->parExpression());
-            if (value.is<int32_t>())
-            {
-                condition = value.as<int32_t>();
-            }
-            else if (value.is<int32_t *>())
-            {
-                condition = *value.as<int32_t *>();
-            }
             // 条件为真，执行 if 分支
-            if (condition != 0)
+            if (isTrue(value))
             {
                 return visitStatement(ctx->statement(0));
             }
@@ -231,10 +249,10 @@ class MyVisitor : public FalconScriptBaseVisitor
         {
             // 因为 forInit 部分可能会定义变量，所以需要栈帧
             auto *blockScope =
-                reinterpret_cast<BlockScope *>(at_->node2scope[ctx]);
+                reinterpret_cast<BlockScope *>(at_->scopeOf(ctx));
             if (blockScope)
             {
-                auto frame = std::make_shared<StackFrame>(blockScope);
+                auto frame = newFrame(blockScope);
                 pushStack(frame);
             }
             ++loopDepth_;
@@ -259,16 +277,15 @@ class MyVisitor : public FalconScriptBaseVisitor
                 {
                     break;
                 }
-                if (result.is<StatementFlowControl>() &&
-                    result.as<StatementFlowControl>() ==
-                        StatementFlowControl::Continue)
-                {
-                    continue;
-                }
+                // continue 之后也要执行 forUpdate
                 if (forControl->forUpdate)
                 {
                     visitExpressionList(forControl->forUpdate);
                 }
+                if (onBackEdge(ctx))
+                {
+                    break;
+                }
             }
             --loopDepth_;
             if (blockScope)
@@ -294,11 +311,9 @@ class MyVisitor : public FalconScriptBaseVisitor
                 {
                     break;
                 }
-                if (result.is<StatementFlowControl>() &&
-                    result.as<StatementFlowControl>() ==
-                        StatementFlowControl::Continue)
+                if (onBackEdge(ctx))
                 {
-                    continue;
+                    break;
                 }
             }
             --loopDepth_;
@@ -315,12 +330,12 @@ class MyVisitor : public FalconScriptBaseVisitor
                 {
                     break;
                 }
-                if (result.is<StatementFlowControl>() &&
-                    result.as<StatementFlowControl>() ==
-                        StatementFlowControl::Continue)
+                // 剩下的迭代和 while 一样，先检查循环条件
+                if (onBackEdge(ctx))
                 {
-                    continue;
+                    break;
                 }
+                // continue 之后也要检查循环条件
                 auto condition /*:int32_t*/ =
                     visitParExpression(ctx->parExpression()).as<int>();
                 if (condition == 0)
@@ -330,7 +345,76 @@ class MyVisitor : public FalconScriptBaseVisitor
             }
             --loopDepth_;
         }
-        // 递归检查父节点是否是循环语句，如果是，则返回Break或Continue
+        else if (ctx->SWITCH())
+        {
+            int32_t value;
+            auto selector = visitParExpression(ctx->parExpression());
+            if (selector.is<int32_t>())
+            {
+                value = selector.as<int32_t>();
+            }
+            else if (selector.is<int32_t *>())
+            {
+                value = *selector.as<int32_t *>();
+            }
+            // 和 Java 一样，case 标签都是 int
+            else if (selector.is<int64_t>() || selector.is<int64_t *>())
+            {
+                throw std::runtime_error("switch不支持long");
+            }
+            else if (selector.is<BigInt>() || selector.is<BigInt *>())
+            {
+                throw std::runtime_error("switch不支持bigint");
+            }
+            else if (selector.is<ArrayRef>())
+            {
+                throw std::runtime_error("switch不支持数组");
+            }
+            else if (selector.is<IntMap *>())
+            {
+                throw std::runtime_error("switch不支持map");
+            }
+            else
+            {
+                throw std::runtime_error("类型不匹配");
+            }
+            auto groups = ctx->switchBlockStatementGroup();
+            auto target = switchTable(ctx).lookup(value);
+            // 各个分支中定义的变量放在同一个栈帧里
+            auto *blockScope =
+                reinterpret_cast<BlockScope *>(at_->scopeOf(ctx));
+            if (blockScope)
+            {
+                auto frame = newFrame(blockScope);
+                pushStack(frame);
+            }
+            antlrcpp::Any flow = nullptr;
+            // 从命中的分支开始，没有 break 就继续执行后面的分支
+            for (size_t i = target; i < groups.size() && flow.isNull(); ++i)
+            {
+                for (auto *statement : groups[i]->blockStatement())
+                {
+                    auto result = visitBlockStatement(statement);
+                    if (result.is<StatementFlowControl>())
+                    {
+                        flow = result;
+                        break;
+                    }
+                }
+            }
+            if (blockScope)
+            {
+                popStack();
+            }
+            // break 只结束 switch，continue 交给外层的循环
+            if (flow.is<StatementFlowControl>() &&
+                flow.as<StatementFlowControl>() ==
+                    StatementFlowControl::Continue)
+            {
+                return flow;
+            }
+        }
+        // 递归检查父节点是否是循环或 switch 语句，如果是，则返回Break或Continue
         else if (ctx->BREAK())
         {
             auto parent = ctx->parent;
@@ -339,14 +423,15 @@ class MyVisitor : public FalconScriptBaseVisitor
                 auto statement =
                     dynamic_cast<FalconScriptParser::StatementContext *>(
                         parent);
-                if (statement && (statement->FOR() || statement->WHILE()))
+                if (statement && (statement->FOR() || statement->WHILE() ||
+                                  statement->SWITCH()))
                 {
                     return StatementFlowControl::Break;
                 }
                 parent = parent->parent;
             }
-            std::cout << "\033[33mWarning: \033[0mbreak不在循环中，已忽略"
-                      << std::endl;
+            out_ << "\033[33mWarning: \033[0mbreak不在循环中，已忽略"
+                 << std::endl;
         }
         else if (ctx->CONTINUE())
         {
@@ -362,18 +447,42 @@ class MyVisitor : public FalconScriptBaseVisitor
                 }
                 parent = parent->parent;
             }
-            std::cout << "\033[33mWarning: \033[0mcontinue不在循环中，已忽略"
-                      << std::endl;
+            out_ << "\033[33mWarning: \033[0mcontinue不在循环中，已忽略"
+                 << std::endl;
         }
         else if (ctx->statementExpression)
         {
             auto result = visitExpression(ctx->statementExpression);
             // 类似于 a; 的语句，输出变量的值
-            if (ctx->statementExpression->primary())
+            if (result.is<ArrayRef>())
+            {
+                out_ << ctx->statementExpression->getText() << ": ";
+                result.as<ArrayRef>().print(out_);
+                out_ << std::endl;
+            }
+            else if (result.is<IntMap *>())
+            {
+                out_ << ctx->statementExpression->getText() << ": ";
+                result.as<IntMap *>()->print(out_);
+                out_ << std::endl;
+            }
+            // 变量和数组元素是 int32_t*，long 和 bigint 变量是 int64_t* 和
+            // BigInt*，只读的 m[k] 是 int32_t
+            else if (ctx->statementExpression->primary() ||
+                     ctx->statementExpression->L_BRACKET())
             {
-                assert(result.is<int32_t *>());
-                std::cout << ctx->statementExpression->getText() << ": "
-                          << *result.as<int *>() << std::endl;
+                out_ << ctx->statementExpression->getText() << ": ";
+                printValue(result);
+                out_ << std::endl;
+            }
+            // 有返回值的内置函数，和变量一样输出结果
+            else if (ctx->statementExpression->methodCall())
+            {
+                if (result.is<int32_t>())
+                {
+                    out_ << ctx->statementExpression->getText() << ": "
+                         << result.as<int32_t>() << std::endl;
+                }
             }
             else if (ctx->statementExpression->bop != nullptr)
             {
@@ -396,8 +505,10 @@ class MyVisitor : public FalconScriptBaseVisitor
                         if (isRepl_ && loopDepth_ == 0)
                         {
                             // 非赋值的二元运算符的计算结果输出
-                            std::cout << ctx->statementExpression->getText()
-                                      << ": " << result.as<int>() << std::endl;
+                            out_ << ctx->statementExpression->getText()
+                                 << ": ";
+                            printValue(result);
+                            out_ << std::endl;
                         }
                 }
             }
@@ -406,7 +517,8 @@ class MyVisitor : public FalconScriptBaseVisitor
         return nullptr;
     }
 
-    virtual antlrcpp::Any /* int32_t, int32_t* */ visitExpression(
+    virtual antlrcpp::Any /* int32_t, int64_t, BigInt 和它们的指针 */
+    visitExpression(
         FalconScriptParser::ExpressionContext *ctx) override
     {
         // 缓存所有的表达式结果
@@ -415,62 +527,60 @@ class MyVisitor : public FalconScriptBaseVisitor
         {
             result /* int32_t, int32_t* */ = visitPrimary(ctx->primary());
         }
+        // 内置函数
+        else if (ctx->methodCall())
+        {
+            result = visitMethodCall(ctx->methodCall());
+        }
+        // 数组下标，下标取满时得到元素的 int32_t*，否则是子数组；
+        // map 的下标是键
+        else if (ctx->L_BRACKET())
+        {
+            antlrcpp::Any array(visitExpression(ctx->expression(0)));
+            if (array.is<IntMap *>())
+            {
+                result = indexMap(ctx, array.as<IntMap *>());
+            }
+            else if (!array.is<ArrayRef>())
+            {
+                throw std::runtime_error(ctx->expression(0)->getText() +
+                                         "不是数组");
+            }
+            else
+            {
+                auto index = valueOf(visitExpression(ctx->expression(1)));
+                auto ref = array.as<ArrayRef>();
+                result = ref.index(index);
+                // 写入和别的数组共用的缓冲区之前先复制一份
+                if (ref.array->isShared() && result.is<int32_t *>() &&
+                    isWritten(ctx))
+                {
+                    ref.array->unshare();
+                    result = ref.index(index);
+                }
+            }
+        }
         // 双目运算符
         else if (ctx->bop != nullptr && ctx->expression().size() == 2)
         {
             // 获取左右表达式的结果
             antlrcpp::Any left(visitExpression(ctx->expression(0)));
             antlrcpp::Any right(visitExpression(ctx->expression(1)));
-            assert(left.is<int32_t>() ||
-                   left.is<int32_t *>() && left.as<int32_t *>() != nullptr);
-            assert(right.is<int32_t>() ||
-                   right.is<int32_t *>() && right.as<int32_t *>() != nullptr);
-
-            std::string leftName;
-            // 根据运算符类型进行计算
-            switch (ctx->bop->getType())
-            {
-                BINARY_OPERATOR(PLUS, +);
-                BINARY_OPERATOR(MINUS, -);
-                BINARY_OPERATOR(MULTIPLY, *);
-                BINARY_OPERATOR(DIVIDE, /);
-                BINARY_OPERATOR(MODULUS, %);
-                BINARY_OPERATOR(L_SHIFT, <<);
-                BINARY_OPERATOR(R_SHIFT, >>);
-                BINARY_OPERATOR(EQUAL, ==);
-                BINARY_OPERATOR(NOT_EQUAL, !=);
-                BINARY_OPERATOR(GREATER, >);
-                BINARY_OPERATOR(LESS, <);
-                BINARY_OPERATOR(GREATER_EQUAL, >=);
-                BINARY_OPERATOR(LESS_EQUAL, <=);
-                BINARY_OPERATOR(BIT_AND, &);
-                BINARY_OPERATOR(BIT_OR, |);
-                BINARY_OPERATOR(BIT_XOR, ^);
-                BINARY_OPERATOR(AND, &&);
-                BINARY_OPERATOR(OR, ||);
-                default:
-                    // 赋值号需要获取左边的变量名
-                    leftName =
-                        ctx->expression(0)->primary()->IDENTIFIER()->getText();
-                    break;
+            // 运算核的编号按节点缓存，操作数的种类变了才重新查表
+            auto kernel = binaryKernelIndex(kernelOf(ctx), ctx, left, right);
+            if (isBig(kernel % binaryKinds / operandKinds) ||
+                isBig(kernel % operandKinds))
+            {
+                charge(limbCountOf(left) + limbCountOf(right));
             }
-            // 赋值号
-            switch (ctx->bop->getType())
-            {
-                // 这里会用到 leftName 修改内存中的变量值
-                ASSIGN_OPERATOR(ASSIGN, =);
-                ASSIGN_OPERATOR(PLUS_ASSIGN, +=);
-                ASSIGN_OPERATOR(MINUS_ASSIGN, -=);
-                ASSIGN_OPERATOR(MULTIPLY_ASSIGN, *=);
-                ASSIGN_OPERATOR(DIVIDE_ASSIGN, /=);
-                ASSIGN_OPERATOR(MODULUS_ASSIGN, %=);
-                ASSIGN_OPERATOR(L_SHIFT_ASSIGN, <<=);
-                ASSIGN_OPERATOR(R_SHIFT_ASSIGN, >>=);
-                ASSIGN_OPERATOR(BIT_AND_ASSIGN, &=);
-                ASSIGN_OPERATOR(BIT_OR_ASSIGN, |=);
-                ASSIGN_OPERATOR(BIT_XOR_ASSIGN, ^=);
-                default:
-                    break;
+            const auto &op = binaryOperators[kernel / binaryKinds];
+            result = op.kernels[kernel % binaryKinds](left, right);
+            // 如果是repl模式且不在循环中，则输出赋值后变量的新值
+            if (op.assign && isRepl_ && loopDepth_ == 0)
+            {
+                out_ << ctx->expression(0)->getText() << ": ";
+                printValue(result);
+                out_ << std::endl;
             }
         }
         // 前置单目运算符
@@ -478,22 +588,25 @@ class MyVisitor : public FalconScriptBaseVisitor
         {
             antlrcpp::Any child(visitExpression(ctx->expression(0)));
             switch (ctx->prefix->getType())
-            {
-                PREFIX_UNARY_OPERATOR(PLUS, +);
-                PREFIX_UNARY_OPERATOR(MINUS, -);
-                PREFIX_UNARY_OPERATOR(NOT, !);
-                PREFIX_UNARY_OPERATOR(NEGATE, ~);
-            }
-            switch (ctx->prefix->getType())
             {
                 case FalconScriptParser::INCREMENT:
-                    assert(child.is<int32_t *>());
-                    result = ++*child.as<int32_t *>();
+                    result = step(child, 1, true);
                     break;
                 case FalconScriptParser::DECREMENT:
-                    assert(child.is<int32_t *>());
-                    result = --*child.as<int32_t *>();
+                    result = step(child, -1, true);
+                    break;
+                default:
+                {
+                    auto kernel =
+                        unaryKernelIndex(kernelOf(ctx), ctx, child);
+                    if (isBig(kernel % operandKinds))
+                    {
+                        charge(limbCountOf(child));
+                    }
+                    result = unaryOperators[kernel / operandKinds]
+                                 .kernels[kernel % operandKinds](child);
                     break;
+                }
             }
         }
         // 后置单目运算符
@@ -503,12 +616,10 @@ class MyVisitor : public FalconScriptBaseVisitor
             switch (ctx->postfix->getType())
             {
                 case FalconScriptParser::INCREMENT:
-                    assert(child.is<int32_t *>());
-                    result = (*child.as<int32_t *>())++;
+                    result = step(child, 1, false);
                     break;
                 case FalconScriptParser::DECREMENT:
-                    assert(child.is<int32_t *>());
-                    result = (*child.as<int32_t *>())--;
+                    result = step(child, -1, false);
                     break;
             }
         }
@@ -517,8 +628,7 @@ class MyVisitor : public FalconScriptBaseVisitor
                  ctx->bop->getType() == FalconScriptParser::TERNARY)
         {
             antlrcpp::Any cond(visitExpression(ctx->expression(0)));
-            assert(cond.is<int32_t>());
-            if (cond.as<int32_t>() != 0)
+            if (isTrue(cond))
             {
                 result = visitExpression(ctx->expression(1));
             }
@@ -531,6 +641,43 @@ class MyVisitor : public FalconScriptBaseVisitor
         return result;
     }
 
+    /**
+     * 调用内置函数，参数从左到右求值，见 Builtins.hpp
+     */
+    virtual antlrcpp::Any /* int32_t，或者没有返回值 */ visitMethodCall(
+        FalconScriptParser::MethodCallContext *ctx) override
+    {
+        auto name = ctx->IDENTIFIER()->getText();
+        auto *builtin = findBuiltin(name);
+        if (builtin == nullptr)
+        {
+            throw std::runtime_error("函数" + name + "未定义");
+        }
+        BuiltinArgs args;
+        if (ctx->expressionList())
+        {
+            for (auto *argument : ctx->expressionList()->expression())
+            {
+                args.push_back(visitExpression(argument));
+            }
+        }
+        auto maxArity = builtin->arity + builtin->optional;
+        if (args.size() < builtin->arity || args.size() > maxArity)
+        {
+            std::stringstream ss;
+            ss << "函数" << name << "需要" << builtin->arity;
+            if (builtin->optional > 0)
+            {
+                ss << "到" << maxArity;
+            }
+            ss << "个参数";
+            throw std::runtime_error(ss.str());
+        }
+        BuiltinContext context{temporaries_, input_, allowFiles_, &memory_,
+                               sortThreads_, budget_};
+        return builtin->call(builtin->name, args, context);
+    }
+
     virtual antlrcpp::Any /* @see visitExpression, int32_t, int32_t* */
     visitPrimary(FalconScriptParser::PrimaryContext *ctx) override
     {
@@ -550,7 +697,9 @@ class MyVisitor : public FalconScriptBaseVisitor
             auto variable = currentStack->getVariable(varName);
             if (variable.isNotNull())
             {
-                assert(variable.is<int32_t *>());
+                assert(variable.is<int32_t *>() || variable.is<int64_t *>() ||
+                       variable.is<BigInt *>() || variable.is<ArrayRef>() ||
+                       variable.is<IntMap *>());
                 return variable;
             }
             else
@@ -563,34 +712,107 @@ class MyVisitor : public FalconScriptBaseVisitor
         }
     }
 
-    virtual antlrcpp::Any /* int32_t */ visitLiteral(
+    virtual antlrcpp::Any /* int32_t, int64_t, std::string */ visitLiteral(
         FalconScriptParser::LiteralContext *ctx) override
     {
+        // 字符串只能作为内置函数的参数，比如文件名
+        if (ctx->STRING_LITERAL())
+        {
+            return unescape(ctx->STRING_LITERAL()->getText());
+        }
         return visitIntegerLiteral(ctx->integerLiteral());
     }
 
-    virtual antlrcpp::Any /* int32_t */ visitIntegerLiteral(
-        FalconScriptParser::IntegerLiteralContext *ctx) override
+    /**
+     * 去掉字符串字面量两边的引号，处理 \n、\"、\\、八进制的 \101
+     * 和 \u0041 这样的转义字符，\u 转成 UTF-8
+     */
+    static std::string unescape(const std::string &literal)
     {
-        if (ctx->DECIMAL_LITERAL())
+        std::string result;
+        auto end = literal.size() - 1;
+        for (size_t i = 1; i < end; ++i)
         {
-            return std::atoi(ctx->DECIMAL_LITERAL()->getText().c_str());
-        }
-        else if (ctx->HEX_LITERAL())
-        {
-            return static_cast<int>(std::strtoul(
-                ctx->HEX_LITERAL()->getText().c_str(), nullptr, 16));
-        }
-        else if (ctx->OCTAL_LITERAL())
-        {
-            return static_cast<int>(std::strtoul(
-                ctx->OCTAL_LITERAL()->getText().c_str(), nullptr, 8));
+            if (literal[i] != '\\')
+            {
+                result += literal[i];
+                continue;
+            }
+            auto c = literal[++i];
+            switch (c)
+            {
+                case 'b':
+                    result += '\b';
+                    break;
+                case 't':
+                    result += '\t';
+                    break;
+                case 'n':
+                    result += '\n';
+                    break;
+                case 'f':
+                    result += '\f';
+                    break;
+                case 'r':
+                    result += '\r';
+                    break;
+                case 'u':
+                {
+                    while (literal[i] == 'u')
+                    {
+                        ++i;
+                    }
+                    auto code = std::stoul(literal.substr(i, 4), nullptr, 16);
+                    i += 3;
+                    // 一个字节 0xxxxxxx，两个字节 110xxxxx 10xxxxxx，
+                    // 三个字节 1110xxxx 10xxxxxx 10xxxxxx
+                    auto bytes = code < 0x80 ? 1 : code < 0x800 ? 2 : 3;
+                    const unsigned lead[] = {0, 0, 0xC0, 0xE0};
+                    result += static_cast<char>(lead[bytes] |
+                                                (code >> (6 * (bytes - 1))));
+                    for (int k = bytes - 2; k >= 0; --k)
+                    {
+                        result += static_cast<char>(0x80 |
+                                                    ((code >> (6 * k)) & 0x3F));
+                    }
+                    break;
+                }
+                default:
+                    if (c >= '0' && c <= '7')
+                    {
+                        // 最多三位，不超过 \377
+                        int value = c - '0';
+                        for (int digits = 1; digits < 3 && i + 1 < end;
+                             ++digits)
+                        {
+                            int next = literal[i + 1] - '0';
+                            if (next < 0 || next > 7 || value * 8 + next > 0377)
+                            {
+                                break;
+                            }
+                            value = value * 8 + next;
+                            ++i;
+                        }
+                        result += static_cast<char>(value);
+                    }
+                    else
+                    {
+                        // \"、\' 和 \\ 就是引号和反斜杠本身
+                        result += c;
+                    }
+            }
         }
-        else  // ctx->BINARY_LITERAL()
+        return result;
+    }
+
+    virtual antlrcpp::Any /* int32_t, int64_t */ visitIntegerLiteral(
+        FalconScriptParser::IntegerLiteralContext *ctx) override
+    {
+        if (isLongLiteral(ctx))
         {
-            return static_cast<int>(std::strtoul(
-                ctx->BINARY_LITERAL()->getText().c_str(), nullptr, 2));
+            return longLiteral(ctx);
         }
+        return intLiteral(ctx);
     }
 
     virtual antlrcpp::Any /* FalconType */ visitTypeType(
@@ -600,6 +822,10 @@ class MyVisitor : public FalconScriptBaseVisitor
         {
             return visitPrimitiveType(ctx->primitiveType());
         }
+        if (ctx->MAP())
+        {
+            return FalconType::Map;
+        }
         throw std::runtime_error("未知类型");
     }
 
@@ -610,14 +836,28 @@ class MyVisitor : public FalconScriptBaseVisitor
         {
             return FalconType::Integer;
         }
+        if (ctx->LONG())
+        {
+            return FalconType::Long;
+        }
+        if (ctx->BIGINT())
+        {
+            return FalconType::BigInt;
+        }
         return nullptr;
     }
 
     virtual antlrcpp::Any /* std::nullptr_t */ visitVariableDeclarators(
         FalconScriptParser::VariableDeclaratorsContext *ctx) override
     {
+        bool isMap = ctx->typeType()->MAP() != nullptr;
         for (auto declarator : ctx->variableDeclarator())
         {
+            if (isMap)
+            {
+                declareMap(declarator);
+                continue;
+            }
             visitVariableDeclarator(declarator);
         }
         return nullptr;
@@ -638,25 +878,54 @@ class MyVisitor : public FalconScriptBaseVisitor
             ss << "变量" << varName.as<std::string>() << "已定义";
             throw std::runtime_error(ss.str());
         }
-        int value = 0;
-        if (ctx->variableInitializer())
+        auto *declarators =
+            static_cast<FalconScriptParser::VariableDeclaratorsContext *>(
+                ctx->parent);
+        auto type = visitTypeType(declarators->typeType()).as<FalconType>();
+        if (!ctx->variableDeclaratorId()->expression().empty())
         {
-            auto result = visitVariableInitializer(ctx->variableInitializer());
-            if (result.is<int32_t>())
+            if (type != FalconType::Integer)
             {
-                value = result.as<int32_t>();
+                throw std::runtime_error(declarators->typeType()->getText() +
+                                         "不能声明成数组");
             }
-            else if (result.is<int32_t *>())
+            declareArray(varNameString, ctx);
+            return nullptr;
+        }
+        if (type == FalconType::BigInt)
+        {
+            declareBigInt(varNameString, ctx);
+            return nullptr;
+        }
+        bool isLong = type == FalconType::Long;
+        int64_t value = 0;
+        if (ctx->variableInitializer())
+        {
+            auto initial =
+                visitVariableInitializer(ctx->variableInitializer());
+            value = isLong ? longValueOf(initial) : valueOf(initial);
+        }
+        if (stack_.size() == 1 && !globals_.empty())
+        {
+            auto global = globals_.find(varNameString);
+            if (global != globals_.end())
             {
-                value = *result.as<int32_t *>();
+                value = global->second;
             }
         }
-        currentStack->addVariable(varNameString, new int(value));
+        if (isLong)
+        {
+            currentStack->addLongVariable(varNameString, value);
+        }
+        else
+        {
+            currentStack->addVariable(varNameString,
+                                      static_cast<int32_t>(value));
+        }
         // 新定义的变量输出一下
         if (isRepl_ && loopDepth_ == 0)
         {
-            std::cout << varName.as<std::string>() << ": " << value
-                      << std::endl;
+            out_ << varName.as<std::string>() << ": " << value << std::endl;
         }
 
         return nullptr;
@@ -671,6 +940,10 @@ class MyVisitor : public FalconScriptBaseVisitor
     virtual antlrcpp::Any /* @see visitExpression */ visitVariableInitializer(
         FalconScriptParser::VariableInitializerContext *ctx) override
     {
+        if (ctx->arrayInitializer())
+        {
+            throw std::runtime_error("只有数组可以用花括号初始化");
+        }
         return visitExpression(ctx->expression());
     }
 
@@ -705,6 +978,494 @@ class MyVisitor : public FalconScriptBaseVisitor
     }
 
   private:
+    /**
+     * 表达式的值，变量和数组元素都要解引用
+     */
+    static int32_t valueOf(const antlrcpp::Any &value)
+    {
+        if (value.is<int32_t>())
+        {
+            return value.as<int32_t>();
+        }
+        if (value.is<int32_t *>())
+        {
+            return *value.as<int32_t *>();
+        }
+        if (value.is<ArrayRef>())
+        {
+            throw std::runtime_error("数组不能直接参与运算");
+        }
+        if (value.is<IntMap *>())
+        {
+            throw std::runtime_error("map不能直接参与运算");
+        }
+        if (value.is<int64_t>() || value.is<int64_t *>())
+        {
+            throw std::runtime_error("long不能隐式转换成int");
+        }
+        if (value.is<BigInt>() || value.is<BigInt *>())
+        {
+            throw std::runtime_error("bigint不能隐式转换成int");
+        }
+        // 没有返回值的内置函数
+        throw std::runtime_error("类型不匹配");
+    }
+
+    /**
+     * int 或者 long 表达式的值，int 扩展成 int64_t
+     */
+    static int64_t longValueOf(const antlrcpp::Any &value)
+    {
+        if (value.is<int64_t>())
+        {
+            return value.as<int64_t>();
+        }
+        if (value.is<int64_t *>())
+        {
+            return *value.as<int64_t *>();
+        }
+        if (value.is<BigInt>() || value.is<BigInt *>())
+        {
+            throw std::runtime_error("bigint不能隐式转换成long");
+        }
+        return valueOf(value);
+    }
+
+    /**
+     * bigint 的初始值可以是 int、long、bigint，
+     * 或者十进制的字符串字面量，比如 "123456789012345678901234567890"
+     */
+    static BigInt bigValueOf(const antlrcpp::Any &value)
+    {
+        if (value.is<BigInt>())
+        {
+            return value.as<BigInt>();
+        }
+        if (value.is<BigInt *>())
+        {
+            return *value.as<BigInt *>();
+        }
+        if (value.is<std::string>())
+        {
+            return BigInt::parse(value.as<std::string>());
+        }
+        return longValueOf(value);
+    }
+
+    /**
+     * 条件表达式的值是否不为 0
+     */
+    static bool isTrue(const antlrcpp::Any &value)
+    {
+        if (value.is<BigInt>())
+        {
+            return !value.as<BigInt>().isZero();
+        }
+        if (value.is<BigInt *>())
+        {
+            return !value.as<BigInt *>()->isZero();
+        }
+        return longValueOf(value) != 0;
+    }
+
+    /**
+     * 输出 int、long 或者 bigint 表达式的值
+     */
+    void printValue(const antlrcpp::Any &value)
+    {
+        charge(limbCountOf(value));
+        if (value.is<BigInt>())
+        {
+            out_ << value.as<BigInt>();
+        }
+        else if (value.is<BigInt *>())
+        {
+            out_ << *value.as<BigInt *>();
+        }
+        else
+        {
+            out_ << longValueOf(value);
+        }
+    }
+
+    /**
+     * ++ 和 --，操作数是 int、long 或者 bigint 变量，prefix 为 true 时得到新值
+     */
+    static antlrcpp::Any step(antlrcpp::Any &child, int delta, bool prefix)
+    {
+        if (child.is<int64_t *>())
+        {
+            return step(*child.as<int64_t *>(), delta, prefix);
+        }
+        if (child.is<BigInt *>())
+        {
+            return step(*child.as<BigInt *>(), delta, prefix);
+        }
+        assert(child.is<int32_t *>());
+        return step(*child.as<int32_t *>(), delta, prefix);
+    }
+
+    template <typename T>
+    static T step(T &variable, int delta, bool prefix)
+    {
+        T old = variable;
+        variable = static_cast<T>(variable + delta);
+        return prefix ? variable : old;
+    }
+
+    /**
+     * 带 L 后缀的整数字面量是 long
+     */
+    /**
+     * 表达式的结果是否会被写入：它是赋值的左边或者 ++、-- 的操作数，
+     * 中间可以隔着括号和三目运算符的分支
+     */
+    static bool isWritten(FalconScriptParser::ExpressionContext *ctx)
+    {
+        antlr4::tree::ParseTree *node = ctx;
+        for (auto *parent = node->parent; parent != nullptr;
+             node = parent, parent = node->parent)
+        {
+            if (dynamic_cast<FalconScriptParser::PrimaryContext *>(parent))
+            {
+                continue;
+            }
+            auto *expression =
+                dynamic_cast<FalconScriptParser::ExpressionContext *>(parent);
+            if (expression == nullptr)
+            {
+                return false;
+            }
+            if (expression->primary() != nullptr)
+            {
+                continue;
+            }
+            if (expression->postfix != nullptr)
+            {
+                return true;
+            }
+            if (expression->prefix != nullptr)
+            {
+                auto type = expression->prefix->getType();
+                return type == FalconScriptParser::INCREMENT ||
+                       type == FalconScriptParser::DECREMENT;
+            }
+            if (expression->bop == nullptr)
+            {
+                return false;
+            }
+            if (expression->bop->getType() == FalconScriptParser::TERNARY)
+            {
+                if (node == expression->expression(0))
+                {
+                    return false;
+                }
+                continue;
+            }
+            auto op = findOperator(binaryOperators,
+                                   expression->bop->getType());
+            return op >= 0 && binaryOperators[op].assign &&
+                   node == expression->expression(0);
+        }
+        return false;
+    }
+
+    /**
+     * m[k]：写入时没有这个键就插入，得到值的 int32_t*；
+     * 只读时不插入，得到值本身，没有这个键时为 0
+     */
+    antlrcpp::Any indexMap(FalconScriptParser::ExpressionContext *ctx,
+                           IntMap *map)
+    {
+        auto key = valueOf(visitExpression(ctx->expression(1)));
+        if (isWritten(ctx))
+        {
+            return map->insert(key);
+        }
+        auto *value = map->find(key);
+        return value == nullptr ? 0 : *value;
+    }
+
+    /**
+     * bigint x = "123456789012345678901234567890";
+     *
+     * 和 int 变量一样可以用 -D 注入初值
+     */
+    void declareBigInt(const std::string &name,
+                       FalconScriptParser::VariableDeclaratorContext *ctx)
+    {
+        BigInt value;
+        if (ctx->variableInitializer())
+        {
+            auto initial =
+                visitVariableInitializer(ctx->variableInitializer());
+            value = bigValueOf(initial);
+        }
+        if (stack_.size() == 1 && !globals_.empty())
+        {
+            auto global = globals_.find(name);
+            if (global != globals_.end())
+            {
+                value = global->second;
+            }
+        }
+        stack_.back()->addBigVariable(name, value);
+        if (isRepl_ && loopDepth_ == 0)
+        {
+            out_ << name << ": ";
+            printValue(stack_.back()->getVariable(name));
+            out_ << std::endl;
+        }
+    }
+
+    /**
+     * map m; 不能是数组，也不能有初始值，和数组一样属于声明它的块的栈帧
+     */
+    void declareMap(FalconScriptParser::VariableDeclaratorContext *ctx)
+    {
+        auto name = ctx->variableDeclaratorId()->IDENTIFIER()->getText();
+        if (!ctx->variableDeclaratorId()->expression().empty())
+        {
+            throw std::runtime_error("map不能声明成数组");
+        }
+        if (ctx->variableInitializer())
+        {
+            throw std::runtime_error("map不能有初始值");
+        }
+        auto currentStack = stack_[stack_.size() - 1];
+        if (currentStack->getVariable(name, false).isNotNull())
+        {
+            throw std::runtime_error("变量" + name + "已定义");
+        }
+        auto *map = currentStack->addMap(name);
+        if (isRepl_ && loopDepth_ == 0)
+        {
+            out_ << name << ": ";
+            map->print(out_);
+            out_ << std::endl;
+        }
+    }
+
+    /**
+     * int a[2][3] = {{1, 2, 3}, {4, 5, 6}};
+     * int w[3] = slice(a[0], 0, 3);
+     *
+     * 每一维的长度在声明时求值，没有给出初始值的元素为 0。
+     * 用另一个数组初始化时元素个数必须相同，见 arrayFrom。
+     * 数组属于声明它的块的栈帧，离开作用域时释放
+     */
+    void declareArray(const std::string &name,
+                      FalconScriptParser::VariableDeclaratorContext *ctx)
+    {
+        std::vector<size_t> dims;
+        for (auto dimension : ctx->variableDeclaratorId()->expression())
+        {
+            auto length = valueOf(visitExpression(dimension));
+            if (length <= 0)
+            {
+                throw std::runtime_error("数组的长度必须大于0");
+            }
+            dims.push_back(static_cast<size_t>(length));
+        }
+        auto initializer = ctx->variableInitializer();
+        antlrcpp::Any source;
+        if (initializer && initializer->expression())
+        {
+            source = visitExpression(initializer->expression());
+            if (!source.is<ArrayRef>())
+            {
+                throw std::runtime_error("数组只能用花括号或者数组初始化");
+            }
+        }
+        auto array = source.isNull()
+                         ? stack_.back()->addArray(name, std::move(dims))
+                         : stack_.back()->addArray(name, std::move(dims),
+                                                   source.as<ArrayRef>());
+        if (initializer && initializer->arrayInitializer())
+        {
+            initializeArray(array, initializer->arrayInitializer());
+        }
+        if (isRepl_ && loopDepth_ == 0)
+        {
+            out_ << name << ": ";
+            array.print(out_);
+            out_ << std::endl;
+        }
+    }
+
+    /**
+     * 按花括号的嵌套层次逐维填充，层次必须和数组的维数一致
+     */
+    void initializeArray(const ArrayRef &array,
+                         FalconScriptParser::ArrayInitializerContext *ctx)
+    {
+        auto initializers = ctx->variableInitializer();
+        if (initializers.size() > array.length())
+        {
+            throw std::runtime_error("初始值的个数超过了数组的长度");
+        }
+        for (size_t i = 0; i < initializers.size(); ++i)
+        {
+            auto element = array.index(static_cast<int32_t>(i));
+            auto nested = initializers[i]->arrayInitializer();
+            if (element.is<ArrayRef>() != (nested != nullptr))
+            {
+                throw std::runtime_error("初始值的层次和数组的维数不一致");
+            }
+            if (nested)
+            {
+                initializeArray(element.as<ArrayRef>(), nested);
+            }
+            else
+            {
+                *element.as<int32_t *>() =
+                    valueOf(visitExpression(initializers[i]->expression()));
+            }
+        }
+    }
+
+    /**
+     * 表达式节点缓存的运算核编号，见 binaryKernelIndex
+     *
+     * 按 MyListener 分配的编号存在这个实例里，不写到语法树上，
+     * 多个实例可以共用同一棵语法树。repl 每次输入都会给新的节点编号
+     */
+    int &kernelOf(FalconScriptParser::ExpressionContext *ctx)
+    {
+        auto id = static_cast<size_t>(ctx->id);
+        if (id >= kernels_.size())
+        {
+            kernels_.resize(std::max(at_->expressions, id + 1), -1);
+        }
+        return kernels_[id];
+    }
+
+    /**
+     * switch 语句的分派表，第一次执行时根据 case 标签生成
+     *
+     * repl 模式下每次输入都会重新生成语法树，节点地址可能被复用，所以不缓存
+     */
+    SwitchTable switchTable(FalconScriptParser::StatementContext *ctx)
+    {
+        auto it = switchTables_.find(ctx);
+        if (it != switchTables_.end())
+        {
+            return it->second;
+        }
+        std::vector<std::pair<int32_t, int>> cases;
+        int defaultTarget;
+        switchLabels(ctx, cases, defaultTarget);
+        SwitchTable table(std::move(cases), defaultTarget);
+        if (!isRepl_)
+        {
+            switchTables_.emplace(ctx, table);
+        }
+        return table;
+    }
+
+    /**
+     * 消耗 steps 步预算，没有设置预算时什么也不做
+     */
+    void charge(uint64_t steps)
+    {
+        if (budget_ != nullptr)
+        {
+            budget_->charge(steps);
+        }
+    }
+
+    /**
+     * kind 是运算核编号中的一个操作数种类
+     */
+    static bool isBig(int kind)
+    {
+        return kind == static_cast<int>(OperandKind::BigValue) ||
+               kind == static_cast<int>(OperandKind::BigReference);
+    }
+
+    static size_t limbCountOf(const antlrcpp::Any &value)
+    {
+        if (value.is<BigInt>())
+        {
+            return value.as<BigInt>().limbCount();
+        }
+        if (value.is<BigInt *>())
+        {
+            return value.as<BigInt *>()->limbCount();
+        }
+        return 0;
+    }
+
+    /**
+     * 循环的一条回边，循环足够热时在虚拟机中执行剩下的迭代
+     *
+     * 返回 true 表示循环已经执行完毕，循环外变量的新值已经写回栈帧
+     */
+    bool onBackEdge(FalconScriptParser::StatementContext *ctx)
+    {
+        charge(1);
+        if (osr_ == nullptr)
+        {
+            return false;
+        }
+        auto *program = osr_->onBackEdge(ctx);
+        if (program == nullptr)
+        {
+            return false;
+        }
+        std::vector<int32_t *> slots;
+        for (auto &name : program->slots)
+        {
+            auto variable = stack_.back()->getVariable(name);
+            // 变量还没有定义，继续解释执行，由解释器报错；
+            // 槽位只能是整数变量，数组通过 arrays 访问
+            if (variable.isNull() || !variable.is<int32_t *>())
+            {
+                return false;
+            }
+            slots.push_back(variable.as<int32_t *>());
+        }
+        std::vector<Array *> arrays;
+        for (auto &array : program->arrays)
+        {
+            // 编译时按第一次进入时的数组确定了维数，之后可能是另一个数组
+            auto variable = stack_.back()->getVariable(array.name);
+            if (variable.isNull() || !variable.is<ArrayRef>() ||
+                !variable.as<ArrayRef>().isWhole() ||
+                (array.rank != 0 &&
+                 variable.as<ArrayRef>().array->rank() != array.rank))
+            {
+                return false;
+            }
+            arrays.push_back(variable.as<ArrayRef>().array);
+        }
+        // 循环中的声明失败时，之后用到的是外层的同名变量，字节码中没有
+        for (auto &name : program->shadows)
+        {
+            if (stack_.back()->getVariable(name).isNotNull())
+            {
+                return false;
+            }
+        }
+        // 字节码直接写缓冲区，共用的先复制一份
+        for (auto *array : arrays)
+        {
+            array->unshare();
+        }
+        VM(*program, out_, budget_, &memory_)
+            .run(slots.data(), arrays.data());
+        return true;
+    }
+
+    /**
+     * 栈帧本身也记在 memory_ 的账上
+     */
+    std::shared_ptr<StackFrame> newFrame(BlockScope *scope)
+    {
+        return std::allocate_shared<StackFrame>(
+            AccountedAllocator<StackFrame>(&memory_), scope, &memory_);
+    }
+
     void pushStack(std::shared_ptr<StackFrame> frame)
     {
         if (stack_.size() > 0)
@@ -743,14 +1504,31 @@ class MyVisitor : public FalconScriptBaseVisitor
 
   private:
     /// 注解树，里面有作用域信息
-    AnnotatedTree *at_;
+    const AnnotatedTree *at_;
+    /// 栈帧和变量用到的内存，在 stack_ 之后析构
+    MemoryAccount memory_;
+    /// 内置函数返回的数组，每条语句开始时释放
+    TemporaryArrays temporaries_{&memory_};
     /// 栈帧
     std::vector<std::shared_ptr<StackFrame>> stack_;
     /// isRepl_ 是否处于REPL模式
     const bool isRepl_;
     /// loopDepth_ 记录当前所在的循环层级
     int loopDepth_;
+    /// 脚本的输出
+    std::ostream &out_;
+    /// 为空表示不做栈上替换
+    std::unique_ptr<OsrCompiler> osr_;
+    std::unordered_map<FalconScriptParser::StatementContext *, SwitchTable>
+        switchTables_;
+    /// 下标是表达式节点的编号，-1 表示还没有求值过
+    std::vector<int> kernels_;
+    /// 顶层变量注入的初值
+    std::unordered_map<std::string, int32_t> globals_;
+    /// 为空表示不限制
+    Budget *budget_ = nullptr;
+    bool allowFiles_ = true;
+    size_t sortThreads_ = 0;
+    input::IntReader *input_ = nullptr;
 };
 
-#undef BINARY_OPERATOR
-#undef PREFIX_UNARY_OPERATOR
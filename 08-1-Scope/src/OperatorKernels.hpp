@@ -0,0 +1,593 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <iterator>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include "./generated/FalconScriptParser.h"
+#include "Array.hpp"
+#include "BigInt.hpp"
+
+/**
+ * 运算对象的种类：字面量和运算结果是值，变量是指针，
+ * int、long 和 bigint 各两种
+ */
+enum class OperandKind : uint8_t
+{
+    Value,  ///< int32_t
+    Reference,  ///< int32_t*
+    LongValue,  ///< int64_t
+    LongReference,  ///< int64_t*
+    BigValue,  ///< BigInt
+    BigReference,  ///< BigInt*
+};
+
+/// 操作数种类的个数，双目运算符每种组合一个运算核
+constexpr int operandKinds = 6;
+constexpr int binaryKinds = operandKinds * operandKinds;
+
+template <OperandKind kind>
+struct Operand;
+
+template <>
+struct Operand<OperandKind::Value>
+{
+    using Type = int32_t;
+    static int32_t load(antlrcpp::Any &any)
+    {
+        return any.as<int32_t>();
+    }
+};
+
+template <>
+struct Operand<OperandKind::Reference>
+{
+    using Type = int32_t;
+    static int32_t load(antlrcpp::Any &any)
+    {
+        return *any.as<int32_t *>();
+    }
+};
+
+template <>
+struct Operand<OperandKind::LongValue>
+{
+    using Type = int64_t;
+    static int64_t load(antlrcpp::Any &any)
+    {
+        return any.as<int64_t>();
+    }
+};
+
+template <>
+struct Operand<OperandKind::LongReference>
+{
+    using Type = int64_t;
+    static int64_t load(antlrcpp::Any &any)
+    {
+        return *any.as<int64_t *>();
+    }
+};
+
+/**
+ * bigint 取引用，不复制 limb 数组
+ */
+template <>
+struct Operand<OperandKind::BigValue>
+{
+    using Type = BigInt;
+    static const BigInt &load(antlrcpp::Any &any)
+    {
+        return any.as<BigInt>();
+    }
+};
+
+template <>
+struct Operand<OperandKind::BigReference>
+{
+    using Type = BigInt;
+    static const BigInt &load(antlrcpp::Any &any)
+    {
+        return *any.as<BigInt *>();
+    }
+};
+
+constexpr bool isReference(OperandKind kind)
+{
+    return kind == OperandKind::Reference ||
+           kind == OperandKind::LongReference ||
+           kind == OperandKind::BigReference;
+}
+
+/**
+ * 类型从窄到宽的次序和名字
+ */
+template <typename T>
+constexpr int rankOf = std::is_same_v<T, int32_t>   ? 0
+                       : std::is_same_v<T, int64_t> ? 1
+                                                    : 2;
+
+template <typename T>
+constexpr const char *typeName = rankOf<T> == 0   ? "int"
+                                 : rankOf<T> == 1 ? "long"
+                                                  : "bigint";
+
+/**
+ * 和 Java 一样，两个操作数按其中较宽的类型计算
+ */
+template <OperandKind left, OperandKind right>
+using CommonType =
+    std::conditional_t<(rankOf<typename Operand<left>::Type> >=
+                        rankOf<typename Operand<right>::Type>),
+                       typename Operand<left>::Type,
+                       typename Operand<right>::Type>;
+
+/**
+ * 转成较宽的类型，类型相同时直接引用，bigint 不复制
+ */
+template <typename T, typename U>
+decltype(auto) widen(const U &value)
+{
+    if constexpr (std::is_same_v<T, U>)
+    {
+        return (value);
+    }
+    else
+    {
+        return static_cast<T>(value);
+    }
+}
+
+/**
+ * 复合赋值的结果按变量的类型截断，bigint 取低 64 位
+ */
+template <typename Target, typename T>
+Target narrow(T &&value)
+{
+    using Source = std::decay_t<T>;
+    if constexpr (std::is_same_v<Target, Source>)
+    {
+        return std::forward<T>(value);
+    }
+    else if constexpr (std::is_same_v<Source, BigInt>)
+    {
+        return static_cast<Target>(value.truncate());
+    }
+    else
+    {
+        return static_cast<Target>(value);
+    }
+}
+
+/**
+ * 比较和逻辑运算的结果是 int，其余运算的结果和操作数一样宽
+ */
+template <typename T, typename Result>
+using ResultType =
+    std::conditional_t<std::is_same_v<Result, bool>, int32_t, T>;
+
+/**
+ * 标准库里没有的运算，和 std::plus<> 一样按参数的类型计算
+ */
+struct ShiftLeft
+{
+    template <typename T>
+    T operator()(T a, T b) const
+    {
+        return a << b;
+    }
+};
+
+struct ShiftRight
+{
+    template <typename T>
+    T operator()(T a, T b) const
+    {
+        return a >> b;
+    }
+};
+
+/**
+ * 整数除法和取模：除数为 0 时抛出异常，不让 SIGFPE 杀掉整个进程
+ * （--serve 的常驻进程里还有别的脚本在执行）；
+ * 最小值除以 -1 和加减乘一样按补码回绕，余数为 0。bigint 自己检查除数
+ */
+struct Divides
+{
+    template <typename T>
+    T operator()(const T &a, const T &b) const
+    {
+        if constexpr (std::is_integral_v<T>)
+        {
+            if (b == 0)
+            {
+                throw std::runtime_error("除数不能为0");
+            }
+            if (b == -1)
+            {
+                using Unsigned = std::make_unsigned_t<T>;
+                return static_cast<T>(Unsigned(0) - static_cast<Unsigned>(a));
+            }
+        }
+        return a / b;
+    }
+};
+
+struct Modulus
+{
+    template <typename T>
+    T operator()(const T &a, const T &b) const
+    {
+        if constexpr (std::is_integral_v<T>)
+        {
+            if (b == 0)
+            {
+                throw std::runtime_error("除数不能为0");
+            }
+            if (b == -1)
+            {
+                return 0;
+            }
+        }
+        return a % b;
+    }
+};
+
+struct Second
+{
+    template <typename T>
+    T operator()(const T &, const T &b) const
+    {
+        return b;
+    }
+};
+
+struct UnaryPlus
+{
+    template <typename T>
+    T operator()(const T &a) const
+    {
+        return a;
+    }
+};
+
+/**
+ * 逻辑运算和 0 比较，bigint 没有到 bool 的转换
+ */
+struct LogicalAnd
+{
+    template <typename T>
+    bool operator()(const T &a, const T &b) const
+    {
+        return a != T{} && b != T{};
+    }
+};
+
+struct LogicalOr
+{
+    template <typename T>
+    bool operator()(const T &a, const T &b) const
+    {
+        return a != T{} || b != T{};
+    }
+};
+
+struct LogicalNot
+{
+    template <typename T>
+    bool operator()(const T &a) const
+    {
+        return a == T{};
+    }
+};
+
+/**
+ * bigint 不支持位运算和移位，这些运算核在运行时报错
+ */
+template <typename Op>
+constexpr bool isBitwise =
+    std::is_same_v<Op, ShiftLeft> || std::is_same_v<Op, ShiftRight> ||
+    std::is_same_v<Op, std::bit_and<>> || std::is_same_v<Op, std::bit_or<>> ||
+    std::is_same_v<Op, std::bit_xor<>> || std::is_same_v<Op, std::bit_not<>>;
+
+template <typename Op, typename T>
+constexpr bool isSupported = !(std::is_same_v<T, BigInt> && isBitwise<Op>);
+
+using BinaryKernel = antlrcpp::Any (*)(antlrcpp::Any &, antlrcpp::Any &);
+using UnaryKernel = antlrcpp::Any (*)(antlrcpp::Any &);
+
+/**
+ * 双目运算的运算核，操作数的种类在编译期确定，运行时没有任何类型判断。
+ * 两个操作数都是 int 时和只有 int 的时候是同一份代码，不会因为 long、bigint 变慢
+ */
+template <typename Op, OperandKind left, OperandKind right>
+antlrcpp::Any binaryKernel(antlrcpp::Any &lhs, antlrcpp::Any &rhs)
+{
+    using T = CommonType<left, right>;
+    if constexpr (!isSupported<Op, T>)
+    {
+        throw std::runtime_error("bigint不支持位运算");
+    }
+    else
+    {
+        auto result = Op{}(widen<T>(Operand<left>::load(lhs)),
+                           widen<T>(Operand<right>::load(rhs)));
+        return static_cast<ResultType<T, decltype(result)>>(std::move(result));
+    }
+}
+
+/**
+ * 赋值（包括复合赋值）的运算核，左侧一定是变量。
+ * 和 Java 一样，复合赋值按变量的类型截断，宽的类型不能直接赋值给窄的
+ */
+template <typename Op, OperandKind left, OperandKind right>
+antlrcpp::Any assignKernel(antlrcpp::Any &lhs, antlrcpp::Any &rhs)
+{
+    using Target = typename Operand<left>::Type;
+    using T = CommonType<left, right>;
+    if constexpr (!isReference(left))
+    {
+        throw std::runtime_error("赋值号左侧不能为字面量");
+    }
+    else if constexpr (std::is_same_v<Op, Second> &&
+                       rankOf<Target> < rankOf<T>)
+    {
+        throw std::runtime_error(std::string(typeName<T>) + "不能隐式转换成" +
+                                 typeName<Target>);
+    }
+    else if constexpr (!isSupported<Op, T>)
+    {
+        throw std::runtime_error("bigint不支持位运算");
+    }
+    else
+    {
+        auto *target = lhs.as<Target *>();
+        *target = narrow<Target>(Op{}(widen<T>(*target),
+                                      widen<T>(Operand<right>::load(rhs))));
+        return *target;
+    }
+}
+
+template <typename Op, OperandKind kind>
+antlrcpp::Any unaryKernel(antlrcpp::Any &child)
+{
+    using T = typename Operand<kind>::Type;
+    if constexpr (!isSupported<Op, T>)
+    {
+        throw std::runtime_error("bigint不支持位运算");
+    }
+    else
+    {
+        auto result = Op{}(Operand<kind>::load(child));
+        return static_cast<ResultType<T, decltype(result)>>(std::move(result));
+    }
+}
+
+/**
+ * 双目运算符（包括赋值号）的所有运算核
+ */
+struct BinaryOperator
+{
+    size_t token;
+    bool assign;
+    /// 下标是 左操作数种类 * operandKinds + 右操作数种类
+    BinaryKernel kernels[binaryKinds];
+};
+
+struct UnaryOperator
+{
+    size_t token;
+    UnaryKernel kernels[operandKinds];  ///< 下标是操作数种类
+};
+
+template <typename Op, size_t... kinds>
+constexpr BinaryOperator arithmetic(size_t token,
+                                    std::index_sequence<kinds...>)
+{
+    return {token,
+            false,
+            {&binaryKernel<Op, OperandKind(kinds / operandKinds),
+                           OperandKind(kinds % operandKinds)>...}};
+}
+
+template <typename Op>
+constexpr BinaryOperator arithmetic(size_t token)
+{
+    return arithmetic<Op>(token, std::make_index_sequence<binaryKinds>{});
+}
+
+template <typename Op, size_t... kinds>
+constexpr BinaryOperator assignment(size_t token,
+                                    std::index_sequence<kinds...>)
+{
+    return {token,
+            true,
+            {&assignKernel<Op, OperandKind(kinds / operandKinds),
+                           OperandKind(kinds % operandKinds)>...}};
+}
+
+template <typename Op>
+constexpr BinaryOperator assignment(size_t token)
+{
+    return assignment<Op>(token, std::make_index_sequence<binaryKinds>{});
+}
+
+template <typename Op, size_t... kinds>
+constexpr UnaryOperator prefix(size_t token, std::index_sequence<kinds...>)
+{
+    return {token, {&unaryKernel<Op, OperandKind(kinds)>...}};
+}
+
+template <typename Op>
+constexpr UnaryOperator prefix(size_t token)
+{
+    return prefix<Op>(token, std::make_index_sequence<operandKinds>{});
+}
+
+/**
+ * 所有的双目运算符，新增运算符或者类型都只需要修改这里
+ */
+inline constexpr BinaryOperator binaryOperators[] = {
+    arithmetic<std::plus<>>(FalconScriptParser::PLUS),
+    arithmetic<std::minus<>>(FalconScriptParser::MINUS),
+    arithmetic<std::multiplies<>>(FalconScriptParser::MULTIPLY),
+    arithmetic<Divides>(FalconScriptParser::DIVIDE),
+    arithmetic<Modulus>(FalconScriptParser::MODULUS),
+    arithmetic<ShiftLeft>(FalconScriptParser::L_SHIFT),
+    arithmetic<ShiftRight>(FalconScriptParser::R_SHIFT),
+    arithmetic<std::equal_to<>>(FalconScriptParser::EQUAL),
+    arithmetic<std::not_equal_to<>>(FalconScriptParser::NOT_EQUAL),
+    arithmetic<std::greater<>>(FalconScriptParser::GREATER),
+    arithmetic<std::less<>>(FalconScriptParser::LESS),
+    arithmetic<std::greater_equal<>>(FalconScriptParser::GREATER_EQUAL),
+    arithmetic<std::less_equal<>>(FalconScriptParser::LESS_EQUAL),
+    arithmetic<std::bit_and<>>(FalconScriptParser::BIT_AND),
+    arithmetic<std::bit_or<>>(FalconScriptParser::BIT_OR),
+    arithmetic<std::bit_xor<>>(FalconScriptParser::BIT_XOR),
+    arithmetic<LogicalAnd>(FalconScriptParser::AND),
+    arithmetic<LogicalOr>(FalconScriptParser::OR),
+    assignment<Second>(FalconScriptParser::ASSIGN),
+    assignment<std::plus<>>(FalconScriptParser::PLUS_ASSIGN),
+    assignment<std::minus<>>(FalconScriptParser::MINUS_ASSIGN),
+    assignment<std::multiplies<>>(FalconScriptParser::MULTIPLY_ASSIGN),
+    assignment<Divides>(FalconScriptParser::DIVIDE_ASSIGN),
+    assignment<Modulus>(FalconScriptParser::MODULUS_ASSIGN),
+    assignment<ShiftLeft>(FalconScriptParser::L_SHIFT_ASSIGN),
+    assignment<ShiftRight>(FalconScriptParser::R_SHIFT_ASSIGN),
+    assignment<std::bit_and<>>(FalconScriptParser::BIT_AND_ASSIGN),
+    assignment<std::bit_or<>>(FalconScriptParser::BIT_OR_ASSIGN),
+    assignment<std::bit_xor<>>(FalconScriptParser::BIT_XOR_ASSIGN),
+};
+
+/**
+ * 前置单目运算符，++/-- 需要修改变量，单独处理
+ */
+inline constexpr UnaryOperator unaryOperators[] = {
+    prefix<UnaryPlus>(FalconScriptParser::PLUS),
+    prefix<std::negate<>>(FalconScriptParser::MINUS),
+    prefix<LogicalNot>(FalconScriptParser::NOT),
+    prefix<std::bit_not<>>(FalconScriptParser::NEGATE),
+};
+
+template <typename Table>
+constexpr int findOperator(const Table &table, size_t token)
+{
+    for (size_t i = 0; i < std::size(table); ++i)
+    {
+        if (table[i].token == token)
+        {
+            return static_cast<int>(i);
+        }
+    }
+    return -1;
+}
+
+inline int operandKind(antlrcpp::Any &any)
+{
+    if (any.is<int32_t>())
+    {
+        return static_cast<int>(OperandKind::Value);
+    }
+    if (any.is<int32_t *>())
+    {
+        return static_cast<int>(OperandKind::Reference);
+    }
+    if (any.is<int64_t>())
+    {
+        return static_cast<int>(OperandKind::LongValue);
+    }
+    if (any.is<int64_t *>())
+    {
+        return static_cast<int>(OperandKind::LongReference);
+    }
+    if (any.is<BigInt>())
+    {
+        return static_cast<int>(OperandKind::BigValue);
+    }
+    if (any.is<BigInt *>())
+    {
+        return static_cast<int>(OperandKind::BigReference);
+    }
+    if (any.is<ArrayRef>())
+    {
+        throw std::runtime_error("数组不能直接参与运算");
+    }
+    throw std::runtime_error("类型不匹配");
+}
+
+/**
+ * any 是不是 kind 种类的操作数，比 operandKind 少几次类型比较
+ */
+inline bool hasKind(antlrcpp::Any &any, int kind)
+{
+    switch (static_cast<OperandKind>(kind))
+    {
+        case OperandKind::Value:
+            return any.is<int32_t>();
+        case OperandKind::Reference:
+            return any.is<int32_t *>();
+        case OperandKind::LongValue:
+            return any.is<int64_t>();
+        case OperandKind::LongReference:
+            return any.is<int64_t *>();
+        case OperandKind::BigValue:
+            return any.is<BigInt>();
+        case OperandKind::BigReference:
+            return any.is<BigInt *>();
+    }
+    return false;
+}
+
+/**
+ * 双目运算符节点的运算核编号：运算符下标 * binaryKinds + 操作数种类
+ *
+ * 上一次求值的编号缓存在 kernel 中（初值为 -1），操作数种类没变时直接使用。
+ * 同一个节点的操作数种类可能变化：三目运算符的两个分支种类不同，
+ * 或者内层同名变量的声明失败后，名字解析到外层另一种类型的变量，
+ * 所以每次都要核对，对不上时重新查表
+ */
+inline int binaryKernelIndex(int &kernel,
+                             FalconScriptParser::ExpressionContext *ctx,
+                             antlrcpp::Any &lhs,
+                             antlrcpp::Any &rhs)
+{
+    if (kernel >= 0 && hasKind(lhs, kernel % binaryKinds / operandKinds) &&
+        hasKind(rhs, kernel % operandKinds))
+    {
+        return kernel;
+    }
+    auto op = kernel >= 0 ? kernel / binaryKinds
+                          : findOperator(binaryOperators, ctx->bop->getType());
+    if (op < 0)
+    {
+        throw std::runtime_error("未知的运算符");
+    }
+    kernel =
+        op * binaryKinds + operandKind(lhs) * operandKinds + operandKind(rhs);
+    return kernel;
+}
+
+/**
+ * 前置单目运算符节点的运算核编号：运算符下标 * operandKinds + 操作数种类，
+ * 和双目运算符一样缓存并核对
+ */
+inline int unaryKernelIndex(int &kernel,
+                            FalconScriptParser::ExpressionContext *ctx,
+                            antlrcpp::Any &child)
+{
+    if (kernel >= 0 && hasKind(child, kernel % operandKinds))
+    {
+        return kernel;
+    }
+    auto op = kernel >= 0
+                  ? kernel / operandKinds
+                  : findOperator(unaryOperators, ctx->prefix->getType());
+    if (op < 0)
+    {
+        throw std::runtime_error("未知的运算符");
+    }
+    kernel = op * operandKinds + operandKind(child);
+    return kernel;
+}
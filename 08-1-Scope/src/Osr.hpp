@@ -0,0 +1,70 @@
+#pragma once
+
+#include "IRBuilder.hpp"
+#include "VM.hpp"
+
+/**
+ * 栈上替换（On-Stack Replacement）
+ *
+ * 顶层脚本往往只有一个大循环，整个循环只进入一次，等不到"第二次执行"再优化。
+ * 解释器在每条回边上计数，循环足够热之后，把剩下的迭代编译成字节码，
+ * 带着栈帧中变量的当前值在虚拟机中继续执行。
+ */
+class OsrCompiler
+{
+  public:
+    OsrCompiler(const AnnotatedTree *at, int threshold)
+        : at_(at), threshold_(threshold)
+    {
+    }
+
+    /**
+     * 记录一次回边，循环足够热时返回编译好的字节码，否则返回空
+     *
+     * 编译结果按循环缓存，内层循环再次进入时可以立刻切换过去
+     */
+    const BytecodeProgram *onBackEdge(
+        FalconScriptParser::StatementContext *ctx)
+    {
+        auto &loop = loops_[ctx];
+        if (loop.program == nullptr && !loop.failed &&
+            ++loop.backEdges >= threshold_)
+        {
+            compile(ctx, loop);
+        }
+        return loop.program.get();
+    }
+
+  private:
+    struct LoopProfile
+    {
+        int backEdges = 0;
+        bool failed = false;  ///< 循环中有 IR 不支持的写法，一直解释执行
+        std::unique_ptr<BytecodeProgram> program;
+    };
+
+  private:
+    void compile(FalconScriptParser::StatementContext *ctx, LoopProfile &loop)
+    {
+        std::unique_ptr<IRFunction> fn;
+        try
+        {
+            fn = IRBuilder(at_).buildLoop(ctx);
+        }
+        catch (IRUnsupported &e)
+        {
+            loop.failed = true;
+            return;
+        }
+        IROptimizer(*fn).run();
+        loop.program =
+            std::make_unique<BytecodeProgram>(BytecodeLowering(*fn).lower());
+    }
+
+  private:
+    const AnnotatedTree *at_;
+    /// 回边执行多少次之后编译
+    int threshold_;
+    std::unordered_map<FalconScriptParser::StatementContext *, LoopProfile>
+        loops_;
+};
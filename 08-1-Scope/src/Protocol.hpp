@@ -0,0 +1,139 @@
+#pragma once
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+/**
+ * falcon --serve 和 falcon-client 之间的协议
+ *
+ * 只用于本机的 Unix 域套接字，整数都按本机字节序。
+ * 请求：uint32 标志位、uint32 源码长度、源码。
+ * 应答：若干帧，每帧是 uint8 类型、uint32 长度、内容。
+ * 输出一边产生一边发送，最后一帧是退出码。
+ *
+ * 这个文件只依赖系统头文件，客户端不需要链接 antlr4。
+ */
+namespace protocol
+{
+/// 请求的标志位
+enum Flag : uint32_t
+{
+    Optimize = 1,  ///< 相当于 -O
+};
+
+enum class Frame : uint8_t
+{
+    Out = 'O',   ///< 标准输出的片段
+    Err = 'E',   ///< 标准错误的片段
+    Exit = 'X',  ///< 内容是 int32 退出码
+};
+
+/// 源码长度的上限，防止错误的请求耗尽内存
+constexpr uint32_t maxSourceSize = 64u << 20;
+
+inline bool writeAll(int fd, const void *data, size_t size)
+{
+    auto *p = static_cast<const char *>(data);
+    while (size > 0)
+    {
+        // 对方已经断开时不要触发 SIGPIPE
+        auto n = ::send(fd, p, size, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n <= 0)
+        {
+            return false;
+        }
+        p += n;
+        size -= static_cast<size_t>(n);
+    }
+    return true;
+}
+
+inline bool readAll(int fd, void *data, size_t size)
+{
+    auto *p = static_cast<char *>(data);
+    while (size > 0)
+    {
+        auto n = ::recv(fd, p, size, 0);
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n <= 0)
+        {
+            return false;
+        }
+        p += n;
+        size -= static_cast<size_t>(n);
+    }
+    return true;
+}
+
+inline bool writeFrame(int fd, Frame type, const void *data, uint32_t size)
+{
+    char header[5];
+    header[0] = static_cast<char>(type);
+    std::memcpy(header + 1, &size, sizeof(size));
+    return writeAll(fd, header, sizeof(header)) && writeAll(fd, data, size);
+}
+
+inline bool readFrame(int fd, Frame &type, std::string &data)
+{
+    char header[5];
+    if (!readAll(fd, header, sizeof(header)))
+    {
+        return false;
+    }
+    uint32_t size;
+    std::memcpy(&size, header + 1, sizeof(size));
+    type = static_cast<Frame>(header[0]);
+    data.resize(size);
+    return readAll(fd, data.data(), size);
+}
+
+/**
+ * 填写套接字地址，路径太长时返回 false
+ */
+inline bool socketAddress(const std::string &path, sockaddr_un &addr)
+{
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(addr.sun_path))
+    {
+        return false;
+    }
+    std::memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+    return true;
+}
+
+/**
+ * 连接到服务端，失败时返回 -1
+ */
+inline int connectTo(const std::string &path)
+{
+    sockaddr_un addr;
+    if (!socketAddress(path, addr))
+    {
+        return -1;
+    }
+    int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0)
+    {
+        return -1;
+    }
+    if (::connect(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0)
+    {
+        ::close(fd);
+        return -1;
+    }
+    return fd;
+}
+}  // namespace protocol
@@ -0,0 +1,136 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * 协作式的时间片调度：少量工作线程轮流执行大量可以暂停的任务
+ *
+ * 任务每次最多执行 quantum 条指令，没有执行完就排到队尾，等其他任务各执行
+ * 一个时间片之后再继续。一个长时间运行的循环只会拖慢自己，
+ * 其他任务的延迟取决于任务个数和时间片的长度。
+ *
+ * 和 ThreadPool 不同，这里只有一个先进先出的队列：
+ * 让出线程的任务如果放回自己的队尾再取出，就又轮到它了。
+ */
+class Scheduler
+{
+  public:
+    /**
+     * 执行一个时间片，参数是最多执行的指令数，执行完返回 true
+     *
+     * 任务自己处理脚本的错误，抛出异常的任务视为已经结束
+     */
+    using Task = std::function<bool(size_t quantum)>;
+
+    Scheduler(size_t threads, size_t quantum)
+        : quantum_(quantum == 0 ? 1 : quantum), active_(0), stopping_(false)
+    {
+        if (threads == 0)
+        {
+            threads = 1;
+        }
+        for (size_t i = 0; i < threads; ++i)
+        {
+            workers_.emplace_back([this] { work(); });
+        }
+    }
+
+    /**
+     * 等所有任务执行完再退出
+     */
+    ~Scheduler()
+    {
+        wait();
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stopping_ = true;
+        }
+        ready_.notify_all();
+        for (auto &worker : workers_)
+        {
+            worker.join();
+        }
+    }
+
+    Scheduler(const Scheduler &) = delete;
+    Scheduler &operator=(const Scheduler &) = delete;
+
+    void spawn(Task task)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            queue_.push_back(std::move(task));
+            ++active_;
+        }
+        ready_.notify_one();
+    }
+
+    /**
+     * 等到已经提交的任务全部结束
+     */
+    void wait()
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        idle_.wait(lock, [this] { return active_ == 0; });
+    }
+
+  private:
+    void work()
+    {
+        while (true)
+        {
+            Task task;
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                ready_.wait(lock,
+                            [this] { return stopping_ || !queue_.empty(); });
+                if (queue_.empty())
+                {
+                    return;
+                }
+                task = std::move(queue_.front());
+                queue_.pop_front();
+            }
+            bool finished;
+            try
+            {
+                finished = task(quantum_);
+            }
+            catch (...)
+            {
+                finished = true;
+            }
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (finished)
+            {
+                if (--active_ == 0)
+                {
+                    idle_.notify_all();
+                }
+            }
+            else
+            {
+                queue_.push_back(std::move(task));
+                ready_.notify_one();
+            }
+        }
+    }
+
+  private:
+    const size_t quantum_;
+    std::mutex mutex_;
+    /// 队列中有任务，或者要退出了
+    std::condition_variable ready_;
+    /// 所有任务都结束了
+    std::condition_variable idle_;
+    std::deque<Task> queue_;
+    /// 已经提交还没有结束的任务数，包括正在执行的
+    size_t active_;
+    bool stopping_;
+    std::vector<std::thread> workers_;
+};
@@ -61,28 +61,19 @@ class Scope : public Symbol
 class BlockScope : public Scope
 {
   public:
+    /**
+     * 匿名的块用编号作为名字，编号由创建者（MyListener）分配，不使用全局计数器
+     */
     BlockScope(Scope* enclosingScope,
                antlr4::ParserRuleContext* ctx,
-               const std::string& name = "")
+               const std::string& name)
     {
         enclosingScope_ = enclosingScope;
         ctx_ = ctx;
-        if (name != "")
-        {
-            name_ = "block_" + name;
-        }
-        else
-        {
-            name_ = "block_" + std::to_string(block_id++);
-        }
+        name_ = "block_" + name;
     }
 
     virtual ~BlockScope()
     {
     }
-
-  private:
-    static uint32_t block_id;
 };
-
-inline uint32_t BlockScope::block_id = 0;
@@ -0,0 +1,208 @@
+#pragma once
+
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <cerrno>
+#include <functional>
+#include <iostream>
+#include <stdexcept>
+#include <streambuf>
+#include "Protocol.hpp"
+#include "ThreadPool.hpp"
+
+/**
+ * falcon --serve：常驻进程，通过 Unix 域套接字接收脚本，在线程池中执行
+ *
+ * 进程启动、antlr 运行时初始化、ATN 反序列化都只发生一次，
+ * 之后每个脚本只需要付出解析和执行本身的开销。协议见 Protocol.hpp
+ */
+class Server
+{
+  public:
+    /**
+     * 执行一个脚本，返回退出码
+     *
+     * 会在多个线程中同时调用，每次调用都要使用独立的解释器实例
+     */
+    using Job = std::function<int(const std::string &source,
+                                  uint32_t flags,
+                                  std::ostream &out,
+                                  std::ostream &err)>;
+
+    Server(std::string path, size_t threads, Job job)
+        : path_(std::move(path)), job_(std::move(job)), pool_(threads)
+    {
+    }
+
+    /**
+     * 监听并处理请求，只在出错时返回
+     */
+    void serve()
+    {
+        sockaddr_un addr;
+        if (!protocol::socketAddress(path_, addr))
+        {
+            throw std::runtime_error("套接字路径太长：" + path_);
+        }
+        int listener = ::socket(AF_UNIX, SOCK_STREAM, 0);
+        if (listener < 0)
+        {
+            throw std::runtime_error("无法创建套接字");
+        }
+        // 上次运行留下的套接字文件可以删掉；路径上是别的文件，
+        // 或者还有进程在上面监听时不能删
+        struct stat status;
+        if (::lstat(path_.c_str(), &status) == 0)
+        {
+            if (!S_ISSOCK(status.st_mode))
+            {
+                ::close(listener);
+                throw std::runtime_error("已经存在，而且不是套接字：" + path_);
+            }
+            if (!isStale(addr))
+            {
+                ::close(listener);
+                throw std::runtime_error("已经有进程在监听：" + path_);
+            }
+            ::unlink(path_.c_str());
+        }
+        if (::bind(listener, reinterpret_cast<sockaddr *>(&addr),
+                   sizeof(addr)) != 0 ||
+            ::listen(listener, SOMAXCONN) != 0)
+        {
+            ::close(listener);
+            throw std::runtime_error("无法监听：" + path_);
+        }
+        while (true)
+        {
+            int fd = ::accept(listener, nullptr, nullptr);
+            if (fd < 0)
+            {
+                if (errno == EINTR || errno == ECONNABORTED)
+                {
+                    continue;
+                }
+                ::close(listener);
+                throw std::runtime_error("accept 失败");
+            }
+            // 连上之后不发请求、也不读应答的客户端不能一直占着工作线程
+            timeval timeout{ioTimeoutSeconds, 0};
+            ::setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout,
+                         sizeof(timeout));
+            ::setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout,
+                         sizeof(timeout));
+            pool_.submit([this, fd] {
+                handle(fd);
+                ::close(fd);
+            });
+        }
+    }
+
+  private:
+    /**
+     * 把写入的内容打包成帧发给客户端，缓冲区满了或者 flush 时发送
+     */
+    class FrameBuf : public std::streambuf
+    {
+      public:
+        FrameBuf(int fd, protocol::Frame type) : fd_(fd), type_(type)
+        {
+            setp(buffer_, buffer_ + sizeof(buffer_));
+        }
+
+      protected:
+        virtual int_type overflow(int_type ch) override
+        {
+            if (sync() != 0)
+            {
+                return traits_type::eof();
+            }
+            if (!traits_type::eq_int_type(ch, traits_type::eof()))
+            {
+                *pptr() = traits_type::to_char_type(ch);
+                pbump(1);
+            }
+            return traits_type::not_eof(ch);
+        }
+
+        virtual int sync() override
+        {
+            auto size = static_cast<uint32_t>(pptr() - pbase());
+            if (size == 0)
+            {
+                return 0;
+            }
+            setp(buffer_, buffer_ + sizeof(buffer_));
+            return protocol::writeFrame(fd_, type_, buffer_, size) ? 0 : -1;
+        }
+
+      private:
+        int fd_;
+        protocol::Frame type_;
+        char buffer_[4096];
+    };
+
+  private:
+    /**
+     * 套接字文件是不是上次运行留下的：连接被拒绝说明没有进程在监听
+     */
+    static bool isStale(const sockaddr_un &addr)
+    {
+        int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd < 0)
+        {
+            return false;
+        }
+        bool refused =
+            ::connect(fd, reinterpret_cast<const sockaddr *>(&addr),
+                      sizeof(addr)) != 0 &&
+            errno == ECONNREFUSED;
+        ::close(fd);
+        return refused;
+    }
+
+    void handle(int fd)
+    {
+        uint32_t header[2];
+        if (!protocol::readAll(fd, header, sizeof(header)) ||
+            header[1] > protocol::maxSourceSize)
+        {
+            return;
+        }
+        std::string source(header[1], '\0');
+        if (!protocol::readAll(fd, source.data(), source.size()))
+        {
+            return;
+        }
+        FrameBuf outBuf(fd, protocol::Frame::Out);
+        FrameBuf errBuf(fd, protocol::Frame::Err);
+        std::ostream out(&outBuf);
+        std::ostream err(&errBuf);
+        int32_t status;
+        try
+        {
+            status = job_(source, header[0], out, err);
+        }
+        catch (std::exception &e)
+        {
+            err << "Error: " << e.what() << std::endl;
+            status = 1;
+        }
+        out.flush();
+        err.flush();
+        protocol::writeFrame(fd, protocol::Frame::Exit, &status,
+                             sizeof(status));
+    }
+
+  private:
+    /// 一次 recv 或 send 最多等待的秒数，超时后放弃这个请求
+    static constexpr time_t ioTimeoutSeconds = 10;
+
+    std::string path_;
+    Job job_;
+    /// 最后初始化、最先析构，等正在执行的任务结束之后其他成员才失效
+    ThreadPool pool_;
+};
@@ -1,12 +1,29 @@
 #pragma once
 
+#include "Array.hpp"
+#include "BigInt.hpp"
+#include "HashMap.hpp"
+#include "Memory.hpp"
 #include "Scope.hpp"
+#include <deque>
 #include <sstream>
 
 class StackFrame
 {
   public:
-    StackFrame(BlockScope* scope) : scope_(scope), parentFrame(nullptr)
+    /**
+     * 变量表和变量的存储空间都记在 memory 的账上
+     */
+    StackFrame(BlockScope* scope, MemoryAccount* memory)
+        : parentFrame(nullptr),
+          scope_(scope),
+          variables_(Allocator<Variables::value_type>(memory)),
+          values_(Allocator<int>(memory)),
+          longValues_(Allocator<int64_t>(memory)),
+          bigValues_(Allocator<BigInt>(memory)),
+          arrays_(Allocator<Array>(memory)),
+          maps_(Allocator<IntMap>(memory)),
+          memory_(memory)
     {
     }
 
@@ -31,16 +48,67 @@ class StackFrame
         }
     }
 
-    void addVariable(const std::string& name, int* value)
+    /**
+     * 变量的存储空间属于栈帧，出栈时一起释放
+     */
+    void addVariable(const std::string& name, int value)
     {
-        if (getVariable(name, false).isNotNull())
-        {
-            std::stringstream ss;
-            ss << "variable " << name << " already exists in this scope."
-               << std::endl;
-            throw std::runtime_error(ss.str());
-        }
-        variables_[name] = value;
+        checkUndefined(name);
+        variables_[name] = &values_.emplace_back(value);
+    }
+
+    /**
+     * long 变量，变量表中是 int64_t*
+     */
+    void addLongVariable(const std::string& name, int64_t value)
+    {
+        checkUndefined(name);
+        variables_[name] = &longValues_.emplace_back(value);
+    }
+
+    /**
+     * bigint 变量，变量表中是 BigInt*，limb 数组也记在 memory_ 的账上
+     */
+    void addBigVariable(const std::string& name, const BigInt& value)
+    {
+        checkUndefined(name);
+        variables_[name] = &bigValues_.emplace_back(value, memory_);
+    }
+
+    /**
+     * 数组和普通变量一样属于栈帧，元素都初始化为 0
+     */
+    ArrayRef addArray(const std::string& name, std::vector<size_t> dims)
+    {
+        checkUndefined(name);
+        ArrayRef array{&arrays_.emplace_back(std::move(dims), memory_), 0, 0};
+        variables_[name] = array;
+        return array;
+    }
+
+    /**
+     * 用另一个数组初始化的数组，见 arrayFrom
+     */
+    ArrayRef addArray(const std::string& name,
+                      std::vector<size_t> dims,
+                      const ArrayRef& source)
+    {
+        checkUndefined(name);
+        ArrayRef array{
+            &arrays_.emplace_back(arrayFrom(std::move(dims), source, memory_))};
+        variables_[name] = array;
+        return array;
+    }
+
+    /**
+     * map 也属于栈帧，变量表中是 IntMap*
+     */
+    IntMap* addMap(const std::string& name)
+    {
+        checkUndefined(name);
+        auto* map = &maps_.emplace_back(memory_);
+        variables_[name] = map;
+        return map;
     }
 
   public:
@@ -53,6 +121,34 @@ class StackFrame
     StackFrame* parentFrame;
 
   private:
+    void checkUndefined(const std::string& name) const
+    {
+        if (getVariable(name, false).isNotNull())
+        {
+            std::stringstream ss;
+            ss << "variable " << name << " already exists in this scope."
+               << std::endl;
+            throw std::runtime_error(ss.str());
+        }
+    }
+
+  private:
+    template <typename T>
+    using Allocator = AccountedAllocator<T>;
+    using Variables = std::unordered_map<
+        std::string,
+        antlrcpp::Any,
+        std::hash<std::string>,
+        std::equal_to<std::string>,
+        Allocator<std::pair<const std::string, antlrcpp::Any>>>;
+
     Scope* scope_;
-    std::unordered_map<std::string, antlrcpp::Any> variables_;
+    Variables variables_;
+    /// deque 扩容时不会移动已有元素，variables_ 中的指针一直有效
+    std::deque<int, Allocator<int>> values_;
+    std::deque<int64_t, Allocator<int64_t>> longValues_;
+    std::deque<BigInt, Allocator<BigInt>> bigValues_;
+    std::deque<Array, Allocator<Array>> arrays_;
+    std::deque<IntMap, Allocator<IntMap>> maps_;
+    MemoryAccount* memory_;
 };
@@ -0,0 +1,189 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <sstream>
+#include <vector>
+#include "IntegerLiteral.hpp"
+#include "OperatorKernels.hpp"
+
+/**
+ * switch 的分派表，把 case 的值映射到跳转目标
+ *
+ * 标签紧凑时用数组直接索引（跳转表），稀疏时在排好序的标签上二分查找，
+ * 都不需要像 if/else 链那样逐个比较。
+ * 跳转目标的含义由使用者决定：解释器里是语句组的下标，字节码里是指令地址。
+ */
+class SwitchTable
+{
+  public:
+    SwitchTable() : min_(0), defaultTarget_(-1)
+    {
+    }
+
+    /**
+     * cases 中的值不能重复
+     */
+    SwitchTable(std::vector<std::pair<int32_t, int>> cases, int defaultTarget)
+        : min_(0), defaultTarget_(defaultTarget)
+    {
+        if (cases.empty())
+        {
+            return;
+        }
+        std::sort(cases.begin(), cases.end());
+        min_ = cases.front().first;
+        auto range = static_cast<int64_t>(cases.back().first) - min_ + 1;
+        // 空位不超过一半时用跳转表
+        if (range <= static_cast<int64_t>(cases.size()) * 2)
+        {
+            dense_.assign(range, defaultTarget);
+            for (auto &[value, target] : cases)
+            {
+                dense_[static_cast<int64_t>(value) - min_] = target;
+            }
+        }
+        else
+        {
+            sorted_ = std::move(cases);
+        }
+    }
+
+    int lookup(int32_t value) const
+    {
+        if (!dense_.empty())
+        {
+            auto offset = static_cast<uint64_t>(static_cast<int64_t>(value) -
+                                                min_);
+            return offset < dense_.size() ? dense_[offset] : defaultTarget_;
+        }
+        auto it = std::lower_bound(
+            sorted_.begin(), sorted_.end(), value,
+            [](const std::pair<int32_t, int> &entry, int32_t v) {
+                return entry.first < v;
+            });
+        return it != sorted_.end() && it->first == value ? it->second
+                                                         : defaultTarget_;
+    }
+
+    bool isDense() const
+    {
+        return !dense_.empty();
+    }
+
+  private:
+    /// 序列化分派表
+    friend class BytecodeCache;
+
+    int32_t min_;
+    int defaultTarget_;
+    std::vector<int> dense_;
+    std::vector<std::pair<int32_t, int>> sorted_;
+};
+
+/**
+ * 常量表达式求值，只允许字面量和不修改变量的运算符，用于 case 标签
+ */
+inline int32_t constantExpression(FalconScriptParser::ExpressionContext *ctx)
+{
+    if (auto *primary = ctx->primary())
+    {
+        if (primary->expression())
+        {
+            return constantExpression(primary->expression());
+        }
+        if (primary->literal() && primary->literal()->integerLiteral())
+        {
+            auto *literal = primary->literal()->integerLiteral();
+            // 和 Java 一样，case 标签都是 int
+            if (isLongLiteral(literal))
+            {
+                throw std::runtime_error("case 标签不能是long：" +
+                                         literal->getText());
+            }
+            return intLiteral(literal);
+        }
+    }
+    else if (ctx->bop != nullptr && ctx->expression().size() == 2)
+    {
+        auto op = findOperator(binaryOperators, ctx->bop->getType());
+        if (op >= 0 && !binaryOperators[op].assign)
+        {
+            antlrcpp::Any left = constantExpression(ctx->expression(0));
+            antlrcpp::Any right = constantExpression(ctx->expression(1));
+            // 除数为 0 时 Divides 和 Modulus 抛出异常，和运行时一样
+            return binaryOperators[op].kernels[0](left, right).as<int32_t>();
+        }
+    }
+    else if (ctx->prefix != nullptr)
+    {
+        auto op = findOperator(unaryOperators, ctx->prefix->getType());
+        if (op >= 0)
+        {
+            antlrcpp::Any child = constantExpression(ctx->expression(0));
+            return unaryOperators[op].kernels[0](child).as<int32_t>();
+        }
+    }
+    else if (ctx->bop != nullptr && ctx->expression().size() == 3)
+    {
+        return constantExpression(ctx->expression(0)) != 0
+                   ? constantExpression(ctx->expression(1))
+                   : constantExpression(ctx->expression(2));
+    }
+    throw std::runtime_error("case 标签必须是常量：" + ctx->getText());
+}
+
+/**
+ * 收集 switch 的所有标签
+ *
+ * 跳转目标是语句组的下标，没有语句的结尾标签跳到末尾（下标等于语句组个数），
+ * 没有 default 时 defaultTarget 也是末尾
+ */
+inline void switchLabels(FalconScriptParser::StatementContext *ctx,
+                         std::vector<std::pair<int32_t, int>> &cases,
+                         int &defaultTarget)
+{
+    auto groups = ctx->switchBlockStatementGroup();
+    int end = static_cast<int>(groups.size());
+    defaultTarget = -1;
+    auto addLabel = [&](FalconScriptParser::SwitchLabelContext *label,
+                        int target) {
+        if (label->DEFAULT())
+        {
+            if (defaultTarget >= 0)
+            {
+                throw std::runtime_error("switch 中有多个 default");
+            }
+            defaultTarget = target;
+            return;
+        }
+        cases.push_back(
+            {constantExpression(label->constantExpression), target});
+    };
+    for (int i = 0; i < end; ++i)
+    {
+        for (auto *label : groups[i]->switchLabel())
+        {
+            addLabel(label, i);
+        }
+    }
+    for (auto *label : ctx->switchLabel())
+    {
+        addLabel(label, end);
+    }
+    if (defaultTarget < 0)
+    {
+        defaultTarget = end;
+    }
+    auto sorted = cases;
+    std::sort(sorted.begin(), sorted.end());
+    for (size_t i = 1; i < sorted.size(); ++i)
+    {
+        if (sorted[i].first == sorted[i - 1].first)
+        {
+            std::stringstream ss;
+            ss << "case " << sorted[i].first << " 重复";
+            throw std::runtime_error(ss.str());
+        }
+    }
+}
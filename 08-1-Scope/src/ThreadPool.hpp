@@ -0,0 +1,170 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * 固定数量的工作线程，每个线程有自己的任务队列，自己的队列空了就去偷别人的
+ *
+ * 外部提交的任务轮流放进各个队列；工作线程自己提交的任务放进自己的队列，
+ * 从队尾取（刚提交的任务用到的数据多半还在缓存里），偷的时候从队首取。
+ * 任务数由 pending_ 统计，空闲的线程在 ready_ 上等待，不会空转。
+ */
+class ThreadPool
+{
+  public:
+    explicit ThreadPool(size_t threads)
+        : pending_(0), stopping_(false), next_(0)
+    {
+        if (threads == 0)
+        {
+            threads = 1;
+        }
+        for (size_t i = 0; i < threads; ++i)
+        {
+            queues_.push_back(std::make_unique<Queue>());
+        }
+        for (size_t i = 0; i < threads; ++i)
+        {
+            workers_.emplace_back([this, i] { work(i); });
+        }
+    }
+
+    /**
+     * 等已经提交的任务全部执行完再退出
+     */
+    ~ThreadPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stopping_ = true;
+        }
+        ready_.notify_all();
+        for (auto &worker : workers_)
+        {
+            worker.join();
+        }
+    }
+
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool &operator=(const ThreadPool &) = delete;
+
+    size_t size() const
+    {
+        return workers_.size();
+    }
+
+    /**
+     * 当前工作线程在线程池中的下标，0 到 size() - 1，
+     * 任务可以用它找到只属于这个线程的数据
+     */
+    static size_t workerIndex()
+    {
+        return self_;
+    }
+
+    void submit(std::function<void()> task)
+    {
+        size_t index;
+        if (owner_ == this)
+        {
+            index = self_;
+        }
+        else
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            index = next_++ % queues_.size();
+        }
+        {
+            auto &queue = *queues_[index];
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            queue.tasks.push_back(std::move(task));
+        }
+        // 先入队再计数，保证 pending_ 不超过队列中的任务数
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            ++pending_;
+        }
+        ready_.notify_one();
+    }
+
+  private:
+    struct Queue
+    {
+        std::mutex mutex;
+        std::deque<std::function<void()>> tasks;
+    };
+
+    /**
+     * 取一个任务：先从自己的队尾取，再依次偷其他队列的队首
+     */
+    bool pop(size_t self, std::function<void()> &task)
+    {
+        for (size_t i = 0; i < queues_.size(); ++i)
+        {
+            auto &queue = *queues_[(self + i) % queues_.size()];
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            if (queue.tasks.empty())
+            {
+                continue;
+            }
+            if (i == 0)
+            {
+                task = std::move(queue.tasks.back());
+                queue.tasks.pop_back();
+            }
+            else
+            {
+                task = std::move(queue.tasks.front());
+                queue.tasks.pop_front();
+            }
+            return true;
+        }
+        return false;
+    }
+
+    void work(size_t self)
+    {
+        owner_ = this;
+        self_ = self;
+        while (true)
+        {
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                ready_.wait(lock, [this] { return stopping_ || pending_ > 0; });
+                if (pending_ == 0)
+                {
+                    return;
+                }
+                // 预订一个任务，队列中一定有一个属于自己
+                --pending_;
+            }
+            std::function<void()> task;
+            while (!pop(self, task))
+            {
+                // 别的线程正在同一个队列上取任务，换一圈再找
+                std::this_thread::yield();
+            }
+            task();
+        }
+    }
+
+  private:
+    /// 当前线程所属的线程池和队列下标，不是工作线程时为空
+    static inline thread_local ThreadPool *owner_ = nullptr;
+    static inline thread_local size_t self_ = 0;
+
+    std::vector<std::unique_ptr<Queue>> queues_;
+    /// 保护 pending_、stopping_ 和 next_
+    std::mutex mutex_;
+    std::condition_variable ready_;
+    size_t pending_;
+    bool stopping_;
+    size_t next_;
+    std::vector<std::thread> workers_;
+};
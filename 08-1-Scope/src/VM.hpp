@@ -0,0 +1,299 @@
+#pragma once
+
+#include <algorithm>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include "Array.hpp"
+#include "Budget.hpp"
+#include "Bytecode.hpp"
+#include "Memory.hpp"
+#include "Simd.hpp"
+
+/**
+ * 执行字节码的虚拟机
+ *
+ * 寄存器和下一条指令的位置都保存在对象里，不占用本机的调用栈，
+ * 所以可以执行一部分之后暂停，之后（可以在另一个线程中）继续执行
+ */
+class VM
+{
+  public:
+    /**
+     * budget 为空表示不限制，否则每次跳转（进入一个基本块）消耗一步
+     *
+     * 脚本中声明的数组记在 memory 的账上，为空时不限制
+     */
+    VM(const BytecodeProgram &program,
+       std::ostream &out,
+       Budget *budget = nullptr,
+       MemoryAccount *memory = nullptr)
+        : program_(program),
+          out_(out),
+          budget_(budget),
+          memory_(memory != nullptr ? memory : &ownMemory_),
+          regs_(program.registers),
+          arrays_(program.arrays.size(), nullptr),
+          ip_(program.code.data())
+    {
+    }
+
+    /**
+     * 一直执行到结束
+     *
+     * slots 按 BytecodeProgram::slots 的顺序给出外部变量的地址，
+     * arrays 按 BytecodeProgram::arrays 的顺序给出外部数组，
+     * 脚本中声明的数组对应空指针
+     */
+    void run(int32_t *const *slots = nullptr, Array *const *arrays = nullptr)
+    {
+        bindArrays(arrays);
+        execute<false>(0, slots);
+    }
+
+    /**
+     * 最多执行 budget 条指令，执行完返回 true，否则暂停，再次调用时接着执行
+     *
+     * 每次调用都要传入同样的 slots 和 arrays
+     */
+    bool resume(size_t budget,
+                int32_t *const *slots = nullptr,
+                Array *const *arrays = nullptr)
+    {
+        bindArrays(arrays);
+        return execute<true>(budget, slots);
+    }
+
+  private:
+    void bindArrays(Array *const *arrays)
+    {
+        if (arrays == nullptr)
+        {
+            return;
+        }
+        for (size_t i = 0; i < arrays_.size(); ++i)
+        {
+            if (arrays[i] != nullptr)
+            {
+                arrays_[i] = arrays[i];
+            }
+        }
+    }
+
+    template <bool Budgeted>
+    bool execute(size_t budget, int32_t *const *slots)
+    {
+        int32_t *regs = regs_.data();
+        const Instruction *code = program_.code.data();
+        const Instruction *ip = ip_;
+        while (true)
+        {
+            if constexpr (Budgeted)
+            {
+                if (budget == 0)
+                {
+                    ip_ = ip;
+                    return false;
+                }
+                --budget;
+            }
+            const auto &ins = *ip++;
+            switch (ins.op)
+            {
+                case OpCode::Move:
+                    regs[ins.a] = regs[ins.b];
+                    break;
+#define BINARY_CASE(name)                                                     \
+    case OpCode::name:                                                        \
+        regs[ins.a] = irEvalBinary(IROpcode::name, regs[ins.b], regs[ins.c]); \
+        break
+                    BINARY_CASE(Add);
+                    BINARY_CASE(Sub);
+                    BINARY_CASE(Mul);
+                    BINARY_CASE(Div);
+                    BINARY_CASE(Mod);
+                    BINARY_CASE(Shl);
+                    BINARY_CASE(Shr);
+                    BINARY_CASE(Eq);
+                    BINARY_CASE(Ne);
+                    BINARY_CASE(Lt);
+                    BINARY_CASE(Le);
+                    BINARY_CASE(Gt);
+                    BINARY_CASE(Ge);
+                    BINARY_CASE(BitAnd);
+                    BINARY_CASE(BitOr);
+                    BINARY_CASE(BitXor);
+                    BINARY_CASE(And);
+                    BINARY_CASE(Or);
+                    BINARY_CASE(InBounds);
+#undef BINARY_CASE
+                case OpCode::Neg:
+                    regs[ins.a] = irEvalUnary(IROpcode::Neg, regs[ins.b]);
+                    break;
+                case OpCode::Not:
+                    regs[ins.a] = irEvalUnary(IROpcode::Not, regs[ins.b]);
+                    break;
+                case OpCode::BitNot:
+                    regs[ins.a] = irEvalUnary(IROpcode::BitNot, regs[ins.b]);
+                    break;
+                case OpCode::LoadSlot:
+                    regs[ins.a] = *slots[ins.b];
+                    break;
+                case OpCode::StoreSlot:
+                    *slots[ins.a] = regs[ins.b];
+                    break;
+                case OpCode::Print:
+                    out_ << program_.strings[ins.b] << ": " << regs[ins.a]
+                         << std::endl;
+                    break;
+                case OpCode::ArrayDim:
+                    regs[ins.a] =
+                        static_cast<int32_t>(arrays_[ins.b]->dim(ins.c));
+                    break;
+                // 下标已经检查过（或者证明了不会越界），直接访问
+                case OpCode::LoadElement:
+                    regs[ins.a] = arrays_[ins.b]->data()[regs[ins.c]];
+                    break;
+                case OpCode::StoreElement:
+                    arrays_[ins.a]->data()[regs[ins.b]] = regs[ins.c];
+                    break;
+                case OpCode::NewArray:
+                    arrays_[ins.a] = &owned_.emplace_back(
+                        program_.arrays[ins.a].dims, memory_);
+                    break;
+                case OpCode::PrintArray:
+                    out_ << program_.strings[ins.b] << ": ";
+                    ArrayRef{arrays_[ins.a], 0, 0}.print(out_);
+                    out_ << std::endl;
+                    break;
+                case OpCode::Vector:
+                {
+                    auto result = vector(program_.vectors[ins.b], regs);
+                    if (ins.a >= 0)
+                    {
+                        regs[ins.a] = result;
+                    }
+                    break;
+                }
+                case OpCode::IndexError:
+                    error(ArrayRef::indexError(regs[ins.a], regs[ins.b]),
+                          ins.c != 0);
+                    break;
+                case OpCode::Error:
+                    error(program_.strings[ins.a], ins.b != 0);
+                    break;
+                case OpCode::Jump:
+                    ip = jump(code + ins.a);
+                    break;
+                case OpCode::JumpIfTrue:
+                    if (regs[ins.b] != 0)
+                    {
+                        ip = jump(code + ins.a);
+                    }
+                    break;
+                case OpCode::JumpIfFalse:
+                    if (regs[ins.b] == 0)
+                    {
+                        ip = jump(code + ins.a);
+                    }
+                    break;
+                case OpCode::Switch:
+                    ip = jump(code + program_.switchTables[ins.a].lookup(
+                                         regs[ins.b]));
+                    break;
+                case OpCode::Halt:
+                    // 停在 Halt 上，之后再调用 resume 也直接返回
+                    ip_ = ip - 1;
+                    return true;
+            }
+        }
+    }
+
+    /**
+     * 跳转进入一个基本块，在这里检查预算；两次跳转之间是直线代码
+     */
+    const Instruction *jump(const Instruction *target)
+    {
+        if (budget_ != nullptr)
+        {
+            budget_->step();
+        }
+        return target;
+    }
+
+    /**
+     * 批量运算交给 Simd.hpp 中按 CPU 选好的实现，返回归约的结果
+     *
+     * 访问的元素在向量化时已经证明都在数组范围内，元素个数不是负数。
+     * 一条指令代替了整个循环，和循环一样每个元素消耗一步预算
+     */
+    int32_t vector(const VectorOperation &operation, const int32_t *regs)
+    {
+        const auto &kernels = simd::kernels();
+        auto *a = arrays_[operation.array]->data() + regs[operation.start];
+        auto n = static_cast<size_t>(regs[operation.count]);
+        if (budget_ != nullptr)
+        {
+            budget_->charge(n);
+        }
+        auto value = regs[operation.value];
+        const int32_t *b = operation.source < 0
+                               ? nullptr
+                               : arrays_[operation.source]->data() + value;
+        switch (operation.op)
+        {
+            case IROpcode::VectorSum:
+                return irEvalBinary(IROpcode::Add, value, kernels.sum(a, n));
+            case IROpcode::VectorMin:
+                return n == 0 ? value : std::min(value, kernels.min(a, n));
+            case IROpcode::VectorMax:
+                return n == 0 ? value : std::max(value, kernels.max(a, n));
+            case IROpcode::VectorFill:
+                kernels.fill(a, n, value);
+                break;
+            case IROpcode::VectorCopy:
+                std::memmove(a, b, n * sizeof(int32_t));
+                break;
+            case IROpcode::VectorAdd:
+                b ? kernels.add(a, b, n) : kernels.addScalar(a, n, value);
+                break;
+            case IROpcode::VectorSub:
+                // 减去 value 就是加上 -value
+                b ? kernels.sub(a, b, n)
+                  : kernels.addScalar(a, n,
+                                      irEvalUnary(IROpcode::Neg, value));
+                break;
+            case IROpcode::VectorMul:
+                b ? kernels.mul(a, b, n) : kernels.mulScalar(a, n, value);
+                break;
+            default:
+                break;
+        }
+        return 0;
+    }
+
+    /**
+     * 和 MyVisitor 一样输出运行时错误；不在任何语句中时抛出，由调用方处理
+     */
+    void error(const std::string &message, bool raise)
+    {
+        if (raise)
+        {
+            throw std::runtime_error(message);
+        }
+        out_ << "Error: " << message << std::endl;
+    }
+
+  private:
+    const BytecodeProgram &program_;
+    std::ostream &out_;
+    Budget *budget_;
+    MemoryAccount ownMemory_;
+    MemoryAccount *memory_;
+    std::vector<int32_t> regs_;
+    std::vector<Array *> arrays_;
+    /// NewArray 创建的数组，deque 中的元素地址不会变
+    std::deque<Array> owned_;
+    /// 下一条要执行的指令
+    const Instruction *ip_;
+};
@@ -0,0 +1,88 @@
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <vector>
+
+#include "Protocol.hpp"
+
+/**
+ * falcon --serve 的客户端：把脚本发给服务端，原样输出结果，以脚本的退出码退出
+ *
+ * 不依赖 antlr4，启动开销只有一个普通的小程序
+ */
+int main(int argc, char* argv[])
+{
+    uint32_t flags = 0;
+    std::vector<std::string> args;
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        if (arg == "-O")
+        {
+            flags |= protocol::Optimize;
+        }
+        else
+        {
+            args.push_back(arg);
+        }
+    }
+    if (args.size() != 2)
+    {
+        std::cerr << "请输入： falcon-client [-O] 套接字路径 脚本文件名"
+                  << std::endl;
+        return 1;
+    }
+    std::ifstream file(args[1]);
+    if (!file.is_open())
+    {
+        std::cerr << "无法打开文件：" << args[1] << std::endl;
+        return 1;
+    }
+    std::stringstream source;
+    source << file.rdbuf();
+    auto text = source.str();
+
+    int fd = protocol::connectTo(args[0]);
+    if (fd < 0)
+    {
+        std::cerr << "无法连接：" << args[0] << std::endl;
+        return 1;
+    }
+    uint32_t header[2] = {flags, static_cast<uint32_t>(text.size())};
+    if (!protocol::writeAll(fd, header, sizeof(header)) ||
+        !protocol::writeAll(fd, text.data(), text.size()))
+    {
+        std::cerr << "发送失败" << std::endl;
+        ::close(fd);
+        return 1;
+    }
+    protocol::Frame type;
+    std::string data;
+    while (protocol::readFrame(fd, type, data))
+    {
+        switch (type)
+        {
+            case protocol::Frame::Out:
+                std::fwrite(data.data(), 1, data.size(), stdout);
+                break;
+            case protocol::Frame::Err:
+                std::fflush(stdout);
+                std::fwrite(data.data(), 1, data.size(), stderr);
+                break;
+            case protocol::Frame::Exit:
+            {
+                int32_t status = 1;
+                if (data.size() == sizeof(status))
+                {
+                    std::memcpy(&status, data.data(), sizeof(status));
+                }
+                ::close(fd);
+                return status;
+            }
+        }
+    }
+    std::cerr << "连接意外断开" << std::endl;
+    ::close(fd);
+    return 1;
+}
@@ -1,9 +1,12 @@
 #include <antlr4-runtime.h>
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <future>
 
-#include "./generated/FalconScriptLexer.h"
-#include "./generated/FalconScriptParser.h"
-#include "MyVisitor.hpp"
-#include "MyListener.hpp"
+#include "BytecodeCache.hpp"
+#include "Interpreter.hpp"
+#include "Server.hpp"
 
 /**
  * 借助辅助栈，判断是否有未关闭的括号
@@ -53,11 +56,9 @@ void repl()
     std::string buffer;
     std::string input;
 
-    bool isFirstTime = true;
-    AnnotatedTree at;
-    MyListener listener(&at);
-    // 创建自定义 visitor 实例
-    MyVisitor visitor(true, &at);
+    Interpreter::Options options;
+    options.repl = true;
+    Interpreter interpreter(options);
 
     while (std::getline(std::cin, input))
     {
@@ -86,73 +87,651 @@ void repl()
             std::cout << "> ";
             continue;
         }
-        // 输入流可以是字符串
-        antlr4::ANTLRInputStream inputStream(buffer);
-        // 创建词法分析器实例
-        FalconScriptLexer lexer(&inputStream);
-        // 解析出token
-        antlr4::CommonTokenStream tokens(&lexer);
-        // 创建语法分析器实例
-        FalconScriptParser parser(&tokens);
-        if (isFirstTime)
+        interpreter.eval(buffer);
+
+        // 清空buffer
+        buffer = "";
+        std::cout << "\n> ";
+    }
+}
+
+void printHelp()
+{
+    std::cerr << "请输入： falcon [-O] [--dump-ir] [--osr=N] [--cache=目录] "
+                 "[--max-steps=N] [--timeout=MS] [--max-memory=B] "
+                 "[--mem-stats] [--no-files] [-D 变量=值] [--sweep=文件] "
+                 "[--serve=套接字 | --batch=路径] [--threads=N] [脚本文件名]"
+              << std::endl;
+    std::cerr << "  -O         编译成 SSA 形式的 IR，优化后在字节码虚拟机上执行"
+              << std::endl;
+    std::cerr << "  --dump-ir  输出优化后的 IR（隐含 -O）" << std::endl;
+    std::cerr << "  --osr=N    解释执行时，循环回边执行 N 次后切换到字节码，"
+                 "0 表示关闭，默认 1000"
+              << std::endl;
+    std::cerr << "  --cache=D  把编译好的字节码缓存在目录 D 中，"
+                 "源码不变时跳过编译（隐含 -O）"
+              << std::endl;
+    std::cerr << "  --serve=S  常驻进程，在 Unix 域套接字 S 上"
+                 "接收 falcon-client 提交的脚本"
+              << std::endl;
+    std::cerr << "  --batch=P  并行执行多个脚本，P 是目录"
+                 "（其中所有的 .falc 文件）或者每行一个文件名的列表"
+              << std::endl;
+    std::cerr << "  -D n=V     把顶层变量 n 的初值换成 V，可以有多个"
+              << std::endl;
+    std::cerr << "  --sweep=F  参数扫描：脚本只编译一次，CSV 文件 F 的第一行是"
+                 "变量名，之后每行一组初值，并行执行（隐含 -O）"
+              << std::endl;
+    std::cerr << "  --max-steps=N  每个脚本最多执行 N 步（循环的迭代、"
+                 "进入的语句块和内置函数处理的元素），超出时停止，退出码为 2"
+              << std::endl;
+    std::cerr << "  --timeout=MS   每个脚本最长执行 MS 毫秒，"
+                 "超出时停止，退出码为 2"
+              << std::endl;
+    std::cerr << "  --max-memory=B  每个脚本的栈帧、变量和寄存器"
+                 "最多使用 B 字节，超出时停止，退出码为 2"
+              << std::endl;
+    std::cerr << "  --mem-stats    执行结束时输出内存峰值" << std::endl;
+    std::cerr << "  --no-files     不允许脚本用 load、save 读写文件"
+              << std::endl;
+    std::cerr << "  --threads=N  --serve、--batch、--sweep 的工作线程数，"
+                 "默认等于 CPU 核数"
+              << std::endl;
+}
+
+/**
+ * 执行脚本，cacheDir 不为空时优先使用缓存的字节码
+ *
+ * 返回退出码：有语法错误时为 1，超出执行预算时为 2，否则为 0
+ */
+int runScript(const std::string& source,
+              const Interpreter::Options& options,
+              const std::string& cacheDir,
+              std::ostream& out,
+              std::ostream& err)
+{
+    // 输出 IR 时需要完整地编译一遍
+    bool useCache = !cacheDir.empty() && !options.dumpIR;
+    if (useCache)
+    {
+        if (auto program = BytecodeCache(cacheDir).load(source))
         {
-            // 解析输入并生成解析树（AST）
-            auto prog = parser.prog();
-            antlr4::tree::ParseTreeWalker::DEFAULT.walk(&listener, prog);
+            try
+            {
+                Interpreter::runBytecode(*program, {}, options, out, err);
+            }
+            catch (BudgetExceeded& e)
+            {
+                err << "Error: " << e.what() << std::endl;
+                return 2;
+            }
+            return 0;
+        }
+    }
+    Interpreter interpreter(options, out, err);
+    std::istringstream in(source);
+    auto syntaxErrors = interpreter.load(in);
+    int status = syntaxErrors == 0 ? 0 : 1;
+    try
+    {
+        interpreter.execute();
+    }
+    catch (BudgetExceeded& e)
+    {
+        err << "Error: " << e.what() << std::endl;
+        status = 2;
+    }
+    // 有语法错误的脚本不缓存，下次运行还要报错
+    if (useCache && syntaxErrors == 0 && interpreter.bytecode() != nullptr)
+    {
+        BytecodeCache(cacheDir).store(source, *interpreter.bytecode());
+    }
+    return status;
+}
 
-            // 遍历语法树
-            visitor.visitProg(prog);
-            isFirstTime = false;
+/**
+ * 多个工作线程同时执行脚本时，每个脚本的 sort 只分到一份 CPU 核数，
+ * 否则每次排序都创建和核数一样多的线程，线程数是工作线程数的若干倍
+ */
+size_t sortThreadsPerWorker(size_t workers)
+{
+    size_t cores = std::max(1u, std::thread::hardware_concurrency());
+    return std::max<size_t>(1, cores / std::max<size_t>(workers, 1));
+}
+
+/**
+ * 常驻进程模式，每个请求用独立的解释器实例执行
+ */
+void serve(const std::string& socketPath,
+           size_t threads,
+           const Interpreter::Options& options,
+           const std::string& cacheDir)
+{
+    // 预热：antlr 在第一次创建 parser 时反序列化 ATN
+    std::ostringstream sink;
+    runScript("int warmup = 0;", options, "", sink, sink);
+
+    Server server(socketPath, threads,
+                  [&](const std::string& source, uint32_t flags,
+                      std::ostream& out, std::ostream& err) {
+                      auto jobOptions = options;
+                      if (flags & protocol::Optimize)
+                      {
+                          jobOptions.optimize = true;
+                      }
+                      return runScript(source, jobOptions, cacheDir, out, err);
+                  });
+    std::cerr << "listening on " << socketPath << std::endl;
+    server.serve();
+}
+
+/**
+ * --batch 的参数：目录中所有的 .falc 文件按文件名排序，
+ * 否则是每行一个文件名的列表
+ */
+std::vector<std::string> batchFiles(const std::string& path)
+{
+    std::vector<std::string> files;
+    if (std::filesystem::is_directory(path))
+    {
+        for (auto& entry : std::filesystem::directory_iterator(path))
+        {
+            if (entry.is_regular_file() && entry.path().extension() == ".falc")
+            {
+                files.push_back(entry.path().string());
+            }
         }
-        else [[likely]]
+        std::sort(files.begin(), files.end());
+        return files;
+    }
+    std::ifstream list(path);
+    if (!list.is_open())
+    {
+        throw std::runtime_error("无法打开文件：" + path);
+    }
+    std::string line;
+    while (std::getline(list, line))
+    {
+        if (!line.empty())
         {
-            parser.reset();
-            auto blockStatement = parser.blockStatement();
-            antlr4::tree::ParseTreeWalker::DEFAULT.walk(&listener,
-                                                        blockStatement);
-            // 遍历语法树
-            visitor.visitBlockStatement(blockStatement);
+            files.push_back(line);
         }
+    }
+    return files;
+}
 
-        // 清空buffer
-        buffer = "";
-        std::cout << "\n> ";
+/**
+ * 在线程池中并行执行 labels.size() 个任务，job(i, out, err) 返回退出码
+ *
+ * 每个任务的输出先写到自己的缓冲区，再按顺序依次输出，前面的任务执行完
+ * 就可以输出，不用等全部结束。最后在标准错误输出每个任务的耗时。
+ * 有任务失败时返回 1
+ */
+int runParallel(
+    const std::vector<std::string>& labels,
+    size_t threads,
+    const std::function<int(size_t, std::ostream&, std::ostream&)>& job)
+{
+    struct Result
+    {
+        std::ostringstream out;
+        std::ostringstream err;
+        int status = 0;
+        double ms = 0;  ///< 执行时间，不含排队等待
+        std::promise<void> done;
+    };
+
+    std::vector<Result> results(labels.size());
+    auto start = std::chrono::steady_clock::now();
+    ThreadPool pool(threads);
+    for (size_t i = 0; i < labels.size(); ++i)
+    {
+        pool.submit([&, i] {
+            auto& result = results[i];
+            auto begin = std::chrono::steady_clock::now();
+            try
+            {
+                result.status = job(i, result.out, result.err);
+            }
+            catch (BudgetExceeded& e)
+            {
+                result.err << "Error: " << e.what() << std::endl;
+                result.status = 2;
+            }
+            catch (std::exception& e)
+            {
+                result.err << "Error: " << e.what() << std::endl;
+                result.status = 1;
+            }
+            std::chrono::duration<double, std::milli> elapsed =
+                std::chrono::steady_clock::now() - begin;
+            result.ms = elapsed.count();
+            result.done.set_value();
+        });
     }
+
+    int status = 0;
+    for (size_t i = 0; i < labels.size(); ++i)
+    {
+        auto& result = results[i];
+        result.done.get_future().wait();
+        std::cout << "==> " << labels[i] << " <==" << std::endl;
+        std::cout << result.out.str() << std::flush;
+        std::cerr << result.err.str() << std::flush;
+        if (result.status != 0)
+        {
+            status = 1;
+        }
+    }
+    std::chrono::duration<double, std::milli> total =
+        std::chrono::steady_clock::now() - start;
+
+    for (size_t i = 0; i < labels.size(); ++i)
+    {
+        std::fprintf(stderr, "%10.2f ms  %s%s\n", results[i].ms,
+                     labels[i].c_str(), results[i].status == 0 ? "" : "  失败");
+    }
+    std::fprintf(stderr, "%10.2f ms  共 %zu 个任务，%zu 个线程\n",
+                 total.count(), labels.size(), pool.size());
+    return status;
 }
 
-void printHelp()
+/**
+ * 批量执行，每个脚本用独立的解释器实例
+ */
+int runBatch(const std::string& path,
+             size_t threads,
+             const Interpreter::Options& options,
+             const std::string& cacheDir)
+{
+    auto files = batchFiles(path);
+    return runParallel(files, threads,
+                       [&](size_t i, std::ostream& out, std::ostream& err) {
+                           std::ifstream file(files[i]);
+                           if (!file.is_open())
+                           {
+                               throw std::runtime_error("无法打开文件：" +
+                                                        files[i]);
+                           }
+                           std::stringstream source;
+                           source << file.rdbuf();
+                           return runScript(source.str(), options, cacheDir,
+                                            out, err);
+                       });
+}
+
+/**
+ * 解析十进制的 int32，整个字符串（除去首尾空白）都必须是数字
+ */
+bool parseInt(const std::string& text, int32_t& value)
+{
+    const char* begin = text.c_str();
+    char* end;
+    errno = 0;
+    long result = std::strtol(begin, &end, 10);
+    while (std::isspace(static_cast<unsigned char>(*end)))
+    {
+        ++end;
+    }
+    if (end == begin || *end != '\0' || errno == ERANGE ||
+        result < INT32_MIN || result > INT32_MAX)
+    {
+        return false;
+    }
+    value = static_cast<int32_t>(result);
+    return true;
+}
+
+/**
+ * 去掉首尾的空白
+ */
+std::string trim(const std::string& text)
+{
+    auto begin = text.find_first_not_of(" \t\r");
+    if (begin == std::string::npos)
+    {
+        return "";
+    }
+    auto end = text.find_last_not_of(" \t\r");
+    return text.substr(begin, end - begin + 1);
+}
+
+/**
+ * 参数扫描用的 CSV 文件：第一行是变量名，之后每行一组初值，用逗号分隔
+ */
+void readSweep(const std::string& path,
+               std::vector<std::string>& names,
+               std::vector<std::vector<int32_t>>& rows)
+{
+    std::ifstream file(path);
+    if (!file.is_open())
+    {
+        throw std::runtime_error("无法打开文件：" + path);
+    }
+    std::string line;
+    size_t lineNumber = 0;
+    while (std::getline(file, line))
+    {
+        ++lineNumber;
+        if (trim(line).empty())
+        {
+            continue;
+        }
+        std::vector<std::string> fields;
+        std::stringstream ss(line);
+        std::string field;
+        while (std::getline(ss, field, ','))
+        {
+            fields.push_back(trim(field));
+        }
+        if (names.empty())
+        {
+            names = std::move(fields);
+            continue;
+        }
+        std::vector<int32_t> row(fields.size());
+        bool ok = fields.size() == names.size();
+        for (size_t i = 0; ok && i < fields.size(); ++i)
+        {
+            ok = parseInt(fields[i], row[i]);
+        }
+        if (!ok)
+        {
+            throw std::runtime_error(path + " 第 " +
+                                     std::to_string(lineNumber) +
+                                     " 行格式不对");
+        }
+        rows.push_back(std::move(row));
+    }
+}
+
+/**
+ * 注入顶层变量的初值后执行，names 是变量名，rows 的每一行是一组初值
+ *
+ * sweep 为 false 时只有一组初值，直接执行；否则脚本只解析、编译一次，
+ * 每组初值在线程池中各执行一次，输出按行的顺序排列，labels 是每一行的标题
+ */
+int runWithGlobals(const std::string& source,
+                   Interpreter::Options options,
+                   const std::vector<std::string>& names,
+                   const std::vector<std::vector<int32_t>>& rows,
+                   const std::vector<std::string>& labels,
+                   bool sweep,
+                   size_t threads)
 {
-    std::cerr << "请输入： falcon [脚本文件名]" << std::endl;
+    options.globals = names;
+    Interpreter interpreter(options);
+    std::istringstream in(source);
+    if (interpreter.load(in) > 0)
+    {
+        return 1;
+    }
+    auto declared = interpreter.declaredGlobals();
+    for (auto& name : names)
+    {
+        if (std::find(declared.begin(), declared.end(), name) ==
+            declared.end())
+        {
+            std::cerr << "脚本中没有顶层变量：" << name << std::endl;
+            return 1;
+        }
+    }
+    if (!sweep)
+    {
+        try
+        {
+            interpreter.execute(rows[0]);
+        }
+        catch (BudgetExceeded& e)
+        {
+            std::cerr << "Error: " << e.what() << std::endl;
+            return 2;
+        }
+        return 0;
+    }
+
+    std::unique_ptr<BytecodeProgram> bytecode;
+    if (options.optimize)
+    {
+        bytecode = interpreter.compile();
+    }
+    // IR 不支持的脚本由 MyVisitor 解释执行：所有工作线程共用上面分析好的
+    // 语法树，每个工作线程一个实例，每组初值都在同一个实例上 execute，
+    // 输出先写到线程自己的缓冲区里
+    struct Walker
+    {
+        std::ostringstream out;
+        std::ostringstream err;
+        std::unique_ptr<Interpreter> interpreter;
+    };
+    std::vector<Walker> walkers(std::max<size_t>(threads, 1));
+    auto walkerOptions = options;
+    walkerOptions.optimize = walkerOptions.dumpIR = false;
+    return runParallel(
+        labels, threads, [&](size_t i, std::ostream& out, std::ostream& err) {
+            if (bytecode != nullptr)
+            {
+                Interpreter::runBytecode(*bytecode, rows[i], options, out,
+                                         err);
+                return 0;
+            }
+            auto& walker = walkers[ThreadPool::workerIndex()];
+            if (walker.interpreter == nullptr)
+            {
+                walker.interpreter = std::make_unique<Interpreter>(
+                    interpreter, walkerOptions, walker.out, walker.err);
+            }
+            auto drain = [&] {
+                out << walker.out.str();
+                err << walker.err.str();
+                walker.out.str("");
+                walker.err.str("");
+            };
+            try
+            {
+                walker.interpreter->execute(rows[i]);
+            }
+            catch (...)
+            {
+                drain();
+                throw;
+            }
+            drain();
+            return 0;
+        });
 }
 
 int main(int argc, char* argv[])
 {
+    Interpreter::Options options;
+    options.osrThreshold = 1000;
+    std::string cacheDir;
+    std::string socketPath;
+    std::string batchPath;
+    std::string sweepPath;
+    /// -D 给出的初值，每一组都一样
+    std::vector<std::string> names;
+    std::vector<int32_t> values;
+    size_t threads = std::thread::hardware_concurrency();
+    std::vector<std::string> files;
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        if (arg == "-O")
+        {
+            options.optimize = true;
+        }
+        else if (arg == "--dump-ir")
+        {
+            options.optimize = options.dumpIR = true;
+        }
+        else if (arg.compare(0, 6, "--osr=") == 0)
+        {
+            options.osrThreshold = std::atoi(arg.c_str() + 6);
+        }
+        else if (arg.compare(0, 8, "--cache=") == 0)
+        {
+            cacheDir = arg.substr(8);
+            options.optimize = true;
+        }
+        else if (arg.compare(0, 8, "--serve=") == 0)
+        {
+            socketPath = arg.substr(8);
+        }
+        else if (arg.compare(0, 8, "--batch=") == 0)
+        {
+            batchPath = arg.substr(8);
+        }
+        else if (arg.compare(0, 12, "--max-steps=") == 0)
+        {
+            options.maxSteps = std::strtoull(arg.c_str() + 12, nullptr, 10);
+        }
+        else if (arg.compare(0, 10, "--timeout=") == 0)
+        {
+            options.timeout =
+                std::chrono::milliseconds(std::atoi(arg.c_str() + 10));
+        }
+        else if (arg.compare(0, 13, "--max-memory=") == 0)
+        {
+            options.maxMemory = std::strtoull(arg.c_str() + 13, nullptr, 10);
+        }
+        else if (arg == "--mem-stats")
+        {
+            options.reportMemory = true;
+        }
+        else if (arg == "--no-files")
+        {
+            options.allowFiles = false;
+        }
+        else if (arg.compare(0, 10, "--threads=") == 0)
+        {
+            threads = std::atoi(arg.c_str() + 10);
+        }
+        else if (arg.compare(0, 8, "--sweep=") == 0)
+        {
+            sweepPath = arg.substr(8);
+            options.optimize = true;
+        }
+        else if (arg.compare(0, 2, "-D") == 0)
+        {
+            // -D n=1000 或者 -Dn=1000
+            std::string define = arg.size() > 2 ? arg.substr(2)
+                                 : i + 1 < argc ? argv[++i]
+                                                : "";
+            auto equal = define.find('=');
+            int32_t value;
+            if (equal == std::string::npos ||
+                !parseInt(define.substr(equal + 1), value))
+            {
+                printHelp();
+                return 1;
+            }
+            names.push_back(trim(define.substr(0, equal)));
+            values.push_back(value);
+        }
+        else if (arg[0] == '-')
+        {
+            printHelp();
+            return 1;
+        }
+        else
+        {
+            files.push_back(arg);
+        }
+    }
+    if (!socketPath.empty() || !batchPath.empty())
+    {
+        if (!files.empty() || (!socketPath.empty() && !batchPath.empty()) ||
+            !names.empty() || !sweepPath.empty())
+        {
+            printHelp();
+            return 1;
+        }
+        options.sortThreads = sortThreadsPerWorker(threads);
+        try
+        {
+            if (!batchPath.empty())
+            {
+                return runBatch(batchPath, threads, options, cacheDir);
+            }
+            serve(socketPath, threads, options, cacheDir);
+        }
+        catch (std::exception& e)
+        {
+            std::cerr << e.what() << std::endl;
+        }
+        return 1;
+    }
     // repl模式
-    if (argc == 1)
+    else if (files.empty())
     {
         repl();
     }
     // 读取脚本文件
-    else if (argc == 2)
+    else if (files.size() == 1)
     {
-        std::ifstream file(argv[1]);
+        std::ifstream file(files[0]);
         if (!file.is_open())
         {
-            std::cerr << "无法打开文件：" << argv[1] << std::endl;
+            std::cerr << "无法打开文件：" << files[0] << std::endl;
+            return 1;
+        }
+        std::stringstream source;
+        source << file.rdbuf();
+        // 参数扫描时多个实例同时执行，不能共用标准输入
+        if (sweepPath.empty())
+        {
+            options.inputFd = STDIN_FILENO;
+        }
+        else
+        {
+            options.sortThreads = sortThreadsPerWorker(threads);
+        }
+        if (names.empty() && sweepPath.empty())
+        {
+            return runScript(source.str(), options, cacheDir, std::cout,
+                             std::cerr);
+        }
+        try
+        {
+            std::vector<std::vector<int32_t>> rows;
+            std::vector<std::string> labels;
+            if (sweepPath.empty())
+            {
+                rows.push_back(values);
+            }
+            else
+            {
+                std::vector<std::string> columns;
+                readSweep(sweepPath, columns, rows);
+                for (auto& row : rows)
+                {
+                    std::string label;
+                    for (size_t j = 0; j < columns.size(); ++j)
+                    {
+                        label += (j == 0 ? "" : ", ") + columns[j] + "=" +
+                                 std::to_string(row[j]);
+                    }
+                    labels.push_back(label);
+                    row.insert(row.begin(), values.begin(), values.end());
+                }
+                names.insert(names.end(), columns.begin(), columns.end());
+            }
+            auto sorted = names;
+            std::sort(sorted.begin(), sorted.end());
+            if (std::adjacent_find(sorted.begin(), sorted.end()) !=
+                sorted.end())
+            {
+                throw std::runtime_error("同一个变量给了多个初值");
+            }
+            return runWithGlobals(source.str(), options, names, rows, labels,
+                                  !sweepPath.empty(), threads);
+        }
+        catch (std::exception& e)
+        {
+            std::cerr << e.what() << std::endl;
             return 1;
         }
-        // 输入流可以是文件
-        antlr4::ANTLRInputStream inputStream(file);
-        FalconScriptLexer lexer(&inputStream);
-        antlr4::CommonTokenStream tokens(&lexer);
-        FalconScriptParser parser(&tokens);
-        auto* tree = parser.prog();
-        // BlockScope globalScope(nullptr, tree, "global");
-        AnnotatedTree at;
-        MyListener listener(&at);
-        antlr4::tree::ParseTreeWalker::DEFAULT.walk(&listener, tree);
-        MyVisitor visitor(false, &at);
-        visitor.visitProg(tree);
     }
     else
     {
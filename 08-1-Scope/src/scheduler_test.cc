@@ -0,0 +1,170 @@
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "Falcon.hpp"
+
+/**
+ * falcon::Scheduler 的测试：只有一个工作线程，时间片很短，
+ * 按完成的先后次序检查程序是不是真的被暂停、轮流执行
+ *
+ *     ./scheduler_test
+ *
+ * 如果调度器退化成先来先服务（一个程序一直执行到结束），
+ * 先提交的长程序会挡住后面所有的程序，这里的检查都会失败
+ */
+namespace
+{
+const char *const sumSource =
+    "int n = 0;\n"
+    "int s = 0;\n"
+    "for (int i = 0; i < n; i++)\n"
+    "{\n"
+    "    s += i;\n"
+    "}\n"
+    "s;\n";
+
+/**
+ * 同一个程序，不同的 n，各用自己的 Context
+ */
+struct Job
+{
+    int32_t n;
+    std::ostringstream out;
+    std::ostringstream err;
+    std::unique_ptr<falcon::Context> context;
+};
+
+class Checker
+{
+  public:
+    void expect(bool condition, const std::string &what)
+    {
+        std::cout << (condition ? "通过：" : "失败：") << what << std::endl;
+        failures_ += condition ? 0 : 1;
+    }
+
+    int status() const
+    {
+        return failures_ == 0 ? 0 : 1;
+    }
+
+  private:
+    int failures_ = 0;
+};
+
+/**
+ * 在一个工作线程上依次提交 jobs，返回完成的次序（jobs 的下标）
+ */
+std::vector<size_t> schedule(std::shared_ptr<const falcon::Program> program,
+                             std::vector<std::unique_ptr<Job>> &jobs,
+                             size_t quantum)
+{
+    std::mutex mutex;
+    std::vector<size_t> order;
+    falcon::Scheduler scheduler(1, quantum);
+    for (size_t i = 0; i < jobs.size(); ++i)
+    {
+        auto &job = *jobs[i];
+        job.context = std::make_unique<falcon::Context>(job.out, job.err);
+        job.context->setGlobals({{"n", job.n}});
+        scheduler.spawn(program, *job.context, [&, i](bool) {
+            std::lock_guard<std::mutex> lock(mutex);
+            order.push_back(i);
+        });
+    }
+    scheduler.wait();
+    return order;
+}
+
+size_t positionOf(const std::vector<size_t> &order, size_t job)
+{
+    for (size_t i = 0; i < order.size(); ++i)
+    {
+        if (order[i] == job)
+        {
+            return i;
+        }
+    }
+    return order.size();
+}
+
+/**
+ * 调度执行的输出要和直接执行的相同
+ */
+bool sameAsRun(const falcon::Program &program, const Job &job)
+{
+    std::ostringstream out;
+    std::ostringstream err;
+    falcon::Context context(out, err);
+    context.setGlobals({{"n", job.n}});
+    program.run(context);
+    return job.out.str() == out.str() && job.err.str() == err.str();
+}
+
+std::unique_ptr<Job> makeJob(int32_t n)
+{
+    auto job = std::make_unique<Job>();
+    job->n = n;
+    return job;
+}
+}  // namespace
+
+int main()
+{
+    Checker checker;
+    falcon::CompileOptions options;
+    options.globals = {"n"};
+    auto program = falcon::compile(sumSource, options);
+    checker.expect(program->isCompiled(), "求和的程序编译成了字节码");
+
+    // 抢占：先提交一个很长的程序，后面的短程序都要比它先结束
+    std::vector<std::unique_ptr<Job>> jobs;
+    jobs.push_back(makeJob(5000000));
+    for (int i = 0; i < 5; ++i)
+    {
+        jobs.push_back(makeJob(100));
+    }
+    auto order = schedule(program, jobs, 1000);
+    checker.expect(order.size() == jobs.size(), "所有程序都执行完了");
+    checker.expect(positionOf(order, 0) == jobs.size() - 1,
+                   "先提交的长程序最后结束，没有挡住短程序");
+    bool same = true;
+    for (auto &job : jobs)
+    {
+        same = same && sameAsRun(*program, *job);
+    }
+    checker.expect(same, "输出和 Program::run 相同");
+
+    // 轮转：两个长程序交替执行，短一些的先结束，虽然它后提交
+    jobs.clear();
+    jobs.push_back(makeJob(4000000));
+    jobs.push_back(makeJob(1000000));
+    order = schedule(program, jobs, 1000);
+    checker.expect(order == std::vector<size_t>{1, 0},
+                   "两个长程序轮流执行，后提交的短一些的先结束");
+
+    // 不能暂停的程序不接受
+    auto walked = falcon::compile("int s = 0;\nwhile (eof() == 0) s += "
+                                  "read_int();\ns;\n");
+    std::ostringstream out;
+    falcon::Context context(out);
+    bool rejected = false;
+    try
+    {
+        falcon::Scheduler scheduler(1);
+        scheduler.spawn(walked, context);
+    }
+    catch (std::invalid_argument &)
+    {
+        rejected = true;
+    }
+    checker.expect(!walked->isCompiled() && rejected,
+                   "解释执行的程序提交时报错");
+
+    return checker.status();
+}
@@ -0,0 +1,166 @@
+#include <atomic>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+#include "Interpreter.hpp"
+
+/**
+ * 多线程压力测试：在多个线程中同时用各自的 Interpreter 执行同一批脚本，
+ * 每次的输出都要和单线程执行的结果完全相同
+ *
+ *     ./stress --threads=16 --rounds=4 scripts/sieve.falc scripts/map.falc
+ *
+ * 每个脚本分别解释执行和编译成字节码执行（-O），栈上替换的阈值调低，
+ * 让 OSR 也参与进来。内置函数不能读写文件，否则多个线程会写同一个文件。
+ * 多线程执行时所有实例共用同一份分析好的语法树，和 libfalcon 的用法相同，
+ * 有人往语法树上写缓存时也会暴露出来。
+ * 有人往代码里加了全局的可变状态时，输出会对不上，
+ * 配合 -fsanitize=thread 编译还能发现没有体现在输出上的数据竞争
+ */
+namespace
+{
+struct Script
+{
+    std::string path;
+    std::string source;
+    /// 只用来提供分析好的语法树
+    std::unique_ptr<Interpreter> loaded;
+};
+
+struct Result
+{
+    std::string out;
+    std::string err;
+
+    bool operator==(const Result& other) const
+    {
+        return out == other.out && err == other.err;
+    }
+};
+
+/**
+ * shared 为 true 时共用 script.loaded 的语法树，否则自己解析一遍
+ */
+Result run(const Script& script, bool optimize, bool shared)
+{
+    Interpreter::Options options;
+    options.optimize = optimize;
+    options.osrThreshold = 10;
+    options.allowFiles = false;
+    std::ostringstream out;
+    std::ostringstream err;
+    auto interpreter =
+        shared ? std::make_unique<Interpreter>(*script.loaded, options, out,
+                                               err)
+               : std::make_unique<Interpreter>(options, out, err);
+    if (!shared)
+    {
+        std::istringstream in(script.source);
+        interpreter->load(in);
+    }
+    try
+    {
+        interpreter->execute();
+    }
+    catch (std::exception& e)
+    {
+        err << "Error: " << e.what() << std::endl;
+    }
+    return {out.str(), err.str()};
+}
+
+size_t parseCount(const std::string& arg, size_t prefix)
+{
+    auto count = std::strtoul(arg.c_str() + prefix, nullptr, 10);
+    return count == 0 ? 1 : count;
+}
+}  // namespace
+
+int main(int argc, char* argv[])
+{
+    size_t threads = 8;
+    size_t rounds = 2;
+    std::vector<Script> scripts;
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        if (arg.compare(0, 10, "--threads=") == 0)
+        {
+            threads = parseCount(arg, 10);
+            continue;
+        }
+        if (arg.compare(0, 9, "--rounds=") == 0)
+        {
+            rounds = parseCount(arg, 9);
+            continue;
+        }
+        std::ifstream file(arg);
+        if (!file.is_open())
+        {
+            std::cerr << "无法打开文件：" << arg << std::endl;
+            return 1;
+        }
+        std::stringstream source;
+        source << file.rdbuf();
+        std::ostringstream sink;
+        auto loaded = std::make_unique<Interpreter>(Interpreter::Options{},
+                                                    sink, sink);
+        loaded->load(source);
+        scripts.push_back({arg, source.str(), std::move(loaded)});
+    }
+    if (scripts.empty())
+    {
+        std::cerr << "请输入： stress [--threads=N] [--rounds=N] 脚本文件名..."
+                  << std::endl;
+        return 1;
+    }
+
+    // 单线程的结果作为标准答案，下标 2k 是解释执行，2k + 1 是 -O
+    std::vector<Result> expected;
+    for (auto& script : scripts)
+    {
+        expected.push_back(run(script, false, false));
+        expected.push_back(run(script, true, false));
+    }
+
+    // 每个线程从不同的位置开始轮流执行所有的任务，同一时刻尽量执行不同的脚本
+    std::atomic<size_t> failures{0};
+    std::mutex mutex;
+    std::vector<std::thread> workers;
+    for (size_t t = 0; t < threads; ++t)
+    {
+        workers.emplace_back([&, t] {
+            for (size_t round = 0; round < rounds; ++round)
+            {
+                for (size_t k = 0; k < expected.size(); ++k)
+                {
+                    auto job = (k + t) % expected.size();
+                    auto& script = scripts[job / 2];
+                    if (run(script, job % 2 == 1, true) == expected[job])
+                    {
+                        continue;
+                    }
+                    ++failures;
+                    std::lock_guard<std::mutex> lock(mutex);
+                    std::cerr << "线程 " << t << " 第 " << round << " 轮："
+                              << script.path << (job % 2 == 1 ? " -O" : "")
+                              << " 的输出和单线程执行时不同" << std::endl;
+                }
+            }
+        });
+    }
+    for (auto& worker : workers)
+    {
+        worker.join();
+    }
+
+    auto total = threads * rounds * expected.size();
+    std::cout << total << " 次执行，" << failures << " 次输出不同" << std::endl;
+    return failures == 0 ? 0 : 1;
+}